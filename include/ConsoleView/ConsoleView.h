@@ -43,6 +43,10 @@
  * 	Server in multicast mode
  * \var CONSOLE_RECEIVE
  * 	Cliente in multicast mode
+ * \var CONSOLE_MCAST_SEND
+ * 	Server in IP multicast mode
+ * \var CONSOLE_MCAST_RECEIVE
+ * 	Client in IP multicast mode
  */
 enum dcConsoleFunction {
 	CONSOLE_NONE,
@@ -51,7 +55,9 @@ enum dcConsoleFunction {
 	CONSOLE_LINK_SEND,
 	CONSOLE_LINK_RECEIVE,
 	CONSOLE_SEND,
-	CONSOLE_RECEIVE
+	CONSOLE_RECEIVE,
+	CONSOLE_MCAST_SEND,
+	CONSOLE_MCAST_RECEIVE
 };
 
 /**
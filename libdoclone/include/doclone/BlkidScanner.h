@@ -0,0 +1,101 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLKIDSCANNER_H_
+#define BLKIDSCANNER_H_
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <doclone/FsFactory.h>
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var BLKID_PROBE_THREADS
+ *
+ * Maximum number of devices probed at the same time
+ */
+const unsigned int BLKID_PROBE_THREADS = 8;
+
+/**
+ * \class BlkidScanner
+ * \brief Reads the filesystem tags of the devices with libblkid. Singleton.
+ *
+ * Every device is probed once with the low-level API of libblkid, which reads
+ * its type, secondary type, label and uuid at the same time, without the
+ * blkid cache. Several devices can be probed in parallel.
+ *
+ * The devices of the host that have each uuid are indexed the first time they
+ * are needed in a job. The index is dropped when a new job starts, and when a
+ * filesystem is made or written during the job.
+ *
+ * \date October, 2015
+ */
+class BlkidScanner {
+public:
+	~BlkidScanner();
+
+	static BlkidScanner* getInstance();
+
+	static void probe(const std::string &dev, blkidInfo &info);
+	void probeAll(const std::vector<std::string> &devs,
+			std::vector<blkidInfo> &infos);
+
+	bool isUUIDRepeated(const std::string &uuid) throw(Exception);
+	void clearIndex();
+
+private:
+	/// Private constructor to implement singleton pattern
+	BlkidScanner();
+
+	/**
+	 * \struct probeJob
+	 * \brief A set of devices shared by several probing threads
+	 */
+	struct probeJob {
+		/// The devices to probe
+		const std::vector<std::string> *devs;
+		/// The tags of each device
+		std::vector<blkidInfo> *infos;
+		/// The next device to probe
+		size_t next;
+		/// Protects next
+		pthread_mutex_t mutex;
+	};
+
+	static void *probeThread(void *data);
+	static void probeNext(probeJob *job);
+
+	bool buildIndex();
+
+	/// Devices of the host by uuid
+	std::multimap<std::string, std::string> _uuids;
+	/// Whether _uuids has been filled
+	bool _indexed;
+	/// Protects the members above
+	pthread_mutex_t _mutex;
+};
+
+}
+
+#endif /* BLKIDSCANNER_H_ */
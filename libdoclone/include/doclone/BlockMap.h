@@ -0,0 +1,98 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOCKMAP_H_
+#define BLOCKMAP_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var BLOCKS_SUFFIX
+ *
+ * Appended to the root directory of a partition to name the archive entry
+ * that holds its blocks
+ */
+const char BLOCKS_SUFFIX[] = ".blocks";
+
+/**
+ * \struct blockExtent
+ * \brief A run of consecutive used blocks
+ */
+struct blockExtent {
+	/// First block of the run
+	uint64_t start;
+	/// Number of blocks in the run
+	uint64_t count;
+};
+
+/**
+ * \class BlockMap
+ * \brief The blocks of a filesystem that are in use
+ *
+ * A partition imaged block by block only stores the blocks in its map, in
+ * disk order, and they are written back to the same offsets when restoring.
+ * There is no mount and no work per file.
+ *
+ * The map goes in the image header, encoded as variable-length integers: the
+ * block size, the size of the filesystem in blocks, the number of extents and,
+ * for each extent, the gap since the end of the previous one and its length.
+ *
+ * \date October, 2015
+ */
+class BlockMap {
+public:
+	BlockMap();
+	BlockMap(uint32_t blockSize, uint64_t blockCount);
+
+	uint32_t getBlockSize() const;
+	uint64_t getBlockCount() const;
+	uint64_t getUsedBlocks() const;
+	uint64_t getUsedBytes() const;
+	uint64_t getDeviceSize() const;
+	const std::vector<blockExtent> &getExtents() const;
+
+	void addExtent(uint64_t start, uint64_t count) throw(Exception);
+
+	void encode(std::string &buf) const;
+	void decode(const uint8_t *buf, size_t size) throw(Exception);
+
+private:
+	static void putNumber(std::string &buf, uint64_t value);
+	static uint64_t getNumber(const uint8_t *&buf, const uint8_t *end)
+		throw(Exception);
+
+	/// Size of a block in bytes
+	uint32_t _blockSize;
+	/// Size of the filesystem in blocks
+	uint64_t _blockCount;
+	/// Number of blocks in all the extents
+	uint64_t _usedBlocks;
+	/// The used blocks, sorted and not adjacent to each other
+	std::vector<blockExtent> _extents;
+};
+
+}
+
+#endif /* BLOCKMAP_H_ */
@@ -31,6 +31,40 @@
 
 namespace Doclone {
 
+/**
+ * \enum dcCodec
+ * \brief Compression codecs for the data of the images
+ *
+ * \var CODEC_GZIP
+ * 	gzip, readable by all the versions of doclone
+ * \var CODEC_ZSTD
+ * 	Zstandard
+ * \var CODEC_LZ4
+ * 	LZ4
+ * \var CODEC_NONE
+ * 	No compression
+ */
+enum dcCodec {
+	CODEC_GZIP,
+	CODEC_ZSTD,
+	CODEC_LZ4,
+	CODEC_NONE
+};
+
+/**
+ * \enum dcLagPolicy
+ * \brief What to do with a receiver that falls behind the lag window
+ *
+ * \var LAG_SPOOL
+ * 	Keep its data in a temporary file and send it at its own pace
+ * \var LAG_DROP
+ * 	Disconnect it
+ */
+enum dcLagPolicy {
+	LAG_SPOOL,
+	LAG_DROP
+};
+
 /**
  * \defgroup CPPAPI C++ API
  * \brief C++ API for libdoclone.
@@ -120,6 +154,15 @@ namespace Doclone {
  * - nodes number (int): The number of receivers
  * - empty (int): Clone the partition table without reading/writing the data (true or false)
  * - force (int): Force working even if the image doesn't fit in the destination device (true or false)
+ * - threads (int): Number of threads used to read, compress and restore the image (0 = one per processor)
+ * - codec (dcCodec): Compression codec of the created images (gzip by default)
+ * - compression level (int): Level for the codec (0 = the codec default)
+ * - buffer size (int): Size in bytes of the data buffers (0 = by descriptor type)
+ * - buffer count (int): Number of buffers read ahead (0 = the default)
+ * - lag window (int): MiB a receiver can fall behind the fastest one (0 = the default)
+ * - lag policy (dcLagPolicy): What to do with the receivers out of the window
+ * - multicast rate (int): Mbit/s sent in the multicast mode (0 = the default)
+ * - block imaging (bool): Image the supported filesystems block by block
  *
  * These are some setters for configuring the properties:
  *
@@ -131,6 +174,15 @@ namespace Doclone {
  * 	void setAddress(const std::string &address);
  * 	void setInterface(const std::string &interface);
  * 	void setForce(bool force);
+ * 	void setThreads(unsigned int threads);
+ * 	void setCodec(Doclone::dcCodec codec);
+ * 	void setCompressionLevel(int level);
+ * 	void setBufferSize(unsigned int size);
+ * 	void setBufferCount(unsigned int count);
+ * 	void setLagWindow(unsigned int window);
+ * 	void setLagPolicy(Doclone::dcLagPolicy policy);
+ * 	void setMulticastRate(unsigned int rate);
+ * 	void setBlockImaging(bool blocks);
  * \endcode
  *
  * The last step is to call one of the methods that perform the work:
@@ -142,6 +194,8 @@ namespace Doclone {
  * 	void receive() throw(Exception);
  * 	void chainOrigin() throw(Exception);
  * 	void chainLink() throw(Exception);
+ * 	void multicastSend() throw(Exception);
+ * 	void multicastReceive() throw(Exception);
  * \endcode
  *
  * All this methods raise an exception if anything goes wrong. The library has
@@ -222,7 +276,7 @@ namespace Doclone {
  * - Receive and restore/write image to the disk
  *
  * All the network operations can be performed using the unicast/multicast mode
- * (Recommended) or the link mode.
+ * (Recommended), the link mode or the IP multicast mode.
  *
  * For use it, first at all, the library user must set the parameters, like
  * image path, device path, no-data, etc.
@@ -250,6 +304,8 @@ public:
 	void receive() throw(Exception);
 	void chainOrigin() throw(Exception);
 	void chainLink() throw(Exception);
+	void multicastSend() throw(Exception);
+	void multicastReceive() throw(Exception);
 
 	bool getEmpty() const;
 	void setEmpty(bool empty);
@@ -265,6 +321,24 @@ public:
 	void setInterface(const std::string &interface);
 	bool getForce() const;
 	void setForce(bool force);
+	unsigned int getThreads() const;
+	void setThreads(unsigned int threads);
+	Doclone::dcCodec getCodec() const;
+	void setCodec(Doclone::dcCodec codec);
+	int getCompressionLevel() const;
+	void setCompressionLevel(int level);
+	unsigned int getBufferSize() const;
+	void setBufferSize(unsigned int size);
+	unsigned int getBufferCount() const;
+	void setBufferCount(unsigned int count);
+	unsigned int getLagWindow() const;
+	void setLagWindow(unsigned int window);
+	Doclone::dcLagPolicy getLagPolicy() const;
+	void setLagPolicy(Doclone::dcLagPolicy policy);
+	unsigned int getMulticastRate() const;
+	void setMulticastRate(unsigned int rate);
+	bool getBlockImaging() const;
+	void setBlockImaging(bool blocks);
 
 	void addOperation(Operation *op);
 	void markCompleted(dcOperationType type, const std::string &target);
@@ -289,6 +363,24 @@ protected:
 	bool _empty;
 	/// Mode force enabled/disabled
 	bool _force;
+	/// Number of worker threads, 0 for one per processor
+	unsigned int _threads;
+	/// Compression codec of the created images
+	Doclone::dcCodec _codec;
+	/// Compression level, 0 for the default of the codec
+	int _compressionLevel;
+	/// Size of the data buffers, 0 to choose it from the descriptor type
+	unsigned int _bufferSize;
+	/// Number of data buffers read ahead, 0 for the default
+	unsigned int _bufferCount;
+	/// MiB a receiver can fall behind the fastest one, 0 for the default
+	unsigned int _lagWindow;
+	/// What to do with the receivers out of the lag window
+	Doclone::dcLagPolicy _lagPolicy;
+	/// Sending rate of the multicast mode in Mbit/s, 0 for the default
+	unsigned int _multicastRate;
+	/// Whether the supported filesystems are imaged block by block
+	bool _blockImaging;
 
 	/// Vector with the state of the execution
 	std::vector<Operation *> _operations;
@@ -21,12 +21,16 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include <map>
+#include <string>
 #include <vector>
 
 #include <archive.h>
 
+#include <doclone/BlockMap.h>
 #include <doclone/observer/AbstractSubject.h>
 #include <doclone/exception/Exception.h>
 
@@ -40,19 +44,66 @@ namespace Doclone {
 typedef off_t dcBuffSize;
 
 /**
- * \var BUFFER_SIZE
+ * \var SOCKET_BUFFER_SIZE
  *
- * Size of data buffer
+ * Default size of the data buffers when reading from a socket
+ */
+const dcBuffSize SOCKET_BUFFER_SIZE = 1048576;
+
+/**
+ * \var FILE_BUFFER_SIZE
+ *
+ * Default size of the data buffers when reading from a regular file or a
+ * block device
  */
-const dcBuffSize BUFFER_SIZE = 10240;
+const dcBuffSize FILE_BUFFER_SIZE = 4194304;
 
 /**
- * \var UPDATE_QUOTIENT
+ * \var DEFAULT_BUFFER_SIZE
+ *
+ * Default size of the data buffers for any other descriptor
+ */
+const dcBuffSize DEFAULT_BUFFER_SIZE = 1048576;
+
+/**
+ * \var UPDATE_SIZE
  *
  * The observer is notified every time the current amount of transferred data
- * exceeds a multiple of (BUFFER_SIZE * UPDATE_QUOTIENT)
+ * exceeds a multiple of UPDATE_SIZE
+ */
+const uint32_t UPDATE_SIZE = 157286400;
+
+/**
+ * \var BUFFER_COUNT
+ *
+ * Default number of buffers in the ring shared by the reading thread and the
+ * writer in copyData()
+ */
+const unsigned int BUFFER_COUNT = 4;
+
+/**
+ * \var ZEROCOPY_CHUNK_SIZE
+ *
+ * Amount of data moved by each sendfile() or splice() call, and requested
+ * size for the pipes used by splice()
+ */
+const size_t ZEROCOPY_CHUNK_SIZE = 1048576;
+
+/**
+ * \var ZERO_BLOCK_SIZE
+ *
+ * Granularity of the zero detection when a device is read raw. The blocks
+ * full of zeros aren't stored.
+ */
+const size_t ZERO_BLOCK_SIZE = 4096;
+
+/**
+ * \var RAW_SUFFIX
+ *
+ * Appended to the root directory of a partition to name the directory of the
+ * entries that hold its raw data
  */
-const unsigned int UPDATE_QUOTIENT = 15360;
+const char RAW_SUFFIX[] = ".raw";
 
 /**
  * \typedef readFunction
@@ -70,6 +121,14 @@ typedef ssize_t (*readFunction) (int, void*, size_t);
  */
 typedef ssize_t (*writeFunction) (int, const void*, size_t);
 
+/**
+ * \typedef zeroFunction
+ *
+ * A pointer to a function that tells if a buffer is full of zeros. It points
+ * to the fastest version the processor can run.
+ */
+typedef bool (*zeroFunction) (const char*, size_t);
+
 /**
  * \class DataTransfer
  * \brief Singleton interface to get, set up and use the file/socket descriptors
@@ -86,15 +145,25 @@ typedef ssize_t (*writeFunction) (int, const void*, size_t);
  */
 class DataTransfer : public AbstractSubject {
 public:
-	~DataTransfer() {}
+	~DataTransfer();
 	static DataTransfer* getInstance();
 
+	dcBuffSize getBufferSize(int fd) const;
+	unsigned int getBufferCount() const;
+
 	uint64_t archiveToBuf(struct archive *arIn, std::string &target) throw(Exception);
 	uint64_t bufToArchive(const std::string &source, std::vector<struct archive*> &outArchives) throw(Exception);
 	uint64_t fdToArchive(int fd, std::vector<struct archive*> &outArchives) throw(Exception);
+	uint64_t sparseToArchive(int fd, struct archive_entry *entry, std::vector<struct archive*> &outArchives) throw(Exception);
+	uint64_t blocksToArchive(int fd, const BlockMap &map, std::vector<struct archive*> &outArchives) throw(Exception);
+	uint64_t archiveToBlocks(struct archive *arIn, int fd, const BlockMap &map) throw(Exception);
+	uint64_t rawToArchive(int fd, uint64_t size, const std::string &prefix, std::vector<struct archive*> &outArchives) throw(Exception);
+	void zeroRange(int fd, uint64_t offset, uint64_t len) throw(Exception);
 	uint64_t copyData(struct archive *arIn, std::vector<struct archive *> &outArchives) throw(Exception);
 	uint64_t copyData(int fdin, std::vector<int> &outFds) throw(Exception);
 	uint64_t copyData(int fdin, int fdout) throw(Exception);
+	uint64_t zeroCopyData(int fdin, std::vector<int> &outFds) throw(Exception);
+	uint64_t zeroCopyData(int fdin, int fdout) throw(Exception);
 	void copyHeader(struct archive_entry *entry, std::vector<struct archive*> &outArchives) throw(Exception);
 
 	void initLocalRead();
@@ -102,6 +171,8 @@ public:
 	void initLocalWrite();
 	void initSocketWrite();
 
+	static bool readSparseMap(int fd, const struct stat &st, struct archive_entry *entry);
+
 	static ssize_t readBytes (int s, void *buf, size_t len) throw (Exception);
 	static ssize_t recvData (int s, void *buf, size_t len) throw (Exception);
 	static ssize_t writeBytes (int s, const void *buf, size_t len) throw (Exception);
@@ -109,6 +180,7 @@ public:
 	static ssize_t sendData (std::vector<int> &fds, const void *buf, size_t len) throw (Exception);
 
 	void setTotalSize(const uint64_t size);
+	void addTransferredBytes(uint64_t nbytes);
 
 	uint64_t getTotalSize() const;
 	uint64_t getTransferredBytes() const;
@@ -122,6 +194,68 @@ private:
 	/// Private constructor is needed in Singleton pattern
 	DataTransfer();
 
+	/**
+	 * \enum pipeError
+	 * \brief Errors of the reading thread of a transferPipe
+	 */
+	enum pipeError {
+		PIPE_NO_ERROR,
+		PIPE_READ_ERROR,
+		PIPE_RECV_ERROR,
+		PIPE_THREAD_ERROR
+	};
+
+	/**
+	 * \struct transferPipe
+	 * \brief Ring of buffers filled by readerThread() and drained by copyData()
+	 */
+	struct transferPipe {
+		/// Origin descriptor
+		int fdin;
+		/// Function used to read from fdin
+		Doclone::readFunction read;
+		/// The buffers of the ring
+		std::vector<char *> bufs;
+		/// Size of each buffer
+		dcBuffSize size;
+		/// Amount of data in each buffer, 0 means end of data
+		std::vector<ssize_t> lens;
+		/// Number of buffers filled until now
+		uint64_t produced;
+		/// Number of buffers drained until now
+		uint64_t consumed;
+		/// Kind of error of the reading thread, if any
+		int error;
+		/// Whether the reading thread must stop
+		bool stop;
+		/// Protects all the members above
+		pthread_mutex_t mutex;
+		/// Signaled when a buffer is filled
+		pthread_cond_t filled;
+		/// Signaled when a buffer is drained or the reader must stop
+		pthread_cond_t drained;
+		/// The reading thread
+		pthread_t reader;
+	};
+
+	static void *readerThread(void *data);
+	void stopPipe(transferPipe &pipe, bool abort);
+
+	char *getBuffer(unsigned int index, dcBuffSize size);
+
+	void writeRawEntry(const std::string &prefix, uint64_t offset, const char *buf, size_t len, std::vector<struct archive*> &outArchives) throw(Exception);
+
+	static bool isZero(const char *buf, size_t len);
+#ifdef HAVE_X86_SIMD
+	static bool isZeroSse2(const char *buf, size_t len);
+	static bool isZeroAvx2(const char *buf, size_t len);
+#endif
+
+	bool sendFileData(int fdin, std::vector<int> &outFds, uint64_t &totalNbytes) throw(Exception);
+	bool spliceData(int fdin, std::vector<int> &outFds, uint64_t &totalNbytes) throw(Exception);
+	static void throwReadError(int fd) throw(Exception);
+	static void throwWriteError(int fd) throw(Exception);
+
 	/// Total size to transfer
 	uint64_t _totalSize;
 	/// Transferred bytes at the moment
@@ -130,6 +264,12 @@ private:
 	uint32_t _notificationPointSize;
 	/// Number of times the observers have been notified at the moment
 	uint32_t _transferNotificationsCount;
+	/// Page aligned data buffers, kept until the end of the process
+	std::vector<char *> _buffers;
+	/// Size of each buffer of this->_buffers
+	dcBuffSize _buffersSize;
+	/// Zero detection for this processor
+	Doclone::zeroFunction _isZero;
 };
 
 }
@@ -19,6 +19,8 @@
 #ifndef DISK_H_
 #define DISK_H_
 
+#include <sys/types.h>
+
 #include <string>
 #include <vector>
 
@@ -32,6 +34,12 @@ namespace Doclone {
 /// Size of the Master Boot Record of the disk
 const uint16_t MBR_SIZE = 440;
 
+/// Microseconds between two checks for the node of a new partition
+const useconds_t PARTITION_NODE_WAIT = 100000;
+
+/// Checks for the node of a new partition before giving up (30 seconds)
+const int PARTITION_NODE_TRIES = 300;
+
 /**
  * \class Disk
  * \brief Represents a full disk.
@@ -80,7 +88,10 @@ protected:
 			const Partition *part) const throw(Exception);
 	PedConstraint *calcConstraint(const PedPartition* pPart,
 			uint64_t usedBytes) const throw(Exception);
+	void initPartitions(const std::vector<PedPartition *> &pedParts)
+		throw(Exception);
 	void writePartitionToDisk(Partition *part) const throw(Exception);
+	void waitForPartitions() const throw(Exception);
 
 	virtual void makeLabel() const throw(Exception) = 0;
 };
@@ -21,6 +21,7 @@
 
 #include <string>
 
+#include <doclone/BlockMap.h>
 #include <doclone/exception/Exception.h>
 
 namespace Doclone {
@@ -143,14 +144,14 @@ public:
 	bool getFormatSupport() const;
 	bool getUUIDSupport() const;
 	bool getLabelSupport() const;
+	bool getBlockSupport() const;
 	void setLabel(const std::string &label);
 	void setUUID(const std::string &uuid);
 
-	void readLabel(const std::string &dev) throw(Exception);
-	void readUUID(const std::string &dev) throw(Exception);
-
 	virtual void writeLabel(const std::string &dev) const throw(Exception) {}
 	virtual void writeUUID(const std::string &dev) const throw(Exception) {}
+	virtual void readBlockMap(const std::string &dev, BlockMap &map) const
+			throw(Exception) {}
 
 protected:
 	/// If the mount is native or external
@@ -184,6 +185,8 @@ protected:
 	bool _uuidSupport;
 	/// If it has label reading/writing support
 	bool _labelSupport;
+	/// If it can be imaged block by block
+	bool _blockSupport;
 };
 /**@}*/
 
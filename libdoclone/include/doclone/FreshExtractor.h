@@ -0,0 +1,155 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRESHEXTRACTOR_H_
+#define FRESHEXTRACTOR_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var FRESH_CACHED_DIRS
+ *
+ * Maximum number of directory descriptors kept open by a FreshExtractor
+ */
+const size_t FRESH_CACHED_DIRS = 128;
+
+/**
+ * \var FRESH_PREALLOC_SIZE
+ *
+ * Regular files of this size or bigger are allocated with fallocate() before
+ * writing their data
+ */
+const size_t FRESH_PREALLOC_SIZE = 65536;
+
+/**
+ * \class FreshExtractor
+ * \brief Writes the files of an archive in a filesystem just formatted
+ *
+ * Unlike archive_write_disk, it doesn't look for files to replace nor checks
+ * the paths for symlinks, since nothing is in the filesystem but what it
+ * writes. The files are created relative to the descriptors of their parent
+ * directories, which are cached. Regular files get their owner, mode and
+ * times through their own descriptor, and the directories in a final pass
+ * run by finish(), which also flushes the filesystem with syncfs().
+ *
+ * The regular files that aren't sparse are allocated at their final size
+ * before their data is written, so they are less fragmented.
+ *
+ * The entries with ACLs or file flags go to a disk archive instead.
+ *
+ * The entries can be written from several threads at the same time.
+ *
+ * \date October, 2015
+ */
+class FreshExtractor {
+public:
+	FreshExtractor(const std::string &root, int flags) throw(Exception);
+	~FreshExtractor();
+
+	void writeEntry(struct archive *archiveIn, struct archive_entry *entry)
+		throw(Exception);
+	void writeEntry(struct archive_entry *entry, const std::string &data,
+			const std::vector<std::pair<int64_t, size_t> > &blocks)
+		throw(Exception);
+	void finish() throw(Exception);
+
+private:
+	/**
+	 * \struct cachedDir
+	 * \brief An open directory
+	 */
+	struct cachedDir {
+		/// Descriptor of the directory
+		int fd;
+		/// Number of entries being written in it
+		unsigned int refs;
+		/// Position in the list of recently used directories
+		std::list<std::string>::iterator lru;
+	};
+
+	/**
+	 * \struct deferredDir
+	 * \brief Metadata of a directory, applied by finish()
+	 */
+	struct deferredDir {
+		/// Path relative to the root
+		std::string path;
+		/// Owner
+		uid_t uid;
+		/// Group
+		gid_t gid;
+		/// Permissions
+		mode_t mode;
+		/// Access and modification times
+		struct timespec times[2];
+	};
+
+	bool relativePath(const char *path, std::string &relPath) const;
+	bool isNative(struct archive_entry *entry, std::string &relPath,
+			std::string &relLink) const;
+	int createEntry(struct archive_entry *entry, const std::string &relPath,
+			const std::string &relLink) throw(Exception);
+	void finishFile(struct archive_entry *entry, int fd, int64_t end)
+		throw(Exception);
+	void setXattrs(struct archive_entry *entry, int fd,
+			const std::string &relPath) throw(Exception);
+
+	cachedDir *acquireDir(const std::string &path) throw(Exception);
+	void releaseDir(cachedDir *dir);
+
+	static void splitPath(const std::string &path, std::string &parent,
+			std::string &name);
+	static void getTimes(struct archive_entry *entry, struct timespec *times);
+	static void writeBlock(int fd, const char *buff, size_t size,
+			int64_t offset) throw(Exception);
+
+	/// Path of the root of the filesystem, ended in '/'
+	std::string _root;
+	/// Descriptor of the root of the filesystem
+	int _rootFd;
+	/// Writes the entries this extractor can't
+	struct archive *_fallback;
+	/// Open directories, by their path relative to the root
+	std::map<std::string, cachedDir *> _dirs;
+	/// Paths of the open directories, the most recently used at the front
+	std::list<std::string> _lru;
+	/// Directories waiting for their metadata, in creation order
+	std::vector<deferredDir> _deferred;
+	/// Protects all the members above, but _root and _rootFd
+	pthread_mutex_t _mutex;
+};
+
+}
+
+#endif /* FRESHEXTRACTOR_H_ */
@@ -32,13 +32,17 @@ namespace Doclone {
 
 /**
  * \struct blkidInfo
- * \brief A couple of tags obtained with libblkid for a filesystem
+ * \brief The tags obtained with libblkid for a filesystem
  */
 struct blkidInfo {
 	/// The name of the filesystem
 	std::string type;
 	/// Secondary type of the filesystem
 	std::string sec_type;
+	/// Label of the filesystem
+	std::string label;
+	/// UUID of the filesystem
+	std::string uuid;
 };
 
 /**
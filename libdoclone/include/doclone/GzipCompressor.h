@@ -0,0 +1,151 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GZIPCOMPRESSOR_H_
+#define GZIPCOMPRESSOR_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var GZIP_BLOCK_SIZE
+ *
+ * Amount of uncompressed data compressed by each job
+ */
+const size_t GZIP_BLOCK_SIZE = 131072;
+
+/**
+ * \var GZIP_DICT_SIZE
+ *
+ * Size of the deflate window, used to prime each job with the tail of the
+ * previous block
+ */
+const size_t GZIP_DICT_SIZE = 32768;
+
+/**
+ * \var GZIP_DEFAULT_LEVEL
+ *
+ * Compression level, the same used by libarchive's gzip filter
+ */
+const int GZIP_DEFAULT_LEVEL = 6;
+
+/**
+ * \typedef gzipSink
+ *
+ * A pointer to a function that receives the compressed data in order.
+ */
+typedef void (*gzipSink) (void *data, const void *buf, size_t len);
+
+/**
+ * \class GzipCompressor
+ * \brief Compresses a stream in gzip format using a pool of threads
+ *
+ * The input is split in blocks of GZIP_BLOCK_SIZE bytes that are deflated in
+ * parallel. Each block is primed with the last 32KiB of the previous one and
+ * ended with a sync flush, so the concatenation of all of them is a single
+ * deflate stream. The result is a standard gzip member that any gzip
+ * decoder can read.
+ *
+ * \date October, 2015
+ */
+class GzipCompressor {
+public:
+	GzipCompressor(unsigned int threads, int level, gzipSink sink,
+			void *sinkData) throw(Exception);
+	~GzipCompressor();
+
+	void write(const void *buf, size_t len) throw(Exception);
+	void finish() throw(Exception);
+
+private:
+	/**
+	 * \struct gzipJob
+	 * \brief A block of data to be compressed by a worker
+	 */
+	struct gzipJob {
+		/// Uncompressed data
+		std::vector<unsigned char> in;
+		/// Tail of the previous block, used as dictionary
+		std::vector<unsigned char> dict;
+		/// Compressed data
+		std::vector<unsigned char> out;
+		/// CRC-32 of the uncompressed data
+		unsigned long crc;
+		/// Whether this is the last block of the stream
+		bool last;
+		/// Whether a worker has finished with this block
+		bool done;
+		/// Whether zlib failed compressing this block
+		bool failed;
+	};
+
+	static void *worker(void *data);
+	static void compress(gzipJob *job, int level);
+
+	void submit(bool last) throw(Exception);
+	void flushFront() throw(Exception);
+	void writeHeader() throw(Exception);
+	void writeTrailer() throw(Exception);
+
+	/// Compression level
+	int _level;
+	/// Function that receives the compressed data
+	gzipSink _sink;
+	/// Opaque pointer passed to the sink
+	void *_sinkData;
+	/// Block being filled by write()
+	gzipJob *_current;
+	/// Tail of the last submitted block
+	std::vector<unsigned char> _dict;
+	/// Blocks waiting for a worker
+	std::deque<gzipJob *> _pending;
+	/// Submitted blocks, in stream order
+	std::deque<gzipJob *> _inFlight;
+	/// Maximum number of submitted blocks kept in memory
+	size_t _maxInFlight;
+	/// Worker threads
+	std::vector<pthread_t> _workers;
+	/// Protects the queues and the job states
+	pthread_mutex_t _mutex;
+	/// Signaled when a block is submitted or the workers must stop
+	pthread_cond_t _jobReady;
+	/// Signaled when a worker finishes a block
+	pthread_cond_t _jobDone;
+	/// Whether the workers must stop
+	bool _stop;
+	/// Whether the gzip header has been written
+	bool _headerWritten;
+	/// Whether finish() has been called
+	bool _finished;
+	/// CRC-32 of all the data written
+	unsigned long _crc;
+	/// Size of all the data written
+	uint64_t _size;
+};
+
+}
+
+#endif /* GZIPCOMPRESSOR_H_ */
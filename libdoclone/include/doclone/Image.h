@@ -21,22 +21,52 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include <string>
+#include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <xercesc/dom/DOM.hpp>
 
+#include <doclone/BlockMap.h>
+#include <doclone/Clone.h>
 #include <doclone/Util.h>
 #include <doclone/DiskLabel.h>
+#include <doclone/GzipCompressor.h>
 #include <doclone/Partition.h>
+#include <doclone/SenderPool.h>
+#include <doclone/TreeWriter.h>
 #include <doclone/xml/XMLDocument.h>
 #include <doclone/exception/Exception.h>
+#include <doclone/exception/WarningException.h>
 
 namespace Doclone {
 
+/**
+ * \var READ_BATCH_FILES
+ *
+ * Number of files of a directory kept open to be read in disk order
+ */
+const unsigned int READ_BATCH_FILES = 256;
+
+/**
+ * \var READ_AHEAD_FILES
+ *
+ * Number of files ahead of the one being read whose data is requested
+ */
+const unsigned int READ_AHEAD_FILES = 8;
+
+/**
+ * \var READ_AHEAD_SIZE
+ *
+ * Amount of data requested from the beginning of each of those files
+ */
+const off_t READ_AHEAD_SIZE = 1048576;
+
 /**
  * \enum imageType
  *
@@ -95,6 +125,7 @@ public:
 	uint64_t getSize() const;
 	Doclone::imageType getType() const;
 	void setType(Doclone::imageType type);
+	Doclone::dcCodec getCodec() const;
 	Disk *getDisk();
 	struct archive *getArchiveIn() const;
 	const std::vector<struct archive *> &getArchivesOut() const;
@@ -104,6 +135,8 @@ private:
 	uint64_t _size;
 	/// Image type (disk or partition)
 	Doclone::imageType _type;
+	/// Compression codec of the image data
+	Doclone::dcCodec _codec;
 	/// If the image has data or only a partition table
 	bool _noData;
 	/// Disk to work on
@@ -112,6 +145,67 @@ private:
 	struct archive *_archiveIn;
 	/// Vector of writing archive objects
 	std::vector<struct archive *> _archivesOut;
+	/// Descriptors fed by the writing archive
+	std::vector<int> _fdsOut;
+	/// Parallel gzip compressor, if the writing archive uses one
+	GzipCompressor *_compressor;
+	/// Per receiver sender threads, if the archive feeds several sockets
+	SenderPool *_senders;
+	/// Cleared headers to be reused while reading the files of a partition
+	std::vector<struct archive_entry *> _spareEntries;
+
+	void openWriteArchive(struct archive *arch) throw(Exception);
+
+	static void sendToFds(void *clientData, const void *buff, size_t length);
+	static ssize_t writeToFds(struct archive *arch, void *clientData,
+			const void *buff, size_t length);
+	static ssize_t writeToCompressor(struct archive *arch, void *clientData,
+			const void *buff, size_t length);
+	static int closeCompressor(struct archive *arch, void *clientData);
+	static int diskWriteFlags();
+
+	/**
+	 * \struct pendingFile
+	 * \brief A regular file waiting to be read in disk order
+	 */
+	struct pendingFile {
+		/// Header of the file
+		struct archive_entry *entry;
+		/// Descriptor of the file, or -1
+		int fd;
+		/// Path of the file
+		std::string path;
+		/// Status of the file
+		struct stat filestat;
+		/// Where the data of the file starts in the device
+		uint64_t physical;
+	};
+
+	static bool physicalOrder(const pendingFile &a, const pendingFile &b);
+
+	/**
+	 * \struct formatJob
+	 * \brief A partition being formatted in its own thread
+	 */
+	struct formatJob {
+		/// The partition to format
+		Partition *part;
+		/// The formatting thread
+		pthread_t thread;
+		/// Whether the thread has been created and not joined yet
+		bool started;
+		/// Copy of the warning that skips the partition, if any
+		Exception *error;
+		/// Copy of the error that stops the restore, if any
+		Exception *fatal;
+	};
+
+	static void *formatThread(void *data);
+	static void formatPartition(formatJob *job);
+	static void joinFormatThreads(std::vector<formatJob> &jobs);
+	static void freeFormatJobs(std::vector<formatJob> &jobs);
+	struct archive_entry *getSpareEntry();
+	void putSpareEntry(struct archive_entry *entry);
 
 	bool fitInDisk() const throw(Exception);
 
@@ -121,7 +215,20 @@ private:
 	void readDataFromDisk(struct archive_entry_linkresolver *lResolv,
 			const std::string &path, const std::string &imgRootDir,
 			size_t mPointLength) throw(Exception);
+	bool readFileBatch(struct archive_entry_linkresolver *lResolv,
+			std::vector<pendingFile> &batch) throw(Exception);
+	void readFileFromDisk(struct archive_entry_linkresolver *lResolv,
+			struct archive_entry *&entry, int fd, const std::string &path,
+			const struct stat &filestat) throw(Exception);
 	void writeDataToDisk() throw(Exception);
+	void takeWriteErrors(TreeWriter &writer, bool *errorPartitions) const;
+	void readBlocksFromDisk(const Partition *part) throw(Exception);
+	void writeBlocksToDisk(const Partition *part) throw(Exception);
+	void readRawFromDisk(const Partition *part) throw(Exception);
+	void writeRawToDisk(const Partition *part, const std::string &name,
+			uint64_t size, int &fd, uint64_t &end) throw(Exception);
+	void finishRawToDisk(const Partition *part, int &fd, uint64_t end)
+			throw(Exception);
 };
 
 }
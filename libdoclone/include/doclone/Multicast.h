@@ -0,0 +1,245 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MULTICAST_H_
+#define MULTICAST_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <doclone/NetNode.h>
+#include <doclone/Relay.h>
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var MCAST_PAYLOAD
+ *
+ * Bytes of the stream carried by each data datagram. Small enough to fit in
+ * an Ethernet frame with the IP, UDP and doclone headers.
+ */
+const uint16_t MCAST_PAYLOAD = 1400;
+
+/**
+ * \var MCAST_HEADER_SIZE
+ *
+ * Size of the header in front of every datagram
+ */
+const uint16_t MCAST_HEADER_SIZE = 20;
+
+/**
+ * \var MCAST_MAGIC
+ *
+ * First four bytes of every datagram, "DCMC"
+ */
+const uint32_t MCAST_MAGIC = 0x44434d43;
+
+/**
+ * \var MCAST_DEFAULT_RATE
+ *
+ * Default sending rate, in Mbit/s
+ */
+const unsigned int MCAST_DEFAULT_RATE = 500;
+
+/**
+ * \var MCAST_NAK_INTERVAL
+ *
+ * Milliseconds between two NAKs of a receiver, and between two repairs of the
+ * same datagram
+ */
+const unsigned int MCAST_NAK_INTERVAL = 10;
+
+/**
+ * \var MCAST_TIMEOUT
+ *
+ * Milliseconds without news from the other side before giving up
+ */
+const unsigned int MCAST_TIMEOUT = 30000;
+
+/**
+ * \var MCAST_LINGER
+ *
+ * Milliseconds a complete receiver keeps answering the end of the session,
+ * in case its acknowledgement was lost
+ */
+const unsigned int MCAST_LINGER = 1000;
+
+/**
+ * \class Multicast
+ * \brief Implementation of the IP multicast server and client.
+ *
+ * The server sends the stream only once, as sequenced UDP datagrams sent to
+ * MULTICAST_GROUP at a fixed rate. The receivers deliver them in order and
+ * send back a NAK with the ranges they are missing. The server repairs them
+ * by multicast again, so the sent bandwidth doesn't depend on the number of
+ * receivers.
+ *
+ * The session goes like this:
+ *
+ * - The server announces itself until every receiver has said hello
+ * - The server sends the data and repairs the NAKed datagrams
+ * - The server announces the end until every receiver says it is done
+ *
+ * Every datagram begins with a MCAST_HEADER_SIZE bytes header, in big-endian:
+ * magic (4), session (4), sequence (8), payload length (2), type (1) and a
+ * reserved byte.
+ *
+ * \date October, 2015
+ */
+class Multicast : public NetNode {
+public:
+	Multicast();
+	~Multicast();
+
+	void send() throw(Exception);
+	void receive() throw(Exception);
+
+private:
+	/**
+	 * \enum packetType
+	 * \brief Kinds of datagram
+	 */
+	enum packetType {
+		/// Server to group, the sequence is the size of the stream
+		PKT_ANNOUNCE = 1,
+		/// Receiver to server, the sequence is the receiver id
+		PKT_HELLO,
+		/// Server to group, a datagram of the stream
+		PKT_DATA,
+		/// Receiver to server, the payload is a list of missing ranges
+		PKT_NAK,
+		/// Server to group, the sequence is the number of data datagrams
+		PKT_END,
+		/// Receiver to server, the sequence is the receiver id
+		PKT_DONE
+	};
+
+	/**
+	 * \struct packet
+	 * \brief A datagram, once parsed
+	 */
+	struct packet {
+		/// Session of the server
+		uint32_t session;
+		/// Meaning depends on the type
+		uint64_t seq;
+		/// One of packetType
+		uint8_t type;
+		/// Length of the payload
+		uint16_t length;
+		/// Header and payload
+		char data[MCAST_HEADER_SIZE + MCAST_PAYLOAD];
+	};
+
+	virtual void closeConnection() throw(Exception);
+
+	void sendFromImage() throw(Exception);
+	void sendFromDevice() throw(Exception);
+
+	void receiveToImage() throw(Exception);
+	void receiveToDevice() throw(Exception);
+
+	void openSocket(bool receiver) throw(Exception);
+	void waitReceivers(uint64_t totalSize) throw(Exception);
+	uint64_t waitServer() throw(Exception);
+
+	void transmit(int fdin, int store) throw(Exception);
+	void finishTransmission(int store, uint64_t packets, uint64_t length)
+			throw(Exception);
+	void serveRequests(int timeout) throw(Exception);
+	void repair(int store) throw(Exception);
+	void pace(size_t length);
+
+	void receiveStream(int fdout, bool notify) throw(Exception);
+	void deliver(int fdout, const char *buf, size_t len, bool notify)
+			throw(Exception);
+	void sendNak(uint64_t next, uint64_t limit,
+			const std::map<uint64_t, std::vector<char> > &pending);
+	void linger() throw(Exception);
+
+	bool isStopped();
+
+	void sendPacket(const sockaddr_in &to, uint8_t type, uint64_t seq,
+			const void *payload, uint16_t length) throw(Exception);
+	bool recvPacket(packet &pkt, sockaddr_in &from, int timeout) throw(Exception);
+
+	static void *senderThread(void *data);
+	static void *receiverThread(void *data);
+
+	static uint64_t now();
+
+	/// Number of receivers (for server)
+	unsigned int _nodesNum;
+	/// UDP socket
+	int _sock;
+	/// Identifier of the session (the server's) or of the receiver
+	uint32_t _id;
+	/// Session being received (for clients)
+	uint32_t _session;
+	/// Address of the multicast group
+	sockaddr_in _group;
+	/// Address of the server's socket (for clients)
+	sockaddr_in _server;
+	/// Sending rate in Mbit/s
+	unsigned int _rate;
+	/// Time, in nanoseconds, when the next datagram can be sent
+	uint64_t _nextSend;
+	/// Receivers that said hello, by id, with their address
+	std::map<uint32_t, std::string> _receivers;
+	/// Receivers that got the whole stream
+	std::set<uint32_t> _done;
+	/// Ranges of datagrams waiting to be repaired
+	std::deque<std::pair<uint64_t, uint64_t> > _repairs;
+	/// Last time each datagram was repaired
+	std::map<uint64_t, uint64_t> _repaired;
+	/// Number of data datagrams sent until now
+	uint64_t _sentPackets;
+	/// Time of the last datagram received from the other side
+	uint64_t _lastHeard;
+	/// End of the pipe used by the archive, in device mode
+	int _archiveFd;
+	/// End of the pipe used by the network thread, in device mode
+	int _networkFd;
+	/// Temporary copy of the stream, for repairs (device mode only)
+	int _spool;
+	/// Keeps the stream while the archive isn't read (receiver, device mode)
+	Relay *_relay;
+	/// The network thread, in device mode
+	pthread_t _thread;
+	/// Whether the network thread has been created
+	bool _threadStarted;
+	/// Whether the network thread failed
+	bool _failed;
+	/// Whether the network thread must stop
+	bool _stop;
+	/// Protects _failed and _stop
+	pthread_mutex_t _mutex;
+};
+
+}
+
+#endif /* MULTICAST_H_ */
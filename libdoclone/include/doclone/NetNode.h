@@ -49,6 +49,13 @@ const dcPort PORT_PING = 7772;
  */
 const dcPort PORT_DATA = 7773;
 
+/**
+ * \var PORT_MULTICAST
+ *
+ * UDP port used to transfer the data in the multicast mode
+ */
+const dcPort PORT_MULTICAST = 7774;
+
 /**
  * \typedef dcGroup
  *
@@ -29,7 +29,9 @@
 
 #include <parted/parted.h>
 
+#include <doclone/BlockMap.h>
 #include <doclone/Filesystem.h>
+#include <doclone/FsFactory.h>
 #include <doclone/exception/Exception.h>
 
 namespace Doclone {
@@ -112,14 +114,25 @@ public:
 	const std::string &getMountPoint() const;
 	const std::string &getRootDir() const;
 	void setRootDir(const std::string &rootDir);
+	const BlockMap *getBlockMap() const;
+	void setBlockMap(BlockMap *map);
+	bool getRaw() const;
+	void setRaw(bool raw);
+
+	bool isDeviceImage() const;
+	bool isFormatted() const;
 
 	void initFromPath(const std::string &path) throw(Exception);
+	void initFromPedPartition(PedPartition *pPart, const blkidInfo &info)
+		throw(Exception);
 
 	void clearSignatures() const throw(Exception);
-	void format() const throw(Exception);
+	void eraseSignatures() const throw(Exception);
+	void format() throw(Exception);
 	void writeLabel() const throw(Exception);
 	void writeUUID() const throw(Exception);
 	void writeFlags() const throw(Exception);
+	void setFlags() const throw(Exception);
 
 	void doMount() throw(Exception);
 	void doUmount() throw(Exception);
@@ -149,17 +162,23 @@ private:
 	std::string _mountPoint;
 	/// Root directory of the partition in the image header
 	std::string _rootDir;
+	/// Used blocks, if the partition is imaged block by block
+	BlockMap *_blockMap;
+	/// Whether the whole partition is imaged raw, but its zero blocks
+	bool _raw;
+	/// Whether format() has made a new filesystem on the partition
+	bool _formatted;
 
 	void externalMount() throw(Exception);
 
 	// Initialize functions
 	void initNum() throw(Exception);
-	void initType() throw(Exception);
-	void initFS() throw(Exception);
+	void initType(const PedPartition *pPart) throw(Exception);
+	void initFS(const blkidInfo &info) throw(Exception);
 	void initMinSize() throw(Exception);
-	void initStartPos() throw(Exception);
-	void initUsedPart() throw(Exception);
-	void initFlags() throw(Exception);
+	void initStartPos(const PedPartition *pPart) throw(Exception);
+	void initUsedPart(const PedPartition *pPart) throw(Exception);
+	void initFlags(PedPartition *pPart) throw(Exception);
 
 	uint64_t usedSpace() throw(Exception);
 };
@@ -0,0 +1,155 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var RELAY_SPOOL_SIZE
+ *
+ * Maximum size of the spool of a relay. It is also limited to half the free
+ * space of its filesystem.
+ */
+const uint64_t RELAY_SPOOL_SIZE = 1073741824;
+
+/**
+ * \class Relay
+ * \brief Forwards a stream to the next link while a local copy is written
+ *
+ * A forwarding thread receives the stream and sends every block to the next
+ * link as soon as it arrives. The blocks are then queued for a second thread,
+ * that writes them to the local descriptor at its own pace.
+ *
+ * Up to the lag window is queued in memory. If the local writer falls further
+ * behind, the rest of the blocks are spooled to a temporary file until it
+ * catches up, so a slow local disk doesn't hold back the chain. The spool is
+ * bounded, when it is full the forwarder waits for the local writer.
+ *
+ * The local copy can also be written to a pipe owned by the relay, for the
+ * caller to decode it while it arrives. Without a next link, the relay is
+ * just a spool that keeps receiving while the caller is busy with something
+ * else, like preparing the disk. Then the caller calls stopSpooling(), and the
+ * rest of the stream comes at the pace of the local copy.
+ *
+ * The stream can also come from a pipe, fed by a thread of the caller.
+ *
+ * A failing next link is reported and the local copy goes on.
+ *
+ * \date October, 2015
+ */
+class Relay {
+public:
+	Relay(int fdin, int fdnext, int fdlocal, uint64_t window, bool notify)
+			throw(Exception);
+	~Relay();
+
+	int getLocalFd() const;
+	void stopSpooling();
+	void finish() throw(Exception);
+
+private:
+	static void *forwarderThread(void *data);
+	static void *writerThread(void *data);
+
+	void forward() throw(Exception);
+	void writeLocal() throw(Exception);
+	void queue(std::vector<char> *block);
+	bool writeAll(const char *buf, size_t len) throw(Exception);
+	void stop();
+
+	/// Socket connected to the previous link, or a pipe with the stream
+	int _fdin;
+	/// Socket connected to the next link, -1 if none
+	int _fdnext;
+	/// Descriptor of the local copy
+	int _fdlocal;
+	/// Read end of the local pipe, -1 if the local copy isn't a pipe
+	int _pipeRead;
+	/// Whether _fdlocal is the write end of the relay's pipe
+	bool _ownsLocal;
+	/// IP address of the next link
+	std::string _host;
+	/// Bytes the local copy can fall behind before spooling
+	uint64_t _window;
+	/// Whether the local writes are counted as transferred data
+	bool _notify;
+	/// Blocks waiting for the local writer, in stream order
+	std::deque<std::vector<char> *> _blocks;
+	/// Bytes in _blocks
+	uint64_t _queued;
+	/// Bytes of the stream received until now
+	uint64_t _head;
+	/// Bytes of the stream written to the local descriptor
+	uint64_t _written;
+	/// Temporary file for the blocks out of the window, -1 if unavailable
+	int _spoolFd;
+	/// Maximum size of the spool
+	uint64_t _spoolSize;
+	/// Whether new blocks can be spooled
+	bool _spoolEnabled;
+	/// Whether the new blocks go to the spool
+	bool _spooling;
+	/// Whether the forwarder is writing to the spool outside the lock
+	bool _appending;
+	/// Position in the stream of the first spooled byte
+	uint64_t _spoolStart;
+	/// Position in the stream of the end of the spooled data
+	uint64_t _spoolEnd;
+	/// Whether the whole stream has been received
+	bool _finished;
+	/// Whether receiving from the previous link failed
+	bool _recvFailed;
+	/// Whether sending to the next link failed
+	bool _nextFailed;
+	/// Whether writing the local copy failed
+	bool _localFailed;
+	/// Whether the reader of the local copy has closed it
+	bool _localClosed;
+	/// Whether the threads must stop
+	bool _stop;
+	/// The forwarding thread
+	pthread_t _forwarder;
+	/// The local writing thread
+	pthread_t _writer;
+	/// Whether the forwarding thread is running or not joined yet
+	bool _forwarderStarted;
+	/// Whether the local writing thread is running or not joined yet
+	bool _writerStarted;
+	/// Protects all the members above
+	pthread_mutex_t _mutex;
+	/// Signaled when there is new data for the writer
+	pthread_cond_t _filled;
+	/// Signaled when the writer progresses or stops
+	pthread_cond_t _drained;
+};
+
+}
+
+#endif /* RELAY_H_ */
@@ -0,0 +1,164 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SENDERPOOL_H_
+#define SENDERPOOL_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <doclone/Clone.h>
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var DEFAULT_LAG_WINDOW
+ *
+ * How far, in bytes, a receiver can fall behind the fastest one before the
+ * lag policy is applied to it
+ */
+const uint64_t DEFAULT_LAG_WINDOW = 268435456;
+
+/**
+ * \class SenderPool
+ * \brief Sends the same stream to many receivers, one thread per receiver
+ *
+ * The data passed to write() is stored in a ring of reference-counted chunks
+ * that all the senders read. A chunk is freed when every sender has sent it.
+ * The writer is only throttled by the fastest receiver. Receivers that fall
+ * more than the lag window behind it are spooled to a temporary file, or
+ * dropped, according to the lag policy, so they can't slow down the rest.
+ *
+ * A failing receiver is reported and left behind. The transfer only fails when
+ * no receiver remains.
+ *
+ * \date October, 2015
+ */
+class SenderPool {
+public:
+	SenderPool(const std::vector<int> &fds, uint64_t window,
+			Doclone::dcLagPolicy policy) throw(Exception);
+	~SenderPool();
+
+	void write(const void *buf, size_t len) throw(Exception);
+	void finish() throw(Exception);
+	void sendFile(int fdin) throw(Exception);
+
+private:
+	/**
+	 * \enum senderState
+	 * \brief Where a sender takes its data from, or why it has stopped
+	 */
+	enum senderState {
+		SENDER_RING,
+		SENDER_SPOOL,
+		SENDER_DONE,
+		SENDER_FAILED,
+		SENDER_DROPPED
+	};
+
+	/**
+	 * \struct chunk
+	 * \brief A block of the stream shared by the senders
+	 */
+	struct chunk {
+		/// The data
+		std::vector<char> data;
+		/// Position of the first byte in the stream
+		uint64_t offset;
+		/// Number of senders that still have to send it
+		unsigned int refs;
+	};
+
+	/**
+	 * \struct sender
+	 * \brief State of the thread that feeds a receiver
+	 */
+	struct sender {
+		/// Socket connected to the receiver
+		int fd;
+		/// IP address of the receiver
+		std::string host;
+		/// One of senderState
+		int state;
+		/// Whether the failure or drop has already been reported
+		bool reported;
+		/// Bytes of the stream sent to this receiver
+		uint64_t sent;
+		/// Chunk being sent outside the lock, if any
+		chunk *busy;
+		/// Spool descriptor, -1 if none
+		int spoolFd;
+		/// Whether the spool is a temporary file owned by the pool
+		bool ownSpool;
+		/// Offset of the spool where spoolStart is stored
+		off_t spoolBase;
+		/// Position in the stream of the first spooled byte
+		uint64_t spoolStart;
+		/// Position in the stream of the end of the spooled data
+		uint64_t spoolEnd;
+		/// The sending thread
+		pthread_t thread;
+		/// Whether the thread has been created
+		bool started;
+		/// The pool this sender belongs to
+		SenderPool *pool;
+	};
+
+	static void *senderThread(void *data);
+
+	void applyPolicy(sender *snd);
+	bool spool(sender *snd, const char *buf, size_t len, uint64_t offset);
+	void drop(sender *snd);
+	void releaseChunks(sender *snd);
+	void freeChunks();
+	bool isActive(const sender *snd) const;
+	void reportFailures() throw(Exception);
+	void stop();
+
+	/// Maximum distance to the fastest receiver
+	uint64_t _window;
+	/// What to do with the receivers out of the window
+	Doclone::dcLagPolicy _policy;
+	/// Per receiver state
+	std::vector<sender *> _senders;
+	/// Chunks not yet sent to every receiver in the ring, in stream order
+	std::deque<chunk *> _ring;
+	/// Bytes of the stream written until now
+	uint64_t _head;
+	/// Whether the whole stream has been written
+	bool _finished;
+	/// Whether the senders must stop
+	bool _stop;
+	/// Protects all the members above and the senders
+	pthread_mutex_t _mutex;
+	/// Signaled when there is new data for the senders
+	pthread_cond_t _filled;
+	/// Signaled when a sender progresses or stops
+	pthread_cond_t _drained;
+};
+
+}
+
+#endif /* SENDERPOOL_H_ */
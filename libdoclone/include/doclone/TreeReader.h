@@ -0,0 +1,189 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEREADER_H_
+#define TREEREADER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var TREE_INLINE_SIZE
+ *
+ * Files up to this size are read by the walkers into memory. The bigger ones
+ * are passed open to the writer, which streams them.
+ */
+const size_t TREE_INLINE_SIZE = 1048576;
+
+/**
+ * \var TREE_QUEUE_SIZE
+ *
+ * Maximum amount of file data waiting in the queue
+ */
+const size_t TREE_QUEUE_SIZE = 67108864;
+
+/**
+ * \var TREE_QUEUE_ENTRIES
+ *
+ * Maximum number of entries waiting in the queue
+ */
+const size_t TREE_QUEUE_ENTRIES = 4096;
+
+/**
+ * \var TREE_QUEUE_FDS
+ *
+ * Maximum number of open files waiting in the queue
+ */
+const size_t TREE_QUEUE_FDS = 64;
+
+/**
+ * \class TreeReader
+ * \brief Reads a directory tree with a pool of threads
+ *
+ * The walker threads scan directories, stat and open the files and read the
+ * small ones into memory. Each walker keeps its own stack of directories to
+ * scan and steals from the others when it runs out of work. The finished
+ * entries go through a bounded queue to the thread that calls readTree(),
+ * the only one that writes in the archives, so the stream stays serialized.
+ *
+ * A directory is always queued before its contents. The data of a hard linked
+ * file is stored with the first of its names that is found, and the rest of
+ * names are written as links once it is in the archive.
+ *
+ * \date October, 2015
+ */
+class TreeReader {
+public:
+	TreeReader(unsigned int threads, const std::string &path,
+			const std::string &imgRootDir) throw(Exception);
+	~TreeReader();
+
+	void readTree(std::vector<struct archive*> &outArchives) throw(Exception);
+
+private:
+	/**
+	 * \struct treeEntry
+	 * \brief A file ready to be written in the archive
+	 */
+	struct treeEntry {
+		/// Header of the file
+		struct archive_entry *entry;
+		/// Content of the file, if it has been read by the walker
+		std::string data;
+		/// Descriptor of the file, if the writer has to read it, or -1
+		int fd;
+		/// Whether the file has holes, only read if fd is set
+		bool holes;
+		/// Whether the data is stored with another name of the file
+		bool link;
+	};
+
+	/**
+	 * \struct treeWalker
+	 * \brief State of a walker thread
+	 */
+	struct treeWalker {
+		/// Directories waiting to be scanned, the newest at the back
+		std::deque<std::string> dirs;
+		/// Reads the metadata of the files
+		struct archive *archiveIn;
+		/// The walker thread
+		pthread_t thread;
+		/// Whether the thread has been created
+		bool started;
+		/// The reader this walker belongs to
+		TreeReader *reader;
+	};
+
+	/// Device and inode of a file
+	typedef std::pair<dev_t, ino_t> inodeKey;
+
+	static void *walkerThread(void *data);
+
+	bool nextDirectory(treeWalker *walker, std::string &path);
+	void scanDirectory(treeWalker *walker, const std::string &path);
+	treeEntry *readEntry(treeWalker *walker, int dirfd,
+			const std::string &name, const std::string &path,
+			const std::string &relPath, const struct stat &filestat,
+			int fdin) throw(Exception);
+	bool push(treeEntry *item);
+	void pushDirectory(treeWalker *walker, const std::string &path);
+
+	void writeEntry(treeEntry *item,
+			std::vector<struct archive*> &outArchives) throw(Exception);
+	void writeLinks(const inodeKey &key, const std::string &target,
+			std::vector<struct archive*> &outArchives) throw(Exception);
+
+	static void freeEntry(treeEntry *item);
+	void stop();
+
+	/// Path of the root of the tree, ended in '/'
+	std::string _path;
+	/// Path of the tree inside the image
+	std::string _imgRootDir;
+	/// Walker threads
+	std::vector<treeWalker *> _walkers;
+	/// Directories queued or being scanned
+	unsigned int _pendingDirs;
+	/// Finished entries, in the order they will be written
+	std::deque<treeEntry *> _queue;
+	/// Bytes of file data in the queue
+	size_t _queuedBytes;
+	/// Open files in the queue
+	size_t _queuedFds;
+	/// Hard linked files already claimed by a walker
+	std::set<inodeKey> _claimed;
+	/// Directories with errors, reported by the writer
+	std::vector<std::string> _errorDirs;
+	/// Whether a walker has failed
+	bool _failed;
+	/// Whether the walkers must stop
+	bool _stop;
+	/// Protects all the members above
+	pthread_mutex_t _mutex;
+	/// Signaled when there are directories to scan or the walk ends
+	pthread_cond_t _workReady;
+	/// Signaled when an entry is queued or the walk ends
+	pthread_cond_t _entryReady;
+	/// Signaled when the writer takes an entry
+	pthread_cond_t _spaceReady;
+
+	/// Names already written of the hard linked files, only used by the writer
+	std::map<inodeKey, std::string> _linkTargets;
+	/// Links waiting for their target, only used by the writer
+	std::multimap<inodeKey, treeEntry *> _pendingLinks;
+};
+
+}
+
+#endif /* TREEREADER_H_ */
@@ -0,0 +1,167 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEWRITER_H_
+#define TREEWRITER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <deque>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <doclone/FreshExtractor.h>
+#include <doclone/exception/Exception.h>
+
+namespace Doclone {
+
+/**
+ * \var TREE_JOB_SIZE
+ *
+ * Files up to this size are loaded into memory and written by the writer
+ * threads. The bigger ones are written by the decoding thread.
+ */
+const size_t TREE_JOB_SIZE = 1048576;
+
+/**
+ * \var TREE_JOBS_SIZE
+ *
+ * Maximum amount of file data waiting for a writer thread
+ */
+const size_t TREE_JOBS_SIZE = 67108864;
+
+/**
+ * \var TREE_JOBS_ENTRIES
+ *
+ * Maximum number of entries waiting for a writer thread
+ */
+const size_t TREE_JOBS_ENTRIES = 4096;
+
+/**
+ * \class TreeWriter
+ * \brief Extracts the entries of an archive with a pool of threads
+ *
+ * The thread that calls writeEntry() decodes the archive and hands the small
+ * files, links and special files to the writer threads, each one with its own
+ * disk archive, so their creation syscalls overlap.
+ *
+ * The directories and the big files are written by the decoding thread, so a
+ * directory always exists before its contents are handed over. An entry whose
+ * path or hard link target is still being written waits until it is done. The
+ * metadata of the directories is applied when finish() closes the archive of
+ * the decoding thread, after all the files have been written inside them.
+ *
+ * The entries of a partition just formatted are written by its
+ * FreshExtractor instead of the disk archives.
+ *
+ * \date October, 2015
+ */
+class TreeWriter {
+public:
+	TreeWriter(unsigned int threads, int flags) throw(Exception);
+	~TreeWriter();
+
+	void writeEntry(struct archive *archiveIn, struct archive_entry *entry,
+			unsigned int part, FreshExtractor *extractor) throw(Exception);
+	bool takeError(unsigned int &part, std::string &path);
+	void finish() throw(Exception);
+
+private:
+	/**
+	 * \struct treeJob
+	 * \brief An entry waiting for a writer thread
+	 */
+	struct treeJob {
+		/// Header of the file
+		struct archive_entry *entry;
+		/// Content of the file, its blocks one after the other
+		std::string data;
+		/// Offset in the file and size of each block of data
+		std::vector<std::pair<int64_t, size_t> > blocks;
+		/// Index of the partition of the file
+		unsigned int part;
+		/// Writes the file instead of the disk archive of the worker, or 0
+		FreshExtractor *extractor;
+	};
+
+	/**
+	 * \struct treeWorker
+	 * \brief State of a writer thread
+	 */
+	struct treeWorker {
+		/// Writes the files in the disk
+		struct archive *archiveOut;
+		/// The writer thread
+		pthread_t thread;
+		/// Whether the thread has been created
+		bool started;
+		/// The extractor this worker belongs to
+		TreeWriter *writer;
+	};
+
+	/// A file that couldn't be written, and its partition
+	typedef std::pair<unsigned int, std::string> treeError;
+
+	static void *writerThread(void *data);
+
+	struct archive *newArchive() const;
+	void writeJob(treeWorker *worker, treeJob *job);
+	void push(treeJob *job);
+	treeJob *pop();
+	void done(treeJob *job, bool error);
+	void waitFor(const std::string &path, const char *hardlink);
+
+	static void freeJob(treeJob *job);
+	void stop();
+
+	/// Options of the disk archives
+	int _flags;
+	/// Writes the directories and the big files, in the decoding thread
+	std::vector<struct archive *> _archives;
+	/// Writer threads
+	std::vector<treeWorker *> _workers;
+	/// Entries waiting for a writer thread
+	std::deque<treeJob *> _queue;
+	/// Bytes of file data in the queue
+	size_t _queuedBytes;
+	/// Paths of the entries handed over and not yet written
+	std::multiset<std::string> _inFlight;
+	/// Files that couldn't be written
+	std::deque<treeError> _errors;
+	/// Whether the writers must stop
+	bool _stop;
+	/// Protects all the members above, but _flags and _archives
+	pthread_mutex_t _mutex;
+	/// Signaled when an entry is queued or the writers must stop
+	pthread_cond_t _jobReady;
+	/// Signaled when a writer takes an entry
+	pthread_cond_t _spaceReady;
+	/// Signaled when a writer finishes an entry
+	pthread_cond_t _jobDone;
+};
+
+}
+
+#endif /* TREEWRITER_H_ */
@@ -22,8 +22,11 @@
 #include <config.h>
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <string>
+#include <vector>
 
 #include <doclone/exception/Exception.h>
 
@@ -76,6 +79,19 @@
 
 namespace Doclone {
 
+/**
+ * \struct dirEntry
+ * \brief A name read from a directory
+ */
+struct dirEntry {
+	/// Inode number
+	ino_t ino;
+	/// Type of file, DT_UNKNOWN if the filesystem doesn't tell it
+	unsigned char type;
+	/// Name of the file
+	std::string name;
+};
+
 /**
  * \class Util
  * \brief A set of useful functions
@@ -94,6 +110,10 @@ public:
 	static uint64_t getFileSize(const std::string &path) throw(Exception);
 
 	static void writeBinData(const std::string &file, const void *data, unsigned int offset, unsigned int size) throw(Exception);
+	static bool readBinData(int fd, void *data, uint64_t offset, size_t size);
+	static uint64_t getPhysicalOffset(int fd);
+	static void readDirectory(int fd, std::vector<dirEntry> &entries) throw(Exception);
+	static int openEntry(int dirfd, const dirEntry &entry, struct stat &filestat);
 
 	static void addMtabEntry(const std::string &partPath, const std::string &mountPoint, const std::string &mountName, const std::string &mountOptions) throw(Exception);
 	static void updateMtab(const std::string &partPath) throw(Exception);
@@ -106,6 +126,7 @@ public:
 
 	static bool isBlockDevice(const std::string &path) throw(Exception);
 	static bool isDisk(const std::string &device) throw(Exception);
+	static bool isRotational(const std::string &device);
 
 	static bool match(const std::string &str, const std::string &regEx);
 
@@ -115,13 +136,14 @@ public:
 	static bool isVirtualDirectory(const char *path);
 	static bool isLiveFile(const char *path);
 
-	static bool isUUIDRepeated(const char *uuid) throw(Exception);
+	static unsigned int getNumberOfCpus();
 
 	static uint32_t swapEndian(uint32_t x);
 	static uint64_t swapEndian(uint64_t x);
 
 	static void signalCapture();
 	static void signalHandler(int s) throw(Exception);
+	static void blockSignals();
 
 	static void split(const std::string &string, char delim, std::vector<std::string> &elems);
 	static std::string find_program_in_path(const std::string &program);
@@ -132,6 +154,9 @@ public:
 
 	static char *doubletoString(const double value, char *dst);
 	static double stringToDouble(const char* str);
+
+private:
+	static bool inodeOrder(const dirEntry &a, const dirEntry &b);
 };
 
 }
@@ -179,6 +179,15 @@
  * - nodes number (int): The number of receivers
  * - empty (int): Clone the partition table without reading/writing the data (true or false)
  * - force (int): Force working even if the image doesn't fit in the destination device (true or false)
+ * - threads (int): Number of threads used to read, compress and restore the image (0 = one per processor)
+ * - codec (dcCodec): Compression codec of the created images (gzip by default)
+ * - compression level (int): Level for the codec (0 = the codec default)
+ * - buffer size (int): Size in bytes of the data buffers (0 = by descriptor type)
+ * - buffer count (int): Number of buffers read ahead (0 = the default)
+ * - lag window (int): MiB a receiver can fall behind the fastest one (0 = the default)
+ * - lag policy (dcLagPolicy): What to do with the receivers out of the window
+ * - multicast rate (int): Mbit/s sent in the multicast mode (0 = the default)
+ * - block imaging (int): Image the supported filesystems block by block (true or false)
  *
  * These are some functions for configuring those properties:
  *
@@ -190,6 +199,15 @@
  * 	void doclone_set_nodes_number(dc_doclone *dc_obj, unsigned int number);
  * 	void doclone_set_empty(dc_doclone *dc_obj, unsigned short empty);
  * 	void doclone_set_force(dc_doclone *dc_obj, unsigned short force);
+ * 	void doclone_set_threads(dc_doclone *dc_obj, unsigned int threads);
+ * 	void doclone_set_codec(dc_doclone *dc_obj, dcCodec codec);
+ * 	void doclone_set_compression_level(dc_doclone *dc_obj, int level);
+ * 	void doclone_set_buffer_size(dc_doclone *dc_obj, unsigned int size);
+ * 	void doclone_set_buffer_count(dc_doclone *dc_obj, unsigned int count);
+ * 	void doclone_set_lag_window(dc_doclone *dc_obj, unsigned int window);
+ * 	void doclone_set_lag_policy(dc_doclone *dc_obj, dcLagPolicy policy);
+ * 	void doclone_set_multicast_rate(dc_doclone *dc_obj, unsigned int rate);
+ * 	void doclone_set_block_imaging(dc_doclone *dc_obj, unsigned short blocks);
  * \endcode
  *
  * The last step is to call one of the functions that perform the work:
@@ -201,6 +219,8 @@
  * 	int doclone_receive(const dc_doclone *dc_obj);
  * 	int doclone_chain_origin(const dc_doclone *dc_obj);
  * 	int doclone_chain_link(const dc_doclone *dc_obj);
+ * 	int doclone_multicast_send(const dc_doclone *dc_obj);
+ * 	int doclone_multicast_receive(const dc_doclone *dc_obj);
  * \endcode
  *
  * All of these functions receive a pointer to a dc_doclone object which
@@ -345,6 +365,40 @@ typedef enum dcEvent {
 	EVT_NEW_CONNECION
 } dcEvent;
 
+/**
+ * \enum dcCodec
+ * \brief C wrapper for Doclone::dcCodec
+ *
+ * \var CODEC_GZIP
+ * 	gzip, readable by all the versions of doclone
+ * \var CODEC_ZSTD
+ * 	Zstandard
+ * \var CODEC_LZ4
+ * 	LZ4
+ * \var CODEC_NONE
+ * 	No compression
+ */
+typedef enum dcCodec {
+	CODEC_GZIP,
+	CODEC_ZSTD,
+	CODEC_LZ4,
+	CODEC_NONE
+} dcCodec;
+
+/**
+ * \enum dcLagPolicy
+ * \brief C wrapper for Doclone::dcLagPolicy
+ *
+ * \var LAG_SPOOL
+ * 	Keep its data in a temporary file and send it at its own pace
+ * \var LAG_DROP
+ * 	Disconnect it
+ */
+typedef enum dcLagPolicy {
+	LAG_SPOOL,
+	LAG_DROP
+} dcLagPolicy;
+
 /**
  * \typedef transferCallback
  *
@@ -397,6 +451,24 @@ typedef struct dc_doclone {
 	uint8_t _empty;
 	/// Mode force enabled/disabled
 	uint8_t _force;
+	/// Number of reading, compression and restoring threads, 0 for one per processor
+	uint32_t _threads;
+	/// Compression codec of the created images
+	uint8_t _codec;
+	/// Compression level, 0 for the default of the codec
+	int32_t _compressionLevel;
+	/// Size of the data buffers, 0 to choose it from the descriptor type
+	uint32_t _bufferSize;
+	/// Number of data buffers read ahead, 0 for the default
+	uint32_t _bufferCount;
+	/// MiB a receiver can fall behind the fastest one, 0 for the default
+	uint32_t _lagWindow;
+	/// What to do with the receivers out of the lag window
+	uint8_t _lagPolicy;
+	/// Sending rate of the multicast mode in Mbit/s, 0 for the default
+	uint32_t _multicastRate;
+	/// Image the supported filesystems block by block
+	uint8_t _blockImaging;
 	/// Event subscriber object
 	void * _observer;
 } dc_doclone;
@@ -422,6 +494,8 @@ int doclone_send(const dc_doclone *dc_obj);
 int doclone_receive(const dc_doclone *dc_obj);
 int doclone_chain_origin(const dc_doclone *dc_obj);
 int doclone_chain_link(const dc_doclone *dc_obj);
+int doclone_multicast_send(const dc_doclone *dc_obj);
+int doclone_multicast_receive(const dc_doclone *dc_obj);
 
 /*
  * Setters for the dc_doclone object
@@ -433,6 +507,15 @@ void doclone_set_interface(dc_doclone *dc_obj, const char *interface);
 void doclone_set_nodes_number(dc_doclone *dc_obj, unsigned int number);
 void doclone_set_empty(dc_doclone *dc_obj, unsigned short empty);
 void doclone_set_force(dc_doclone *dc_obj, unsigned short force);
+void doclone_set_threads(dc_doclone *dc_obj, unsigned int threads);
+void doclone_set_codec(dc_doclone *dc_obj, dcCodec codec);
+void doclone_set_compression_level(dc_doclone *dc_obj, int level);
+void doclone_set_buffer_size(dc_doclone *dc_obj, unsigned int size);
+void doclone_set_buffer_count(dc_doclone *dc_obj, unsigned int count);
+void doclone_set_lag_window(dc_doclone *dc_obj, unsigned int window);
+void doclone_set_lag_policy(dc_doclone *dc_obj, dcLagPolicy policy);
+void doclone_set_multicast_rate(dc_doclone *dc_obj, unsigned int rate);
+void doclone_set_block_imaging(dc_doclone *dc_obj, unsigned short blocks);
 
 /*
  * Functions for set the callbacks of libdoclone events
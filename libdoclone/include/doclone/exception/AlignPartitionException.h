@@ -41,6 +41,12 @@ public:
 		this->_msg=D_("The partition cannot be aligned to MiB");
 	}
 
+	Exception *clone() const {
+		return new AlignPartitionException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("The connection has been closed by other node");
 	}
 
+	Exception *clone() const {
+		return new BrokenPipeException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
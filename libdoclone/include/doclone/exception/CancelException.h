@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("The job was canceled by the user");
 	}
 
+	Exception *clone() const {
+		return new CancelException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't close a network socket");
 	}
 
+	Exception *clone() const {
+		return new CloseConnectionException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
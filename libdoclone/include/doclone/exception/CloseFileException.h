@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't close a file descriptor");
 	}
 
+	Exception *clone() const {
+		return new CloseFileException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Committing changes to disk failed");
 	}
 
+	Exception *clone() const {
+		return new CommitException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
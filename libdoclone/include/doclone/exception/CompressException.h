@@ -0,0 +1,51 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSEXCEPTION_H_
+#define COMPRESSEXCEPTION_H_
+
+#include <doclone/exception/ErrorException.h>
+
+namespace Doclone {
+
+/**
+ * \addtogroup Exceptions
+ * @{
+ *
+ * \class CompressException
+ * \brief Error compressing the image data.
+ * \date October, 2015
+ */
+class CompressException: public ErrorException {
+public:
+	CompressException() throw() {
+		this->_msg=D_("Can't compress data");
+	}
+
+	Exception *clone() const {
+		return new CompressException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+};
+/**@}*/
+
+}
+
+#endif /* COMPRESSEXCEPTION_H_ */
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("There was a connection error");
 	}
 
+	Exception *clone() const {
+		return new ConnectionException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
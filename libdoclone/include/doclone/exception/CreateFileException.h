@@ -47,6 +47,13 @@ public:
 	}
 	~CreateFileException() throw() {}
 
+	Exception *clone() const {
+		return new CreateFileException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the file
 	const std::string _file;
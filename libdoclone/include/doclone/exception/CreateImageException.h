@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("The image can't be created");
 	}
 
+	Exception *clone() const {
+		return new CreateImageException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't create partition");
 	}
 
+	Exception *clone() const {
+		return new CreatePartitionException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -0,0 +1,64 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DROPRECEIVEREXCEPTION_H_
+#define DROPRECEIVEREXCEPTION_H_
+
+#include <string>
+
+#include <doclone/exception/WarningException.h>
+
+namespace Doclone {
+
+/**
+ * \addtogroup Exceptions
+ * @{
+ *
+ * \class DropReceiverException
+ * \brief A receiver has been disconnected for falling too far behind
+ * \date October, 2015
+ */
+class DropReceiverException: public WarningException {
+public:
+	/// \param host The receiver's host name or IP address
+	DropReceiverException(const std::string &host) throw() : _host(host) {
+		// TO TRANSLATORS: looks like	Too slow, disconnected: 192.168.1.10
+		std::string msg=D_("Too slow, disconnected:");
+		msg.append(" ");
+		msg.append(this->_host);
+
+		this->_msg = msg;
+	}
+	~DropReceiverException() throw() {}
+
+	Exception *clone() const {
+		return new DropReceiverException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
+private:
+	/// The receiver's host or IP
+	const std::string _host;
+};
+/**@}*/
+
+}
+
+#endif /* DROPRECEIVEREXCEPTION_H_ */
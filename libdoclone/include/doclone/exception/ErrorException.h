@@ -62,6 +62,13 @@ public:
 		Logger *log = Logger::getInstance();
 		log->error(message.str());
 	}
+
+	Exception *clone() const {
+		return new ErrorException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
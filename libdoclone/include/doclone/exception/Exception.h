@@ -111,6 +111,22 @@ public:
 		return this->_msg.c_str();
 	}
 
+	/**
+	 * Copies the exception keeping its type, to be rethrown elsewhere,
+	 * usually in another thread. Re-implemented in the inherited classes.
+	 */
+	virtual Exception *clone() const {
+		return new Exception(*this);
+	}
+
+	/**
+	 * Throws a copy of the exception with its type, even through a
+	 * pointer to a base class. Re-implemented in the inherited classes.
+	 */
+	virtual void raise() const {
+		throw *this;
+	}
+
 protected:
 	std::string _msg;
 };
@@ -46,6 +46,13 @@ public:
 	}
 	~FileNotFoundException() throw() {}
 
+	Exception *clone() const {
+		return new FileNotFoundException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the file
 	const std::string _file;
@@ -44,6 +44,13 @@ public:
 	}
 	~FormatException() throw() {}
 
+	Exception *clone() const {
+		return new FormatException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the partition
 	const std::string _device;
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't install GRUB bootloader");
 	}
 
+	Exception *clone() const {
+		return new GrubException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Initialization of Doclone logic failed");
 	}
 
+	Exception *clone() const {
+		return new InitializationException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -39,6 +39,12 @@ public:
 		this->_msg=D_("Invalid image");
 	}
 
+	Exception *clone() const {
+		return new InvalidImageException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't create a new disk label");
 	}
 
+	Exception *clone() const {
+		return new MakeLabelException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
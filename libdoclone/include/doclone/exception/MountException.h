@@ -46,6 +46,13 @@ public:
 	}
 	~MountException() throw() {}
 
+	Exception *clone() const {
+		return new MountException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the device to be mounted
 	const std::string _device;
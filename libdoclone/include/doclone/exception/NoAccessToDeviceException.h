@@ -49,6 +49,13 @@ public:
 	}
 	~NoAccessToDeviceException() throw() {}
 
+	Exception *clone() const {
+		return new NoAccessToDeviceException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The device path
 	const std::string _deviceName;
@@ -39,6 +39,12 @@ public:
 		this->_msg=D_("Not a block device");
 	}
 
+	Exception *clone() const {
+		return new NoBlockDeviceException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
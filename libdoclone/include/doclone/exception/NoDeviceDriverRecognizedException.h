@@ -45,6 +45,12 @@ public:
 		this->_msg=D_("The library can't determine whether this device is SCSI or IDE. Using SCSI by default.");
 	}
 
+	Exception *clone() const {
+		return new NoDeviceDriverRecognizedException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -40,6 +40,12 @@ public:
 		this->_msg=D_("Image doesn't fit in device");
 	}
 
+	Exception *clone() const {
+		return new NoFitInDeviceException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
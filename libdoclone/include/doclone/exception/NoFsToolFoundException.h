@@ -46,6 +46,14 @@ public:
 		this->_msg = msg;
 	}
 	~NoFsToolFoundException() throw() {}
+
+	Exception *clone() const {
+		return new NoFsToolFoundException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The missing command
 	const std::string _command;
@@ -49,6 +49,13 @@ public:
 	}
 	~NoLabelSupportException() throw() {}
 
+	Exception *clone() const {
+		return new NoLabelSupportException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the filesystem
 	const std::string _fsName;
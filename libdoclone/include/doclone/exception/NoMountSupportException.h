@@ -47,6 +47,13 @@ public:
 	}
 	~NoMountSupportException() throw() {}
 
+	Exception *clone() const {
+		return new NoMountSupportException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the filesystem
 	const std::string _fsName;
@@ -38,6 +38,13 @@ public:
 	NoSelinuxSupportException() throw() {
 		this->_msg = D_("Selinux attributes will not be cloned due to Doclone was built without support for Selinux");
 	}
+
+	Exception *clone() const {
+		return new NoSelinuxSupportException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -49,6 +49,13 @@ public:
 	}
 	~NoUuidSupportException() throw() {}
 
+	Exception *clone() const {
+		return new NoUuidSupportException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the filesystem
 	const std::string _fsName;
@@ -49,6 +49,13 @@ public:
 	}
 	~OpenFileException() throw() {}
 
+	Exception *clone() const {
+		return new OpenFileException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the file
 	const std::string _filePath;
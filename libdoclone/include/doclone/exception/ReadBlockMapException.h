@@ -0,0 +1,64 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2013 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef READBLOCKMAPEXCEPTION_H_
+#define READBLOCKMAPEXCEPTION_H_
+
+#include <string>
+
+#include <doclone/exception/WarningException.h>
+
+namespace Doclone {
+
+/**
+ * \addtogroup Exceptions
+ * @{
+ *
+ * \class ReadBlockMapException
+ * \brief Error reading the used blocks of a filesystem.
+ * \date October, 2015
+ */
+class ReadBlockMapException : public WarningException {
+public:
+	/// \param device The path of the partition
+	ReadBlockMapException(const std::string &device) throw() : _device(device) {
+		// TO TRANSLATORS: looks like	Can't read the used blocks: /dev/sdb1
+		std::string msg= D_("Can't read the used blocks:");
+		msg.append(" ");
+		msg.append(this->_device);
+
+		this->_msg = msg;
+	}
+	~ReadBlockMapException() throw() {}
+
+	Exception *clone() const {
+		return new ReadBlockMapException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
+private:
+	/// The path of the partition
+	const std::string _device;
+};
+/**@}*/
+
+}
+
+#endif /* READBLOCKMAPEXCEPTION_H_ */
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't read data");
 	}
 
+	Exception *clone() const {
+		return new ReadDataException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
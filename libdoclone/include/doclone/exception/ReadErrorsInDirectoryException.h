@@ -47,6 +47,13 @@ public:
 	}
 	~ReadErrorsInDirectoryException() throw() {}
 
+	Exception *clone() const {
+		return new ReadErrorsInDirectoryException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the directory
 	const std::string _directory;
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't receive data");
 	}
 
+	Exception *clone() const {
+		return new ReceiveDataException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
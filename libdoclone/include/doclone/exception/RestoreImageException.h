@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("The image can't be restored");
 	}
 
+	Exception *clone() const {
+		return new RestoreImageException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -44,6 +44,13 @@ public:
 	}
 	~SendDataException() throw() {}
 
+	Exception *clone() const {
+		return new SendDataException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The receiver's host or IP
 	const std::string _host;
@@ -42,6 +42,13 @@ public:
 	}
 
 	~SigAbrtException() throw() {}
+
+	Exception *clone() const {
+		return new SigAbrtException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -49,6 +49,13 @@ public:
 	}
 	~SignalCaughtException() throw() {}
 
+	Exception *clone() const {
+		return new SignalCaughtException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The signal caught
 	const int _signal;
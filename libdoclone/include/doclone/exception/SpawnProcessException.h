@@ -48,6 +48,13 @@ public:
 	}
 	~SpawnProcessException() throw() {}
 
+	Exception *clone() const {
+		return new SpawnProcessException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The name of the process
 	const std::string _processName;
@@ -61,6 +61,13 @@ public:
 
 	~TooMuchPartitionsException() throw() {}
 
+	Exception *clone() const {
+		return new TooMuchPartitionsException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The number of partitions in the image
 	const uint8_t _numParts;
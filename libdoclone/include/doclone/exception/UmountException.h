@@ -46,6 +46,13 @@ public:
 	}
 	~UmountException() throw() {}
 
+	Exception *clone() const {
+		return new UmountException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the partition
 	const std::string _path;
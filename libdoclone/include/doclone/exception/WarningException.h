@@ -63,6 +63,12 @@ public:
 		log->warn(message.str());
 	}
 
+	Exception *clone() const {
+		return new WarningException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -37,6 +37,12 @@ public:
 		this->_msg=D_("Can't write data");
 	}
 
+	Exception *clone() const {
+		return new WriteDataException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -47,6 +47,13 @@ public:
 	}
 	~WriteErrorsInDirectoryException() throw() {}
 
+	Exception *clone() const {
+		return new WriteErrorsInDirectoryException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the directory
 	const std::string _directory;
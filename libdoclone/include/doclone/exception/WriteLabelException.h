@@ -46,6 +46,13 @@ public:
 	}
 	~WriteLabelException() throw() {}
 
+	Exception *clone() const {
+		return new WriteLabelException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the partition
 	const std::string _device;
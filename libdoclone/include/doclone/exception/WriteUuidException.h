@@ -46,6 +46,13 @@ public:
 	}
 	~WriteUuidException() throw() {}
 
+	Exception *clone() const {
+		return new WriteUuidException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
+
 private:
 	/// The path of the partition
 	const std::string _device;
@@ -40,6 +40,12 @@ public:
 		this->_msg=D_("Wrong image type");
 	}
 
+	Exception *clone() const {
+		return new WrongImageTypeException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
@@ -39,6 +39,12 @@ public:
 		this->_msg=D_("Parse error in the XML header");
 	}
 
+	Exception *clone() const {
+		return new XMLParseException(*this);
+	}
+	void raise() const {
+		throw *this;
+	}
 };
 /**@}*/
 
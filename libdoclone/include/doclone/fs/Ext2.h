@@ -96,7 +96,8 @@ namespace Doclone {
  * \class Ext2
  * \brief Ext2 operations.
  *
- * Functions to write the label and uuid of a ext2/3/4 filesystem
+ * Functions to write the label and uuid of a ext2/3/4 filesystem, and to read
+ * its used blocks from the block bitmap
  * \date August, 2011
  */
 class Ext2 : public Filesystem {
@@ -105,6 +106,8 @@ public:
 
 	void writeLabel(const std::string &dev) const throw(Exception);
 	void writeUUID(const std::string &dev) const throw(Exception);
+	void readBlockMap(const std::string &dev, BlockMap &map) const
+			throw(Exception);
 
 private:
 	virtual void checkSupport();
@@ -23,6 +23,7 @@
 
 #include <string>
 
+#include <doclone/BlockMap.h>
 #include <doclone/Filesystem.h>
 
 /**
@@ -102,7 +103,7 @@ namespace Doclone {
  * \class Fat16
  * \brief Operations for Fat16
  *
- * Writes UUID and label
+ * Writes UUID and label, and reads the used clusters from the FAT
  * \date August, 2011
  */
 class Fat16 : public Filesystem {
@@ -111,6 +112,11 @@ public:
 
 	void writeLabel(const std::string &dev) const throw(Exception);
 	void writeUUID(const std::string &dev) const throw(Exception);
+	void readBlockMap(const std::string &dev, BlockMap &map) const
+			throw(Exception);
+
+	static void readFatMap(const std::string &dev, BlockMap &map)
+			throw(Exception);
 
 private:
 	void checkSupport();
@@ -23,6 +23,7 @@
 
 #include <string>
 
+#include <doclone/BlockMap.h>
 #include <doclone/Filesystem.h>
 #include <doclone/exception/Exception.h>
 
@@ -96,7 +97,7 @@ namespace Doclone {
  * \class Fat32
  * \brief Fat32 operations
  *
- * Writes uuid and label
+ * Writes uuid and label, and reads the used clusters from the FAT
  * \date August, 2011
  */
 class Fat32 : public Filesystem {
@@ -105,6 +106,8 @@ public:
 
 	void writeLabel(const std::string &dev) const throw(Exception);
 	void writeUUID(const std::string &dev) const throw(Exception);
+	void readBlockMap(const std::string &dev, BlockMap &map) const
+			throw(Exception);
 
 private:
 	void checkSupport();
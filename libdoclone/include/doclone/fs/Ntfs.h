@@ -21,8 +21,13 @@
 
 #include <config.h>
 
+#include <stdint.h>
+
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <doclone/BlockMap.h>
 #include <doclone/Filesystem.h>
 #include <doclone/exception/Exception.h>
 
@@ -92,11 +97,17 @@ namespace Doclone {
  */
 #define BLKID_REGEXP_NTFS "^ntfs$"
 
+/**
+ * \def NTFS_BITMAP_RECORD
+ * Number of the MFT record of $Bitmap, the allocation bitmap of the clusters.
+ */
+#define NTFS_BITMAP_RECORD 6
+
 /**
  * \class Ntfs
  * \brief Operations for Ntfs
  *
- * Writes UUID and label
+ * Writes UUID and label, and reads the used clusters from $Bitmap
  * \date August, 2011
  */
 class Ntfs : public Filesystem {
@@ -105,9 +116,36 @@ public:
 
 	void writeLabel(const std::string &dev) const throw(Exception);
 	void writeUUID(const std::string &dev) const throw(Exception);
+	void readBlockMap(const std::string &dev, BlockMap &map) const
+			throw(Exception);
 
 private:
+	/**
+	 * \struct bitmapScan
+	 * \brief Progress through $Bitmap
+	 */
+	struct bitmapScan {
+		/// Number of clusters of the volume
+		uint64_t clusters;
+		/// Sectors in a cluster
+		uint32_t sectorsPerCluster;
+		/// Next cluster to be looked at
+		uint64_t cluster;
+		/// First cluster of the current run of used ones
+		uint64_t runStart;
+		/// Whether the previous cluster was used
+		bool inRun;
+	};
+
 	void checkSupport();
+
+	static bool applyFixups(uint8_t *record, uint32_t size);
+	static bool decodeRunlist(const uint8_t *run, const uint8_t *end,
+			std::vector<std::pair<int64_t, uint64_t> > &runs);
+	static void scanBitmap(bitmapScan &scan, const uint8_t *buf, size_t len,
+			BlockMap &map) throw(Exception);
+	static void skipBitmap(bitmapScan &scan, uint64_t len, BlockMap &map)
+			throw(Exception);
 };
 /**@}*/
 
@@ -75,7 +75,7 @@ public:
 	const uint8_t getElementValueU8(const DOMElement *parent, const char *name);
 	const uint16_t getElementValueU16(const DOMElement *parent, const char *name);
 	const uint64_t getElementValueU64(const DOMElement *parent, const char *name);
-	const uint8_t *getElementValueBinary(const DOMElement *parent, const char *name);
+	const uint8_t *getElementValueBinary(const DOMElement *parent, const char *name, size_t &size);
 private:
 	///XML document
 	DOMDocument *_doc;
@@ -0,0 +1,286 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/BlkidScanner.h>
+
+#include <pthread.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <blkid/blkid.h>
+
+#include <doclone/Logger.h>
+#include <doclone/Util.h>
+
+namespace Doclone {
+
+/**
+ * \brief Initializes the attributes
+ */
+BlkidScanner::BlkidScanner(): _uuids(), _indexed(false) {
+	pthread_mutex_init(&this->_mutex, 0);
+}
+
+BlkidScanner::~BlkidScanner() {
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+/**
+ * \brief Singleton stuff
+ *
+ * \return A BlkidScanner object
+ */
+BlkidScanner* BlkidScanner::getInstance() {
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+	pthread_mutex_lock(&mutex);
+
+	static BlkidScanner instance;
+
+	pthread_mutex_unlock(&mutex);
+
+	return &instance;
+}
+
+/**
+ * \brief Reads the type, secondary type, label and uuid of a device at once
+ *
+ * If the device can't be read or no filesystem is found in it, the type is
+ * "nofs".
+ *
+ * \param dev
+ * 		The path of the device
+ * \param info
+ * 		The tags found
+ */
+void BlkidScanner::probe(const std::string &dev, blkidInfo &info) {
+	Logger *log = Logger::getInstance();
+	log->debug("BlkidScanner::probe(dev=>%s) start", dev.c_str());
+
+	info = blkidInfo();
+
+	blkid_probe pr = blkid_new_probe_from_filename(dev.c_str());
+	if(!pr) {
+		info.type = "nofs";
+		log->debug("BlkidScanner::probe(type=>%s) end", info.type.c_str());
+		return;
+	}
+
+	blkid_probe_enable_superblocks(pr, 1);
+	blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE
+			| BLKID_SUBLKS_SECTYPE | BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID);
+
+	if(blkid_do_safeprobe(pr) != 0) {
+		info.type = "nofs";
+	} else {
+		const char *value;
+
+		if(!blkid_probe_lookup_value(pr, "TYPE", &value, 0)) {
+			info.type = value;
+		}
+		if(!blkid_probe_lookup_value(pr, "SEC_TYPE", &value, 0)) {
+			info.sec_type = value;
+		}
+		if(!blkid_probe_lookup_value(pr, "LABEL", &value, 0)) {
+			info.label = value;
+		}
+		if(!blkid_probe_lookup_value(pr, "UUID", &value, 0)) {
+			info.uuid = value;
+		}
+	}
+
+	blkid_free_probe(pr);
+
+	log->debug("BlkidScanner::probe(type=>%s) end", info.type.c_str());
+}
+
+/**
+ * \brief Probes several devices in parallel
+ *
+ * \param devs
+ * 		The paths of the devices
+ * \param infos
+ * 		The tags found in each device, in the same order
+ */
+void BlkidScanner::probeAll(const std::vector<std::string> &devs,
+		std::vector<blkidInfo> &infos) {
+	Logger *log = Logger::getInstance();
+	log->debug("BlkidScanner::probeAll(devs=>%d) start", devs.size());
+
+	infos.assign(devs.size(), blkidInfo());
+
+	probeJob job;
+	job.devs = &devs;
+	job.infos = &infos;
+	job.next = 0;
+	pthread_mutex_init(&job.mutex, 0);
+
+	// This thread probes too, so one less is needed
+	size_t numThreads = devs.size() < BLKID_PROBE_THREADS ?
+			devs.size() : BLKID_PROBE_THREADS;
+	std::vector<pthread_t> threads;
+	for(size_t i = 1; i < numThreads; i++) {
+		pthread_t thread;
+		if(pthread_create(&thread, 0, BlkidScanner::probeThread, &job) == 0) {
+			threads.push_back(thread);
+		}
+	}
+
+	BlkidScanner::probeNext(&job);
+
+	for(size_t i = 0; i < threads.size(); i++) {
+		pthread_join(threads[i], 0);
+	}
+
+	pthread_mutex_destroy(&job.mutex);
+
+	log->debug("BlkidScanner::probeAll() end");
+}
+
+/**
+ * \brief Main function of the probing threads
+ *
+ * \param data
+ * 		The probeJob shared by the threads
+ */
+void *BlkidScanner::probeThread(void *data) {
+	Util::blockSignals();
+
+	BlkidScanner::probeNext(static_cast<probeJob *>(data));
+
+	return 0;
+}
+
+/**
+ * \brief Probes the devices of a job until none is left
+ *
+ * \param job
+ * 		The probeJob shared by the threads
+ */
+void BlkidScanner::probeNext(probeJob *job) {
+	for(;;) {
+		pthread_mutex_lock(&job->mutex);
+		size_t i = job->next++;
+		pthread_mutex_unlock(&job->mutex);
+
+		if(i >= job->devs->size()) {
+			break;
+		}
+
+		BlkidScanner::probe((*job->devs)[i], (*job->infos)[i]);
+	}
+}
+
+/**
+ * \brief Determines whether the given UUID is assigned to more than one device
+ *
+ * \param uuid
+ * 		The UUID to check
+ *
+ * \return true if there are more than one device with the UUID, or if the
+ * devices can't be listed. false otherwise
+ */
+bool BlkidScanner::isUUIDRepeated(const std::string &uuid) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("BlkidScanner::isUUIDRepeated(uuid=>%s) start", uuid.c_str());
+
+	pthread_mutex_lock(&this->_mutex);
+
+	if(!this->_indexed && !this->buildIndex()) {
+		pthread_mutex_unlock(&this->_mutex);
+
+		// Returning true to enforce mounting/unmounting of the device, just in case.
+		log->debug("BlkidScanner::isUUIDRepeated(retVal=>%d) end", true);
+		return true;
+	}
+
+	bool retVal = this->_uuids.count(uuid) > 1;
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	log->debug("BlkidScanner::isUUIDRepeated(retVal=>%d) end", retVal);
+	return retVal;
+}
+
+/**
+ * \brief Forgets the uuids of the devices
+ *
+ * Must be called when a job starts, and after making or changing a
+ * filesystem.
+ */
+void BlkidScanner::clearIndex() {
+	Logger *log = Logger::getInstance();
+	log->debug("BlkidScanner::clearIndex() start");
+
+	pthread_mutex_lock(&this->_mutex);
+
+	this->_uuids.clear();
+	this->_indexed = false;
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	log->debug("BlkidScanner::clearIndex() end");
+}
+
+/**
+ * \brief Probes all the block devices of the host and indexes their uuids
+ *
+ * The devices are listed in /proc/partitions, like blkid_probe_all() does.
+ *
+ * \return false if the devices can't be listed
+ */
+bool BlkidScanner::buildIndex() {
+	Logger *log = Logger::getInstance();
+	log->debug("BlkidScanner::buildIndex() start");
+
+	std::ifstream partitions("/proc/partitions");
+	if(!partitions.is_open()) {
+		log->debug("BlkidScanner::buildIndex(retVal=>%d) end", false);
+		return false;
+	}
+
+	std::vector<std::string> devs;
+	std::string line;
+	while(std::getline(partitions, line)) {
+		std::istringstream fields(line);
+		unsigned long major, minor, blocks;
+		std::string name;
+
+		// The header and the blank line don't match
+		if(fields >> major >> minor >> blocks >> name) {
+			devs.push_back("/dev/" + name);
+		}
+	}
+
+	std::vector<blkidInfo> infos;
+	this->probeAll(devs, infos);
+
+	for(size_t i = 0; i < devs.size(); i++) {
+		if(!infos[i].uuid.empty()) {
+			this->_uuids.insert(std::make_pair(infos[i].uuid, devs[i]));
+		}
+	}
+
+	this->_indexed = true;
+
+	log->debug("BlkidScanner::buildIndex(retVal=>%d) end", true);
+	return true;
+}
+
+}
@@ -0,0 +1,225 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/BlockMap.h>
+
+#include <doclone/Logger.h>
+#include <doclone/exception/InvalidImageException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Initializes an empty map
+ */
+BlockMap::BlockMap(): _blockSize(0), _blockCount(0), _usedBlocks(0),
+		_extents() {
+}
+
+/**
+ * \brief Initializes a map without used blocks
+ *
+ * \param blockSize
+ * 		Size of a block in bytes
+ * \param blockCount
+ * 		Size of the filesystem in blocks
+ */
+BlockMap::BlockMap(uint32_t blockSize, uint64_t blockCount)
+		: _blockSize(blockSize), _blockCount(blockCount), _usedBlocks(0),
+		  _extents() {
+}
+
+uint32_t BlockMap::getBlockSize() const {
+	return this->_blockSize;
+}
+
+uint64_t BlockMap::getBlockCount() const {
+	return this->_blockCount;
+}
+
+uint64_t BlockMap::getUsedBlocks() const {
+	return this->_usedBlocks;
+}
+
+/**
+ * \brief Returns the amount of data stored in the image
+ */
+uint64_t BlockMap::getUsedBytes() const {
+	return this->_usedBlocks * this->_blockSize;
+}
+
+/**
+ * \brief Returns the size the partition must have to hold the filesystem
+ */
+uint64_t BlockMap::getDeviceSize() const {
+	return this->_blockCount * this->_blockSize;
+}
+
+const std::vector<blockExtent> &BlockMap::getExtents() const {
+	return this->_extents;
+}
+
+/**
+ * \brief Adds a run of used blocks
+ *
+ * The runs must be added in disk order. A run that starts where the last one
+ * ends is merged with it.
+ *
+ * \param start
+ * 		First block of the run
+ * \param count
+ * 		Number of blocks in the run
+ */
+void BlockMap::addExtent(uint64_t start, uint64_t count) throw(Exception) {
+	if(count == 0) {
+		return;
+	}
+
+	uint64_t end = 0;
+	if(!this->_extents.empty()) {
+		end = this->_extents.back().start + this->_extents.back().count;
+	}
+
+	if(start < end || count > this->_blockCount
+			|| start > this->_blockCount - count) {
+		InvalidImageException ex;
+		throw ex;
+	}
+
+	if(!this->_extents.empty() && start == end) {
+		this->_extents.back().count += count;
+	} else {
+		blockExtent extent = { start, count };
+		this->_extents.push_back(extent);
+	}
+
+	this->_usedBlocks += count;
+}
+
+/**
+ * \brief Writes the map in the format stored in the image header
+ *
+ * \param buf
+ * 		The encoded map is appended here
+ */
+void BlockMap::encode(std::string &buf) const {
+	Logger *log = Logger::getInstance();
+	log->debug("BlockMap::encode(extents=>%d) start", this->_extents.size());
+
+	BlockMap::putNumber(buf, this->_blockSize);
+	BlockMap::putNumber(buf, this->_blockCount);
+	BlockMap::putNumber(buf, this->_extents.size());
+
+	uint64_t end = 0;
+	std::vector<blockExtent>::const_iterator it;
+	for(it = this->_extents.begin(); it != this->_extents.end(); ++it) {
+		BlockMap::putNumber(buf, it->start - end);
+		BlockMap::putNumber(buf, it->count);
+		end = it->start + it->count;
+	}
+
+	log->debug("BlockMap::encode(size=>%d) end", buf.size());
+}
+
+/**
+ * \brief Reads a map written by encode()
+ *
+ * \param buf
+ * 		The encoded map
+ * \param size
+ * 		Size of the encoded map
+ */
+void BlockMap::decode(const uint8_t *buf, size_t size) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("BlockMap::decode(buf=>0x%x, size=>%d) start", buf, size);
+
+	const uint8_t *bufEnd = buf + size;
+
+	uint64_t blockSize = BlockMap::getNumber(buf, bufEnd);
+	if(blockSize == 0 || blockSize > 0xffffffffULL) {
+		InvalidImageException ex;
+		throw ex;
+	}
+
+	this->_blockSize = blockSize;
+	this->_blockCount = BlockMap::getNumber(buf, bufEnd);
+	this->_usedBlocks = 0;
+	this->_extents.clear();
+
+	uint64_t numExtents = BlockMap::getNumber(buf, bufEnd);
+	if(numExtents > this->_blockCount) {
+		InvalidImageException ex;
+		throw ex;
+	}
+
+	uint64_t end = 0;
+	for(uint64_t i = 0; i < numExtents; i++) {
+		uint64_t gap = BlockMap::getNumber(buf, bufEnd);
+		uint64_t count = BlockMap::getNumber(buf, bufEnd);
+
+		if(gap > this->_blockCount - end) {
+			InvalidImageException ex;
+			throw ex;
+		}
+
+		this->addExtent(end + gap, count);
+		end += gap + count;
+	}
+
+	log->debug("BlockMap::decode(extents=>%d) end", this->_extents.size());
+}
+
+/**
+ * \brief Appends a number to the buffer, 7 bits per byte
+ *
+ * The high bit of each byte says if more bytes follow.
+ */
+void BlockMap::putNumber(std::string &buf, uint64_t value) {
+	while(value >= 0x80) {
+		buf.push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+
+	buf.push_back(static_cast<char>(value));
+}
+
+/**
+ * \brief Reads a number written by putNumber() and advances the buffer
+ *
+ * \param buf
+ * 		Position of the number in the buffer
+ * \param end
+ * 		End of the buffer, which the number can't cross
+ */
+uint64_t BlockMap::getNumber(const uint8_t *&buf, const uint8_t *end)
+		throw(Exception) {
+	uint64_t value = 0;
+
+	for(unsigned int shift = 0; shift < 64 && buf < end; shift += 7) {
+		uint8_t byte = *buf++;
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+		if((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+
+	InvalidImageException ex;
+	throw ex;
+}
+
+}
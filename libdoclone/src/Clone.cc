@@ -31,6 +31,7 @@
 #include <doclone/Util.h>
 #include <doclone/Unicast.h>
 #include <doclone/Link.h>
+#include <doclone/Multicast.h>
 #include <doclone/exception/Exception.h>
 #include <doclone/exception/ErrorException.h>
 
@@ -40,7 +41,10 @@ namespace Doclone {
  * \brief Initializes gettext, signal handlers and some attributes of this class
  */
 Clone::Clone(): _image(), _device(), _address(), _interface(), _nodesNumber(0),
-		_empty(false), _force(), _operations() {
+		_empty(false), _force(), _threads(0), _codec(CODEC_GZIP),
+		_compressionLevel(0), _bufferSize(0), _bufferCount(0), _lagWindow(0),
+		_lagPolicy(LAG_SPOOL), _multicastRate(0), _blockImaging(false),
+		_operations() {
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 
@@ -257,6 +261,69 @@ void Clone::chainLink() throw(Exception) {
 	log->debug("doclone::chainLink() end");
 }
 
+/**
+ * \ingroup CPPAPI
+ * \brief Sends an image or a device to the network by IP multicast.
+ *
+ * The number of receivers and either image or device path must be set
+ * before calling this function.
+ */
+void Clone::multicastSend() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("doclone::multicastSend() start");
+
+	// The network is handled by Multicast, the data goes through a pipe
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->initLocalRead();
+	trns->initLocalWrite();
+
+	try {
+		Multicast multicast;
+		multicast.send();
+	} catch(const ErrorException &ex) {
+		// Alert to view
+		this->notifyObservers(Doclone::EVT_CANCEL_EXECUTION, "");
+
+		throw;
+	}
+
+	// Notify to view
+	this->notifyObservers(Doclone::EVT_FINISH_EXECUTION, "");
+
+	log->debug("doclone::multicastSend() end");
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Receives an image or a device from the network by IP multicast.
+ *
+ * Either image or device path must be set before calling this function. If
+ * the server's IP is set, other servers are ignored.
+ */
+void Clone::multicastReceive() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("doclone::multicastReceive() start");
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->initLocalRead();
+	trns->initLocalWrite();
+
+	try {
+		Multicast multicast;
+		multicast.receive();
+	} catch(const ErrorException &ex) {
+		// Alert to view
+		this->notifyObservers(Doclone::EVT_CANCEL_EXECUTION, "");
+
+		throw;
+	}
+
+	// Notify to view
+	this->notifyObservers(Doclone::EVT_FINISH_EXECUTION, "");
+
+	log->debug("doclone::multicastReceive() end");
+}
+
 bool Clone::getEmpty() const {
 	return this->_empty;
 }
@@ -359,6 +426,158 @@ void Clone::setForce(bool force) {
 	this->_force = force;
 }
 
+unsigned int Clone::getThreads() const {
+	return this->_threads;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets the number of threads used to read, compress and restore the image
+ *
+ * \param threads
+ * 		Number of threads, 0 = one per online processor
+ */
+void Clone::setThreads(unsigned int threads) {
+	this->_threads = threads;
+}
+
+Doclone::dcCodec Clone::getCodec() const {
+	return this->_codec;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets the compression codec of the images to be created or sent
+ *
+ * Images of any codec can be restored, regardless of this setting.
+ *
+ * \param codec
+ * 		The codec
+ */
+void Clone::setCodec(Doclone::dcCodec codec) {
+	this->_codec = codec;
+}
+
+int Clone::getCompressionLevel() const {
+	return this->_compressionLevel;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets the compression level of the selected codec
+ *
+ * \param level
+ * 		Compression level, 0 = the default of the codec
+ */
+void Clone::setCompressionLevel(int level) {
+	this->_compressionLevel = level;
+}
+
+unsigned int Clone::getBufferSize() const {
+	return this->_bufferSize;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets the size of the buffers used to read and write the data
+ *
+ * It is rounded up to a multiple of the page size.
+ *
+ * \param size
+ * 		Size in bytes, 0 = chosen for each descriptor (1 MiB for sockets,
+ * 		4 MiB for files and devices)
+ */
+void Clone::setBufferSize(unsigned int size) {
+	this->_bufferSize = size;
+}
+
+unsigned int Clone::getBufferCount() const {
+	return this->_bufferCount;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets how many buffers can be read ahead of the writes
+ *
+ * \param count
+ * 		Number of buffers, 0 = the default
+ */
+void Clone::setBufferCount(unsigned int count) {
+	this->_bufferCount = count;
+}
+
+unsigned int Clone::getLagWindow() const {
+	return this->_lagWindow;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets how far a receiver can fall behind the fastest one
+ *
+ * Only used when sending to several receivers. In a chain, it also bounds how
+ * far the local copy of a link falls behind the forwarded stream before being
+ * spooled.
+ *
+ * \param window
+ * 		Size in MiB, 0 = the default (256 MiB)
+ */
+void Clone::setLagWindow(unsigned int window) {
+	this->_lagWindow = window;
+}
+
+Doclone::dcLagPolicy Clone::getLagPolicy() const {
+	return this->_lagPolicy;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets what to do with the receivers out of the lag window
+ *
+ * \param policy
+ * 		LAG_SPOOL (the default) or LAG_DROP
+ */
+void Clone::setLagPolicy(Doclone::dcLagPolicy policy) {
+	this->_lagPolicy = policy;
+}
+
+unsigned int Clone::getMulticastRate() const {
+	return this->_multicastRate;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets the sending rate of the multicast mode
+ *
+ * The datagrams lost because the network or the receivers can't keep up
+ * with it have to be sent again, so it shouldn't be higher than that.
+ *
+ * \param rate
+ * 		Rate in Mbit/s, 0 = the default (500 Mbit/s)
+ */
+void Clone::setMulticastRate(unsigned int rate) {
+	this->_multicastRate = rate;
+}
+
+bool Clone::getBlockImaging() const {
+	return this->_blockImaging;
+}
+
+/**
+ * \ingroup CPPAPI
+ * \brief Sets whether the supported filesystems are imaged block by block
+ *
+ * Only the blocks in use are stored, read in disk order from the device
+ * without mounting it. They are restored to the same offsets, so the
+ * destination partition can't be smaller than the filesystem. The other
+ * filesystems are still imaged file by file.
+ *
+ * \param blocks
+ * 		true = block by block; false = file by file (the default)
+ */
+void Clone::setBlockImaging(bool blocks) {
+	this->_blockImaging = blocks;
+}
+
 /**
  * \brief Adds a pending operation to the vector
  *
@@ -18,16 +18,36 @@
 
 #include <doclone/DataTransfer.h>
 
+#include <config.h>
+
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 
+#include <new>
+
+#include <archive_entry.h>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include <doclone/Clone.h>
 #include <doclone/Logger.h>
+#include <doclone/Util.h>
 #include <doclone/exception/ReadDataException.h>
 #include <doclone/exception/WriteDataException.h>
 #include <doclone/exception/ReceiveDataException.h>
@@ -42,8 +62,28 @@ namespace Doclone {
  */
 DataTransfer::DataTransfer()
 	:  getNbytes(0), putNbytes(0), _totalSize(0), _transferredBytes(0),
-	   _transferNotificationsCount(0) {
-	this->_notificationPointSize = Doclone::BUFFER_SIZE*Doclone::UPDATE_QUOTIENT;
+	   _transferNotificationsCount(0), _buffers(), _buffersSize(0),
+	   _isZero(DataTransfer::isZero) {
+	this->_notificationPointSize = Doclone::UPDATE_SIZE;
+
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		this->_isZero = DataTransfer::isZeroAvx2;
+	} else if(__builtin_cpu_supports("sse2")) {
+		this->_isZero = DataTransfer::isZeroSse2;
+	}
+#endif
+}
+
+/**
+ * \brief Frees the data buffers
+ */
+DataTransfer::~DataTransfer() {
+	std::vector<char *>::iterator it;
+	for(it = this->_buffers.begin(); it != this->_buffers.end(); ++it) {
+		free(*it);
+	}
 }
 
 /**
@@ -79,15 +119,15 @@ uint64_t DataTransfer::archiveToBuf(struct archive *arIn, std::string &target) t
 	Logger *log = Logger::getInstance();
 	log->loopDebug("DataTransfer::archiveToBuf(arIn=>0x%x, buff=>%s) start", arIn, target.c_str());
 
-	char buf[Doclone::BUFFER_SIZE];
-	memset(buf, 0, Doclone::BUFFER_SIZE);
+	dcBuffSize size = this->getBufferSize(-1);
+	char *buf = this->getBuffer(0, size);
 
-	unsigned int nbytes = Doclone::BUFFER_SIZE;
+	ssize_t nbytes = 0;
 	unsigned int totalNbytes = 0;
 	target.clear();
 
-	while ((nbytes = archive_read_data(arIn, buf, Doclone::BUFFER_SIZE)) > 0) {
-		target.append(buf);
+	while ((nbytes = archive_read_data(arIn, buf, size)) > 0) {
+		target.append(buf, nbytes);
 
 		this->_transferredBytes += nbytes;
 		totalNbytes += nbytes;
@@ -99,8 +139,6 @@ uint64_t DataTransfer::archiveToBuf(struct archive *arIn, std::string &target) t
 			this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
 					this->_transferredBytes);
 		}
-
-		memset(buf, 0, Doclone::BUFFER_SIZE);
 	}
 
 	// If the transfer stopped due to an error
@@ -174,11 +212,12 @@ uint64_t DataTransfer::fdToArchive(int fd, std::vector<struct archive*> &outArch
 	log->loopDebug("DataTransfer::transferFile(fd=>%d, outArchives=>0x%x) start", fd, &outArchives);
 
 	int r;
-	char buf[Doclone::BUFFER_SIZE];
-	unsigned int nbytes = 0;
+	dcBuffSize size = this->getBufferSize(fd);
+	char *buf = this->getBuffer(0, size);
+	ssize_t nbytes = 0;
 	unsigned int totalNbytes = 0;
 
-	while ((nbytes = (*this->getNbytes) (fd, buf, Doclone::BUFFER_SIZE)) > 0) {
+	while ((nbytes = (*this->getNbytes) (fd, buf, size)) > 0) {
 		std::vector<struct archive*>::iterator it;
 		for(it = outArchives.begin(); it != outArchives.end(); ++it) {
 			r = archive_write_data(*it, buf, nbytes);
@@ -204,6 +243,544 @@ uint64_t DataTransfer::fdToArchive(int fd, std::vector<struct archive*> &outArch
 	return totalNbytes;
 }
 
+/**
+ * \brief Transfers the data regions of a sparse file to the out archives
+ *
+ * Only the regions in the sparse map of the entry are read. The holes are
+ * passed to libarchive without reading them, the pax writer doesn't store
+ * them and any content will do.
+ *
+ * \param fd
+ * 		Descriptor of the file
+ * \param entry
+ * 		Entry of the file, with its sparse map
+ * \param outArchives
+ * 		Vector of archives to write in
+ *
+ * \return Number of bytes of data read
+ */
+uint64_t DataTransfer::sparseToArchive(int fd, struct archive_entry *entry,
+		std::vector<struct archive*> &outArchives) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::sparseToArchive(fd=>%d, outArchives=>0x%x) start", fd, &outArchives);
+
+	dcBuffSize size = this->getBufferSize(fd);
+	char *buf = this->getBuffer(0, size);
+	int64_t fileSize = archive_entry_size(entry);
+	int64_t pos = 0;
+	uint64_t totalNbytes = 0;
+
+	archive_entry_sparse_reset(entry);
+
+	while(pos < fileSize) {
+		la_int64_t offset = fileSize;
+		la_int64_t length = 0;
+
+		if(archive_entry_sparse_next(entry, &offset, &length) != ARCHIVE_OK) {
+			offset = fileSize;
+			length = 0;
+		}
+
+		la_int64_t dataEnd = offset + length;
+		if(offset < pos) {
+			offset = pos;
+		}
+
+		while(pos < dataEnd || pos < offset) {
+			bool hole = pos < offset;
+			int64_t left = hole ? offset - pos : dataEnd - pos;
+			size_t len = left < size ? left : size;
+
+			// The file may have shrunk, libarchive pads the entry
+			if(!hole && !Util::readBinData(fd, buf, pos, len)) {
+				log->loopDebug("DataTransfer::sparseToArchive(totalNbytes=>%d) end", totalNbytes);
+				return totalNbytes;
+			}
+
+			std::vector<struct archive*>::iterator it;
+			for(it = outArchives.begin(); it != outArchives.end(); ++it) {
+				if(archive_write_data(*it, buf, len) < ARCHIVE_OK) {
+					WriteDataException ex;
+					throw ex;
+				}
+			}
+
+			pos += len;
+
+			if(!hole) {
+				totalNbytes += len;
+				this->addTransferredBytes(len);
+			}
+		}
+	}
+
+	log->loopDebug("DataTransfer::sparseToArchive(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
+
+/**
+ * \brief Fills the sparse map of an entry, if libarchive hasn't done it
+ *
+ * Only the files with fewer blocks than bytes can have holes. Their data
+ * regions are found with SEEK_DATA and SEEK_HOLE. The offset of the file is
+ * left at the beginning.
+ *
+ * \param fd
+ * 		Descriptor of the file
+ * \param st
+ * 		Status of the file
+ * \param entry
+ * 		Entry of the file
+ *
+ * \return Whether the file has holes
+ */
+bool DataTransfer::readSparseMap(int fd, const struct stat &st,
+		struct archive_entry *entry) {
+	if(archive_entry_sparse_count(entry) > 0) {
+		return true;
+	}
+
+	if(st.st_size == 0 || st.st_blocks * 512 >= st.st_size) {
+		return false;
+	}
+
+	off_t pos = 0;
+	bool failed = false;
+
+	while(pos < st.st_size) {
+		off_t data = lseek(fd, pos, SEEK_DATA);
+
+		// ENXIO means that there is only a hole until the end
+		if(data < 0) {
+			failed = errno != ENXIO;
+			break;
+		}
+
+		off_t hole = lseek(fd, data, SEEK_HOLE);
+		if(hole < 0) {
+			failed = true;
+			break;
+		}
+
+		if(hole > st.st_size) {
+			hole = st.st_size;
+		}
+
+		archive_entry_sparse_add_entry(entry, data, hole - data);
+		pos = hole;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+
+	if(failed) {
+		archive_entry_sparse_clear(entry);
+		return false;
+	}
+
+	// A file that is a single hole still needs a map
+	if(archive_entry_sparse_count(entry) == 0) {
+		archive_entry_sparse_add_entry(entry, st.st_size, 0);
+	}
+
+	return true;
+}
+
+/**
+ * \brief Reads the used blocks of a device and writes them in many archives
+ *
+ * The extents are read in disk order with large reads, so a partition is
+ * read in a single sweep of the disk.
+ *
+ * \param fd
+ * 		Descriptor of the device
+ * \param map
+ * 		The blocks to be read
+ * \param outArchives
+ * 		Vector of archives where data will be written
+ *
+ * \return Number of bytes read
+ */
+uint64_t DataTransfer::blocksToArchive(int fd, const BlockMap &map,
+		std::vector<struct archive*> &outArchives) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("DataTransfer::blocksToArchive(fd=>%d, outArchives=>0x%x) start", fd, &outArchives);
+
+	dcBuffSize size = this->getBufferSize(fd);
+	char *buf = this->getBuffer(0, size);
+	uint64_t totalNbytes = 0;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	const std::vector<blockExtent> &extents = map.getExtents();
+	std::vector<blockExtent>::const_iterator ext;
+	for(ext = extents.begin(); ext != extents.end(); ++ext) {
+		off_t offset = ext->start * map.getBlockSize();
+		uint64_t left = ext->count * map.getBlockSize();
+
+		while(left > 0) {
+			size_t len = left < static_cast<uint64_t>(size) ? left : size;
+			ssize_t nbytes = pread(fd, buf, len, offset);
+
+			if(nbytes < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if(nbytes <= 0) {
+				ReadDataException ex;
+				throw ex;
+			}
+
+			std::vector<struct archive*>::iterator it;
+			for(it = outArchives.begin(); it != outArchives.end(); ++it) {
+				if(archive_write_data(*it, buf, nbytes) < ARCHIVE_OK) {
+					WriteDataException ex;
+					throw ex;
+				}
+			}
+
+			offset += nbytes;
+			left -= nbytes;
+			totalNbytes += nbytes;
+
+			this->addTransferredBytes(nbytes);
+		}
+	}
+
+	log->debug("DataTransfer::blocksToArchive(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
+
+/**
+ * \brief Reads a device sequentially and stores its data in the out archive or
+ * vector of archives, except the blocks full of zeros
+ *
+ * Every run of non-zero blocks found in a buffer goes in its own entry, named
+ * after its offset in the device, so nothing has to be known about the data
+ * before reading it.
+ *
+ * \param fd
+ * 		Descriptor of the device
+ * \param size
+ * 		Number of bytes to read
+ * \param prefix
+ * 		Path of the entries, the offset in hexadecimal is appended to it
+ * \param outArchives
+ * 		Vector of archives to write in
+ *
+ * \return Number of bytes stored
+ */
+uint64_t DataTransfer::rawToArchive(int fd, uint64_t size,
+		const std::string &prefix, std::vector<struct archive*> &outArchives)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("DataTransfer::rawToArchive(fd=>%d, size=>%d, prefix=>%s) start", fd, size, prefix.c_str());
+
+	// Holds whole zero blocks
+	dcBuffSize bufSize = this->getBufferSize(fd);
+	bufSize -= bufSize % Doclone::ZERO_BLOCK_SIZE;
+	if(bufSize == 0) {
+		bufSize = Doclone::ZERO_BLOCK_SIZE;
+	}
+
+	char *buf = this->getBuffer(0, bufSize);
+	uint64_t offset = 0;
+	uint64_t totalNbytes = 0;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	while(offset < size) {
+		size_t len = size - offset < static_cast<uint64_t>(bufSize)
+				? size - offset : bufSize;
+
+		if(!Util::readBinData(fd, buf, offset, len)) {
+			ReadDataException ex;
+			throw ex;
+		}
+
+		size_t pos = 0;
+		while(pos < len) {
+			size_t start = pos;
+
+			while(pos < len) {
+				size_t block = len - pos < Doclone::ZERO_BLOCK_SIZE
+						? len - pos : Doclone::ZERO_BLOCK_SIZE;
+
+				if(this->_isZero(buf + pos, block)) {
+					break;
+				}
+
+				pos += block;
+			}
+
+			if(pos > start) {
+				this->writeRawEntry(prefix, offset + start, buf + start,
+						pos - start, outArchives);
+				totalNbytes += pos - start;
+			}
+
+			// The zero block that ended the run
+			pos += len - pos < Doclone::ZERO_BLOCK_SIZE
+					? len - pos : Doclone::ZERO_BLOCK_SIZE;
+		}
+
+		offset += len;
+		this->addTransferredBytes(len);
+	}
+
+	log->debug("DataTransfer::rawToArchive(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
+
+/**
+ * \brief Makes a range of a device read as zeros
+ *
+ * A hole is punched if the device supports it, which usually doesn't write
+ * anything. Otherwise the device is asked to zero the range, or the zeros are
+ * written. The range is counted as transferred data.
+ *
+ * \param fd
+ * 		Descriptor of the device
+ * \param offset
+ * 		Beginning of the range
+ * \param len
+ * 		Length of the range
+ */
+void DataTransfer::zeroRange(int fd, uint64_t offset, uint64_t len)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::zeroRange(fd=>%d, offset=>%d, len=>%d) start", fd, offset, len);
+
+	if(len == 0) {
+		log->loopDebug("DataTransfer::zeroRange() end");
+		return;
+	}
+
+	if(fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset, len)
+			== 0) {
+		this->addTransferredBytes(len);
+		log->loopDebug("DataTransfer::zeroRange() end");
+		return;
+	}
+
+	uint64_t range[2] = {offset, len};
+	if(ioctl(fd, BLKZEROOUT, range) == 0) {
+		this->addTransferredBytes(len);
+		log->loopDebug("DataTransfer::zeroRange() end");
+		return;
+	}
+
+	dcBuffSize size = this->getBufferSize(fd);
+	char *buf = this->getBuffer(0, size);
+	memset(buf, 0, size);
+
+	while(len > 0) {
+		size_t chunk = len < static_cast<uint64_t>(size) ? len : size;
+		ssize_t nbytes = pwrite(fd, buf, chunk, offset);
+
+		if(nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(nbytes <= 0) {
+			WriteDataException ex;
+			throw ex;
+		}
+
+		offset += nbytes;
+		len -= nbytes;
+
+		this->addTransferredBytes(nbytes);
+	}
+
+	log->loopDebug("DataTransfer::zeroRange() end");
+}
+
+/**
+ * \brief Stores a run of raw data as an entry of the out archives
+ *
+ * \param prefix
+ * 		Path of the entry, without the offset
+ * \param offset
+ * 		Position of the data in the device
+ * \param buf
+ * 		The data
+ * \param len
+ * 		Length of the data
+ * \param outArchives
+ * 		Vector of archives to write in
+ */
+void DataTransfer::writeRawEntry(const std::string &prefix, uint64_t offset,
+		const char *buf, size_t len,
+		std::vector<struct archive*> &outArchives) throw(Exception) {
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx",
+			static_cast<unsigned long long>(offset));
+
+	struct archive_entry *entry = archive_entry_new();
+	archive_entry_set_pathname(entry, (prefix + name).c_str());
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_size(entry, len);
+	archive_entry_set_perm(entry, S_IRUSR|S_IWUSR);
+
+	try {
+		this->copyHeader(entry, outArchives);
+
+		std::vector<struct archive*>::iterator it;
+		for(it = outArchives.begin(); it != outArchives.end(); ++it) {
+			if(archive_write_data(*it, buf, len) < ARCHIVE_OK) {
+				WriteDataException ex;
+				throw ex;
+			}
+		}
+	} catch (const Exception &ex) {
+		archive_entry_free(entry);
+		throw;
+	}
+
+	archive_entry_free(entry);
+}
+
+/**
+ * \brief Tells if a buffer is full of zeros, looking at 32 bytes at a time
+ */
+bool DataTransfer::isZero(const char *buf, size_t len) {
+	size_t i = 0;
+
+	for(; i + 32 <= len; i += 32) {
+		uint64_t words[4];
+		memcpy(words, buf + i, sizeof(words));
+
+		if(words[0] | words[1] | words[2] | words[3]) {
+			return false;
+		}
+	}
+
+	for(; i < len; i++) {
+		if(buf[i] != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * \brief Tells if a buffer is full of zeros, looking at 64 bytes at a time
+ */
+__attribute__((target("sse2")))
+bool DataTransfer::isZeroSse2(const char *buf, size_t len) {
+	size_t i = 0;
+
+	for(; i + 64 <= len; i += 64) {
+		const __m128i *p = reinterpret_cast<const __m128i *>(buf + i);
+		__m128i v = _mm_or_si128(
+				_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+				_mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))
+				!= 0xffff) {
+			return false;
+		}
+	}
+
+	return DataTransfer::isZero(buf + i, len - i);
+}
+
+/**
+ * \brief Tells if a buffer is full of zeros, looking at 128 bytes at a time
+ */
+__attribute__((target("avx2")))
+bool DataTransfer::isZeroAvx2(const char *buf, size_t len) {
+	size_t i = 0;
+
+	for(; i + 128 <= len; i += 128) {
+		const __m256i *p = reinterpret_cast<const __m256i *>(buf + i);
+		__m256i v = _mm256_or_si256(
+				_mm256_or_si256(_mm256_loadu_si256(p),
+						_mm256_loadu_si256(p + 1)),
+				_mm256_or_si256(_mm256_loadu_si256(p + 2),
+						_mm256_loadu_si256(p + 3)));
+
+		if(!_mm256_testz_si256(v, v)) {
+			return false;
+		}
+	}
+
+	return DataTransfer::isZero(buf + i, len - i);
+}
+#endif
+
+/**
+ * \brief Writes the data of the current archive entry to the used blocks of a
+ * device
+ *
+ * \param arIn
+ * 		Archive positioned on the entry written by blocksToArchive()
+ * \param fd
+ * 		Descriptor of the device
+ * \param map
+ * 		The blocks to be written
+ *
+ * \return Number of bytes written
+ */
+uint64_t DataTransfer::archiveToBlocks(struct archive *arIn, int fd,
+		const BlockMap &map) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("DataTransfer::archiveToBlocks(arIn=>0x%x, fd=>%d) start", arIn, fd);
+
+	dcBuffSize size = this->getBufferSize(fd);
+	char *buf = this->getBuffer(0, size);
+	uint64_t totalNbytes = 0;
+
+	const std::vector<blockExtent> &extents = map.getExtents();
+	std::vector<blockExtent>::const_iterator ext;
+	for(ext = extents.begin(); ext != extents.end(); ++ext) {
+		off_t offset = ext->start * map.getBlockSize();
+		uint64_t left = ext->count * map.getBlockSize();
+
+		while(left > 0) {
+			size_t len = left < static_cast<uint64_t>(size) ? left : size;
+			ssize_t nbytes = archive_read_data(arIn, buf, len);
+
+			if(nbytes == ARCHIVE_RETRY) {
+				continue;
+			}
+
+			// The image ends before the map does
+			if(nbytes <= 0) {
+				ReadDataException ex;
+				throw ex;
+			}
+
+			for(ssize_t done = 0; done < nbytes;) {
+				ssize_t written = pwrite(fd, buf + done, nbytes - done,
+						offset + done);
+
+				if(written < 0 && errno == EINTR) {
+					continue;
+				}
+
+				if(written <= 0) {
+					WriteDataException ex;
+					throw ex;
+				}
+
+				done += written;
+			}
+
+			offset += nbytes;
+			left -= nbytes;
+			totalNbytes += nbytes;
+
+			this->addTransferredBytes(nbytes);
+		}
+	}
+
+	log->debug("DataTransfer::archiveToBlocks(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
+
 /**
  * \brief Writes the libarchive entry of a file in many archives
  *
@@ -285,6 +862,10 @@ uint64_t DataTransfer::copyData(struct archive *arIn, std::vector<struct archive
 /**
  * \brief Transfers all the data from fdin to all out file descriptors.
  *
+ * A reading thread fills a ring of getBufferCount() buffers while this thread
+ * drains them to the outputs, so reading and writing overlap instead of
+ * taking turns.
+ *
  * \param fdin
  * 		Origin descriptor
  * \param outFds
@@ -296,26 +877,102 @@ uint64_t DataTransfer::copyData(int fdin, std::vector<int> &outFds) throw(Except
 	Logger *log = Logger::getInstance();
 	log->loopDebug("DataTransfer::copyData(fdin=>%d, outFds=>0x%x) start", fdin, &outFds);
 
-	char buf[Doclone::BUFFER_SIZE];
-	unsigned int nbytes = Doclone::BUFFER_SIZE;
-	unsigned int totalNbytes = 0;
+	uint64_t totalNbytes = 0;
+
+	transferPipe pipe;
+	pipe.fdin = fdin;
+	pipe.read = this->getNbytes;
+	pipe.produced = 0;
+	pipe.consumed = 0;
+	pipe.error = PIPE_NO_ERROR;
+	pipe.stop = false;
+	pipe.size = this->getBufferSize(fdin);
+
+	// The buffers are reused by all the transfers of the job
+	for(unsigned int i = 0; i < this->getBufferCount(); i++) {
+		pipe.bufs.push_back(this->getBuffer(i, pipe.size));
+		pipe.lens.push_back(0);
+	}
 
-	while ((nbytes = (*this->getNbytes) (fdin, buf, Doclone::BUFFER_SIZE)) > 0) {
-		std::vector<int>::iterator it;
-		for(it = outFds.begin(); it != outFds.end(); ++it) {
-			(*this->putNbytes) (*it, buf, nbytes);
-		}
+	// An error-checking mutex, see stopPipe()
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+	pthread_mutex_init(&pipe.mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_cond_init(&pipe.filled, 0);
+	pthread_cond_init(&pipe.drained, 0);
 
-		this->_transferredBytes += nbytes;
-		totalNbytes += nbytes;
+	if(pthread_create(&pipe.reader, 0, DataTransfer::readerThread, &pipe) != 0) {
+		pipe.error = PIPE_THREAD_ERROR;
+		this->stopPipe(pipe, false);
 
-		// Notify the views if it crosses a notification point
-		if(this->_transferredBytes >
-			(this->_notificationPointSize * this->_transferNotificationsCount)) {
-			this->_transferNotificationsCount++;
-			this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
-					this->_transferredBytes);
+		InitializationException ex;
+		throw ex;
+	}
+
+	try {
+		for(;;) {
+			pthread_mutex_lock(&pipe.mutex);
+			while(pipe.produced == pipe.consumed
+					&& pipe.error == PIPE_NO_ERROR) {
+				pthread_cond_wait(&pipe.filled, &pipe.mutex);
+			}
+
+			// Data read before an error is still written
+			if(pipe.produced == pipe.consumed) {
+				pthread_mutex_unlock(&pipe.mutex);
+				break;
+			}
+
+			unsigned int slot = pipe.consumed % pipe.bufs.size();
+			ssize_t nbytes = pipe.lens[slot];
+			pthread_mutex_unlock(&pipe.mutex);
+
+			if(nbytes == 0) {
+				break;
+			}
+
+			std::vector<int>::iterator it;
+			for(it = outFds.begin(); it != outFds.end(); ++it) {
+				(*this->putNbytes) (*it, pipe.bufs[slot], nbytes);
+			}
+
+			pthread_mutex_lock(&pipe.mutex);
+			pipe.consumed++;
+			pthread_cond_signal(&pipe.drained);
+			pthread_mutex_unlock(&pipe.mutex);
+
+			this->_transferredBytes += nbytes;
+			totalNbytes += nbytes;
+
+			// Notify the views if it crosses a notification point
+			if(this->_transferredBytes >
+				(this->_notificationPointSize * this->_transferNotificationsCount)) {
+				this->_transferNotificationsCount++;
+				this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
+						this->_transferredBytes);
+			}
 		}
+	} catch(...) {
+		this->stopPipe(pipe, true);
+		throw;
+	}
+
+	int error = pipe.error;
+	this->stopPipe(pipe, false);
+
+	switch(error) {
+	case PIPE_READ_ERROR: {
+		ReadDataException ex;
+		throw ex;
+	}
+	case PIPE_RECV_ERROR: {
+		ReceiveDataException ex;
+		throw ex;
+	}
+	default:
+		break;
 	}
 
 	log->loopDebug("DataTransfer::copyData(totalNbytes=>%d) end", totalNbytes);
@@ -336,15 +993,158 @@ uint64_t DataTransfer::copyData(int fdin, int fdout) throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->loopDebug("DataTransfer::copyData(fdin=>%d, fdout=>%d) start", fdin, fdout);
 
-	char buf[Doclone::BUFFER_SIZE];
-	unsigned int nbytes = Doclone::BUFFER_SIZE;
-	unsigned int totalNbytes = 0;
+	std::vector<int> outFds(1, fdout);
+	uint64_t totalNbytes = this->copyData(fdin, outFds);
 
-	while ((nbytes = (*this->getNbytes) (fdin, buf, Doclone::BUFFER_SIZE)) > 0) {
-		(*this->putNbytes) (fdout, buf, nbytes);
+	log->loopDebug("DataTransfer::copyData(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
 
-		this->_transferredBytes += nbytes;
-		totalNbytes += nbytes;
+/**
+ * \brief Transfers all the data from fdin to all out file descriptors,
+ * without copying it to user space.
+ *
+ * A regular file is sent with sendfile(). Any other input, like a socket, is
+ * moved with splice() through a pipe, and duplicated with tee() when there
+ * are several outputs. If the kernel doesn't support it for these
+ * descriptors, it falls back to copyData().
+ *
+ * \param fdin
+ * 		Origin descriptor
+ * \param outFds
+ * 		Vector of destination descriptors
+ *
+ * \return Number of bytes sent
+ */
+uint64_t DataTransfer::zeroCopyData(int fdin, std::vector<int> &outFds) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::zeroCopyData(fdin=>%d, outFds=>0x%x) start", fdin, &outFds);
+
+	uint64_t totalNbytes = 0;
+	struct stat st;
+
+	if(fstat(fdin, &st) != 0) {
+		DataTransfer::throwReadError(fdin);
+	}
+
+	/*
+	 * splice() refuses files opened in append mode. The image files are
+	 * created empty and written sequentially, so seeking to the end once is
+	 * the same.
+	 */
+	std::vector<int>::iterator it;
+	for(it = outFds.begin(); it != outFds.end(); ++it) {
+		int flags = fcntl(*it, F_GETFL);
+		if(flags != -1 && (flags & O_APPEND)) {
+			lseek(*it, 0, SEEK_END);
+			fcntl(*it, F_SETFL, flags & ~O_APPEND);
+		}
+	}
+
+	bool done;
+	if(S_ISREG(st.st_mode)) {
+		done = this->sendFileData(fdin, outFds, totalNbytes);
+	} else {
+		done = this->spliceData(fdin, outFds, totalNbytes);
+	}
+
+	if(!done) {
+		log->debug("DataTransfer::zeroCopyData() not supported, copying");
+		totalNbytes = this->copyData(fdin, outFds);
+	}
+
+	log->loopDebug("DataTransfer::zeroCopyData(totalNbytes=>%d) end", totalNbytes);
+	return totalNbytes;
+}
+
+/**
+ * \brief Transfers all the data from fdin to fdout, without copying it to
+ * user space.
+ *
+ * \param fdin
+ * 		Origin descriptor
+ * \param fdout
+ * 		Destination descriptor
+ *
+ * \return Number of bytes sent
+ */
+uint64_t DataTransfer::zeroCopyData(int fdin, int fdout) throw(Exception) {
+	std::vector<int> outFds(1, fdout);
+	return this->zeroCopyData(fdin, outFds);
+}
+
+/**
+ * \brief Sends the rest of the regular file [fdin] to all the outputs
+ *
+ * Each chunk is sent to all the outputs before reading the next one, so all
+ * the receivers progress at the same pace.
+ *
+ * \param fdin
+ * 		Origin regular file
+ * \param outFds
+ * 		Vector of destination descriptors
+ * \param [out] totalNbytes
+ * 		Number of bytes sent
+ *
+ * \return false if sendfile() is not supported for these descriptors
+ */
+bool DataTransfer::sendFileData(int fdin, std::vector<int> &outFds,
+		uint64_t &totalNbytes) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::sendFileData(fdin=>%d, outFds=>0x%x) start", fdin, &outFds);
+
+	if(outFds.empty()) {
+		log->loopDebug("DataTransfer::sendFileData(totalNbytes=>%d) end", totalNbytes);
+		return true;
+	}
+
+	off_t offset = lseek(fdin, 0, SEEK_CUR);
+	ssize_t chunk;
+
+	do {
+		chunk = -1;
+
+		std::vector<int>::iterator it;
+		for(it = outFds.begin(); it != outFds.end(); ++it) {
+			off_t pos = offset;
+			// The first output determines the size of this chunk
+			size_t left = chunk < 0 ? Doclone::ZEROCOPY_CHUNK_SIZE : chunk;
+			ssize_t sent = 0;
+
+			while(left > 0) {
+				ssize_t nbytes = sendfile(*it, fdin, &pos, left);
+
+				if(nbytes < 0 && errno == EINTR) {
+					continue;
+				}
+
+				if(nbytes < 0) {
+					if(totalNbytes == 0 && sent == 0 && it == outFds.begin()
+						&& (errno == EINVAL || errno == ENOSYS)) {
+						return false;
+					}
+
+					DataTransfer::throwWriteError(*it);
+				}
+
+				if(nbytes == 0) {
+					break;
+				}
+
+				sent += nbytes;
+				left -= nbytes;
+			}
+
+			if(chunk < 0) {
+				chunk = sent;
+			} else if(sent != chunk) {
+				DataTransfer::throwReadError(fdin);
+			}
+		}
+
+		offset += chunk;
+		this->_transferredBytes += chunk;
+		totalNbytes += chunk;
 
 		// Notify the views if it crosses a notification point
 		if(this->_transferredBytes >
@@ -353,10 +1153,399 @@ uint64_t DataTransfer::copyData(int fdin, int fdout) throw(Exception) {
 			this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
 					this->_transferredBytes);
 		}
+	} while(chunk > 0);
+
+	lseek(fdin, offset, SEEK_SET);
+
+	log->loopDebug("DataTransfer::sendFileData(totalNbytes=>%d) end", totalNbytes);
+	return true;
+}
+
+/**
+ * \brief Moves all the data of [fdin] to all the outputs through pipes
+ *
+ * The data is spliced from [fdin] into a pipe. For each output but the last
+ * one, it is duplicated with tee() into a pipe of its own and spliced from
+ * there. The last output takes it from the first pipe.
+ *
+ * \param fdin
+ * 		Origin descriptor, usually a socket
+ * \param outFds
+ * 		Vector of destination descriptors
+ * \param [out] totalNbytes
+ * 		Number of bytes sent
+ *
+ * \return false if splice() is not supported for these descriptors
+ */
+bool DataTransfer::spliceData(int fdin, std::vector<int> &outFds,
+		uint64_t &totalNbytes) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::spliceData(fdin=>%d, outFds=>0x%x) start", fdin, &outFds);
+
+	if(outFds.empty()) {
+		log->loopDebug("DataTransfer::spliceData(totalNbytes=>%d) end", totalNbytes);
+		return true;
 	}
 
-	log->loopDebug("DataTransfer::copyData(totalNbytes=>%d) end", totalNbytes);
-	return totalNbytes;
+	// pipes[0] is fed from fdin, pipes[i+1] feeds outFds[i]
+	std::vector<int> pipes;
+	size_t chunk = Doclone::ZEROCOPY_CHUNK_SIZE;
+	bool supported = true;
+
+	for(unsigned int i = 0; i < outFds.size(); i++) {
+		int p[2];
+		if(pipe(p) != 0) {
+			supported = false;
+			break;
+		}
+
+		pipes.push_back(p[0]);
+		pipes.push_back(p[1]);
+
+		// All the pipes must hold a whole chunk, or tee() would fall short
+		fcntl(p[1], F_SETPIPE_SZ, Doclone::ZEROCOPY_CHUNK_SIZE);
+		int size = fcntl(p[1], F_GETPIPE_SZ);
+		if(size > 0 && static_cast<size_t>(size) < chunk) {
+			chunk = size;
+		}
+	}
+
+	try {
+		while(supported) {
+			ssize_t nbytes = splice(fdin, 0, pipes[1], 0, chunk,
+					SPLICE_F_MOVE | SPLICE_F_MORE);
+
+			if(nbytes < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if(nbytes < 0) {
+				if(totalNbytes == 0 && (errno == EINVAL || errno == ENOSYS)) {
+					supported = false;
+					break;
+				}
+
+				DataTransfer::throwReadError(fdin);
+			}
+
+			if(nbytes == 0) {
+				break;
+			}
+
+			for(unsigned int i = 0; i < outFds.size(); i++) {
+				bool last = (i == outFds.size() - 1);
+				int src = pipes[0];
+
+				if(!last) {
+					src = pipes[2 * (i + 1)];
+					ssize_t copied = tee(pipes[0], pipes[2 * (i + 1) + 1],
+							nbytes, 0);
+					if(copied != nbytes) {
+						DataTransfer::throwWriteError(outFds[i]);
+					}
+				}
+
+				ssize_t left = nbytes;
+				while(left > 0) {
+					ssize_t moved = splice(src, 0, outFds[i], 0, left,
+							SPLICE_F_MOVE | (last ? 0 : SPLICE_F_MORE));
+
+					if(moved < 0 && errno == EINTR) {
+						continue;
+					}
+
+					if(moved <= 0) {
+						if(totalNbytes == 0 && i == 0 && left == nbytes
+							&& moved < 0 && errno == EINVAL
+							&& outFds.size() == 1) {
+							// Nothing has left the pipe, finish with copyData()
+							supported = false;
+							break;
+						}
+
+						DataTransfer::throwWriteError(outFds[i]);
+					}
+
+					left -= moved;
+				}
+
+				if(!supported) {
+					break;
+				}
+			}
+
+			if(!supported) {
+				/*
+				 * The output refused the first chunk, which is still in the
+				 * pipe: write it in the classic way before falling back.
+				 */
+				std::vector<char> buf(nbytes);
+				ssize_t got = read(pipes[0], &buf[0], nbytes);
+				if(got != nbytes) {
+					DataTransfer::throwReadError(fdin);
+				}
+				(*this->putNbytes) (outFds[0], &buf[0], nbytes);
+				this->_transferredBytes += nbytes;
+				totalNbytes += nbytes + this->copyData(fdin, outFds);
+				supported = true;
+				break;
+			}
+
+			this->_transferredBytes += nbytes;
+			totalNbytes += nbytes;
+
+			// Notify the views if it crosses a notification point
+			if(this->_transferredBytes >
+				(this->_notificationPointSize * this->_transferNotificationsCount)) {
+				this->_transferNotificationsCount++;
+				this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
+						this->_transferredBytes);
+			}
+		}
+	} catch(...) {
+		std::vector<int>::iterator it;
+		for(it = pipes.begin(); it != pipes.end(); ++it) {
+			close(*it);
+		}
+
+		throw;
+	}
+
+	std::vector<int>::iterator it;
+	for(it = pipes.begin(); it != pipes.end(); ++it) {
+		close(*it);
+	}
+
+	log->loopDebug("DataTransfer::spliceData(totalNbytes=>%d) end", totalNbytes);
+	return supported;
+}
+
+/**
+ * \brief Throws the exception for a failed read on [fd]
+ *
+ * \param fd
+ * 		The descriptor that failed
+ */
+void DataTransfer::throwReadError(int fd) throw(Exception) {
+	struct stat st;
+
+	if(fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		ReceiveDataException ex;
+		throw ex;
+	}
+
+	ReadDataException ex;
+	throw ex;
+}
+
+/**
+ * \brief Throws the exception for a failed write on [fd]
+ *
+ * \param fd
+ * 		The descriptor that failed
+ */
+void DataTransfer::throwWriteError(int fd) throw(Exception) {
+	struct stat st;
+
+	if(fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		struct sockaddr_in addr;
+		socklen_t addr_size = sizeof(struct sockaddr_in);
+		getsockname(fd, (struct sockaddr *)&addr, &addr_size);
+		SendDataException ex(inet_ntoa(addr.sin_addr));
+		throw ex;
+	}
+
+	WriteDataException ex;
+	throw ex;
+}
+
+/**
+ * \brief Main loop of the thread that fills the ring of a transferPipe
+ *
+ * Stops after reading the end of data, on error or when the pipe is stopped.
+ *
+ * \param data
+ * 		Pointer to the transferPipe
+ */
+void *DataTransfer::readerThread(void *data) {
+	transferPipe *pipe = static_cast<transferPipe *>(data);
+
+	Util::blockSignals();
+
+	pthread_mutex_lock(&pipe->mutex);
+	for(;;) {
+		while(pipe->produced - pipe->consumed == pipe->bufs.size()
+				&& !pipe->stop) {
+			pthread_cond_wait(&pipe->drained, &pipe->mutex);
+		}
+
+		if(pipe->stop) {
+			break;
+		}
+
+		unsigned int slot = pipe->produced % pipe->bufs.size();
+		pthread_mutex_unlock(&pipe->mutex);
+
+		ssize_t nbytes = 0;
+		int error = PIPE_NO_ERROR;
+		try {
+			nbytes = (*pipe->read) (pipe->fdin, pipe->bufs[slot], pipe->size);
+		} catch(const ReceiveDataException &ex) {
+			error = PIPE_RECV_ERROR;
+		} catch(...) {
+			error = PIPE_READ_ERROR;
+		}
+
+		pthread_mutex_lock(&pipe->mutex);
+		if(error != PIPE_NO_ERROR) {
+			pipe->error = error;
+			pthread_cond_signal(&pipe->filled);
+			break;
+		}
+
+		pipe->lens[slot] = nbytes;
+		pipe->produced++;
+		pthread_cond_signal(&pipe->filled);
+
+		if(nbytes <= 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pipe->mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Stops the reading thread of [pipe] and frees its resources
+ *
+ * This may run while unwinding an exception thrown by the signal handler
+ * inside pthread_cond_wait(), with the mutex already owned by this thread.
+ * That's why the mutex checks for errors.
+ *
+ * \param pipe
+ * 		The pipe to be stopped
+ * \param abort
+ * 		Whether the reader may be blocked on a descriptor that will never
+ * 		deliver more data. In that case the reading side is shut down.
+ */
+void DataTransfer::stopPipe(transferPipe &pipe, bool abort) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("DataTransfer::stopPipe(abort=>%d) start", abort);
+
+	if(pipe.error != PIPE_THREAD_ERROR) {
+		pthread_mutex_lock(&pipe.mutex);
+		pipe.stop = true;
+		pthread_cond_broadcast(&pipe.drained);
+		pthread_mutex_unlock(&pipe.mutex);
+
+		if(abort) {
+			shutdown(pipe.fdin, SHUT_RD);
+		}
+
+		pthread_join(pipe.reader, 0);
+	}
+
+	pthread_cond_destroy(&pipe.drained);
+	pthread_cond_destroy(&pipe.filled);
+	pthread_mutex_destroy(&pipe.mutex);
+
+	log->loopDebug("DataTransfer::stopPipe() end");
+}
+
+/**
+ * \brief Returns the size of the data buffers for reading from [fd]
+ *
+ * The size set by the user is used if any. If not, it is chosen from the type
+ * of the descriptor: large buffers for files and devices, a bit smaller for
+ * sockets. The result is always a multiple of the page size.
+ *
+ * \param fd
+ * 		The descriptor to be read
+ *
+ * \return Size of the buffers
+ */
+dcBuffSize DataTransfer::getBufferSize(int fd) const {
+	Clone *dcl = Clone::getInstance();
+	dcBuffSize size = dcl->getBufferSize();
+
+	if(size == 0) {
+		struct stat st;
+
+		size = Doclone::DEFAULT_BUFFER_SIZE;
+
+		if(fstat(fd, &st) == 0) {
+			if(S_ISSOCK(st.st_mode)) {
+				size = Doclone::SOCKET_BUFFER_SIZE;
+			} else if(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+				size = Doclone::FILE_BUFFER_SIZE;
+			}
+		}
+	}
+
+	long pageSize = sysconf(_SC_PAGESIZE);
+	if(pageSize <= 0) {
+		pageSize = 4096;
+	}
+
+	return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+/**
+ * \brief Returns the number of buffers of the ring used by copyData()
+ *
+ * \return The number set by the user, or BUFFER_COUNT by default
+ */
+unsigned int DataTransfer::getBufferCount() const {
+	Clone *dcl = Clone::getInstance();
+	unsigned int count = dcl->getBufferCount();
+
+	if(count == 0) {
+		count = Doclone::BUFFER_COUNT;
+	}
+
+	// The reader can't overlap with the writer with less than two buffers
+	return count < 2 ? 2 : count;
+}
+
+/**
+ * \brief Returns the data buffer number [index], of at least [size] bytes
+ *
+ * The buffers are page aligned and are not freed after each transfer, so a
+ * job allocates them only once. They are only reallocated when a larger size
+ * is requested.
+ *
+ * \param index
+ * 		Number of the buffer
+ * \param size
+ * 		Minimum size of the buffer
+ *
+ * \return Pointer to the buffer
+ */
+char *DataTransfer::getBuffer(unsigned int index, dcBuffSize size) {
+	if(size > this->_buffersSize) {
+		std::vector<char *>::iterator it;
+		for(it = this->_buffers.begin(); it != this->_buffers.end(); ++it) {
+			free(*it);
+		}
+
+		this->_buffers.clear();
+		this->_buffersSize = size;
+	}
+
+	while(this->_buffers.size() <= index) {
+		void *buf = 0;
+		long pageSize = sysconf(_SC_PAGESIZE);
+
+		if(posix_memalign(&buf, pageSize > 0 ? pageSize : 4096,
+				this->_buffersSize) != 0) {
+			throw std::bad_alloc();
+		}
+
+		this->_buffers.push_back(static_cast<char *>(buf));
+	}
+
+	return this->_buffers[index];
 }
 
 /**
@@ -552,4 +1741,23 @@ void DataTransfer::setTotalSize(uint64_t size) {
 	this->notifyObservers(Doclone::TRANS_TOTAL_SIZE, this->_totalSize);
 }
 
+/**
+ * \brief Accounts data transferred outside of this class
+ *
+ * Notifies the views if it crosses a notification point.
+ *
+ * \param nbytes
+ * 		Number of bytes transferred
+ */
+void DataTransfer::addTransferredBytes(uint64_t nbytes) {
+	this->_transferredBytes += nbytes;
+
+	if(this->_transferredBytes >
+		(this->_notificationPointSize * this->_transferNotificationsCount)) {
+		this->_transferNotificationsCount++;
+		this->notifyObservers(Doclone::TRANS_TRANSFERRED_BYTES,
+				this->_transferredBytes);
+	}
+}
+
 }
@@ -18,12 +18,15 @@
 
 #include <doclone/Disk.h>
 
+#include <unistd.h>
+
 #include <sstream>
 #include <fstream>
 #include <vector>
 
 #include <parted/parted.h>
 
+#include <doclone/BlkidScanner.h>
 #include <doclone/Clone.h>
 #include <doclone/Logger.h>
 #include <doclone/Partition.h>
@@ -146,6 +149,43 @@ void Disk::writeBootCode() const throw(Exception) {
 	log->debug("Disk::writeBootCode() end");
 }
 
+/**
+ * \brief Creates a Partition for each entry of the partition table given
+ *
+ * The filesystems of all the partitions are probed in parallel first. The
+ * partitions that can't be read are skipped.
+ *
+ * \param pedParts
+ * 		The libparted partitions, from the table kept open by the caller
+ */
+void Disk::initPartitions(const std::vector<PedPartition *> &pedParts)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Disk::initPartitions(pedParts=>%d) start", pedParts.size());
+
+	std::vector<std::string> paths;
+	for (unsigned int i = 0; i< pedParts.size(); i++) {
+		paths.push_back(Util::buildPartPath(pedParts[i]->disk->dev->path,
+				pedParts[i]->num));
+	}
+
+	std::vector<blkidInfo> infos;
+	BlkidScanner::getInstance()->probeAll(paths, infos);
+
+	for (unsigned int i = 0; i< pedParts.size(); i++) {
+		try {
+			Partition *part = new Partition();
+			part->initFromPedPartition(pedParts[i], infos[i]);
+			this->_partitions.push_back(part);
+		}
+		catch(const WarningException &ex) {
+			continue;
+		}
+	}
+
+	log->debug("Disk::initPartitions() end");
+}
+
 /**
  * \brief Reads all the partitions of the disk
  *
@@ -165,21 +205,20 @@ void Disk::readPartitions() throw(Exception) {
 	pedDev->open();
 	PedDisk *pDisk = pedDev->getDisk();
 
+	std::vector<PedPartition *> pedParts;
 	while ((pedPart = ped_disk_next_partition (pDisk, pedPart))) {
 		if (ped_partition_is_active (pedPart)) {
-			try {
-				std::string path=
-						Util::buildPartPath(pedPart->disk->dev->path, pedPart->num);
-				Partition *part = new Partition();
-				part->initFromPath(path);
-				this->_partitions.push_back(part);
-			}
-			catch(const WarningException &ex) {
-				continue;
-			}
+			pedParts.push_back(pedPart);
 		}
 	}
 
+	try {
+		this->initPartitions(pedParts);
+	} catch(...) {
+		pedDev->close();
+		throw;
+	}
+
 	pedDev->close();
 
 	log->debug("Disk::readPartitions() end");
@@ -324,7 +363,10 @@ PedConstraint *Disk::calcConstraint(const PedPartition* pPart,
 }
 
 /**
- * \brief Creates a new partition in the disk
+ * \brief Adds a new partition to the partition table in memory
+ *
+ * The table is written to the disk by writePartitions(), with all the
+ * partitions at once.
  *
  * \param part
  * 		The partition that will be created
@@ -373,10 +415,7 @@ void Disk::writePartitionToDisk(Partition *part) const throw(Exception) {
 
 		if (constraint) {
 
-			if (ped_disk_add_partition(pDisk, pedPart, constraint)) {
-				pedDev->commit();
-			}
-			else {
+			if (!ped_disk_add_partition(pDisk, pedPart, constraint)) {
 				AlignPartitionException ex;
 				ex.logMsg();
 
@@ -387,9 +426,7 @@ void Disk::writePartitionToDisk(Partition *part) const throw(Exception) {
 				 */
 				constraint = ped_constraint_any(pDisk->dev);
 
-				if (ped_disk_add_partition(pDisk, pedPart, constraint)) {
-					pedDev->commit();
-				} else {
+				if (!ped_disk_add_partition(pDisk, pedPart, constraint)) {
 					// I give up
 					CreatePartitionException exc;
 					throw exc;
@@ -414,37 +451,110 @@ void Disk::writePartitionToDisk(Partition *part) const throw(Exception) {
 	log->debug("Disk::writePartitionToDisk() end");
 }
 
+/**
+ * \brief Waits for the kernel to create the nodes of the new partitions
+ *
+ * The nodes are made by udev after the partition table is committed.
+ */
+void Disk::waitForPartitions() const throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Disk::waitForPartitions() start");
+
+	for (unsigned int i = 0; i< this->_partitions.size(); i++) {
+		Partition *part = this->_partitions[i];
+
+		if(part->getUsedPart() == 0
+				|| part->getType() == Doclone::PARTITION_EXTENDED) {
+			continue;
+		}
+
+		const std::string &path = part->getPath();
+
+		// Wait up to 30 seconds for every node
+		int tries = 0;
+		while(access(path.c_str(), F_OK) != 0) {
+			if(tries == PARTITION_NODE_TRIES) {
+				NoAccessToDeviceException ex(path);
+				throw ex;
+			}
+
+			usleep(PARTITION_NODE_WAIT);
+			tries++;
+		}
+	}
+
+	log->debug("Disk::waitForPartitions() end");
+}
+
 /**
  * \brief Creates in the disk all partitions in the vector
+ *
+ * The label and the partitions are built in memory and committed together,
+ * so the kernel and udev reread the table once. Then the old signatures of
+ * all the partitions are erased and flushed at once.
  */
 void Disk::writePartitions() const throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Disk::writePartitions() start");
 
-	this->makeLabel();
+	// The table in memory lives while the device is open
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->open();
+
+	try {
+		this->makeLabel();
+
+		for (unsigned int i = 0; i< this->_partitions.size(); i++) {
+			Partition *part = this->_partitions[i];
+
+			if(part->getUsedPart() == 0) {
+				continue;
+			}
+
+			this->writePartitionToDisk(part);
+
+			if(part->getType() != Doclone::PARTITION_EXTENDED) {
+				part->setFlags();
+			}
+		}
+
+		pedDev->commit();
+	} catch(...) {
+		pedDev->close();
+		throw;
+	}
 
 	Clone *dcl = Clone::getInstance();
 	dcl->markCompleted(Doclone::OP_MAKE_DISKLABEL, this->_path);
 
-	for (unsigned int i = 0; i< this->_partitions.size(); i++) {
-		Partition *part = this->_partitions[i];
+	try {
+		this->waitForPartitions();
 
-		if(part->getUsedPart() == 0) {
-			continue;
-		}
+		for (unsigned int i = 0; i< this->_partitions.size(); i++) {
+			Partition *part = this->_partitions[i];
+
+			if(part->getUsedPart() == 0) {
+				continue;
+			}
 
-		this->writePartitionToDisk(part);
+			if(part->getType() != Doclone::PARTITION_EXTENDED) {
+				//Remove old superblocks and signatures if any
+				part->eraseSignatures();
+			}
 
-		if(part->getType() != Doclone::PARTITION_EXTENDED) {
-			//Remove old superblocks and signatures if any
-			part->clearSignatures();
+			std::stringstream target;
+			target << this->_path << ", #" << (i+1);
+			dcl->markCompleted(Doclone::OP_CREATE_PARTITION, target.str());
 		}
 
-		std::stringstream target;
-		target << this->_path << ", #" << (i+1);
-		dcl->markCompleted(Doclone::OP_CREATE_PARTITION, target.str());
+		ped_device_sync(pedDev->getDevice());
+	} catch(...) {
+		pedDev->close();
+		throw;
 	}
 
+	pedDev->close();
+
 	log->debug("Disk::writePartitions() end");
 }
 
@@ -36,7 +36,9 @@ void DiskLabel::setLabelType(Doclone::diskLabelType labelType) {
 }
 
 /**
- * \brief Writes a new disk label in the current disk
+ * \brief Makes a new disk label in the table in memory of the current disk
+ *
+ * It is committed by Disk::writePartitions(), along with the partitions.
  */
 void DiskLabel::makeLabel() const throw(Exception) {
 	Logger *log = Logger::getInstance();
@@ -63,7 +65,6 @@ void DiskLabel::makeLabel() const throw(Exception) {
 		}
 
 		pedDev->setDisk(pDisk);
-		pedDev->commit();
 	}
 
 	pedDev->close();
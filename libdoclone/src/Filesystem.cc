@@ -24,8 +24,6 @@
 
 #include <string>
 
-#include <blkid/blkid.h>
-
 #include <doclone/Logger.h>
 #include <doclone/DataTransfer.h>
 #include <doclone/Util.h>
@@ -43,7 +41,7 @@ Filesystem::Filesystem()
 	: _mountType(), _type(), _code(), _label(), _uuid(), _docloneName(),
 	  _mountName(), _mountOptions(), _command(), _formatOptions(),
 	  _adminCommand(), _mountSupport(), _formatSupport(), _uuidSupport(),
-	  _labelSupport(){
+	  _labelSupport(), _blockSupport(){
 }
 
 // Getters and setters
@@ -96,71 +94,8 @@ bool Filesystem::getUUIDSupport() const {
 bool Filesystem::getLabelSupport() const {
 	return this->_labelSupport;
 }
-
-/**
- * \brief Reads a filesystem label by using libblkid
- *
- * \param dev
- * 		The path of the device where filesystem is
- */
-void Filesystem::readLabel(const std::string &dev) throw(Exception) {
-	Logger *log = Logger::getInstance();
-	log->debug("Filesystem::readLabel(dev=>%s) start", dev.c_str());
-
-	const char *type, *value;
-	blkid_cache cache = 0;
-
-	blkid_get_cache(&cache, "/dev/null"); //Do not use blkid cache
-	blkid_dev blDev = blkid_get_dev(cache, dev.c_str(), BLKID_DEV_NORMAL);
-	if(!blDev) {
-		blkid_put_cache(cache);
-		log->debug("Filesystem::readLabel(label=>) end");
-		return;
-	}
-	blkid_tag_iterate iter = blkid_tag_iterate_begin(blDev);
-
-	while (blkid_tag_next(iter, &type, &value) == 0) {
-		if (!strcmp(type, "LABEL")) {
-			this->_label = value;
-		}
-	}
-	blkid_tag_iterate_end(iter);
-	blkid_put_cache(cache);
-
-	log->debug("Filesystem::readLabel() end");
-}
-
-/**
- * \brief Reads a filesystem uuid by using libblkid
- *
- * \param dev
- * 		The path of the device where filesystem is
- */
-void Filesystem::readUUID(const std::string &dev) throw(Exception) {
-	Logger *log = Logger::getInstance();
-	log->debug("Filesystem::readUUID(dev=>%s) start", dev.c_str());
-
-	const char *type, *value;
-	blkid_cache cache = 0;
-
-	blkid_get_cache(&cache, "/dev/null"); //Do not use blkid cache
-	blkid_dev blDev = blkid_get_dev(cache, dev.c_str(), BLKID_DEV_NORMAL);
-	if(!blDev) {
-		blkid_put_cache(cache);
-		log->debug("Filesystem::readUUID(uuid=>) end");
-		return;
-	}
-	blkid_tag_iterate iter = blkid_tag_iterate_begin(blDev);
-
-	while (blkid_tag_next(iter, &type, &value) == 0) {
-		if (!strcmp(type, "UUID")) {
-			this->_uuid = value;
-		}
-	}
-	blkid_tag_iterate_end(iter);
-	blkid_put_cache(cache);
-
-	log->debug("Filesystem::readUUID() end");
+bool Filesystem::getBlockSupport() const {
+	return this->_blockSupport;
 }
 
 }
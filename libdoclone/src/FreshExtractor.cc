@@ -0,0 +1,790 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/FreshExtractor.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <pthread.h>
+
+#include <doclone/DataTransfer.h>
+#include <doclone/Logger.h>
+#include <doclone/exception/ReadDataException.h>
+#include <doclone/exception/WriteDataException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Opens the root of the filesystem
+ *
+ * \param root
+ * 		Path of the root of the filesystem
+ * \param flags
+ * 		Options of the disk archive for the entries written by libarchive
+ */
+FreshExtractor::FreshExtractor(const std::string &root, int flags)
+		throw(Exception)
+		: _root(root), _rootFd(-1), _fallback(), _dirs(), _lru(), _deferred(),
+		  _mutex() {
+	Logger *log = Logger::getInstance();
+	log->debug("FreshExtractor::FreshExtractor(root=>%s, flags=>%d) start",
+			root.c_str(), flags);
+
+	if(this->_root.empty() || this->_root[this->_root.length()-1] != '/') {
+		this->_root.push_back('/');
+	}
+
+	this->_rootFd = open(this->_root.c_str(),
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(this->_rootFd < 0) {
+		WriteDataException ex;
+		throw ex;
+	}
+
+	// The root is never evicted from the cache
+	cachedDir *dir = new cachedDir();
+	dir->fd = this->_rootFd;
+	dir->refs = 1;
+	this->_lru.push_front("");
+	dir->lru = this->_lru.begin();
+	this->_dirs[""] = dir;
+
+	this->_fallback = archive_write_disk_new();
+	archive_write_disk_set_options(this->_fallback, flags);
+
+	pthread_mutex_init(&this->_mutex, 0);
+
+	log->debug("FreshExtractor::FreshExtractor() end");
+}
+
+/**
+ * \brief Closes the directories and the disk archive
+ */
+FreshExtractor::~FreshExtractor() {
+	if(this->_fallback != 0) {
+		archive_write_free(this->_fallback);
+	}
+
+	std::map<std::string, cachedDir *>::iterator it;
+	for(it = this->_dirs.begin(); it != this->_dirs.end(); ++it) {
+		close(it->second->fd);
+		delete it->second;
+	}
+
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+/**
+ * \brief Writes an entry and reads its data from an archive
+ *
+ * \param archiveIn
+ * 		Archive the entry has been read from
+ * \param entry
+ * 		The entry, with its absolute path
+ */
+void FreshExtractor::writeEntry(struct archive *archiveIn,
+		struct archive_entry *entry) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("FreshExtractor::writeEntry(entry=>%s) start",
+			archive_entry_pathname(entry));
+
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	std::string relPath;
+	std::string relLink;
+	if(!this->isNative(entry, relPath, relLink)) {
+		std::vector<struct archive*> archives(1, this->_fallback);
+
+		pthread_mutex_lock(&this->_mutex);
+		try {
+			trns->copyHeader(entry, archives);
+			trns->copyData(archiveIn, archives);
+		} catch(...) {
+			pthread_mutex_unlock(&this->_mutex);
+			throw;
+		}
+		pthread_mutex_unlock(&this->_mutex);
+
+		log->loopDebug("FreshExtractor::writeEntry() end");
+		return;
+	}
+
+	int fd = this->createEntry(entry, relPath, relLink);
+	if(fd < 0) {
+		log->loopDebug("FreshExtractor::writeEntry() end");
+		return;
+	}
+
+	int r;
+	const void *buff;
+	size_t size;
+	int64_t offset;
+	int64_t end = 0;
+	while((r = archive_read_data_block(archiveIn, &buff, &size, &offset))
+			!= ARCHIVE_EOF) {
+		if(r < ARCHIVE_OK) {
+			close(fd);
+
+			ReadDataException ex;
+			throw ex;
+		}
+
+		try {
+			FreshExtractor::writeBlock(fd, static_cast<const char *>(buff),
+					size, offset);
+		} catch(...) {
+			close(fd);
+			throw;
+		}
+
+		end = offset + size;
+		trns->addTransferredBytes(size);
+	}
+
+	this->finishFile(entry, fd, end);
+
+	log->loopDebug("FreshExtractor::writeEntry() end");
+}
+
+/**
+ * \brief Writes an entry whose data is already in memory
+ *
+ * \param entry
+ * 		The entry, with its absolute path
+ * \param data
+ * 		The blocks of data of the file, one after the other
+ * \param blocks
+ * 		Offset in the file and size of each block of data
+ */
+void FreshExtractor::writeEntry(struct archive_entry *entry,
+		const std::string &data,
+		const std::vector<std::pair<int64_t, size_t> > &blocks)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("FreshExtractor::writeEntry(entry=>%s) start",
+			archive_entry_pathname(entry));
+
+	std::vector<std::pair<int64_t, size_t> >::const_iterator it;
+	size_t pos = 0;
+
+	std::string relPath;
+	std::string relLink;
+	if(!this->isNative(entry, relPath, relLink)) {
+		pthread_mutex_lock(&this->_mutex);
+
+		int r = archive_write_header(this->_fallback, entry);
+		for(it = blocks.begin(); r >= ARCHIVE_OK && it != blocks.end(); ++it) {
+			r = archive_write_data_block(this->_fallback, data.data() + pos,
+					it->second, it->first);
+			pos += it->second;
+		}
+		if(r >= ARCHIVE_OK) {
+			r = archive_write_finish_entry(this->_fallback);
+		}
+
+		pthread_mutex_unlock(&this->_mutex);
+
+		if(r < ARCHIVE_OK) {
+			WriteDataException ex;
+			throw ex;
+		}
+
+		log->loopDebug("FreshExtractor::writeEntry() end");
+		return;
+	}
+
+	int fd = this->createEntry(entry, relPath, relLink);
+	if(fd < 0) {
+		log->loopDebug("FreshExtractor::writeEntry() end");
+		return;
+	}
+
+	int64_t end = 0;
+	for(it = blocks.begin(); it != blocks.end(); ++it) {
+		try {
+			FreshExtractor::writeBlock(fd, data.data() + pos, it->second,
+					it->first);
+		} catch(...) {
+			close(fd);
+			throw;
+		}
+
+		pos += it->second;
+		end = it->first + it->second;
+	}
+
+	this->finishFile(entry, fd, end);
+
+	log->loopDebug("FreshExtractor::writeEntry() end");
+}
+
+/**
+ * \brief Applies the metadata of the directories and flushes the filesystem
+ *
+ * It must be called once all the entries have been written.
+ */
+void FreshExtractor::finish() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("FreshExtractor::finish() start");
+
+	// Its own directories are fixed up when it is closed
+	archive_write_close(this->_fallback);
+	archive_write_free(this->_fallback);
+	this->_fallback = 0;
+
+	bool error = false;
+
+	// The children first, in case a parent is not searchable
+	std::vector<deferredDir>::reverse_iterator it;
+	for(it = this->_deferred.rbegin(); it != this->_deferred.rend(); ++it) {
+		const char *path = it->path.empty() ? "." : it->path.c_str();
+
+		if(fchownat(this->_rootFd, path, it->uid, it->gid,
+				AT_SYMLINK_NOFOLLOW) < 0
+			|| fchmodat(this->_rootFd, path, it->mode, 0) < 0
+			|| utimensat(this->_rootFd, path, it->times,
+				AT_SYMLINK_NOFOLLOW) < 0) {
+			error = true;
+		}
+	}
+	this->_deferred.clear();
+
+	if(syncfs(this->_rootFd) < 0) {
+		error = true;
+	}
+
+	if(error) {
+		WriteDataException ex;
+		throw ex;
+	}
+
+	log->debug("FreshExtractor::finish() end");
+}
+
+/**
+ * \brief Gets the path of a file relative to the root
+ *
+ * \param path
+ * 		Absolute path of the file
+ * \param relPath
+ * 		Path relative to the root, without trailing slashes. Empty for the
+ * 		root itself.
+ *
+ * \return False if the file is not under the root
+ */
+bool FreshExtractor::relativePath(const char *path, std::string &relPath)
+		const {
+	std::string target = path;
+	while(target.length() > 1 && target[target.length()-1] == '/') {
+		target.erase(target.length()-1);
+	}
+
+	if(target.compare(0, this->_root.length()-1, this->_root, 0,
+			this->_root.length()-1) != 0) {
+		return false;
+	}
+
+	if(target.length() == this->_root.length()-1) {
+		relPath.clear();
+		return true;
+	}
+
+	if(target[this->_root.length()-1] != '/') {
+		return false;
+	}
+
+	relPath = target.substr(this->_root.length());
+	return true;
+}
+
+/**
+ * \brief Tells whether an entry is written by this class or by libarchive
+ *
+ * \param entry
+ * 		The entry to write
+ * \param relPath
+ * 		Its path relative to the root
+ * \param relLink
+ * 		The target of the hard link relative to the root, or empty
+ */
+bool FreshExtractor::isNative(struct archive_entry *entry,
+		std::string &relPath, std::string &relLink) const {
+	if(!this->relativePath(archive_entry_pathname(entry), relPath)) {
+		return false;
+	}
+
+	relLink.clear();
+	if(archive_entry_hardlink(entry) != 0
+			&& (!this->relativePath(archive_entry_hardlink(entry), relLink)
+				|| relLink.empty())) {
+		return false;
+	}
+
+	unsigned long set;
+	unsigned long clear;
+	archive_entry_fflags(entry, &set, &clear);
+
+	return archive_entry_acl_count(entry, ARCHIVE_ENTRY_ACL_TYPE_ACCESS
+			| ARCHIVE_ENTRY_ACL_TYPE_DEFAULT) == 0 && set == 0;
+}
+
+/**
+ * \brief Creates a file
+ *
+ * Everything but the regular files gets its metadata here, but the
+ * directories, whose metadata is deferred to finish().
+ *
+ * \param entry
+ * 		The entry to write
+ * \param relPath
+ * 		Its path relative to the root
+ * \param relLink
+ * 		The target of the hard link relative to the root, or empty
+ *
+ * \return The descriptor of a regular file to write its data in, or -1
+ */
+int FreshExtractor::createEntry(struct archive_entry *entry,
+		const std::string &relPath, const std::string &relLink)
+		throw(Exception) {
+	mode_t type = archive_entry_filetype(entry);
+	mode_t mode = archive_entry_perm(entry);
+	uid_t uid = archive_entry_uid(entry);
+	gid_t gid = archive_entry_gid(entry);
+
+	struct timespec times[2];
+	FreshExtractor::getTimes(entry, times);
+
+	deferredDir deferred;
+	deferred.path = relPath;
+	deferred.uid = uid;
+	deferred.gid = gid;
+	deferred.mode = mode;
+	deferred.times[0] = times[0];
+	deferred.times[1] = times[1];
+
+	// The root already exists
+	if(relPath.empty()) {
+		if(type == AE_IFDIR) {
+			this->setXattrs(entry, this->_rootFd, relPath);
+
+			pthread_mutex_lock(&this->_mutex);
+			this->_deferred.push_back(deferred);
+			pthread_mutex_unlock(&this->_mutex);
+		}
+
+		return -1;
+	}
+
+	std::string parentPath;
+	std::string name;
+	FreshExtractor::splitPath(relPath, parentPath, name);
+
+	cachedDir *parent = this->acquireDir(parentPath);
+
+	int fd = -1;
+	int r = 0;
+
+	// The hard links may come without a file type
+	switch(relLink.empty() ? type : AE_IFREG) {
+	case AE_IFDIR: {
+		r = mkdirat(parent->fd, name.c_str(), 0700);
+
+		// Like lost+found, made by the formatting tool
+		if(r < 0 && errno == EEXIST) {
+			r = 0;
+		}
+		break;
+	}
+	case AE_IFREG: {
+		if(relLink.empty()) {
+			int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+
+			fd = openat(parent->fd, name.c_str(), flags, 0600);
+			if(fd < 0 && errno == EEXIST
+					&& unlinkat(parent->fd, name.c_str(), 0) == 0) {
+				fd = openat(parent->fd, name.c_str(), flags, 0600);
+			}
+
+			r = fd < 0 ? -1 : 0;
+			break;
+		}
+
+		std::string linkParent;
+		std::string linkName;
+		FreshExtractor::splitPath(relLink, linkParent, linkName);
+
+		cachedDir *target;
+		try {
+			target = this->acquireDir(linkParent);
+		} catch(...) {
+			this->releaseDir(parent);
+			throw;
+		}
+
+		r = linkat(target->fd, linkName.c_str(), parent->fd, name.c_str(), 0);
+		if(r < 0 && errno == EEXIST
+				&& unlinkat(parent->fd, name.c_str(), 0) == 0) {
+			r = linkat(target->fd, linkName.c_str(), parent->fd,
+					name.c_str(), 0);
+		}
+
+		this->releaseDir(target);
+
+		// The data of the file comes with this name
+		if(r == 0 && archive_entry_size(entry) > 0) {
+			fd = openat(parent->fd, name.c_str(),
+					O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+			r = fd < 0 ? -1 : 0;
+		}
+		break;
+	}
+	case AE_IFLNK: {
+		r = symlinkat(archive_entry_symlink(entry), parent->fd, name.c_str());
+		if(r < 0 && errno == EEXIST
+				&& unlinkat(parent->fd, name.c_str(), 0) == 0) {
+			r = symlinkat(archive_entry_symlink(entry), parent->fd,
+					name.c_str());
+		}
+
+		if(r == 0) {
+			r = fchownat(parent->fd, name.c_str(), uid, gid,
+					AT_SYMLINK_NOFOLLOW);
+		}
+		if(r == 0) {
+			r = utimensat(parent->fd, name.c_str(), times,
+					AT_SYMLINK_NOFOLLOW);
+		}
+		break;
+	}
+	default: {
+		r = mknodat(parent->fd, name.c_str(), type | 0600,
+				archive_entry_rdev(entry));
+		if(r < 0 && errno == EEXIST
+				&& unlinkat(parent->fd, name.c_str(), 0) == 0) {
+			r = mknodat(parent->fd, name.c_str(), type | 0600,
+					archive_entry_rdev(entry));
+		}
+
+		if(r == 0) {
+			r = fchownat(parent->fd, name.c_str(), uid, gid,
+					AT_SYMLINK_NOFOLLOW);
+		}
+		if(r == 0) {
+			r = fchmodat(parent->fd, name.c_str(), mode, 0);
+		}
+		if(r == 0) {
+			r = utimensat(parent->fd, name.c_str(), times,
+					AT_SYMLINK_NOFOLLOW);
+		}
+		break;
+	}
+	}
+
+	this->releaseDir(parent);
+
+	if(r < 0) {
+		if(fd >= 0) {
+			close(fd);
+		}
+
+		WriteDataException ex;
+		throw ex;
+	}
+
+	if(type == AE_IFDIR) {
+		// Its contents come next, so it is worth having it open
+		cachedDir *dir = this->acquireDir(relPath);
+		try {
+			this->setXattrs(entry, dir->fd, relPath);
+		} catch(...) {
+			this->releaseDir(dir);
+			throw;
+		}
+		this->releaseDir(dir);
+
+		pthread_mutex_lock(&this->_mutex);
+		this->_deferred.push_back(deferred);
+		pthread_mutex_unlock(&this->_mutex);
+	} else if(type != AE_IFREG) {
+		this->setXattrs(entry, -1, relPath);
+	}
+
+	// The space of the whole file at once, instead of a piece in each write
+	if(fd >= 0 && archive_entry_sparse_count(entry) == 0
+			&& archive_entry_size(entry)
+				>= static_cast<int64_t>(FRESH_PREALLOC_SIZE)) {
+		// Just a hint, not all the filesystems support it
+		fallocate(fd, 0, 0, archive_entry_size(entry));
+	}
+
+	return fd;
+}
+
+/**
+ * \brief Applies the metadata of a regular file and closes it
+ *
+ * \param entry
+ * 		The entry of the file
+ * \param fd
+ * 		Descriptor of the file, always closed
+ * \param end
+ * 		End of the data written in the file
+ */
+void FreshExtractor::finishFile(struct archive_entry *entry, int fd,
+		int64_t end) throw(Exception) {
+	struct timespec times[2];
+	FreshExtractor::getTimes(entry, times);
+
+	int r = 0;
+
+	// A hole at the end of the file
+	if(end < archive_entry_size(entry)) {
+		r = ftruncate(fd, archive_entry_size(entry));
+	}
+
+	// The owner first, because chown() clears the setuid bits
+	if(r == 0) {
+		r = fchown(fd, archive_entry_uid(entry), archive_entry_gid(entry));
+	}
+	if(r == 0) {
+		r = fchmod(fd, archive_entry_perm(entry));
+	}
+	if(r == 0) {
+		r = futimens(fd, times);
+	}
+
+	// The last, because chown() drops security.capability
+	if(r == 0) {
+		try {
+			this->setXattrs(entry, fd, "");
+		} catch(...) {
+			close(fd);
+			throw;
+		}
+	}
+
+	if(close(fd) < 0) {
+		r = -1;
+	}
+
+	if(r < 0) {
+		WriteDataException ex;
+		throw ex;
+	}
+}
+
+/**
+ * \brief Sets the extended attributes of a file
+ *
+ * \param entry
+ * 		The entry of the file
+ * \param fd
+ * 		Descriptor of the file, or -1 to use its path
+ * \param relPath
+ * 		Path of the file relative to the root, if fd is -1
+ */
+void FreshExtractor::setXattrs(struct archive_entry *entry, int fd,
+		const std::string &relPath) throw(Exception) {
+	if(archive_entry_xattr_reset(entry) == 0) {
+		return;
+	}
+
+	std::string path;
+	if(fd < 0) {
+		path = this->_root + relPath;
+	}
+
+	const char *name;
+	const void *value;
+	size_t size;
+	while(archive_entry_xattr_next(entry, &name, &value, &size)
+			== ARCHIVE_OK) {
+		int r;
+		if(fd >= 0) {
+			r = fsetxattr(fd, name, value, size, 0);
+		} else {
+			r = lsetxattr(path.c_str(), name, value, size, 0);
+		}
+
+		if(r < 0) {
+			WriteDataException ex;
+			throw ex;
+		}
+	}
+}
+
+/**
+ * \brief Gets the descriptor of a directory, creating it if it is missing
+ *
+ * The directory stays open until releaseDir() is called.
+ *
+ * \param path
+ * 		Path of the directory relative to the root
+ */
+FreshExtractor::cachedDir *FreshExtractor::acquireDir(const std::string &path)
+		throw(Exception) {
+	pthread_mutex_lock(&this->_mutex);
+
+	std::map<std::string, cachedDir *>::iterator it = this->_dirs.find(path);
+	if(it != this->_dirs.end()) {
+		cachedDir *dir = it->second;
+		dir->refs++;
+		this->_lru.splice(this->_lru.begin(), this->_lru, dir->lru);
+
+		pthread_mutex_unlock(&this->_mutex);
+		return dir;
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	std::string parentPath;
+	std::string name;
+	FreshExtractor::splitPath(path, parentPath, name);
+
+	cachedDir *parent = this->acquireDir(parentPath);
+
+	int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+	int fd = openat(parent->fd, name.c_str(), flags);
+
+	// Archives without the entries of some directories
+	if(fd < 0 && errno == ENOENT) {
+		mkdirat(parent->fd, name.c_str(), 0755);
+		fd = openat(parent->fd, name.c_str(), flags);
+	}
+
+	this->releaseDir(parent);
+
+	if(fd < 0) {
+		WriteDataException ex;
+		throw ex;
+	}
+
+	pthread_mutex_lock(&this->_mutex);
+
+	cachedDir *dir;
+	it = this->_dirs.find(path);
+	if(it != this->_dirs.end()) {
+		// Another thread has opened it meanwhile
+		close(fd);
+
+		dir = it->second;
+		dir->refs++;
+		this->_lru.splice(this->_lru.begin(), this->_lru, dir->lru);
+	} else {
+		dir = new cachedDir();
+		dir->fd = fd;
+		dir->refs = 1;
+		this->_lru.push_front(path);
+		dir->lru = this->_lru.begin();
+		this->_dirs[path] = dir;
+	}
+
+	// The least recently used directories not in use are closed
+	std::list<std::string>::iterator lt = this->_lru.end();
+	while(this->_dirs.size() > FRESH_CACHED_DIRS && lt != this->_lru.begin()) {
+		--lt;
+
+		std::map<std::string, cachedDir *>::iterator dt =
+				this->_dirs.find(*lt);
+		if(dt->second->refs == 0) {
+			close(dt->second->fd);
+			delete dt->second;
+			this->_dirs.erase(dt);
+
+			lt = this->_lru.erase(lt);
+		}
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	return dir;
+}
+
+/**
+ * \brief Lets a directory got by acquireDir() be closed
+ */
+void FreshExtractor::releaseDir(cachedDir *dir) {
+	pthread_mutex_lock(&this->_mutex);
+	dir->refs--;
+	pthread_mutex_unlock(&this->_mutex);
+}
+
+/**
+ * \brief Splits a relative path in the path of its parent and its name
+ */
+void FreshExtractor::splitPath(const std::string &path, std::string &parent,
+		std::string &name) {
+	size_t pos = path.rfind('/');
+	if(pos == std::string::npos) {
+		parent.clear();
+		name = path;
+	} else {
+		parent = path.substr(0, pos);
+		name = path.substr(pos + 1);
+	}
+}
+
+/**
+ * \brief Gets the access and modification times of an entry
+ *
+ * The times not stored in the entry are left as they are.
+ */
+void FreshExtractor::getTimes(struct archive_entry *entry,
+		struct timespec *times) {
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	if(archive_entry_atime_is_set(entry)) {
+		times[0].tv_sec = archive_entry_atime(entry);
+		times[0].tv_nsec = archive_entry_atime_nsec(entry);
+	}
+
+	times[1].tv_sec = 0;
+	times[1].tv_nsec = UTIME_OMIT;
+	if(archive_entry_mtime_is_set(entry)) {
+		times[1].tv_sec = archive_entry_mtime(entry);
+		times[1].tv_nsec = archive_entry_mtime_nsec(entry);
+	}
+}
+
+/**
+ * \brief Writes a whole block of data at an offset of a file
+ */
+void FreshExtractor::writeBlock(int fd, const char *buff, size_t size,
+		int64_t offset) throw(Exception) {
+	while(size > 0) {
+		ssize_t nbytes = pwrite(fd, buff, size, offset);
+		if(nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(nbytes <= 0) {
+			WriteDataException ex;
+			throw ex;
+		}
+
+		buff += nbytes;
+		size -= nbytes;
+		offset += nbytes;
+	}
+}
+
+}
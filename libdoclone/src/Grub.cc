@@ -69,7 +69,7 @@ void Grub::searchPartition() throw(Exception) {
 		try {
 			Partition *part = partitions[i];
 
-			if(!part->isWritable()) {
+			if(!part->isWritable() || part->getRaw()) {
 				continue;
 			}
 
@@ -0,0 +1,384 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/GzipCompressor.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include <doclone/Logger.h>
+#include <doclone/Util.h>
+#include <doclone/exception/CompressException.h>
+#include <doclone/exception/InitializationException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Starts the pool of workers
+ *
+ * \param threads
+ * 		Number of worker threads
+ * \param level
+ * 		Compression level (1-9)
+ * \param sink
+ * 		Function that receives the compressed data
+ * \param sinkData
+ * 		Opaque pointer passed to the sink
+ */
+GzipCompressor::GzipCompressor(unsigned int threads, int level,
+		gzipSink sink, void *sinkData) throw(Exception)
+		: _level(level), _sink(sink), _sinkData(sinkData), _current(),
+		  _dict(), _pending(), _inFlight(), _maxInFlight(), _workers(),
+		  _mutex(), _jobReady(), _jobDone(), _stop(false),
+		  _headerWritten(false), _finished(false), _crc(), _size(0) {
+	Logger *log = Logger::getInstance();
+	log->debug("GzipCompressor::GzipCompressor(threads=>%d, level=>%d) start", threads, level);
+
+	if(threads == 0) {
+		threads = 1;
+	}
+
+	// Enough blocks to keep all the workers busy while the front is written
+	this->_maxInFlight = threads * 2;
+	this->_crc = crc32(0L, Z_NULL, 0);
+
+	pthread_mutex_init(&this->_mutex, 0);
+	pthread_cond_init(&this->_jobReady, 0);
+	pthread_cond_init(&this->_jobDone, 0);
+
+	for(unsigned int i = 0; i < threads; i++) {
+		pthread_t thread;
+		if(pthread_create(&thread, 0, GzipCompressor::worker, this) != 0) {
+			break;
+		}
+
+		this->_workers.push_back(thread);
+	}
+
+	if(this->_workers.empty()) {
+		pthread_cond_destroy(&this->_jobDone);
+		pthread_cond_destroy(&this->_jobReady);
+		pthread_mutex_destroy(&this->_mutex);
+
+		InitializationException ex;
+		throw ex;
+	}
+
+	log->debug("GzipCompressor::GzipCompressor() end");
+}
+
+/**
+ * \brief Stops the workers and frees the pending blocks
+ */
+GzipCompressor::~GzipCompressor() {
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+	pthread_cond_broadcast(&this->_jobReady);
+	pthread_mutex_unlock(&this->_mutex);
+
+	std::vector<pthread_t>::iterator it;
+	for(it = this->_workers.begin(); it != this->_workers.end(); ++it) {
+		pthread_join(*it, 0);
+	}
+
+	std::deque<gzipJob *>::iterator jt;
+	for(jt = this->_inFlight.begin(); jt != this->_inFlight.end(); ++jt) {
+		delete *jt;
+	}
+
+	delete this->_current;
+
+	pthread_cond_destroy(&this->_jobDone);
+	pthread_cond_destroy(&this->_jobReady);
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+/**
+ * \brief Appends data to the stream
+ *
+ * The data is copied, so the buffer can be reused once this method returns.
+ *
+ * \param buf
+ * 		Uncompressed data
+ * \param len
+ * 		Size of the data
+ */
+void GzipCompressor::write(const void *buf, size_t len) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("GzipCompressor::write(buf=>0x%x, len=>%d) start", buf, len);
+
+	const unsigned char *data = static_cast<const unsigned char *>(buf);
+
+	while(len > 0) {
+		if(this->_current == 0) {
+			this->_current = new gzipJob();
+			this->_current->in.reserve(GZIP_BLOCK_SIZE);
+		}
+
+		size_t room = GZIP_BLOCK_SIZE - this->_current->in.size();
+		size_t chunk = len < room ? len : room;
+
+		this->_current->in.insert(this->_current->in.end(), data, data + chunk);
+		data += chunk;
+		len -= chunk;
+
+		if(this->_current->in.size() == GZIP_BLOCK_SIZE) {
+			this->submit(false);
+		}
+	}
+
+	log->loopDebug("GzipCompressor::write() end");
+}
+
+/**
+ * \brief Compresses the remaining data and writes the gzip trailer
+ */
+void GzipCompressor::finish() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("GzipCompressor::finish() start");
+
+	if(this->_finished) {
+		log->debug("GzipCompressor::finish() end");
+		return;
+	}
+
+	this->_finished = true;
+
+	// The last block closes the deflate stream, even if it is empty
+	if(this->_current == 0) {
+		this->_current = new gzipJob();
+	}
+
+	this->submit(true);
+
+	while(!this->_inFlight.empty()) {
+		this->flushFront();
+	}
+
+	this->writeTrailer();
+
+	log->debug("GzipCompressor::finish() end");
+}
+
+/**
+ * \brief Hands the current block to the workers
+ *
+ * If there are too many blocks in memory, the oldest ones are written out
+ * before returning.
+ *
+ * \param last
+ * 		Whether this block ends the stream
+ */
+void GzipCompressor::submit(bool last) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("GzipCompressor::submit(last=>%d) start", last);
+
+	gzipJob *job = this->_current;
+	this->_current = 0;
+
+	job->last = last;
+	job->done = false;
+	job->failed = false;
+	job->dict = this->_dict;
+
+	// Keep the tail of this block for priming the next one
+	if(job->in.size() >= GZIP_DICT_SIZE) {
+		this->_dict.assign(job->in.end() - GZIP_DICT_SIZE, job->in.end());
+	} else {
+		this->_dict.insert(this->_dict.end(), job->in.begin(), job->in.end());
+		if(this->_dict.size() > GZIP_DICT_SIZE) {
+			this->_dict.erase(this->_dict.begin(),
+					this->_dict.end() - GZIP_DICT_SIZE);
+		}
+	}
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_pending.push_back(job);
+	this->_inFlight.push_back(job);
+	pthread_cond_signal(&this->_jobReady);
+	pthread_mutex_unlock(&this->_mutex);
+
+	while(this->_inFlight.size() > this->_maxInFlight) {
+		this->flushFront();
+	}
+
+	log->loopDebug("GzipCompressor::submit() end");
+}
+
+/**
+ * \brief Waits for the oldest block and sends it to the sink
+ */
+void GzipCompressor::flushFront() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("GzipCompressor::flushFront() start");
+
+	pthread_mutex_lock(&this->_mutex);
+	gzipJob *job = this->_inFlight.front();
+	while(!job->done) {
+		pthread_cond_wait(&this->_jobDone, &this->_mutex);
+	}
+	this->_inFlight.pop_front();
+	pthread_mutex_unlock(&this->_mutex);
+
+	if(job->failed) {
+		delete job;
+		CompressException ex;
+		throw ex;
+	}
+
+	try {
+		if(!this->_headerWritten) {
+			this->writeHeader();
+		}
+
+		(*this->_sink) (this->_sinkData, &job->out[0], job->out.size());
+	} catch(...) {
+		delete job;
+		throw;
+	}
+
+	this->_crc = crc32_combine(this->_crc, job->crc, job->in.size());
+	this->_size += job->in.size();
+
+	delete job;
+
+	log->loopDebug("GzipCompressor::flushFront() end");
+}
+
+/**
+ * \brief Writes the gzip member header
+ */
+void GzipCompressor::writeHeader() throw(Exception) {
+	// ID1, ID2, CM=deflate, FLG=0, MTIME=0, XFL=0, OS=Unix
+	const unsigned char header[10] =
+		{ 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03 };
+
+	(*this->_sink) (this->_sinkData, header, sizeof(header));
+	this->_headerWritten = true;
+}
+
+/**
+ * \brief Writes the gzip member trailer (CRC-32 and size, little endian)
+ */
+void GzipCompressor::writeTrailer() throw(Exception) {
+	unsigned char trailer[8];
+
+	for(int i = 0; i < 4; i++) {
+		trailer[i] = (this->_crc >> (8 * i)) & 0xff;
+		trailer[i + 4] = (this->_size >> (8 * i)) & 0xff;
+	}
+
+	(*this->_sink) (this->_sinkData, trailer, sizeof(trailer));
+}
+
+/**
+ * \brief Main loop of the worker threads
+ *
+ * \param data
+ * 		Pointer to the GzipCompressor object
+ */
+void *GzipCompressor::worker(void *data) {
+	GzipCompressor *gz = static_cast<GzipCompressor *>(data);
+
+	Util::blockSignals();
+
+	pthread_mutex_lock(&gz->_mutex);
+	for(;;) {
+		while(gz->_pending.empty() && !gz->_stop) {
+			pthread_cond_wait(&gz->_jobReady, &gz->_mutex);
+		}
+
+		if(gz->_stop) {
+			break;
+		}
+
+		gzipJob *job = gz->_pending.front();
+		gz->_pending.pop_front();
+		pthread_mutex_unlock(&gz->_mutex);
+
+		GzipCompressor::compress(job, gz->_level);
+
+		pthread_mutex_lock(&gz->_mutex);
+		job->done = true;
+		pthread_cond_broadcast(&gz->_jobDone);
+	}
+	pthread_mutex_unlock(&gz->_mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Deflates a block as a fragment of a raw deflate stream
+ *
+ * \param job
+ * 		The block to be compressed
+ * \param level
+ * 		Compression level
+ */
+void GzipCompressor::compress(gzipJob *job, int level) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+
+	job->crc = crc32(0L, Z_NULL, 0);
+	if(!job->in.empty()) {
+		job->crc = crc32(job->crc, &job->in[0], job->in.size());
+	}
+
+	// Negative window bits: raw deflate, the gzip framing is ours
+	if(deflateInit2(&strm, level, Z_DEFLATED, -15, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		job->failed = true;
+		return;
+	}
+
+	if(!job->dict.empty()) {
+		deflateSetDictionary(&strm, &job->dict[0], job->dict.size());
+	}
+
+	int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+	int ret = Z_OK;
+	size_t produced = 0;
+
+	job->out.resize(deflateBound(&strm, job->in.size()) + 16);
+	strm.next_in = job->in.empty() ? Z_NULL : &job->in[0];
+	strm.avail_in = job->in.size();
+
+	do {
+		if(produced == job->out.size()) {
+			job->out.resize(job->out.size() * 2);
+		}
+
+		strm.next_out = &job->out[produced];
+		strm.avail_out = job->out.size() - produced;
+
+		ret = deflate(&strm, flush);
+		produced = job->out.size() - strm.avail_out;
+	} while(ret == Z_OK && (strm.avail_out == 0 ||
+			(flush == Z_FINISH)));
+
+	if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+		job->failed = true;
+	}
+
+	job->out.resize(produced);
+	deflateEnd(&strm);
+}
+
+}
@@ -18,14 +18,19 @@
 
 #include <doclone/Image.h>
 
+#include <stdlib.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <endian.h>
 #include <time.h>
 #include <dirent.h>
+#include <errno.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -36,12 +41,18 @@
 
 #include <xercesc/dom/DOM.hpp>
 
+#include <doclone/BlkidScanner.h>
 #include <doclone/Clone.h>
 #include <doclone/Logger.h>
 #include <doclone/Operation.h>
 #include <doclone/DataTransfer.h>
 #include <doclone/DlFactory.h>
 #include <doclone/FsFactory.h>
+#include <doclone/FreshExtractor.h>
+#include <doclone/GzipCompressor.h>
+#include <doclone/SenderPool.h>
+#include <doclone/TreeReader.h>
+#include <doclone/TreeWriter.h>
 #include <doclone/xml/XMLDocument.h>
 #include <doclone/exception/Exception.h>
 #include <doclone/exception/ErrorException.h>
@@ -56,8 +67,11 @@
 #include <doclone/exception/NoMountSupportException.h>
 #include <doclone/exception/NoSelinuxSupportException.h>
 #include <doclone/exception/NoFitInDeviceException.h>
+#include <doclone/exception/OpenFileException.h>
+#include <doclone/exception/NoCodecSupportException.h>
 #include <doclone/exception/TooMuchPartitionsException.h>
 #include <doclone/exception/FileNotFoundException.h>
+#include <doclone/exception/FormatException.h>
 #include <doclone/exception/ReadErrorsInDirectoryException.h>
 #include <doclone/exception/WriteErrorsInDirectoryException.h>
 #include <doclone/exception/CancelException.h>
@@ -71,9 +85,15 @@ namespace Doclone {
 /**
  * \brief Initializes attributes
  */
-Image::Image(): _size(), _type(), _disk(), _archiveIn(), _archivesOut() {
+Image::Image(): _size(), _type(), _codec(), _disk(), _archiveIn(),
+		_archivesOut(), _fdsOut(), _compressor(), _senders(),
+		_spareEntries() {
 	Clone *dcl = Clone::getInstance();
 	this->_noData = dcl->getEmpty();
+	this->_codec = dcl->getCodec();
+
+	// Every job indexes the uuids of the devices again
+	BlkidScanner::getInstance()->clearIndex();
 }
 
 /**
@@ -81,6 +101,8 @@ Image::Image(): _size(), _type(), _disk(), _archiveIn(), _archivesOut() {
  */
 Image::~Image() {
 	delete this->_disk;
+	delete this->_compressor;
+	delete this->_senders;
 }
 
 /**
@@ -134,12 +156,15 @@ void Image::initFdReadArchive(const int fdin) throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Image::initFdRead(fdin=>%d) start", fdin);
 
+	DataTransfer *trns = DataTransfer::getInstance();
+
 	this->_archiveIn = archive_read_new();
 	archive_read_support_format_tar(this->_archiveIn);
-	archive_read_support_filter_gzip(this->_archiveIn);
+	// Any codec, the header says which one but it is inside the stream
+	archive_read_support_filter_all(this->_archiveIn);
 
 	if(archive_read_open_fd(this->_archiveIn,
-			fdin, Doclone::BUFFER_SIZE) != ARCHIVE_OK) {
+			fdin, trns->getBufferSize(fdin)) != ARCHIVE_OK) {
 		InitializationException ex;
 		throw ex;
 	}
@@ -156,6 +181,16 @@ void  Image::initDiskWriteArchive() {
 
 	 struct archive *arch = archive_write_disk_new();
 
+	archive_write_disk_set_options(arch, Image::diskWriteFlags());
+	this->_archivesOut.push_back(arch);
+
+	log->debug("Image::initDiskWrite() end");
+}
+
+/**
+ * \brief Options of the disk write archives
+ */
+int Image::diskWriteFlags() {
 	int flags = ARCHIVE_EXTRACT_OWNER;
 	flags |= ARCHIVE_EXTRACT_PERM;
 	flags |= ARCHIVE_EXTRACT_TIME;
@@ -164,10 +199,7 @@ void  Image::initDiskWriteArchive() {
 	flags |= ARCHIVE_EXTRACT_XATTR;
 	flags |= ARCHIVE_EXTRACT_UNLINK;
 
-	archive_write_disk_set_options(arch, flags);
-	this->_archivesOut.push_back(arch);
-
-	log->debug("Image::initDiskWrite() end");
+	return flags;
 }
 
 /**
@@ -180,22 +212,30 @@ void Image::initFdWriteArchive(const int fdout) throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Image::initFdWrite(fdout=>%d) start", fdout);
 
+	this->_fdsOut.assign(1, fdout);
+
 	struct archive *arch = archive_write_new();
-	archive_write_add_filter_gzip(arch);
-	archive_write_set_format_pax(arch);
 
-	if(archive_write_open_fd(arch, fdout) != ARCHIVE_OK) {
-		InitializationException ex;
-		throw ex;
+	// Don't add the image to itself, like archive_write_open_fd() does
+	struct stat st;
+	if(fstat(fdout, &st) == 0 && S_ISREG(st.st_mode)) {
+		archive_write_set_skip_file(arch, st.st_dev, st.st_ino);
 	}
 
-	this->_archivesOut.push_back(arch);
+	this->openWriteArchive(arch);
 
 	log->debug("Image::initFdWrite() end");
 }
 
 /**
- * \brief For each descriptor in [fds], create an archive for writing to it
+ * \brief Create one archive whose output is sent to all the descriptors in [fds]
+ *
+ * The tar stream is compressed only once and each compressed block is handed
+ * to every descriptor, so all of them receive the same bytes that a single
+ * archive opened with archive_write_open_fd() would produce.
+ *
+ * With more than one descriptor, the blocks are handed to a SenderPool, so a
+ * slow receiver doesn't hold back the others.
  *
  * \param fds
  * 		Vector of descriptors
@@ -204,23 +244,229 @@ void Image::initFdWriteArchive(std::vector<int> &fds) throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Image::initFdWrite(fds=>0x%x) start", &fds);
 
-	std::vector<int>::iterator it;
-	for(it = fds.begin(); it != fds.end(); ++it) {
-		struct archive *arch = archive_write_new();
-		archive_write_add_filter_gzip(arch);
-		archive_write_set_format_pax(arch);
+	this->_fdsOut = fds;
 
-		if(archive_write_open_fd(arch, *it) != ARCHIVE_OK) {
-			InitializationException ex;
-			throw ex;
-		}
+	if(fds.size() > 1) {
+		Clone *dcl = Clone::getInstance();
+		uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
 
-		this->_archivesOut.push_back(arch);
+		this->_senders = new SenderPool(fds, window, dcl->getLagPolicy());
 	}
 
+	struct archive *arch = archive_write_new();
+	this->openWriteArchive(arch);
+
 	log->debug("Image::initFdWrite() end");
 }
 
+/**
+ * \brief Sets up the compression of [arch] and opens it over this->_fdsOut
+ *
+ * The codec and level are taken from the Clone settings. With gzip and more
+ * than one thread available, the tar stream is handed to a GzipCompressor,
+ * which compresses it in parallel and produces a gzip stream readable by any
+ * doclone version. The other codecs use the libarchive filters.
+ *
+ * \param arch
+ * 		The new write archive
+ */
+void Image::openWriteArchive(struct archive *arch) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Image::openWriteArchive(arch=>0x%x) start", arch);
+
+	Clone *dcl = Clone::getInstance();
+	unsigned int threads = dcl->getThreads();
+	if(threads == 0) {
+		threads = Util::getNumberOfCpus();
+	}
+
+	int level = dcl->getCompressionLevel();
+
+	archive_write_set_format_pax(arch);
+
+	// Same last block policy archive_write_open_fd() applies to sockets
+	archive_write_set_bytes_in_last_block(arch, 1);
+
+	int r = ARCHIVE_OK;
+	bool parallelGzip = false;
+	switch(dcl->getCodec()) {
+	case Doclone::CODEC_GZIP: {
+		if(threads > 1) {
+			parallelGzip = true;
+		} else {
+			r = archive_write_add_filter_gzip(arch);
+		}
+		break;
+	}
+	case Doclone::CODEC_ZSTD: {
+		r = archive_write_add_filter_zstd(arch);
+		// Only honored by libarchive >= 3.6, ignored otherwise
+		archive_write_set_filter_option(arch, "zstd", "threads",
+				Util::intToString(threads).c_str());
+		break;
+	}
+	case Doclone::CODEC_LZ4: {
+		r = archive_write_add_filter_lz4(arch);
+		break;
+	}
+	case Doclone::CODEC_NONE:
+	default: {
+		r = archive_write_add_filter_none(arch);
+		break;
+	}
+	}
+
+	// ARCHIVE_WARN means libarchive will use an external program
+	if(r < ARCHIVE_WARN) {
+		NoCodecSupportException ex;
+		throw ex;
+	}
+
+	if(level != 0 && !parallelGzip && dcl->getCodec() != Doclone::CODEC_NONE) {
+		archive_write_set_filter_option(arch, 0, "compression-level",
+				Util::intToString(level).c_str());
+	}
+
+	if(parallelGzip) {
+		this->_compressor = new GzipCompressor(threads,
+				level != 0 ? level : GZIP_DEFAULT_LEVEL,
+				Image::sendToFds, this);
+
+		r = archive_write_open(arch, this, 0, Image::writeToCompressor,
+				Image::closeCompressor);
+	} else {
+		r = archive_write_open(arch, this, 0, Image::writeToFds, 0);
+	}
+
+	if(r != ARCHIVE_OK) {
+		InitializationException ex;
+		throw ex;
+	}
+
+	this->_archivesOut.push_back(arch);
+
+	log->debug("Image::openWriteArchive() end");
+}
+
+/**
+ * \brief Sends a block of data to all the descriptors in this->_fdsOut
+ *
+ * \param clientData
+ * 		Pointer to the Image object that owns the descriptors
+ * \param buff
+ * 		Block of data
+ * \param length
+ * 		Size of the block
+ */
+void Image::sendToFds(void *clientData, const void *buff, size_t length) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Image::sendToFds(buff=>0x%x, length=>%d) start", buff, length);
+
+	Image *image = static_cast<Image *>(clientData);
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	if(image->_senders != 0) {
+		image->_senders->write(buff, length);
+
+		log->loopDebug("Image::sendToFds() end");
+		return;
+	}
+
+	std::vector<int>::iterator it;
+	for(it = image->_fdsOut.begin(); it != image->_fdsOut.end(); ++it) {
+		const char *data = static_cast<const char *>(buff);
+		size_t left = length;
+
+		while(left > 0) {
+			ssize_t nbytes = (*trns->putNbytes) (*it, data, left);
+			data += nbytes;
+			left -= nbytes;
+		}
+	}
+
+	log->loopDebug("Image::sendToFds() end");
+}
+
+/**
+ * \brief libarchive write callback that sends a block to all the descriptors
+ *
+ * \param arch
+ * 		The archive being written
+ * \param clientData
+ * 		Pointer to the Image object that owns the descriptors
+ * \param buff
+ * 		Block of compressed data
+ * \param length
+ * 		Size of the block
+ *
+ * \return Number of bytes written, or -1 on error
+ */
+ssize_t Image::writeToFds(struct archive *arch, void *clientData,
+		const void *buff, size_t length) {
+	try {
+		Image::sendToFds(clientData, buff, length);
+	} catch(const Exception &ex) {
+		ex.logMsg();
+		archive_set_error(arch, EIO, "Error writing to the descriptors");
+		return -1;
+	}
+
+	return length;
+}
+
+/**
+ * \brief libarchive write callback that feeds the parallel compressor
+ *
+ * \param arch
+ * 		The archive being written
+ * \param clientData
+ * 		Pointer to the Image object that owns the compressor
+ * \param buff
+ * 		Block of uncompressed tar data
+ * \param length
+ * 		Size of the block
+ *
+ * \return Number of bytes written, or -1 on error
+ */
+ssize_t Image::writeToCompressor(struct archive *arch, void *clientData,
+		const void *buff, size_t length) {
+	Image *image = static_cast<Image *>(clientData);
+
+	try {
+		image->_compressor->write(buff, length);
+	} catch(const Exception &ex) {
+		ex.logMsg();
+		archive_set_error(arch, EIO, "Error compressing the data");
+		return -1;
+	}
+
+	return length;
+}
+
+/**
+ * \brief libarchive close callback that flushes the parallel compressor
+ *
+ * \param arch
+ * 		The archive being closed
+ * \param clientData
+ * 		Pointer to the Image object that owns the compressor
+ *
+ * \return ARCHIVE_OK, or ARCHIVE_FATAL on error
+ */
+int Image::closeCompressor(struct archive *arch, void *clientData) {
+	Image *image = static_cast<Image *>(clientData);
+
+	try {
+		image->_compressor->finish();
+	} catch(const Exception &ex) {
+		ex.logMsg();
+		archive_set_error(arch, EIO, "Error compressing the data");
+		return ARCHIVE_FATAL;
+	}
+
+	return ARCHIVE_OK;
+}
+
 /**
  * \brief Free allocated memory for read archive
  */
@@ -231,6 +477,12 @@ void Image::freeReadArchive() {
 	archive_read_close(this->_archiveIn);
 	archive_read_free(this->_archiveIn);
 
+	std::vector<struct archive_entry *>::iterator it;
+	for(it = this->_spareEntries.begin(); it != this->_spareEntries.end(); ++it) {
+		archive_entry_free(*it);
+	}
+	this->_spareEntries.clear();
+
 	log->debug("Image::freeReadArchive() end");
 }
 
@@ -247,6 +499,23 @@ void Image::freeWriteArchive() {
 		archive_write_free(*it);
 	}
 
+	delete this->_compressor;
+	this->_compressor = 0;
+
+	// Wait until all the receivers have got the whole stream
+	if(this->_senders != 0) {
+		try {
+			this->_senders->finish();
+		} catch(...) {
+			delete this->_senders;
+			this->_senders = 0;
+			throw;
+		}
+
+		delete this->_senders;
+		this->_senders = 0;
+	}
+
 	log->debug("Image::freeReadArchive() end");
 }
 
@@ -326,16 +595,21 @@ void Image::loadImageHeader() throw(Exception) {
 	this->_type = static_cast<Doclone::imageType>(
 			doc.getElementValueU8(rootElement, "imageType"));
 
+	// Images without this element are gzip images (CODEC_GZIP is 0)
+	this->_codec = static_cast<Doclone::dcCodec>(
+			doc.getElementValueU8(rootElement, "codec"));
+
 	diskLabelType dLabel =
 			static_cast<Doclone::diskLabelType>(doc.getElementValueU8(rootElement, "diskType"));
 	this->_disk = DlFactory::createDiskLabel(dLabel);
 	this->_disk->initFromPath(dcl->getDevice());
 
 	if(this->_type == Doclone::IMAGE_DISK) {
+		size_t bootCodeSize;
 		const uint8_t *bootCode =
-				doc.getElementValueBinary(rootElement, "bootCode");
+				doc.getElementValueBinary(rootElement, "bootCode", bootCodeSize);
 		uint8_t buffBootCode[Doclone::MBR_SIZE] = {};
-		for(int i=0; i<Doclone::MBR_SIZE; i++) {
+		for(size_t i=0; i<Doclone::MBR_SIZE && i<bootCodeSize; i++) {
 			buffBootCode[i] = bootCode[i];
 		}
 		this->_disk->setBootCode(reinterpret_cast<const char *>(buffBootCode));
@@ -402,6 +676,24 @@ void Image::loadImageHeader() throw(Exception) {
 		const char *rootDir = doc.getElementValueCString(xmlPartition, "rootDir");
 		part->setRootDir(rootDir?rootDir:"");
 
+		// Used blocks, only if it was imaged block by block
+		size_t blockMapSize;
+		const uint8_t *blockMap =
+				doc.getElementValueBinary(xmlPartition, "blockMap", blockMapSize);
+		if(blockMap != 0) {
+			BlockMap *map = new BlockMap();
+			try {
+				map->decode(blockMap, blockMapSize);
+			} catch (const Exception &ex) {
+				delete map;
+				throw;
+			}
+			part->setBlockMap(map);
+		}
+
+		// Whether it was imaged raw
+		part->setRaw(doc.getElementValueU8(xmlPartition, "raw") != 0);
+
 		this->_disk->getPartitions().push_back(part);
 	}
 
@@ -436,6 +728,7 @@ void Image::saveImageHeader() throw(Exception) {
 	doc.createElement(rootElem, "numPartitions", numPartitions);
 	doc.createElement(rootElem, "imageSize", imageSize);
 	doc.createElement(rootElem, "imageType", static_cast<uint8_t>(this->_type));
+	doc.createElement(rootElem, "codec", static_cast<uint8_t>(this->_codec));
 
 	doc.createBinaryElement(rootElem, "bootCode",
 			reinterpret_cast<const uint8_t*>(this->_disk->getBootCode()), Doclone::MBR_SIZE);
@@ -449,9 +742,7 @@ void Image::saveImageHeader() throw(Exception) {
 
 		//Set the root of this partition inside the image
 		std::string rootDir = "_part";
-		char partNum[2] = {};
-		sprintf(partNum,"%d", part->getPartNum());
-		rootDir.append(partNum);
+		rootDir.append(Util::intToString(part->getPartNum()));
 		part->setRootDir(rootDir);
 
 		char startPos[32];
@@ -472,6 +763,18 @@ void Image::saveImageHeader() throw(Exception) {
 		doc.createElement(partitionXML, "uuid",
 						part->getFileSystem()->getUUID().c_str());
 		doc.createElement(partitionXML, "rootDir",rootDir.c_str());
+
+		if(part->getBlockMap() != 0) {
+			std::string blockMap;
+			part->getBlockMap()->encode(blockMap);
+			doc.createBinaryElement(partitionXML, "blockMap",
+					reinterpret_cast<const uint8_t*>(blockMap.data()),
+					blockMap.size());
+		}
+
+		if(part->getRaw()) {
+			doc.createElement(partitionXML, "raw", static_cast<uint8_t>(1));
+		}
 	}
 
 	std::string xmlSer;
@@ -505,6 +808,10 @@ void Image::saveImageHeader() throw(Exception) {
  * This function is called for first time on the root path of the partition and
  * is recursively called to read all the data in the directory tree.
  *
+ * The entries are visited in inode order and the regular files are read in
+ * batches, sorted by the position of their data in the device, so a
+ * rotational disk doesn't jump back and forth.
+ *
  * \param lResolv
  * 		Libarchive link resolver for handling hard links logic
 * \param path
@@ -522,188 +829,771 @@ void Image::readDataFromDisk(struct archive_entry_linkresolver *lResolv,
 	log->loopDebug("Image::readDataFromDisk(lResolv=>0x%x, path=>%s, imgRootDir=>%s, mPointLength=>%d) start",
 			lResolv, path.c_str(), imgRootDir.c_str(), mPointLength);
 
-	DIR *directory;
-	struct dirent *d_file; // a file in *directory
-	struct archive_entry *entry;
+	int dirfd;
+	struct stat dirstat;
+	std::vector<dirEntry> names;
+	std::vector<std::string> subdirs;
+	std::vector<pendingFile> batch;
+	struct archive_entry *entry = 0;
 	bool errors = false;
 	DataTransfer *trns = DataTransfer::getInstance();
 
-	if ((directory = opendir (path.c_str())) == 0) {
+	if ((dirfd = open (path.c_str(), O_RDONLY | O_DIRECTORY)) < 0
+			|| fstat (dirfd, &dirstat) < 0) {
+		if(dirfd >= 0) {
+			close(dirfd);
+		}
+
 		FileNotFoundException ex(path);
 		throw ex;
 	}
 
-	while ((d_file = readdir (directory)) != 0) {
-		struct stat filestat;
-		std::string abPath;
+	// The paths of the entries only differ in the name after these prefixes
+	std::string abPath = path;
+	std::string relPath = imgRootDir + "/" + path.substr(mPointLength);
+	size_t abLength = abPath.length();
+	size_t relLength = relPath.length();
+
+	try {
+		Util::readDirectory(dirfd, names);
+
+		std::vector<dirEntry>::iterator it;
+		for(it = names.begin(); it != names.end(); ++it) {
+			struct stat filestat;
+
+			abPath.resize(abLength);
+			abPath.append(it->name);
+			relPath.resize(relLength);
+			relPath.append(it->name);
+
+			int fdin = Util::openEntry(dirfd, *it, filestat);
+			if(fdin == -2) {
+				errors = true;
+				continue;
+			}
+
+			// The header is reused until a regular file takes it to the batch
+			if(entry == 0) {
+				entry = this->getSpareEntry();
+			} else {
+				archive_entry_clear(entry);
+			}
+
+			try {
+				archive_entry_update_pathname_utf8(entry, relPath.c_str());
+				archive_entry_copy_sourcepath(entry, abPath.c_str());
+				archive_read_disk_entry_from_file(this->_archiveIn, entry, fdin, &filestat);
+
+				switch (archive_entry_filetype(entry)) {
+				case AE_IFDIR: {
+					trns->copyHeader(entry, this->_archivesOut);
+
+					/*
+					 * If the current folder is a virtual one or is the mount
+					 * point of another partition, bypass it.
+					 */
+					if(!Util::isVirtualDirectory(abPath.c_str())
+						&& filestat.st_dev == dirstat.st_dev) {
+
+						abPath.push_back('/');
+						subdirs.push_back(abPath);
+					}
+					break;
+				}
+				case AE_IFLNK: {
+					char linkPath[4096] = {};
+					ssize_t size = 0;
+
+					// Read link
+					if ((size = readlinkat (dirfd, it->name.c_str(), linkPath, sizeof(linkPath) - 1)) < 0) {
+						FileNotFoundException ex(abPath);
+						throw ex;
+					} else {
+							archive_entry_update_symlink_utf8(entry, linkPath);
+							trns->copyHeader(entry, this->_archivesOut);
+					}
+
+					break;
+				}
+				case AE_IFIFO:
+				case AE_IFSOCK:
+				case AE_IFCHR:
+				case AE_IFBLK: {
+					this->readFileFromDisk(lResolv, entry, fdin, abPath, filestat);
+					break;
+				}
+				case AE_IFREG: {
+					// The file is read later, with the rest of its batch
+					pendingFile file;
+					file.entry = entry;
+					file.fd = fdin;
+					file.path = abPath;
+					file.filestat = filestat;
+					file.physical = 0;
+
+					batch.push_back(file);
+					entry = 0;
+					fdin = -1;
+
+					if(batch.size() == READ_BATCH_FILES) {
+						errors |= this->readFileBatch(lResolv, batch);
+					}
+
+					break;
+				}
+				default:
+					ReadDataException ex;
+					throw ex;
+				}
+			}catch(const WarningException &ex) {
+				errors = true;
+			}
+
+			if(fdin >= 0) {
+				close(fdin);
+			}
+		}
+
+		if(!batch.empty()) {
+			errors |= this->readFileBatch(lResolv, batch);
+		}
+
+		this->putSpareEntry(entry);
+		entry = 0;
+
+		// The subdirectories go after the files, which are already closed
+		std::vector<std::string>::iterator dt;
+		for(dt = subdirs.begin(); dt != subdirs.end(); ++dt) {
+			try {
+				this->readDataFromDisk(lResolv, *dt, imgRootDir, mPointLength);
+			}catch(const WarningException &ex) {
+				errors = true;
+			}
+		}
+	} catch(...) {
+		std::vector<pendingFile>::iterator bt;
+		for(bt = batch.begin(); bt != batch.end(); ++bt) {
+			archive_entry_free(bt->entry);
+			if(bt->fd >= 0) {
+				close(bt->fd);
+			}
+		}
+
+		archive_entry_free(entry);
+		close(dirfd);
+		throw;
+	}
+
+	close(dirfd);
 
-		abPath = path;
-		abPath.append(d_file->d_name);
+	if(errors) {
+		ReadErrorsInDirectoryException ex(path);
+		ex.logMsg();
+	}
+
+	log->loopDebug("Image::readDataToDisk() end");
+}
+
+/**
+ * \brief Reads a batch of regular files in the order of their data on disk
+ *
+ * While a file is read, the kernel is asked to bring the beginning of the
+ * next ones, so the disk always has requests queued in the right order. The
+ * batch is emptied and all its files are closed, even on error.
+ *
+ * \param lResolv
+ * 		Libarchive link resolver for handling hard links logic
+ * \param batch
+ * 		Open files with their headers
+ *
+ * \return Whether some file couldn't be read
+ */
+bool Image::readFileBatch(struct archive_entry_linkresolver *lResolv,
+		std::vector<pendingFile> &batch) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Image::readFileBatch(lResolv=>0x%x, batch=>%d) start",
+			lResolv, batch.size());
+
+	bool errors = false;
+
+	std::vector<pendingFile>::iterator it;
+	for(it = batch.begin(); it != batch.end(); ++it) {
+		if(it->fd >= 0 && it->filestat.st_size > 0) {
+			it->physical = Util::getPhysicalOffset(it->fd);
+		}
+	}
+
+	std::stable_sort(batch.begin(), batch.end(), Image::physicalOrder);
+
+	size_t advised = 0;
+
+	try {
+		for(size_t i = 0; i < batch.size(); i++) {
+			for(; advised < batch.size() && advised <= i + READ_AHEAD_FILES;
+					advised++) {
+				const pendingFile &next = batch.at(advised);
+				if(next.fd >= 0 && next.filestat.st_size > 0) {
+					off_t len = next.filestat.st_size < READ_AHEAD_SIZE
+							? next.filestat.st_size : READ_AHEAD_SIZE;
+					posix_fadvise(next.fd, 0, len, POSIX_FADV_WILLNEED);
+				}
+			}
+
+			pendingFile &file = batch.at(i);
+
+			try {
+				this->readFileFromDisk(lResolv, file.entry, file.fd,
+						file.path, file.filestat);
+			}catch(const WarningException &ex) {
+				errors = true;
+			}
+
+			this->putSpareEntry(file.entry);
+			file.entry = 0;
+			if(file.fd >= 0) {
+				close(file.fd);
+				file.fd = -1;
+			}
+		}
+	} catch(...) {
+		for(it = batch.begin(); it != batch.end(); ++it) {
+			archive_entry_free(it->entry);
+			if(it->fd >= 0) {
+				close(it->fd);
+			}
+		}
+
+		batch.clear();
+		throw;
+	}
+
+	batch.clear();
+
+	log->loopDebug("Image::readFileBatch(errors=>%d) end", errors);
+	return errors;
+}
+
+/**
+ * \brief Writes the header of a file that is not a directory nor a link and,
+ * if it has them, its data
+ *
+ * \param lResolv
+ * 		Libarchive link resolver for handling hard links logic
+ * \param entry
+ * 		Header of the file. The link resolver can change it.
+ * \param fd
+ * 		Descriptor of the file, or -1
+ * \param path
+ * 		Path of the file
+ * \param filestat
+ * 		Status of the file
+ */
+void Image::readFileFromDisk(struct archive_entry_linkresolver *lResolv,
+		struct archive_entry *&entry, int fd, const std::string &path,
+		const struct stat &filestat) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Image::readFileFromDisk(path=>%s) start", path.c_str());
+
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	// The holes must be known before the header is written
+	bool holes = fd >= 0 && DataTransfer::readSparseMap(fd, filestat, entry);
+
+	struct archive_entry *sparse;
+	if(archive_entry_nlink(entry) > 1) {
+		archive_entry_linkify(lResolv, &entry, &sparse);
+	}
+	if(entry != 0) {
+		trns->copyHeader(entry, this->_archivesOut);
+	}
+
+	/*
+	 * If the current file is a virtual one, bypass
+	 */
+	if(Util::isLiveFile(path.c_str())) {
+		log->loopDebug("Image::readFileFromDisk() end");
+		return;
+	}
+
+	// else
+	if(entry != 0 && fd >= 0 && archive_entry_size(entry) > 0) {
+		if(holes) {
+			trns->sparseToArchive(fd, entry, this->_archivesOut);
+		} else {
+			trns->fdToArchive(fd, this->_archivesOut);
+		}
+	}
+
+	log->loopDebug("Image::readFileFromDisk() end");
+}
+
+/**
+ * \brief Takes a cleared header to describe a file
+ */
+struct archive_entry *Image::getSpareEntry() {
+	if(this->_spareEntries.empty()) {
+		return archive_entry_new();
+	}
+
+	struct archive_entry *entry = this->_spareEntries.back();
+	this->_spareEntries.pop_back();
+
+	return entry;
+}
+
+/**
+ * \brief Keeps a header that is no longer used, to be taken again
+ *
+ * The link resolver keeps copies of the headers, not the headers themselves.
+ */
+void Image::putSpareEntry(struct archive_entry *entry) {
+	if(entry == 0) {
+		return;
+	}
+
+	archive_entry_clear(entry);
+	this->_spareEntries.push_back(entry);
+}
+
+/**
+ * \brief Sorts the files by the position of their data in the device
+ */
+bool Image::physicalOrder(const pendingFile &a, const pendingFile &b) {
+	return a.physical < b.physical;
+}
+
+/**
+ * \brief Writes all the data in the image file.
+ *
+ * This method is not called for each partition but just once for the whole
+ * image file. All the partitions have been mounted before calling it and the
+ * files in the archive are written in the corresponding mount point. This way
+ * of restoring let us restore a Doclone image that has been modified by other
+ * tools.
+ *
+ * With more than one thread, the files of the mounted partitions are written
+ * by a TreeWriter while this thread keeps decoding the archive. The files of
+ * the partitions just formatted are written by a FreshExtractor.
+ */
+void Image::writeDataToDisk() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Image::writeDataToDisk() start");
+
+	struct archive_entry *entry;
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	//Won't keep restoring partitions with errors
+	uint8_t numPartitions = this->_disk->getPartitions().size();
+	bool errorPartitions[numPartitions];
+	memset(errorPartitions, false, numPartitions);
+
+	// The raw partitions are kept open while their entries arrive
+	std::vector<int> rawFds(numPartitions, -1);
+	std::vector<uint64_t> rawEnds(numPartitions, 0);
+
+	unsigned int threads = Clone::getInstance()->getThreads();
+	if(threads == 0) {
+		threads = Util::getNumberOfCpus();
+	}
+
+	TreeWriter *writer = 0;
+	if(threads > 1) {
+		writer = new TreeWriter(threads, Image::diskWriteFlags());
+	}
+
+	// The partitions just formatted have nothing to replace
+	std::vector<FreshExtractor *> extractors(numPartitions,
+			static_cast<FreshExtractor *>(0));
+
+	try {
+		while(archive_read_next_header(this->_archiveIn, &entry) == ARCHIVE_OK) {
+			std::string abPath = archive_entry_pathname(entry);
+
+			for(int i = 0;i<numPartitions
+				&& this->_disk->getPartitions().at(i)->getUsedPart() != 0; i++) {
+
+				try {
+					Partition *part = this->_disk->getPartitions().at(i);
+
+					// Not mounted, each entry is written at its offset
+					if(part->getRaw()) {
+						std::string rawDir = part->getRootDir()
+								+ Doclone::RAW_SUFFIX + "/";
+
+						if(abPath.compare(0, rawDir.length(), rawDir) == 0
+								&& !errorPartitions[i]) {
+							this->writeRawToDisk(part,
+									abPath.substr(rawDir.length()),
+									archive_entry_size(entry), rawFds[i],
+									rawEnds[i]);
+						}
+
+						continue;
+					}
+
+					// Not mounted, its blocks are written to the device
+					if(part->getBlockMap() != 0) {
+						if(abPath == part->getRootDir() + Doclone::BLOCKS_SUFFIX
+								&& !errorPartitions[i]) {
+							this->writeBlocksToDisk(part);
+						}
+
+						continue;
+					}
+
+					if(part->isMounted()
+							&& abPath.find(part->getRootDir() + "/") == 0
+							&& !errorPartitions[i]) {
+
+						abPath.replace(0,part->getRootDir().length(),
+										part->getMountPoint().c_str());
+
+						archive_entry_update_pathname_utf8(entry, abPath.c_str());
+
+						if(archive_entry_hardlink(entry)!=0
+								&& archive_entry_size(entry)==0) {
+
+								std::string hardLinkPath =
+										archive_entry_hardlink(entry);
+								hardLinkPath.replace(0, part->getRootDir().length(),
+										part->getMountPoint().c_str());
+
+								archive_entry_update_hardlink_utf8(entry,
+										hardLinkPath.c_str());
+						}
+
+						if(part->isFormatted() && extractors[i] == 0) {
+							extractors[i] = new FreshExtractor(
+									part->getMountPoint(),
+									Image::diskWriteFlags()
+									& ~ARCHIVE_EXTRACT_UNLINK);
+						}
+
+						if(writer != 0) {
+							writer->writeEntry(this->_archiveIn, entry, i,
+									extractors[i]);
+						} else if(extractors[i] != 0) {
+							extractors[i]->writeEntry(this->_archiveIn, entry);
+						} else {
+							trns->copyHeader(entry, this->_archivesOut);
+							trns->copyData(this->_archiveIn, this->_archivesOut);
+						}
+					}
+				} catch(const WarningException &e) {
+					errorPartitions[i] = true;
+					WriteErrorsInDirectoryException ex(archive_entry_pathname(entry));
+					ex.logMsg();
+				}
+			}
+
+			if(writer != 0) {
+				this->takeWriteErrors(*writer, errorPartitions);
+			}
+		}
+
+		if(writer != 0) {
+			writer->finish();
+			this->takeWriteErrors(*writer, errorPartitions);
+
+			delete writer;
+			writer = 0;
+		}
+
+		for(int i = 0;i<numPartitions; i++) {
+			if(extractors[i] == 0) {
+				continue;
+			}
+
+			try {
+				extractors[i]->finish();
+			} catch(const WarningException &e) {
+				Partition *part = this->_disk->getPartitions().at(i);
+
+				errorPartitions[i] = true;
+				WriteErrorsInDirectoryException ex(part->getMountPoint());
+				ex.logMsg();
+			}
+
+			delete extractors[i];
+			extractors[i] = 0;
+		}
+
+		// The zeros after the last entry of each raw partition
+		for(int i = 0;i<numPartitions
+			&& this->_disk->getPartitions().at(i)->getUsedPart() != 0; i++) {
+			Partition *part = this->_disk->getPartitions().at(i);
+
+			if(part->getRaw() && !errorPartitions[i]) {
+				try {
+					this->finishRawToDisk(part, rawFds[i], rawEnds[i]);
+				} catch(const WarningException &e) {
+					e.logMsg();
+				}
+			}
+		}
+	} catch (const Exception &ex) {
+		delete writer;
+
+		for(int i = 0;i<numPartitions; i++) {
+			delete extractors[i];
+		}
+
+		for(int i = 0;i<numPartitions; i++) {
+			if(rawFds[i] >= 0) {
+				close(rawFds[i]);
+			}
+		}
+
+		throw;
+	}
+
+	for(int i = 0;i<numPartitions; i++) {
+		if(rawFds[i] >= 0) {
+			close(rawFds[i]);
+		}
+	}
+
+	log->loopDebug("Image::writeDataToDisk() end");
+}
+
+/**
+ * \brief Marks the partitions whose files the writer threads couldn't write
+ *
+ * Like in the single threaded restore, only the first error of each partition
+ * is reported.
+ *
+ * \param writer
+ * 		The extractor of the files
+ * \param errorPartitions
+ * 		Array of flags of the partitions with errors
+ */
+void Image::takeWriteErrors(TreeWriter &writer, bool *errorPartitions) const {
+	unsigned int part;
+	std::string path;
+	while(writer.takeError(part, path)) {
+		if(!errorPartitions[part]) {
+			errorPartitions[part] = true;
+			WriteErrorsInDirectoryException ex(path);
+			ex.logMsg();
+		}
+	}
+}
+
+/**
+ * \brief Reads the used blocks of a partition and stores them in the out
+ * archive or vector of archives
+ *
+ * They go in a single entry, named after the root directory of the partition,
+ * in the order of its block map.
+ *
+ * \param part
+ * 		The partition, which must have a block map
+ */
+void Image::readBlocksFromDisk(const Partition *part) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Image::readBlocksFromDisk(part=>%s) start", part->getPath().c_str());
+
+	const BlockMap *map = part->getBlockMap();
+	std::string relPath = part->getRootDir() + Doclone::BLOCKS_SUFFIX;
+
+	int fdin = open(part->getPath().c_str(), O_RDONLY);
+	if(fdin < 0) {
+		OpenFileException ex(part->getPath());
+		throw ex;
+	}
 
-		//Path of the file in the image
-		std::string relPath = imgRootDir + "/" + abPath.substr(mPointLength);
+	time_t timeNow = time(0);
 
-		if (lstat (abPath.c_str(), &filestat) < 0) {
-			FileNotFoundException ex(abPath);
-			throw ex;
-		}
+	struct archive_entry *entry = archive_entry_new();
+	archive_entry_set_pathname(entry, relPath.c_str());
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_size(entry, map->getUsedBytes());
+	archive_entry_set_perm(entry, S_IRUSR|S_IWUSR);
+	archive_entry_set_mtime(entry, timeNow, 0);
 
-		try {
-			int fdin = open (abPath.c_str(), O_RDONLY);
+	DataTransfer *trns = DataTransfer::getInstance();
+	try {
+		trns->copyHeader(entry, this->_archivesOut);
+		trns->blocksToArchive(fdin, *map, this->_archivesOut);
+	} catch (const Exception &ex) {
+		archive_entry_free(entry);
+		close(fdin);
+		throw;
+	}
 
-			entry = archive_entry_new();
-			archive_entry_update_pathname_utf8(entry, relPath.c_str());
-			archive_read_disk_entry_from_file(this->_archiveIn, entry, fdin, &filestat);
+	archive_entry_free(entry);
+	close(fdin);
 
-			switch (archive_entry_filetype(entry)) {
-			case AE_IFDIR: {
-				if (strcmp (".", d_file->d_name) && strcmp ("..", d_file->d_name)) {
+	log->debug("Image::readBlocksFromDisk() end");
+}
 
-					trns->copyHeader(entry, this->_archivesOut);
+/**
+ * \brief Writes the blocks of a partition, read from the current entry of the
+ * in archive, to the device
+ *
+ * \param part
+ * 		The partition, which must have a block map
+ */
+void Image::writeBlocksToDisk(const Partition *part) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Image::writeBlocksToDisk(part=>%s) start", part->getPath().c_str());
 
-					/*
-					 * If the current folder is a virtual one or is the mount
-					 * point of another partition, bypass it.
-					 */
-					if(Util::isVirtualDirectory(abPath.c_str())
-						|| Util::isMountPoint(abPath)) {
+	int fdout = open(part->getPath().c_str(), O_WRONLY);
+	if(fdout < 0) {
+		OpenFileException ex(part->getPath());
+		throw ex;
+	}
 
-						continue;
-					}
+	DataTransfer *trns = DataTransfer::getInstance();
+	try {
+		trns->archiveToBlocks(this->_archiveIn, fdout, *part->getBlockMap());
+	} catch (const Exception &ex) {
+		close(fdout);
+		throw;
+	}
 
-					abPath.push_back('/');
-					this->readDataFromDisk(lResolv, abPath.c_str(), imgRootDir,
-							mPointLength);
-				}
-				break;
-			}
-			case AE_IFLNK: {
-				char linkPath[4096] = {};
-				ssize_t size = 0;
+	if(fsync(fdout) < 0) {
+		close(fdout);
 
-				// Read link
-				if ((size = readlink (abPath.c_str(), linkPath, sizeof(linkPath))) < 0) {
-					FileNotFoundException ex(path);
-					throw ex;
-				} else {
-						archive_entry_update_symlink_utf8(entry, linkPath);
-						trns->copyHeader(entry, this->_archivesOut);
-				}
+		WriteDataException ex;
+		throw ex;
+	}
 
-				break;
-			}
-			case AE_IFIFO:
-			case AE_IFSOCK:
-			case AE_IFCHR:
-			case AE_IFBLK:
-			case AE_IFREG: {
-				struct archive_entry *sparse;
-				if(archive_entry_nlink(entry) > 1) {
-					archive_entry_linkify(lResolv, &entry, &sparse);
-				}
-				if(entry != 0) {
-					trns->copyHeader(entry, this->_archivesOut);
-				}
+	close(fdout);
 
-				/*
-				 * If the current file is a virtual one, bypass
-				 */
-				if(Util::isLiveFile(abPath.c_str())) {
-					continue;
-				}
+	// The blocks bring the uuid of the imaged partition
+	BlkidScanner::getInstance()->clearIndex();
 
-				// else
-				if(archive_entry_size(entry) > 0) {
-					trns->fdToArchive(fdin, this->_archivesOut);
-				}
+	log->debug("Image::writeBlocksToDisk() end");
+}
 
-				break;
-			}
-			default:
-				ReadDataException ex;
-				throw ex;
-			}
+/**
+ * \brief Reads a partition raw and stores its non-zero blocks in the out
+ * archive or vector of archives
+ *
+ * They go in a directory named after the root directory of the partition,
+ * an entry for each run of data, named after its offset.
+ *
+ * \param part
+ * 		The partition, which must be imaged raw
+ */
+void Image::readRawFromDisk(const Partition *part) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Image::readRawFromDisk(part=>%s) start", part->getPath().c_str());
 
-			archive_entry_free(entry);
-			close(fdin);
-		}catch(const WarningException &ex) {
-			errors = true;
-		}
+	int fdin = open(part->getPath().c_str(), O_RDONLY);
+	if(fdin < 0) {
+		OpenFileException ex(part->getPath());
+		throw ex;
 	}
 
-	closedir (directory);
-
-	if(errors) {
-		ReadErrorsInDirectoryException ex(path);
-		ex.logMsg();
+	DataTransfer *trns = DataTransfer::getInstance();
+	try {
+		trns->rawToArchive(fdin, part->getMinSize(),
+				part->getRootDir() + Doclone::RAW_SUFFIX + "/",
+				this->_archivesOut);
+	} catch (const Exception &ex) {
+		close(fdin);
+		throw;
 	}
 
-	log->loopDebug("Image::readDataToDisk() end");
+	close(fdin);
+
+	log->debug("Image::readRawFromDisk() end");
 }
 
 /**
- * \brief Writes all the data in the image file.
+ * \brief Writes the current entry of the in archive to a raw partition
  *
- * This method is not called for each partition but just once for the whole
- * image file. All the partitions have been mounted before calling it and the
- * files in the archive are written in the corresponding mount point. This way
- * of restoring let us restore a Doclone image that has been modified by other
- * tools.
+ * The range between the end of the previous entry and this one is zeroed.
+ *
+ * \param part
+ * 		The partition, which must be imaged raw
+ * \param name
+ * 		Name of the entry, its offset in hexadecimal
+ * \param size
+ * 		Size of the entry
+ * \param fd
+ * 		Descriptor of the partition, opened here if it is -1
+ * \param end
+ * 		End of the previous entry, updated with the end of this one
  */
-void Image::writeDataToDisk() throw(Exception) {
+void Image::writeRawToDisk(const Partition *part, const std::string &name,
+		uint64_t size, int &fd, uint64_t &end) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->loopDebug("Image::writeDataToDisk() start");
+	log->loopDebug("Image::writeRawToDisk(part=>%s, name=>%s) start", part->getPath().c_str(), name.c_str());
 
-	struct archive_entry *entry;
-	DataTransfer *trns = DataTransfer::getInstance();
+	char *nameEnd;
+	uint64_t offset = strtoull(name.c_str(), &nameEnd, 16);
 
-	//Won't keep restoring partitions with errors
-	uint8_t numPartitions = this->_disk->getPartitions().size();
-	bool errorPartitions[numPartitions];
-	memset(errorPartitions, false, numPartitions);
+	// The entries must come in order and inside the partition
+	if(name.empty() || *nameEnd != '\0' || offset < end
+			|| offset > part->getMinSize()
+			|| size > part->getMinSize() - offset) {
+		InvalidImageException ex;
+		throw ex;
+	}
 
-	while(archive_read_next_header(this->_archiveIn, &entry) == ARCHIVE_OK) {
-		std::string abPath = archive_entry_pathname(entry);
+	if(fd < 0) {
+		fd = open(part->getPath().c_str(), O_WRONLY);
+		if(fd < 0) {
+			OpenFileException ex(part->getPath());
+			throw ex;
+		}
+	}
 
-		for(int i = 0;i<numPartitions
-			&& this->_disk->getPartitions().at(i)->getUsedPart() != 0; i++) {
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->zeroRange(fd, end, offset - end);
 
-			try {
-				Partition *part = this->_disk->getPartitions().at(i);
+	// Byte-sized blocks, to reuse archiveToBlocks()
+	BlockMap map(1, part->getMinSize());
+	map.addExtent(offset, size);
+	trns->archiveToBlocks(this->_archiveIn, fd, map);
 
-				if(part->isMounted()
-						&& abPath.find(part->getRootDir().c_str()) == 0
-						&& !errorPartitions[i]) {
+	end = offset + size;
 
-					abPath.replace(0,part->getRootDir().length(),
-									part->getMountPoint().c_str());
+	log->loopDebug("Image::writeRawToDisk() end");
+}
 
-					archive_entry_update_pathname_utf8(entry, abPath.c_str());
+/**
+ * \brief Zeroes a raw partition after its last entry and flushes it
+ *
+ * \param part
+ * 		The partition, which must be imaged raw
+ * \param fd
+ * 		Descriptor of the partition, opened here if it is -1 and closed
+ * \param end
+ * 		End of the last entry
+ */
+void Image::finishRawToDisk(const Partition *part, int &fd, uint64_t end)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Image::finishRawToDisk(part=>%s) start", part->getPath().c_str());
 
-					if(archive_entry_hardlink(entry)!=0
-							&& archive_entry_size(entry)==0) {
+	if(fd < 0) {
+		fd = open(part->getPath().c_str(), O_WRONLY);
+		if(fd < 0) {
+			OpenFileException ex(part->getPath());
+			throw ex;
+		}
+	}
 
-							std::string hardLinkPath =
-									archive_entry_hardlink(entry);
-							hardLinkPath.replace(0, part->getRootDir().length(),
-									part->getMountPoint().c_str());
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->zeroRange(fd, end, part->getMinSize() - end);
 
-							archive_entry_update_hardlink_utf8(entry,
-									hardLinkPath.c_str());
-					}
+	int retVal = fsync(fd);
+	close(fd);
+	fd = -1;
 
-					trns->copyHeader(entry, this->_archivesOut);
-					trns->copyData(this->_archiveIn, this->_archivesOut);
-				}
-			} catch(const WarningException &e) {
-				errorPartitions[i] = true;
-				WriteErrorsInDirectoryException ex(archive_entry_pathname(entry));
-				ex.logMsg();
-			}
-		}
+	if(retVal < 0) {
+		WriteDataException ex;
+		throw ex;
 	}
 
-	log->loopDebug("Image::writeDataToDisk() end");
+	// The data may bring the uuid of the imaged partition
+	BlkidScanner::getInstance()->clearIndex();
+
+	log->debug("Image::finishRawToDisk() end");
 }
 
 /**
@@ -719,7 +1609,15 @@ void Image::readPartition(int index) throw(Exception) {
 	Partition *part = this->_disk->getPartitions().at(index);
 	Clone *dcl = Clone::getInstance();
 
-	if(!this->_noData) {
+	if(!this->_noData && part->getBlockMap() != 0) {
+		this->readBlocksFromDisk(part);
+
+		dcl->markCompleted(Doclone::OP_READ_DATA, part->getPath());
+	} else if(!this->_noData && part->getRaw()) {
+		this->readRawFromDisk(part);
+
+		dcl->markCompleted(Doclone::OP_READ_DATA, part->getPath());
+	} else if(!this->_noData) {
 		struct archive_entry_linkresolver *lResolv =
 				archive_entry_linkresolver_new();
 		archive_entry_linkresolver_set_strategy(lResolv, ARCHIVE_FORMAT_TAR);
@@ -731,8 +1629,19 @@ void Image::readPartition(int index) throw(Exception) {
 				mountPoint.push_back('/');
 			}
 
-			this->readDataFromDisk(lResolv, mountPoint, part->getRootDir(),
-					mountPoint.length());
+			unsigned int threads = dcl->getThreads();
+			if(threads == 0) {
+				threads = Util::getNumberOfCpus();
+			}
+
+			// A rotational disk is faster with one reader in disk order
+			if(threads > 1 && !Util::isRotational(part->getPath())) {
+				TreeReader reader(threads, mountPoint, part->getRootDir());
+				reader.readTree(this->_archivesOut);
+			} else {
+				this->readDataFromDisk(lResolv, mountPoint, part->getRootDir(),
+						mountPoint.length());
+			}
 		} catch (const CancelException &ex) {
 			part->doUmount();
 			throw;
@@ -793,7 +1702,9 @@ void Image::writePartitionsData(const std::string &device) throw(Exception) {
 	if(!this->_noData) {
 		try {
 			for(unsigned int i = 0;i<this->_disk->getPartitions().size(); i++) {
-				if(this->_disk->getPartitions().at(i)->getMinSize() != 0) {
+				// The partitions imaged from the device aren't mounted
+				if(this->_disk->getPartitions().at(i)->getMinSize() != 0
+					&& !this->_disk->getPartitions().at(i)->isDeviceImage()) {
 					try {
 						this->_disk->getPartitions().at(i)->doMount();
 					} catch(WarningException &ex) {
@@ -856,6 +1767,66 @@ void Image::readPartitionTable(const std::string &device) throw(Exception) {
 	log->debug("Image::readPartitionTable() end");
 }
 
+/**
+ * \brief Main function of the formatting threads
+ *
+ * \param data
+ * 		Pointer to the formatJob of the thread
+ */
+void *Image::formatThread(void *data) {
+	Util::blockSignals();
+
+	Image::formatPartition(static_cast<formatJob *>(data));
+
+	return 0;
+}
+
+/**
+ * \brief Formats the partition of a job and stores the result in it
+ *
+ * The warnings skip the partition. The errors are rethrown by
+ * writePartitionTable() once all the threads have finished.
+ */
+void Image::formatPartition(formatJob *job) {
+	try {
+		job->part->format();
+	} catch (const WarningException &ex) {
+		job->error = ex.clone();
+	} catch (const Exception &ex) {
+		job->fatal = ex.clone();
+	}
+}
+
+/**
+ * \brief Waits for the formatting threads that are still running
+ *
+ * \param jobs
+ * 		The jobs of the threads
+ */
+void Image::joinFormatThreads(std::vector<formatJob> &jobs) {
+	for (unsigned int i = 0;i<jobs.size(); i++) {
+		if(jobs[i].started) {
+			pthread_join(jobs[i].thread, 0);
+			jobs[i].started = false;
+		}
+	}
+}
+
+/**
+ * \brief Frees the exceptions stored in the formatting jobs
+ *
+ * \param jobs
+ * 		The jobs of the threads, already joined
+ */
+void Image::freeFormatJobs(std::vector<formatJob> &jobs) {
+	for (unsigned int i = 0;i<jobs.size(); i++) {
+		delete jobs[i].error;
+		jobs[i].error = 0;
+		delete jobs[i].fatal;
+		jobs[i].fatal = 0;
+	}
+}
+
 /**
  * \brief Reads the vector of partitions to create the real partitions in disk.
  *
@@ -872,6 +1843,72 @@ void Image::writePartitionTable(const std::string &device) throw(Exception) {
 
 		this->_disk->writePartitions();
 
+		/*
+		 * The filesystems are made at the same time, one thread per partition.
+		 * The results are reported below, in the order of the partitions.
+		 */
+		formatJob none;
+		none.part = 0;
+		none.started = false;
+		none.error = 0;
+		none.fatal = 0;
+
+		std::vector<formatJob> jobs(this->_disk->getPartitions().size(), none);
+		try {
+			for (unsigned int i = 0;i<this->_disk->getPartitions().size() &&
+			this->_disk->getPartitions()[i]->getUsedPart() != 0; i++) {
+				Partition *part = this->_disk->getPartitions()[i];
+
+				jobs[i].part = part;
+
+				// The blocks of the image already hold the whole fs
+				if(part->getType() == Doclone::PARTITION_EXTENDED
+						|| part->isDeviceImage()) {
+					continue;
+				}
+
+				if(pthread_create(&jobs[i].thread, 0, Image::formatThread,
+						&jobs[i]) == 0) {
+					jobs[i].started = true;
+				} else {
+					Image::formatPartition(&jobs[i]);
+				}
+			}
+
+			Image::joinFormatThreads(jobs);
+		} catch (...) {
+			/*
+			 * A SIGINT unwinds this thread, but the others still write
+			 * in jobs. A second one mustn't stop the wait for them.
+			 */
+			sigset_t set, old;
+			sigemptyset(&set);
+			sigaddset(&set, SIGPIPE);
+			sigaddset(&set, SIGINT);
+			pthread_sigmask(SIG_BLOCK, &set, &old);
+
+			Image::joinFormatThreads(jobs);
+			Image::freeFormatJobs(jobs);
+
+			pthread_sigmask(SIG_SETMASK, &old, 0);
+			throw;
+		}
+
+		for (unsigned int i = 0;i<jobs.size(); i++) {
+			if(jobs[i].fatal) {
+				Exception *fatal = jobs[i].fatal;
+				jobs[i].fatal = 0;
+				Image::freeFormatJobs(jobs);
+
+				try {
+					fatal->raise();
+				} catch (...) {
+					delete fatal;
+					throw;
+				}
+			}
+		}
+
 		for (unsigned int i = 0;i<this->_disk->getPartitions().size() &&
 		this->_disk->getPartitions()[i]->getUsedPart() != 0; i++) {
 			Partition *part = this->_disk->getPartitions()[i];
@@ -883,31 +1920,28 @@ void Image::writePartitionTable(const std::string &device) throw(Exception) {
 			std::stringstream target;
 			target << device << ", #" << (i+1);
 
-			try {
-				part->format();
+			if(!part->isDeviceImage()) {
+				if(jobs[i].error) {
+					/*
+					 * This partition won't be restored.
+					 * Show the message and skip to the next partition.
+					 */
+					jobs[i].error->logMsg();
+					continue;
+				}
+
 				dcl->markCompleted(Doclone::OP_FORMAT_PARTITION,
 						target.str());
-			} catch (const WarningException &ex) {
-				/*
-				 * This partition won't be restored.
-				 * Show the message and skip to the next partition.
-				 */
-				ex.logMsg();
-				continue;
 			}
 
-			try {
-				part->writeFlags();
-				dcl->markCompleted(Doclone::OP_WRITE_PARTITION_FLAGS,
-						target.str());
-			} catch (const WarningException &ex) {
-				/*
-				 * This error doesn't prevent the partition to be restored.
-				 * Show the message and continue.
-				 */
-				ex.logMsg();
-			}
+			// The flags were committed with the partition table
+			dcl->markCompleted(Doclone::OP_WRITE_PARTITION_FLAGS,
+					target.str());
 
+			// Its label and uuid are in the blocks too
+			if(part->isDeviceImage()) {
+				continue;
+			}
 
 			try {
 				part->writeLabel();
@@ -934,6 +1968,7 @@ void Image::writePartitionTable(const std::string &device) throw(Exception) {
 			}
 		}
 
+		Image::freeFormatJobs(jobs);
 	} else {
 		this->_disk->getPartitions()[0]->setPath(device);
 		this->_disk->getPartitions()[0]->setPartNum(Util::getPartNum(device));
@@ -941,16 +1976,23 @@ void Image::writePartitionTable(const std::string &device) throw(Exception) {
 		std::stringstream target;
 		target << device;
 
-		try {
-			this->_disk->getPartitions()[0]->format();
-			dcl->markCompleted(Doclone::OP_FORMAT_PARTITION, target.str());
-		} catch (const WarningException &ex) {
-			/*
-			 * This partition won't be restored. Since this is the
-			 * only partition, execution must stop.
-			 */
-			ex.logMsg();
-			throw;
+		bool blocks = this->_disk->getPartitions()[0]->isDeviceImage();
+
+		if(blocks) {
+			// The blocks of the image hold the whole fs, label and uuid
+			this->_disk->getPartitions()[0]->clearSignatures();
+		} else {
+			try {
+				this->_disk->getPartitions()[0]->format();
+				dcl->markCompleted(Doclone::OP_FORMAT_PARTITION, target.str());
+			} catch (const WarningException &ex) {
+				/*
+				 * This partition won't be restored. Since this is the
+				 * only partition, execution must stop.
+				 */
+				ex.logMsg();
+				throw;
+			}
 		}
 
 		try {
@@ -965,26 +2007,28 @@ void Image::writePartitionTable(const std::string &device) throw(Exception) {
 			ex.logMsg();
 		}
 
-		try {
-			this->_disk->getPartitions()[0]->writeLabel();
-			dcl->markCompleted(Doclone::OP_WRITE_FS_LABEL, target.str());
-		} catch (const WarningException &ex) {
-			/*
-			 * This error doesn't prevent the partition to be restored.
-			 * Show the message and continue.
-			 */
-			ex.logMsg();
-		}
+		if(!blocks) {
+			try {
+				this->_disk->getPartitions()[0]->writeLabel();
+				dcl->markCompleted(Doclone::OP_WRITE_FS_LABEL, target.str());
+			} catch (const WarningException &ex) {
+				/*
+				 * This error doesn't prevent the partition to be restored.
+				 * Show the message and continue.
+				 */
+				ex.logMsg();
+			}
 
-		try {
-			this->_disk->getPartitions()[0]->writeUUID();
-			dcl->markCompleted(Doclone::OP_WRITE_FS_UUID, target.str());
-		} catch (const WarningException &ex) {
-			/*
-			 * This error doesn't prevent the partition to be restored.
-			 * Show the message and continue.
-			 */
-			ex.logMsg();
+			try {
+				this->_disk->getPartitions()[0]->writeUUID();
+				dcl->markCompleted(Doclone::OP_WRITE_FS_UUID, target.str());
+			} catch (const WarningException &ex) {
+				/*
+				 * This error doesn't prevent the partition to be restored.
+				 * Show the message and continue.
+				 */
+				ex.logMsg();
+			}
 		}
 	}
 
@@ -1009,6 +2053,11 @@ bool Image::canCreateCheck() const throw(Exception) {
 				&& this->_disk->getPartitions()[i]->getUsedPart()!= 0; i++) {
 			Partition *part = this->_disk->getPartitions()[i];
 
+			// Read and written without the tools of its fs
+			if(part->isDeviceImage()) {
+				continue;
+			}
+
 			Filesystem *fs = part->getFileSystem();
 			if(fs->getCode() != Doclone::FS_NOFS) {
 				bool formatSupport = fs->getFormatSupport();
@@ -1123,6 +2172,11 @@ bool Image::canRestoreCheck(const std::string &device) const throw(Exception) {
 				}
 			}
 
+			// Read and written without the tools of its fs
+			if(part->isDeviceImage()) {
+				continue;
+			}
+
 			Filesystem *fs = part->getFileSystem();
 			if(fs->getCode() != Doclone::FS_NOFS) {
 				bool formatSupport = fs->getFormatSupport();
@@ -1242,12 +2296,19 @@ void Image::initRestoreOperations(const std::string &device) const throw(Excepti
 		}
 
 		// All these Operation objects are deleted in doclone::~doclone()
+		Operation *writeFSFlags = new Operation(Doclone::OP_WRITE_PARTITION_FLAGS,
+				partTarget.str());
+
+		// The blocks hold the fs, its label and its uuid
+		if(part->isDeviceImage()) {
+			dcl->addOperation(writeFSFlags);
+			continue;
+		}
+
 		Operation *formatPartOp = new Operation(Doclone::OP_FORMAT_PARTITION,
 				partTarget.str());
 		dcl->addOperation(formatPartOp);
 
-		Operation *writeFSFlags = new Operation(Doclone::OP_WRITE_PARTITION_FLAGS,
-				partTarget.str());
 		dcl->addOperation(writeFSFlags);
 
 		if(fs->getLabelSupport() == true) {
@@ -1281,6 +2342,10 @@ void Image::setType(Doclone::imageType type) {
 	this->_type = type;
 }
 
+Doclone::dcCodec Image::getCodec() const {
+	return this->_codec;
+}
+
 Disk *Image::getDisk() {
 	return this->_disk;
 }
@@ -32,6 +32,7 @@
 #include <doclone/DataTransfer.h>
 #include <doclone/Util.h>
 #include <doclone/Image.h>
+#include <doclone/Relay.h>
 #include <doclone/DiskLabel.h>
 #include <doclone/DlFactory.h>
 #include <doclone/exception/Exception.h>
@@ -429,7 +430,7 @@ void Link::sendFromImage() throw(Exception) {
 	DataTransfer::sendData(this->_fdout, &tmpTotalSize,
 			static_cast<size_t>(sizeof(uint64_t)));
 
-	trns->copyData(fd, this->_fdout);
+	trns->zeroCopyData(fd, this->_fdout);
 
 	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
 
@@ -609,12 +610,14 @@ void Link::receiveToImage() throw(Exception) {
 	uint64_t tmpTotalSize = be64toh(totalSize);
 	trns->setTotalSize(tmpTotalSize);
 
-	std::vector<int> fdsOut;
-	fdsOut.push_back(fd);
 	if(this->_fdout != 0) {
-		fdsOut.push_back(this->_fdout);
+		// The next link doesn't wait for the local disk
+		uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
+		Relay relay(this->_fdin, this->_fdout, fd, window, true);
+		relay.finish();
+	} else {
+		trns->zeroCopyData(this->_fdin, fd);
 	}
-	trns->copyData(this->_fdin, fdsOut);
 
 	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
 
@@ -672,25 +675,48 @@ void Link::receiveToDevice() throw(Exception) {
 	DataTransfer *trns = DataTransfer::getInstance();
 	trns->setTotalSize(tmpTotalSize);
 
+	/*
+	 * The stream is forwarded to the next link, if any, as it arrives, and
+	 * spooled while the disk is partitioned and formatted. The archive reads
+	 * its local copy from a pipe.
+	 */
+	uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
+	int fdnext = this->_fdout != 0 ? this->_fdout : -1;
+	Relay *relay = new Relay(this->_fdin, fdnext, -1, window, false);
+
 	Image image;
-	image.initFdReadArchive(this->_fdin);
-	image.initDiskWriteArchive();
+	try {
+		image.initFdReadArchive(relay->getLocalFd());
+		image.initDiskWriteArchive();
 
-	image.loadImageHeader();
+		image.loadImageHeader();
 
-	if(image.canRestoreCheck(this->_device) == false) {
-		RestoreImageException ex;
-		throw ex;
-	}
+		if(image.canRestoreCheck(this->_device) == false) {
+			RestoreImageException ex;
+			throw ex;
+		}
 
-	image.initRestoreOperations(this->_device);
+		image.initRestoreOperations(this->_device);
 
-	image.writePartitionTable(this->_device);
+		image.writePartitionTable(this->_device);
 
-	image.writePartitionsData(this->_device);
+		// The last link spools only while the disk is prepared
+		if(fdnext < 0) {
+			relay->stopSpooling();
+		}
 
-	image.freeWriteArchive();
-	image.freeReadArchive();
+		image.writePartitionsData(this->_device);
+
+		image.freeWriteArchive();
+		image.freeReadArchive();
+
+		relay->finish();
+	} catch(...) {
+		delete relay;
+		throw;
+	}
+
+	delete relay;
 
 	this->closeConnection();
 
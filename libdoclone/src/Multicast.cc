@@ -0,0 +1,1391 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/Multicast.h>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <endian.h>
+
+#include <doclone/Logger.h>
+#include <doclone/PartedDevice.h>
+#include <doclone/Clone.h>
+#include <doclone/DataTransfer.h>
+#include <doclone/Util.h>
+#include <doclone/DiskLabel.h>
+#include <doclone/Image.h>
+#include <doclone/exception/Exception.h>
+#include <doclone/exception/CancelException.h>
+#include <doclone/exception/ConnectionException.h>
+#include <doclone/exception/CreateFileException.h>
+#include <doclone/exception/ReadDataException.h>
+#include <doclone/exception/WriteDataException.h>
+#include <doclone/exception/ReceiveDataException.h>
+#include <doclone/exception/SendDataException.h>
+#include <doclone/exception/NoBlockDeviceException.h>
+#include <doclone/exception/CreateImageException.h>
+#include <doclone/exception/RestoreImageException.h>
+#include <doclone/exception/CloseConnectionException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Default constructor.
+ *
+ * Initializes attributes.
+ */
+Multicast::Multicast(): _sock(-1), _session(0), _group(), _server(),
+		_nextSend(0), _receivers(), _done(), _repairs(), _repaired(),
+		_sentPackets(0), _lastHeard(0), _archiveFd(-1), _networkFd(-1),
+		_spool(-1), _relay(0), _thread(), _threadStarted(false),
+		_failed(false), _stop(false), _mutex() {
+	pthread_mutex_init(&this->_mutex, 0);
+
+	Clone *dcl = Clone::getInstance();
+
+	unsigned int nodes = dcl->getNodesNumber();
+	if(nodes == 0) {
+		this->_nodesNum = 1;
+	}
+	else {
+		this->_nodesNum = nodes;
+	}
+
+	unsigned int rate = dcl->getMulticastRate();
+	if(rate == 0) {
+		this->_rate = Doclone::MCAST_DEFAULT_RATE;
+	}
+	else {
+		this->_rate = rate;
+	}
+
+	// Several receivers can run in the same host, so the pid isn't enough
+	uint64_t seed = Multicast::now() ^ (static_cast<uint64_t>(getpid()) << 32)
+			^ reinterpret_cast<uintptr_t>(this);
+	this->_id = static_cast<uint32_t>(seed ^ (seed >> 32));
+
+	this->_group.sin_family = AF_INET;
+	this->_group.sin_port = htons(Doclone::PORT_MULTICAST);
+	this->_group.sin_addr.s_addr = inet_addr(Doclone::MULTICAST_GROUP);
+}
+
+/**
+ * \brief Stops the network thread and closes the descriptors, if still open
+ */
+Multicast::~Multicast() {
+	try {
+		this->closeConnection();
+	} catch(...) {}
+
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+/**
+ * \brief Whether the network thread must stop
+ */
+bool Multicast::isStopped() {
+	pthread_mutex_lock(&this->_mutex);
+	bool retVal = this->_stop;
+	pthread_mutex_unlock(&this->_mutex);
+
+	return retVal;
+}
+
+/**
+ * \brief Monotonic time in nanoseconds
+ */
+uint64_t Multicast::now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * \brief Opens the UDP socket of the server or of a receiver
+ *
+ * The receivers bind the multicast port with SO_REUSEADDR and join the group,
+ * so several of them can run in the same host.
+ *
+ * \param receiver
+ * 		Whether the socket is for a receiver
+ */
+void Multicast::openSocket(bool receiver) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::openSocket(receiver=>%d) start", receiver);
+
+	if ((this->_sock = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+		ConnectionException ex;
+		throw ex;
+	}
+
+	// Room for the bursts, the kernel caps it to its own maximum
+	int bufSize = 8 << 20;
+	setsockopt(this->_sock, SOL_SOCKET, receiver ? SO_RCVBUF : SO_SNDBUF,
+			&bufSize, sizeof(bufSize));
+
+	Clone *dcl = Clone::getInstance();
+	const std::string &interface = dcl->getInterface();
+
+	if(receiver) {
+		int iSetOption = 1;
+		setsockopt(this->_sock, SOL_SOCKET, SO_REUSEADDR,
+				&iSetOption, sizeof(iSetOption));
+
+		sockaddr_in local = {};
+		local.sin_family = AF_INET;
+		local.sin_port = htons (Doclone::PORT_MULTICAST);
+		local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+		if ((bind (this->_sock, reinterpret_cast<sockaddr*>(&local),
+				sizeof(local))) < 0) {
+			ConnectionException ex;
+			throw ex;
+		}
+
+		ip_mreq mReq;
+		mReq.imr_multiaddr.s_addr = inet_addr (Doclone::MULTICAST_GROUP);
+		if(interface.empty()) {
+			mReq.imr_interface.s_addr = htonl(INADDR_ANY);
+		} else {
+			mReq.imr_interface.s_addr = inet_addr(interface.c_str());
+		}
+
+		if(setsockopt (this->_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				&mReq, sizeof(mReq)) < 0) {
+			ConnectionException ex;
+			throw ex;
+		}
+	} else {
+		if(!interface.empty()) {
+			in_addr localInterface = {};
+			localInterface.s_addr = inet_addr (interface.c_str());
+			setsockopt(this->_sock, IPPROTO_IP, IP_MULTICAST_IF,
+					&localInterface, sizeof(localInterface));
+		}
+
+		// Receivers in this same host must get the datagrams too
+		u_char loop = 1;
+		setsockopt(this->_sock, IPPROTO_IP, IP_MULTICAST_LOOP,
+				&loop, sizeof(loop));
+	}
+
+	log->debug("Multicast::openSocket() end");
+}
+
+/**
+ * \brief Sends a datagram
+ *
+ * \param to
+ * 		Destination address
+ * \param type
+ * 		One of packetType
+ * \param seq
+ * 		Sequence field of the header
+ * \param payload
+ * 		Data after the header
+ * \param length
+ * 		Size of the payload
+ */
+void Multicast::sendPacket(const sockaddr_in &to, uint8_t type, uint64_t seq,
+		const void *payload, uint16_t length) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Multicast::sendPacket(type=>%d, seq=>%d, length=>%d) start", type, seq, length);
+
+	unsigned char header[MCAST_HEADER_SIZE];
+	uint32_t session = this->_session;
+	if(type == PKT_ANNOUNCE || type == PKT_DATA || type == PKT_END) {
+		session = this->_id;
+	}
+
+	for(int i = 0; i < 4; i++) {
+		header[i] = (MCAST_MAGIC >> (24 - 8 * i)) & 0xff;
+		header[4 + i] = (session >> (24 - 8 * i)) & 0xff;
+	}
+	for(int i = 0; i < 8; i++) {
+		header[8 + i] = (seq >> (56 - 8 * i)) & 0xff;
+	}
+	header[16] = (length >> 8) & 0xff;
+	header[17] = length & 0xff;
+	header[18] = type;
+	header[19] = 0;
+
+	iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = const_cast<void *>(payload);
+	iov[1].iov_len = length;
+
+	msghdr msg = {};
+	msg.msg_name = const_cast<sockaddr_in *>(&to);
+	msg.msg_namelen = sizeof(to);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = length > 0 ? 2 : 1;
+
+	while(sendmsg(this->_sock, &msg, MSG_NOSIGNAL) < 0) {
+		if(errno == EINTR) {
+			continue;
+		}
+
+		// The interface queue is full, give it some time
+		if(errno == ENOBUFS || errno == EAGAIN) {
+			poll(0, 0, 1);
+			continue;
+		}
+
+		SendDataException ex(inet_ntoa(to.sin_addr));
+		throw ex;
+	}
+
+	log->loopDebug("Multicast::sendPacket() end");
+}
+
+/**
+ * \brief Receives a datagram of doclone
+ *
+ * \param [out] pkt
+ * 		The datagram
+ * \param [out] from
+ * 		Address of the sender
+ * \param timeout
+ * 		Milliseconds to wait for it
+ *
+ * \return False if nothing valid has been received
+ */
+bool Multicast::recvPacket(packet &pkt, sockaddr_in &from, int timeout)
+		throw(Exception) {
+	pollfd pfd = { this->_sock, POLLIN, 0 };
+	if(poll(&pfd, 1, timeout) <= 0) {
+		return false;
+	}
+
+	socklen_t addrlen = sizeof(from);
+	ssize_t nbytes = recvfrom(this->_sock, pkt.data, sizeof(pkt.data),
+			MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &addrlen);
+
+	if(nbytes < 0) {
+		if(errno == EINTR || errno == EAGAIN) {
+			return false;
+		}
+
+		ConnectionException ex;
+		throw ex;
+	}
+
+	if(nbytes < MCAST_HEADER_SIZE) {
+		return false;
+	}
+
+	const unsigned char *header = reinterpret_cast<unsigned char *>(pkt.data);
+	uint32_t magic = 0;
+	pkt.session = 0;
+	for(int i = 0; i < 4; i++) {
+		magic = (magic << 8) | header[i];
+		pkt.session = (pkt.session << 8) | header[4 + i];
+	}
+	pkt.seq = 0;
+	for(int i = 0; i < 8; i++) {
+		pkt.seq = (pkt.seq << 8) | header[8 + i];
+	}
+	pkt.length = (header[16] << 8) | header[17];
+	pkt.type = header[18];
+
+	if(magic != MCAST_MAGIC || pkt.length != nbytes - MCAST_HEADER_SIZE) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Announces the session until all the receivers have said hello
+ *
+ * \param totalSize
+ * 		Size of the data, for the receivers to calculate the percentage
+ */
+void Multicast::waitReceivers(uint64_t totalSize) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::waitReceivers(totalSize=>%d) start", totalSize);
+
+	Clone *dcl = Clone::getInstance();
+	uint64_t nextAnnounce = 0;
+
+	while(this->_receivers.size() < this->_nodesNum) {
+		if(Multicast::now() >= nextAnnounce) {
+			this->sendPacket(this->_group, PKT_ANNOUNCE, totalSize, 0, 0);
+			nextAnnounce = Multicast::now() + 200000000ULL;
+		}
+
+		packet pkt;
+		sockaddr_in from;
+		if(!this->recvPacket(pkt, from, 50)) {
+			continue;
+		}
+
+		if(pkt.type != PKT_HELLO || pkt.session != this->_id
+				|| this->_receivers.count(pkt.seq)) {
+			continue;
+		}
+
+		std::string host = inet_ntoa (from.sin_addr);
+		this->_receivers[pkt.seq] = host;
+
+		// Notify the views
+		dcl->triggerEvent(Doclone::EVT_NEW_CONNECION, host);
+	}
+
+	log->debug("Multicast::waitReceivers() end");
+}
+
+/**
+ * \brief Waits for the announcement of a server and says hello to it
+ *
+ * If the user has given an address, other servers are ignored.
+ *
+ * \return The size of the data
+ */
+uint64_t Multicast::waitServer() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::waitServer() start");
+
+	packet pkt;
+	sockaddr_in from;
+
+	while(1) {
+		if(!this->recvPacket(pkt, from, 1000) || pkt.type != PKT_ANNOUNCE) {
+			continue;
+		}
+
+		if(!this->_srcIP.empty()
+				&& this->_srcIP.compare(inet_ntoa (from.sin_addr)) != 0) {
+			continue;
+		}
+
+		break;
+	}
+
+	this->_session = pkt.session;
+	this->_server = from;
+	this->sendPacket(this->_server, PKT_HELLO, this->_id, 0, 0);
+
+	log->debug("Multicast::waitServer(totalSize=>%d) end", pkt.seq);
+	return pkt.seq;
+}
+
+/**
+ * \brief Waits until a datagram of [length] bytes can be sent at the rate
+ *
+ * A small burst is allowed, to make up for the oversleeping.
+ *
+ * \param length
+ * 		Size of the payload
+ */
+void Multicast::pace(size_t length) {
+	uint64_t current = Multicast::now();
+
+	if(this->_nextSend + 2000000 < current) {
+		this->_nextSend = current - 2000000;
+	} else if(this->_nextSend > current + 1000000) {
+		uint64_t wait = this->_nextSend - current;
+		timespec ts = { static_cast<time_t>(wait / 1000000000ULL),
+				static_cast<long>(wait % 1000000000ULL) };
+		nanosleep(&ts, 0);
+	}
+
+	// Mbit/s are bits per microsecond, with the IP and UDP headers
+	uint64_t bits = (length + MCAST_HEADER_SIZE + 28) * 8;
+	this->_nextSend += bits * 1000 / this->_rate;
+}
+
+/**
+ * \brief Reads the pending requests of the receivers
+ *
+ * NAKs are queued for repair, hellos and dones are recorded.
+ *
+ * \param timeout
+ * 		Milliseconds to wait for the first request
+ */
+void Multicast::serveRequests(int timeout) throw(Exception) {
+	packet pkt;
+	sockaddr_in from;
+
+	while(this->recvPacket(pkt, from, timeout)) {
+		timeout = 0;
+
+		if(pkt.session != this->_id) {
+			continue;
+		}
+
+		this->_lastHeard = Multicast::now();
+
+		if(pkt.type == PKT_DONE) {
+			if(this->_receivers.count(pkt.seq)) {
+				this->_done.insert(pkt.seq);
+			}
+		} else if(pkt.type == PKT_NAK) {
+			const unsigned char *range = reinterpret_cast<unsigned char *>(
+					pkt.data + MCAST_HEADER_SIZE);
+
+			for(unsigned int i = 0; i + 16 <= pkt.length; i += 16) {
+				uint64_t first = 0;
+				uint64_t last = 0;
+				for(int j = 0; j < 8; j++) {
+					first = (first << 8) | range[i + j];
+					last = (last << 8) | range[i + 8 + j];
+				}
+
+				// Only what has been sent can be repaired
+				if(last >= this->_sentPackets) {
+					last = this->_sentPackets - 1;
+				}
+
+				if(first <= last && this->_sentPackets > 0) {
+					this->_repairs.push_back(std::make_pair(first, last));
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \brief Sends again the first datagram waiting to be repaired
+ *
+ * Datagrams repaired a moment ago are skipped, they are on their way and the
+ * NAKs of the other receivers would only duplicate them.
+ *
+ * \param store
+ * 		Descriptor with the whole stream sent until now
+ */
+void Multicast::repair(int store) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Multicast::repair(store=>%d) start", store);
+
+	uint64_t seq = this->_repairs.front().first;
+	if(seq == this->_repairs.front().second) {
+		this->_repairs.pop_front();
+	} else {
+		this->_repairs.front().first++;
+	}
+
+	uint64_t current = Multicast::now();
+	uint64_t interval = MCAST_NAK_INTERVAL * 1000000ULL;
+
+	std::map<uint64_t, uint64_t>::iterator it = this->_repaired.find(seq);
+	if(it != this->_repaired.end() && current - it->second < interval) {
+		log->loopDebug("Multicast::repair() end");
+		return;
+	}
+
+	char buf[MCAST_PAYLOAD];
+	ssize_t nbytes;
+	while((nbytes = pread(store, buf, sizeof(buf),
+			static_cast<off_t>(seq * MCAST_PAYLOAD))) < 0 && errno == EINTR);
+
+	if(nbytes <= 0) {
+		ReadDataException ex;
+		throw ex;
+	}
+
+	this->pace(nbytes);
+	this->sendPacket(this->_group, PKT_DATA, seq, buf, nbytes);
+	this->_repaired[seq] = current;
+
+	// Forget the old repairs once in a while
+	if(this->_repaired.size() > 65536) {
+		for(it = this->_repaired.begin(); it != this->_repaired.end();) {
+			if(current - it->second >= interval) {
+				this->_repaired.erase(it++);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	log->loopDebug("Multicast::repair() end");
+}
+
+/**
+ * \brief Sends the stream read from [fdin] to the group
+ *
+ * The repairs have priority over the new data. When the stream ends, the end
+ * of the session is announced.
+ *
+ * \param fdin
+ * 		Source of the stream
+ * \param store
+ * 		Descriptor where the stream can be read back for the repairs. If it
+ * 		isn't [fdin], the stream is copied there.
+ */
+void Multicast::transmit(int fdin, int store) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::transmit(fdin=>%d, store=>%d) start", fdin, store);
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	bool keep = store != fdin;
+	char buf[MCAST_PAYLOAD];
+	size_t filled = 0;
+	uint64_t length = 0;
+	bool eof = false;
+
+	this->_sentPackets = 0;
+	this->_nextSend = Multicast::now();
+
+	while(!this->isStopped()) {
+		this->serveRequests(0);
+
+		if(!this->_repairs.empty()) {
+			this->repair(store);
+			continue;
+		}
+
+		if(eof) {
+			break;
+		}
+
+		// Wait for data without leaving the receivers unattended
+		pollfd pfd[2] = { { fdin, POLLIN, 0 }, { this->_sock, POLLIN, 0 } };
+		if(poll(pfd, 2, 100) <= 0 || !(pfd[0].revents & (POLLIN | POLLHUP))) {
+			continue;
+		}
+
+		ssize_t nbytes = read(fdin, buf + filled, sizeof(buf) - filled);
+		if(nbytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			ReadDataException ex;
+			throw ex;
+		}
+
+		eof = nbytes == 0;
+		filled += nbytes;
+
+		// Every datagram but the last is full, so seq * MCAST_PAYLOAD is its offset
+		if(filled < sizeof(buf) && !(eof && filled > 0)) {
+			continue;
+		}
+
+		if(keep) {
+			off_t offset = static_cast<off_t>(length);
+			for(size_t done = 0; done < filled;) {
+				ssize_t written = pwrite(store, buf + done, filled - done,
+						offset + done);
+				if(written < 0) {
+					if(errno == EINTR) {
+						continue;
+					}
+
+					WriteDataException ex;
+					throw ex;
+				}
+				done += written;
+			}
+		}
+
+		this->pace(filled);
+		this->sendPacket(this->_group, PKT_DATA, this->_sentPackets, buf,
+				filled);
+
+		if(!keep) {
+			trns->addTransferredBytes(filled);
+		}
+
+		this->_sentPackets++;
+		length += filled;
+		filled = 0;
+	}
+
+	if(!this->isStopped()) {
+		this->finishTransmission(store, this->_sentPackets, length);
+	}
+
+	log->debug("Multicast::transmit() end");
+}
+
+/**
+ * \brief Announces the end of the stream until every receiver has got it
+ *
+ * The receivers that don't answer in MCAST_TIMEOUT milliseconds are reported
+ * and left behind. It only fails if none of them got the stream.
+ *
+ * \param store
+ * 		Descriptor where the stream can be read back for the repairs
+ * \param packets
+ * 		Number of data datagrams
+ * \param length
+ * 		Size of the stream
+ */
+void Multicast::finishTransmission(int store, uint64_t packets,
+		uint64_t length) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::finishTransmission(store=>%d, packets=>%d, length=>%d) start", store, packets, length);
+
+	unsigned char payload[8];
+	for(int i = 0; i < 8; i++) {
+		payload[i] = (length >> (56 - 8 * i)) & 0xff;
+	}
+
+	uint64_t timeout = MCAST_TIMEOUT * 1000000ULL;
+	uint64_t nextEnd = 0;
+	this->_lastHeard = Multicast::now();
+
+	while(!this->isStopped() && this->_done.size() < this->_receivers.size()
+			&& Multicast::now() - this->_lastHeard < timeout) {
+		if(!this->_repairs.empty()) {
+			this->repair(store);
+			this->serveRequests(0);
+			continue;
+		}
+
+		if(Multicast::now() >= nextEnd) {
+			this->sendPacket(this->_group, PKT_END, packets, payload,
+					sizeof(payload));
+			nextEnd = Multicast::now() + 100000000ULL;
+		}
+
+		this->serveRequests(MCAST_NAK_INTERVAL);
+	}
+
+	std::map<uint32_t, std::string>::const_iterator it;
+	for(it = this->_receivers.begin(); it != this->_receivers.end(); ++it) {
+		if(!this->_done.count(it->first)) {
+			SendDataException ex(it->second);
+			ex.logMsg();
+		}
+	}
+
+	if(this->_done.empty()) {
+		SendDataException ex(Doclone::MULTICAST_GROUP);
+		throw ex;
+	}
+
+	log->debug("Multicast::finishTransmission() end");
+}
+
+/**
+ * \brief Writes the next piece of the stream
+ *
+ * \param fdout
+ * 		Destination descriptor
+ * \param buf
+ * 		Data
+ * \param len
+ * 		Size of the data
+ * \param notify
+ * 		Whether the data must be counted as transferred
+ */
+void Multicast::deliver(int fdout, const char *buf, size_t len, bool notify)
+		throw(Exception) {
+	for(size_t done = 0; done < len;) {
+		ssize_t written = write(fdout, buf + done, len - done);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			WriteDataException ex;
+			throw ex;
+		}
+		done += written;
+	}
+
+	if(notify) {
+		DataTransfer *trns = DataTransfer::getInstance();
+		trns->addTransferredBytes(len);
+	}
+}
+
+/**
+ * \brief Sends the server the ranges of datagrams not received yet
+ *
+ * \param next
+ * 		First datagram not delivered
+ * \param limit
+ * 		Datagrams from this one on aren't known to have been sent
+ * \param pending
+ * 		Datagrams received out of order
+ */
+void Multicast::sendNak(uint64_t next, uint64_t limit,
+		const std::map<uint64_t, std::vector<char> > &pending) {
+	unsigned char payload[MCAST_PAYLOAD];
+	size_t length = 0;
+	const size_t maxLength = MCAST_PAYLOAD - MCAST_PAYLOAD % 16;
+
+	uint64_t first = next;
+	std::map<uint64_t, std::vector<char> >::const_iterator it =
+			pending.lower_bound(next);
+
+	while(first < limit && length < maxLength) {
+		uint64_t last = limit - 1;
+		if(it != pending.end() && it->first < limit) {
+			last = it->first - 1;
+		}
+
+		if(first <= last && (it == pending.end() || first < it->first)) {
+			for(int i = 0; i < 8; i++) {
+				payload[length + i] = (first >> (56 - 8 * i)) & 0xff;
+				payload[length + 8 + i] = (last >> (56 - 8 * i)) & 0xff;
+			}
+			length += 16;
+		}
+
+		if(it == pending.end() || it->first >= limit) {
+			break;
+		}
+
+		first = it->first + 1;
+		++it;
+	}
+
+	if(length > 0) {
+		this->sendPacket(this->_server, PKT_NAK, this->_id, payload, length);
+	}
+}
+
+/**
+ * \brief Receives the stream of the server and writes it in order to [fdout]
+ *
+ * \param fdout
+ * 		Destination descriptor
+ * \param notify
+ * 		Whether the data must be counted as transferred
+ */
+void Multicast::receiveStream(int fdout, bool notify) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::receiveStream(fdout=>%d) start", fdout);
+
+	std::map<uint64_t, std::vector<char> > pending;
+	uint64_t next = 0;
+	uint64_t seen = 0;
+	uint64_t packets = 0;
+	uint64_t length = 0;
+	uint64_t delivered = 0;
+	bool known = false;
+	bool started = false;
+	uint64_t lastNak = 0;
+	uint64_t timeout = MCAST_TIMEOUT * 1000000ULL;
+	uint64_t interval = MCAST_NAK_INTERVAL * 1000000ULL;
+
+	this->_lastHeard = Multicast::now();
+
+	while(!known || next < packets) {
+		if(this->isStopped()) {
+			CancelException ex;
+			throw ex;
+		}
+
+		uint64_t current = Multicast::now();
+		if(current - this->_lastHeard > timeout) {
+			ReceiveDataException ex;
+			throw ex;
+		}
+
+		if(current - lastNak >= interval) {
+			uint64_t limit = known ? packets : seen;
+			if(next < limit) {
+				this->sendNak(next, limit, pending);
+			}
+			lastNak = current;
+		}
+
+		packet pkt;
+		sockaddr_in from;
+		if(!this->recvPacket(pkt, from, MCAST_NAK_INTERVAL)
+				|| pkt.session != this->_session) {
+			continue;
+		}
+
+		this->_lastHeard = Multicast::now();
+		const char *payload = pkt.data + MCAST_HEADER_SIZE;
+
+		if(pkt.type == PKT_ANNOUNCE) {
+			// The hello was lost
+			if(!started) {
+				this->sendPacket(this->_server, PKT_HELLO, this->_id, 0, 0);
+			}
+		} else if(pkt.type == PKT_END) {
+			started = true;
+			if(!known && pkt.length >= 8) {
+				known = true;
+				packets = pkt.seq;
+				for(int i = 0; i < 8; i++) {
+					length = (length << 8)
+							| static_cast<unsigned char>(payload[i]);
+				}
+			}
+		} else if(pkt.type == PKT_DATA) {
+			started = true;
+
+			if(pkt.seq >= seen) {
+				seen = pkt.seq + 1;
+			}
+
+			if(pkt.seq < next || pending.count(pkt.seq)) {
+				continue;
+			}
+
+			if(pkt.seq > next) {
+				pending[pkt.seq].assign(payload, payload + pkt.length);
+				continue;
+			}
+
+			this->deliver(fdout, payload, pkt.length, notify);
+			delivered += pkt.length;
+			next++;
+
+			// Deliver what was waiting for this datagram
+			std::map<uint64_t, std::vector<char> >::iterator it;
+			while((it = pending.begin()) != pending.end() && it->first == next) {
+				if(!it->second.empty()) {
+					this->deliver(fdout, &it->second[0], it->second.size(),
+							notify);
+				}
+				delivered += it->second.size();
+				pending.erase(it);
+				next++;
+			}
+
+			// The time blocked writing isn't silence of the server
+			this->_lastHeard = Multicast::now();
+		}
+	}
+
+	if(delivered != length) {
+		ReceiveDataException ex;
+		throw ex;
+	}
+
+	this->sendPacket(this->_server, PKT_DONE, this->_id, 0, 0);
+
+	log->debug("Multicast::receiveStream(delivered=>%d) end", delivered);
+}
+
+/**
+ * \brief Answers the end of the session until the server stops announcing it
+ *
+ * The server repeats the end while it lacks the done of some receiver, which
+ * could be this one.
+ */
+void Multicast::linger() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::linger() start");
+
+	uint64_t linger = MCAST_LINGER * 1000000ULL;
+	uint64_t lastEnd = Multicast::now();
+
+	while(!this->isStopped() && Multicast::now() - lastEnd < linger) {
+		packet pkt;
+		sockaddr_in from;
+		if(!this->recvPacket(pkt, from, MCAST_NAK_INTERVAL)
+				|| pkt.session != this->_session || pkt.type != PKT_END) {
+			continue;
+		}
+
+		this->sendPacket(this->_server, PKT_DONE, this->_id, 0, 0);
+		lastEnd = Multicast::now();
+	}
+
+	log->debug("Multicast::linger() end");
+}
+
+/**
+ * \brief Main function of the thread that multicasts the archive
+ *
+ * If the transmission fails, its end of the pipe is closed, so the archive
+ * writer stops too.
+ *
+ * \param data
+ * 		Pointer to the Multicast object
+ */
+void *Multicast::senderThread(void *data) {
+	Multicast *mc = static_cast<Multicast *>(data);
+
+	Util::blockSignals();
+
+	try {
+		mc->transmit(mc->_networkFd, mc->_spool);
+	} catch(const Exception &ex) {
+		pthread_mutex_lock(&mc->_mutex);
+		mc->_failed = true;
+		pthread_mutex_unlock(&mc->_mutex);
+	}
+
+	close(mc->_networkFd);
+	mc->_networkFd = -1;
+
+	return 0;
+}
+
+/**
+ * \brief Main function of the thread that receives the archive
+ *
+ * The pipe is closed as soon as the stream is complete, so the archive reader
+ * doesn't wait for the end of the session.
+ *
+ * \param data
+ * 		Pointer to the Multicast object
+ */
+void *Multicast::receiverThread(void *data) {
+	Multicast *mc = static_cast<Multicast *>(data);
+
+	Util::blockSignals();
+
+	try {
+		mc->receiveStream(mc->_networkFd, false);
+
+		close(mc->_networkFd);
+		mc->_networkFd = -1;
+
+		mc->linger();
+	} catch(const Exception &ex) {
+		pthread_mutex_lock(&mc->_mutex);
+		mc->_failed = true;
+		pthread_mutex_unlock(&mc->_mutex);
+	}
+
+	if(mc->_networkFd >= 0) {
+		close(mc->_networkFd);
+		mc->_networkFd = -1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Performs the sending of an image over network.
+ */
+void Multicast::sendFromImage() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::sendFromImage() start");
+
+	Operation *waitOp = new Operation(
+			Doclone::OP_WAIT_CLIENTS, "");
+
+	Clone *dcl = Clone::getInstance();
+	dcl->addOperation(waitOp);
+
+	int fd = Util::openFile(this->_image);
+	uint64_t totalSize = this->getImageSize(fd);
+
+	this->openSocket(false);
+	this->waitReceivers(totalSize);
+
+	dcl->markCompleted(Doclone::OP_WAIT_CLIENTS, "");
+
+	Operation *transferOp = new Operation(
+			Doclone::OP_TRANSFER_DATA, "");
+
+	dcl->addOperation(transferOp);
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->setTotalSize(totalSize);
+
+	// The image itself is read back for the repairs
+	try {
+		this->transmit(fd, fd);
+	} catch(...) {
+		Util::closeFile(fd);
+		throw;
+	}
+
+	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
+
+	Util::closeFile(fd);
+
+	this->closeConnection();
+
+	log->debug("Multicast::sendFromImage() end");
+}
+
+/**
+ * \brief Performs the sending of a device over network.
+ *
+ * The archive is written to a pipe, read by the thread that multicasts it.
+ * The stream is kept in a temporary file for the repairs.
+ */
+void Multicast::sendFromDevice() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::sendFromDevice() start");
+
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->initialize(Util::getDiskPath(this->_device));
+
+	Operation *waitOp = new Operation(
+				Doclone::OP_WAIT_CLIENTS, "");
+
+	Clone *dcl = Clone::getInstance();
+	dcl->addOperation(waitOp);
+
+	if(!Util::isBlockDevice(this->_device)) {
+		NoBlockDeviceException ex;
+		throw ex;
+	}
+
+	PartedDevice *pDevice = PartedDevice::getInstance();
+	std::string target = pDevice->getPath();
+	Image image;
+
+	if(Util::isDisk(this->_device)) {
+		image.setType(Doclone::IMAGE_DISK);
+	}
+	else {
+		image.setType(Doclone::IMAGE_PARTITION);
+	}
+
+	Operation *readPartTableOp = new Operation(
+			Doclone::OP_READ_PARTITION_TABLE, target);
+
+	dcl->addOperation(readPartTableOp);
+
+	image.readPartitionTable(this->_device);
+
+	// Mark the operation to read partition table as completed
+	dcl->markCompleted(Doclone::OP_READ_PARTITION_TABLE, target);
+
+	if(image.canCreateCheck() == false) {
+		CreateImageException ex;
+		throw ex;
+	}
+
+	// The receivers are told the size in the announcement
+	Disk *disk = image.getDisk();
+	uint8_t numPartitions = disk->getPartitions().size();
+	uint64_t totalSize = 0;
+	for(int i = 0;i<numPartitions;i++) {
+		totalSize += disk->getPartitions().at(i)->getMinSize();
+	}
+
+	this->openSocket(false);
+	this->waitReceivers(totalSize);
+
+	dcl->markCompleted(Doclone::OP_WAIT_CLIENTS, "");
+
+	image.initCreateOperations();
+	image.initDiskReadArchive();
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->setTotalSize(totalSize);
+
+	char path[] = "/tmp/doclone-spool-XXXXXX";
+	if((this->_spool = mkstemp(path)) < 0) {
+		CreateFileException ex(path);
+		throw ex;
+	}
+
+	// Nobody else needs the name
+	unlink(path);
+
+	int fds[2];
+	if(pipe(fds) < 0) {
+		ConnectionException ex;
+		throw ex;
+	}
+	this->_networkFd = fds[0];
+	this->_archiveFd = fds[1];
+
+	if(pthread_create(&this->_thread, 0, Multicast::senderThread, this) != 0) {
+		ConnectionException ex;
+		throw ex;
+	}
+	this->_threadStarted = true;
+
+	image.initFdWriteArchive(this->_archiveFd);
+
+	image.saveImageHeader();
+
+	image.readPartitionsData();
+
+	image.freeWriteArchive();
+	image.freeReadArchive();
+
+	// The end of the stream
+	close(this->_archiveFd);
+	this->_archiveFd = -1;
+
+	pthread_join(this->_thread, 0);
+	this->_threadStarted = false;
+
+	if(this->_failed) {
+		SendDataException ex(Doclone::MULTICAST_GROUP);
+		throw ex;
+	}
+
+	this->closeConnection();
+
+	log->debug("Multicast::sendFromDevice() end");
+}
+
+/**
+ * \brief Performs the sending of an image or a device over network.
+ */
+void Multicast::send() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::send() start");
+
+	Clone *dcl = Clone::getInstance();
+
+	try {
+		if(dcl->getDevice().empty()) {
+			this->sendFromImage();
+		} else {
+			this->sendFromDevice();
+		}
+	} catch (const CancelException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const ReadDataException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const SendDataException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const ErrorException &ex) {
+		this->closeConnection();
+		throw;
+	}
+
+	log->debug("Multicast::send() end");
+}
+
+/**
+ * \brief Performs the reception of an image over network.
+ */
+void Multicast::receiveToImage() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::receiveToImage() start");
+
+	Operation *waitOp = new Operation(
+			Doclone::OP_WAIT_SERVER, "");
+
+	Clone *dcl = Clone::getInstance();
+	dcl->addOperation(waitOp);
+
+	this->openSocket(true);
+	uint64_t totalSize = this->waitServer();
+
+	dcl->markCompleted(Doclone::OP_WAIT_SERVER, "");
+
+	Util::createFile(this->_image);
+	int fd = Util::openFile(this->_image);
+
+	Operation *transferOp = new Operation(
+			Doclone::OP_TRANSFER_DATA, "");
+
+	dcl->addOperation(transferOp);
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->setTotalSize(totalSize);
+
+	try {
+		this->receiveStream(fd, true);
+	} catch(...) {
+		Util::closeFile(fd);
+		throw;
+	}
+
+	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
+
+	Util::closeFile(fd);
+
+	this->linger();
+
+	this->closeConnection();
+
+	log->debug("Multicast::receiveToImage() end");
+}
+
+/**
+ * \brief Performs the reception of a device over network.
+ *
+ * A thread receives the stream and writes it in order to a pipe. A relay
+ * spools it from there for the archive, so the socket is still drained while
+ * the disk is formatted or written slower than the stream arrives.
+ */
+void Multicast::receiveToDevice() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::receiveToDevice() start");
+
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->initialize(Util::getDiskPath(this->_device));
+
+	Operation *waitOp = new Operation(
+				Doclone::OP_WAIT_SERVER, "");
+
+	Clone *dcl = Clone::getInstance();
+	dcl->addOperation(waitOp);
+
+	if(!Util::isBlockDevice(this->_device)) {
+		NoBlockDeviceException ex;
+		throw ex;
+	}
+
+	this->openSocket(true);
+	uint64_t totalSize = this->waitServer();
+
+	dcl->markCompleted(Doclone::OP_WAIT_SERVER, "");
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	trns->setTotalSize(totalSize);
+
+	int fds[2];
+	if(pipe(fds) < 0) {
+		ConnectionException ex;
+		throw ex;
+	}
+	this->_archiveFd = fds[0];
+	this->_networkFd = fds[1];
+
+	if(pthread_create(&this->_thread, 0, Multicast::receiverThread, this) != 0) {
+		ConnectionException ex;
+		throw ex;
+	}
+	this->_threadStarted = true;
+
+	/*
+	 * The server doesn't wait for anybody, so the stream is spooled all
+	 * along while the disk is prepared or written slower than it arrives.
+	 */
+	uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
+	this->_relay = new Relay(this->_archiveFd, -1, -1, window, false);
+
+	Image image;
+	image.initFdReadArchive(this->_relay->getLocalFd());
+	image.initDiskWriteArchive();
+	image.loadImageHeader();
+
+	if(image.canRestoreCheck(this->_device) == false) {
+		RestoreImageException ex;
+		throw ex;
+	}
+
+	image.initRestoreOperations(this->_device);
+	image.writePartitionTable(this->_device);
+	image.writePartitionsData(this->_device);
+
+	image.freeWriteArchive();
+	image.freeReadArchive();
+
+	pthread_join(this->_thread, 0);
+	this->_threadStarted = false;
+
+	if(this->_failed) {
+		ReceiveDataException ex;
+		throw ex;
+	}
+
+	this->_relay->finish();
+
+	this->closeConnection();
+
+	log->debug("Multicast::receiveToDevice() end");
+}
+
+/**
+ * \brief Performs the reception of an image or a device over network.
+ */
+void Multicast::receive() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::receive() start");
+
+	Clone *dcl = Clone::getInstance();
+
+	this->_srcIP = dcl->getAddress();
+
+	try {
+		if(dcl->getDevice().empty()) {
+			this->receiveToImage();
+		} else {
+			this->receiveToDevice();
+		}
+	} catch (const CancelException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const WriteDataException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const ReceiveDataException &ex) {
+		this->closeConnection();
+		throw;
+	} catch (const ErrorException &ex) {
+		this->closeConnection();
+		throw;
+	}
+
+	log->debug("Multicast::receive() end");
+}
+
+/**
+ * \brief Stops the network thread and closes the socket, the pipe and the
+ * spool
+ */
+void Multicast::closeConnection() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Multicast::closeConnection() start");
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+	pthread_mutex_unlock(&this->_mutex);
+
+	// Nobody else would close it
+	if(!this->_threadStarted && this->_networkFd >= 0) {
+		close(this->_networkFd);
+		this->_networkFd = -1;
+	}
+
+	// It reads the pipe until the thread stops and closes its end
+	if(this->_relay != 0) {
+		delete this->_relay;
+		this->_relay = 0;
+	}
+
+	// Closing our end of the pipe unblocks the thread
+	if(this->_archiveFd >= 0) {
+		close(this->_archiveFd);
+		this->_archiveFd = -1;
+	}
+
+	if(this->_threadStarted) {
+		pthread_join(this->_thread, 0);
+		this->_threadStarted = false;
+	}
+
+	if(this->_spool >= 0) {
+		close(this->_spool);
+		this->_spool = -1;
+	}
+
+	if(this->_sock >= 0) {
+		if(close(this->_sock)<0) {
+			CloseConnectionException ex;
+			ex.logMsg();
+		}
+		this->_sock = -1;
+	}
+
+	log->debug("Multicast::closeConnection() end");
+}
+
+}
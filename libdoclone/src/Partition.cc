@@ -26,12 +26,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <string>
 
-#include <blkid/blkid.h>
 #include <parted/parted.h>
 
+#include <doclone/BlkidScanner.h>
 #include <doclone/Clone.h>
 #include <doclone/Logger.h>
 #include <doclone/PartedDevice.h>
@@ -47,6 +48,7 @@
 #include <doclone/exception/UmountException.h>
 #include <doclone/exception/InvalidImageException.h>
 #include <doclone/exception/FileNotFoundException.h>
+#include <doclone/exception/ReadBlockMapException.h>
 
 namespace Doclone {
 
@@ -55,7 +57,8 @@ namespace Doclone {
  *
  */
 Partition::Partition() : _path(), _partNum(), _minSize(), _startPos(),
-		_usedPart(), _fs(), _type(), _flags(), _mountPoint(), _rootDir() {
+		_usedPart(), _fs(), _type(), _flags(), _mountPoint(), _rootDir(),
+		_blockMap(), _raw(), _formatted() {
 }
 /**
  * \brief Free this->_fs
@@ -67,6 +70,8 @@ Partition::~Partition() {
 		delete this->_fs;
 		this->_fs = 0;
 	}
+
+	delete this->_blockMap;
 }
 
 // Getters and setters
@@ -146,6 +151,48 @@ void Partition::setRootDir(const std::string &rootDir) {
 	this->_rootDir = rootDir;
 }
 
+const BlockMap *Partition::getBlockMap() const {
+	return this->_blockMap;
+}
+
+/**
+ * \brief Makes the partition be imaged block by block
+ *
+ * \param map
+ * 		Its used blocks, owned by the partition from now on
+ */
+void Partition::setBlockMap(BlockMap *map) {
+	delete this->_blockMap;
+	this->_blockMap = map;
+}
+
+bool Partition::getRaw() const {
+	return this->_raw;
+}
+
+void Partition::setRaw(bool raw) {
+	this->_raw = raw;
+}
+
+/**
+ * \brief Whether the data is copied from and to the device, block by block
+ * or raw, instead of file by file
+ *
+ * These partitions are neither mounted nor formatted, and their label and
+ * uuid come with the data.
+ */
+bool Partition::isDeviceImage() const {
+	return this->_blockMap != 0 || this->_raw;
+}
+
+/**
+ * \brief Whether the partition holds a new and empty filesystem, made by
+ * format()
+ */
+bool Partition::isFormatted() const {
+	return this->_formatted;
+}
+
 /**
  * \brief Initializes the partition from its path
  *
@@ -155,24 +202,62 @@ void Partition::setRootDir(const std::string &rootDir) {
 void Partition::initFromPath(const std::string &path) throw(Exception) {
 	this->_path = path;
 	this->initNum();
-	this->initType();
-	this->initFS();
+
+	// The partition table is read once for all the attributes
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->open();
+
+	try {
+		PedPartition *pPart = pedDev->getPartition(this->_partNum);
+
+		blkidInfo info;
+		BlkidScanner::probe(this->_path, info);
+
+		this->initType(pPart);
+		this->initFS(info);
+		this->initMinSize();
+		this->initStartPos(pPart);
+		this->initUsedPart(pPart);
+		this->initFlags(pPart);
+	} catch(...) {
+		pedDev->close();
+		throw;
+	}
+
+	pedDev->close();
+}
+
+/**
+ * \brief Initializes the partition from its entry in the partition table
+ *
+ * Used while walking the table, which must be kept open by the caller.
+ *
+ * \param pPart
+ * 		The libparted partition
+ * \param info
+ * 		The tags already read by libblkid from the partition
+ */
+void Partition::initFromPedPartition(PedPartition *pPart,
+		const blkidInfo &info) throw(Exception) {
+	this->_path = Util::buildPartPath(pPart->disk->dev->path, pPart->num);
+	this->_partNum = pPart->num;
+	this->initType(pPart);
+	this->initFS(info);
 	this->initMinSize();
-	this->initStartPos();
-	this->initUsedPart();
-	this->initFlags();
+	this->initStartPos(pPart);
+	this->initUsedPart(pPart);
+	this->initFlags(pPart);
 }
 
 /**
  * \brief Initializes the attribute this->_type
+ *
+ * \param pPart
+ * 		The libparted partition
  */
-void Partition::initType() throw(Exception) {
+void Partition::initType(const PedPartition *pPart) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->debug("Partition::initType() start");
-
-	PartedDevice *pedDev = PartedDevice::getInstance();
-	pedDev->open();
-	PedPartition *pPart = pedDev->getPartition(this->_partNum);
+	log->debug("Partition::initType(pPart=>0x%x) start", pPart);
 
 	switch (pPart->type) {
 		case PED_PARTITION_NORMAL: {
@@ -192,45 +277,22 @@ void Partition::initType() throw(Exception) {
 		}
 	}
 
-	pedDev->close();
-
 	log->debug("Partition::initType() end");
 }
 
 /**
  * \brief Initializes the attribute this->_fs
+ *
+ * \param info
+ * 		The tags read by libblkid from the partition
  */
-void Partition::initFS() throw(Exception) {
+void Partition::initFS(const blkidInfo &info) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->debug("Partition::initFS() start");
-
-	std::string fs_type;
-	const char *type, *value;
-	blkid_cache cache = 0;
-	blkidInfo info;
-
-	blkid_get_cache(&cache, "/dev/null"); //Do not use blkid cache
-	blkid_dev blDev = blkid_get_dev(cache, this->_path.c_str(), BLKID_DEV_NORMAL);
-	if(!blDev) {
-		info.type = "nofs";
-	} else {
-		blkid_tag_iterate iter = blkid_tag_iterate_begin(blDev);
-
-		while (blkid_tag_next(iter, &type, &value) == 0) {
-			if (!strcmp(type, "TYPE")) {
-				info.type = value;
-			}
-			if (!strcmp(type, "SEC_TYPE")) {
-				info.sec_type = value;
-			}
-		}
-		blkid_tag_iterate_end(iter);
-	}
-	blkid_put_cache(cache);
+	log->debug("Partition::initFS(info=>0x%x) start", &info);
 
 	this->_fs = FsFactory::createFilesystem(info);
-	this->_fs->readLabel(this->_path);
-	this->_fs->readUUID(this->_path);
+	this->_fs->setLabel(info.label);
+	this->_fs->setUUID(info.uuid);
 
 	log->debug("Partition::initFS() end");
 }
@@ -242,10 +304,37 @@ void Partition::initMinSize() throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Partition::initMinSize() start");
 
-	if(this->_type == Doclone::PARTITION_EXTENDED
-		|| this->_fs->getType() == Doclone::FSTYPE_NONE) {
+	Clone *dcl = Clone::getInstance();
+
+	if(this->_type == Doclone::PARTITION_EXTENDED) {
 		this->_minSize = 0;
 	}
+	else if(this->_fs->getCode() == Doclone::FS_NOFS) {
+		// Unknown contents, like LUKS or LVM, are imaged raw
+		PartedDevice *pedDev = PartedDevice::getInstance();
+		pedDev->open();
+		this->_minSize = pedDev->getPartitionSize(this->_partNum);
+		pedDev->close();
+
+		this->_raw = true;
+	}
+	else if(this->_fs->getType() == Doclone::FSTYPE_NONE) {
+		this->_minSize = 0;
+	}
+	else if(dcl->getBlockImaging() && this->_fs->getBlockSupport()) {
+		BlockMap *map = new BlockMap();
+
+		try {
+			this->_fs->readBlockMap(this->_path, *map);
+			this->_blockMap = map;
+			this->_minSize = map->getUsedBytes();
+		} catch (const ReadBlockMapException &ex) {
+			// Imaged file by file, as if block imaging was off
+			delete map;
+			ex.logMsg();
+			this->_minSize = this->usedSpace();
+		}
+	}
 	else {
 		this->_minSize = this->usedSpace();
 	}
@@ -255,52 +344,47 @@ void Partition::initMinSize() throw(Exception) {
 
 /**
  * \brief Initializes the attribute this->_startPos
+ *
+ * \param pPart
+ * 		The libparted partition
  */
-void Partition::initStartPos() throw(Exception) {
+void Partition::initStartPos(const PedPartition *pPart) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->debug("Partition::initStartPos() start");
+	log->debug("Partition::initStartPos(pPart=>0x%x) start", pPart);
 
-	PartedDevice *pedDev = PartedDevice::getInstance();
-	pedDev->open();
-	PedDevice *pDev = pedDev->getDevice();
-	PedPartition *pPart = pedDev->getPartition(this->_partNum);
+	const PedDevice *pDev = pPart->disk->dev;
 
 	this->_startPos = static_cast<double>(pPart->geom.start) / pDev->length;
 
-	pedDev->close();
-
 	log->debug("Partition::initStartPos() end");
 }
 
 /**
  * \brief Initializes the attribute this->_usedPart
+ *
+ * \param pPart
+ * 		The libparted partition
  */
-void Partition::initUsedPart() throw(Exception) {
+void Partition::initUsedPart(const PedPartition *pPart) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->debug("Partition::initUsedPart() start");
+	log->debug("Partition::initUsedPart(pPart=>0x%x) start", pPart);
 
-	PartedDevice *pedDev = PartedDevice::getInstance();
-	pedDev->open();
-	PedDevice *pDev = pedDev->getDevice();
-	PedPartition *pPart = pedDev->getPartition(this->_partNum);
+	const PedDevice *pDev = pPart->disk->dev;
 
 	this->_usedPart = static_cast<double>(pPart->geom.length) / pDev->length;
 
-	pedDev->close();
-
 	log->debug("Partition::initUsedPart() end");
 }
 
 /**
  * \brief Initializes the attribute this->_flags
+ *
+ * \param pPart
+ * 		The libparted partition
  */
-void Partition::initFlags() throw(Exception) {
+void Partition::initFlags(PedPartition *pPart) throw(Exception) {
 	Logger *log = Logger::getInstance();
-	log->debug("Partition::initFlags() start");
-
-	PartedDevice *pedDev = PartedDevice::getInstance();
-	pedDev->open();
-	PedPartition *pPart = pedDev->getPartition(this->_partNum);
+	log->debug("Partition::initFlags(pPart=>0x%x) start", pPart);
 
 	this->_flags = 0;
 
@@ -347,8 +431,6 @@ void Partition::initFlags() throw(Exception) {
 		this->_flags|=Doclone::F_DIAG;
 	}
 
-	pedDev->close();
-
 	log->debug("Partition::initFlags() end");
 }
 
@@ -423,6 +505,16 @@ bool Partition::fitInDevice(bool diskImage) throw(Exception) {
 
 	bool retValue = this->_minSize < devSize;
 
+	// A block image is written to the same offsets, it needs the whole fs
+	if(this->_blockMap != 0) {
+		retValue = this->_blockMap->getDeviceSize() <= devSize;
+	}
+
+	// And a raw image needs the whole partition
+	if(this->_raw) {
+		retValue = this->_minSize <= devSize;
+	}
+
 	pedDev->close();
 
 	log->debug("Partition::fitInDevice(retValue=>%d) end", retValue);
@@ -533,7 +625,14 @@ void Partition::doUmount() throw(Exception) {
 		return;
 	}
 
-	sync();
+	// Only the filesystem of this partition is flushed
+	int fd = open(this->_mountPoint.c_str(), O_RDONLY | O_DIRECTORY);
+	if(fd < 0 || syncfs(fd) < 0) {
+		sync();
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
 
 	if(umount2(this->_mountPoint.c_str(), MNT_DETACH)<0) {
 		UmountException ex(this->_mountPoint.c_str());
@@ -574,7 +673,8 @@ bool Partition::isMounted() throw(Exception) {
 			retValue = true;
 			break;
 		} else if (!uuidDevPath.compare(filesys->mnt_fsname)) {
-			if(!Util::isUUIDRepeated(this->_fs->getUUID().c_str())) {
+			BlkidScanner *scanner = BlkidScanner::getInstance();
+			if(!scanner->isUUIDRepeated(this->_fs->getUUID())) {
 				this->_mountPoint =  filesys->mnt_dir;
 				retValue = true;
 				break;
@@ -598,6 +698,26 @@ void Partition::clearSignatures() const throw(Exception) {
 	PartedDevice *pedDev = PartedDevice::getInstance();
 	pedDev->open();
 
+	this->eraseSignatures();
+	ped_device_sync(pedDev->getDevice());
+
+	pedDev->close();
+
+	log->debug("Partition::clearSignatures() end");
+}
+
+/**
+ * \brief Overwrites old signatures and superblocks without flushing them
+ *
+ * Used to clear several partitions with a single ped_device_sync().
+ */
+void Partition::eraseSignatures() const throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Partition::eraseSignatures() start");
+
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->open();
+
 	/*
 	 * The first 68KiB are enough to contain the superblocks of all the
 	 * filsystems supported by libdoclone
@@ -613,17 +733,19 @@ void Partition::clearSignatures() const throw(Exception) {
 	PedPartition *pPart = pedDev->getPartition(this->_partNum);
 
 	ped_geometry_write(&pPart->geom, buf, 0, size/sectorSize);
-	ped_device_sync(pedDev->getDevice());
+
+	// The uuid of the partition is gone
+	BlkidScanner::getInstance()->clearIndex();
 
 	pedDev->close();
 
-	log->debug("Partition::clearSignatures() end");
+	log->debug("Partition::eraseSignatures() end");
 }
 
 /**
  * \brief Formats the partition
  */
-void Partition::format() const throw(Exception) {
+void Partition::format() throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Partition::format() start");
 
@@ -640,6 +762,9 @@ void Partition::format() const throw(Exception) {
 		throw ex;
 	}
 
+	this->_formatted = true;
+	BlkidScanner::getInstance()->clearIndex();
+
 	log->debug("Partition::format() end");
 }
 
@@ -663,6 +788,7 @@ void Partition::writeUUID() const throw(Exception) {
 	log->debug("Partition::writeUUID() start");
 
 	this->_fs->writeUUID(this->_path);
+	BlkidScanner::getInstance()->clearIndex();
 
 	log->debug("Partition::writeUUID() end");
 }
@@ -674,6 +800,24 @@ void Partition::writeFlags() const throw(Exception) {
 	Logger *log = Logger::getInstance();
 	log->debug("Partition::writeFlags() start");
 
+	PartedDevice *pedDev = PartedDevice::getInstance();
+	pedDev->open();
+
+	this->setFlags();
+
+	pedDev->commit();
+	pedDev->close();
+
+	log->debug("Partition::writeFlags() end");
+}
+
+/**
+ * \brief Sets the partition flags in the table in memory, without committing
+ */
+void Partition::setFlags() const throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Partition::setFlags() start");
+
 	PartedDevice *pedDev = PartedDevice::getInstance();
 	pedDev->open();
 	PedPartition *pPart = pedDev->getPartition(this->_partNum);
@@ -736,10 +880,9 @@ void Partition::writeFlags() const throw(Exception) {
 		ped_partition_set_flag(pPart, PED_PARTITION_DIAG, fDiag);
 	}
 
-	pedDev->commit();
 	pedDev->close();
 
-	log->debug("Partition::writeFlags() end");
+	log->debug("Partition::setFlags() end");
 }
 
 /**
@@ -754,8 +897,10 @@ bool Partition::isWritable() const throw(Exception) {
 	bool retValue;
 
 	if(this->_type == Doclone::PARTITION_EXTENDED // It is extended
-		|| this->_fs->getType() == Doclone::FSTYPE_NONE // It doesn't have a unix or dos filesystem
-		|| !this->_fs->getMountSupport() // System can't mount it
+		|| (this->_fs->getType() == Doclone::FSTYPE_NONE // It doesn't have a unix or dos filesystem
+			&& !this->_raw) // and it isn't read raw
+		|| (!this->_fs->getMountSupport() // System can't mount it
+			&& !this->isDeviceImage()) // and it isn't read from the device
 		|| this->_usedPart == 0) { // It isn't a data partition
 		retValue = false;
 	}
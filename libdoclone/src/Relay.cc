@@ -0,0 +1,620 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/Relay.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <doclone/DataTransfer.h>
+#include <doclone/Logger.h>
+#include <doclone/SenderPool.h>
+#include <doclone/Util.h>
+#include <doclone/exception/CreateFileException.h>
+#include <doclone/exception/InitializationException.h>
+#include <doclone/exception/ReadDataException.h>
+#include <doclone/exception/ReceiveDataException.h>
+#include <doclone/exception/SendDataException.h>
+#include <doclone/exception/WriteDataException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Starts the forwarding and the local writing threads
+ *
+ * \param fdin
+ * 		Socket connected to the previous link, or a pipe with the stream
+ * \param fdnext
+ * 		Socket connected to the next link, -1 if this is the last one
+ * \param fdlocal
+ * 		Descriptor where the local copy is written, or -1 to write it to a
+ * 		pipe that is read through getLocalFd()
+ * \param window
+ * 		Bytes the local copy can fall behind before spooling, 0 for the
+ * 		default
+ * \param notify
+ * 		Whether the local writes are counted as transferred data
+ */
+Relay::Relay(int fdin, int fdnext, int fdlocal, uint64_t window, bool notify)
+		throw(Exception)
+		: _fdin(fdin), _fdnext(fdnext), _fdlocal(fdlocal), _pipeRead(-1),
+		  _ownsLocal(false), _host(), _window(window), _notify(notify), _blocks(), _queued(0), _head(0),
+		  _written(0), _spoolFd(-1), _spoolSize(0), _spoolEnabled(true),
+		  _spooling(false), _appending(false),
+		  _spoolStart(0), _spoolEnd(0), _finished(false), _recvFailed(false),
+		  _nextFailed(false), _localFailed(false), _localClosed(false),
+		  _stop(false), _forwarder(), _writer(), _forwarderStarted(false),
+		  _writerStarted(false), _mutex(), _filled(), _drained() {
+	Logger *log = Logger::getInstance();
+	log->debug("Relay::Relay(fdin=>%d, fdnext=>%d, fdlocal=>%d) start", fdin, fdnext, fdlocal);
+
+	if(this->_window == 0) {
+		this->_window = Doclone::DEFAULT_LAG_WINDOW;
+	}
+
+	struct sockaddr_in addr;
+	socklen_t addrSize = sizeof(addr);
+	if(fdnext >= 0 && getpeername(fdnext, reinterpret_cast<sockaddr *>(&addr),
+			&addrSize) == 0) {
+		this->_host = inet_ntoa(addr.sin_addr);
+	}
+
+	if(fdlocal < 0) {
+		int fds[2];
+		if(pipe(fds) < 0) {
+			InitializationException ex;
+			throw ex;
+		}
+
+		// Written without blocking, so the writer can be stopped
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		this->_pipeRead = fds[0];
+		this->_fdlocal = fds[1];
+		this->_ownsLocal = true;
+	}
+
+	char path[] = "/tmp/doclone-spool-XXXXXX";
+	if((this->_spoolFd = mkstemp(path)) < 0) {
+		// Without spool, the forwarder waits for the local writer
+		CreateFileException ex(path);
+		ex.logMsg();
+	} else {
+		// Nobody else needs the name
+		unlink(path);
+
+		// /tmp may be in memory, like in live systems
+		this->_spoolSize = Doclone::RELAY_SPOOL_SIZE;
+		struct statvfs info;
+		if(fstatvfs(this->_spoolFd, &info) == 0) {
+			uint64_t free = static_cast<uint64_t>(info.f_bavail)
+					* info.f_frsize / 2;
+			if(free < this->_spoolSize) {
+				this->_spoolSize = free;
+			}
+		}
+	}
+
+	pthread_mutex_init(&this->_mutex, 0);
+	pthread_cond_init(&this->_filled, 0);
+	pthread_cond_init(&this->_drained, 0);
+
+	if(pthread_create(&this->_writer, 0, Relay::writerThread, this) != 0) {
+		this->stop();
+
+		InitializationException ex;
+		throw ex;
+	}
+	this->_writerStarted = true;
+
+	if(pthread_create(&this->_forwarder, 0, Relay::forwarderThread,
+			this) != 0) {
+		this->stop();
+
+		InitializationException ex;
+		throw ex;
+	}
+	this->_forwarderStarted = true;
+
+	log->debug("Relay::Relay() end");
+}
+
+/**
+ * \brief Stops the threads, if still running, and frees the resources
+ */
+Relay::~Relay() {
+	this->stop();
+}
+
+/**
+ * \brief Returns the descriptor the local copy is read from
+ *
+ * Only if the relay was created without a local descriptor. It gets the end of
+ * file once the whole stream has been written.
+ */
+int Relay::getLocalFd() const {
+	return this->_pipeRead;
+}
+
+/**
+ * \brief Stops spooling new blocks
+ *
+ * The data already spooled is still written, but from now on the forwarder
+ * waits for the local writer once the window is full.
+ */
+void Relay::stopSpooling() {
+	Logger *log = Logger::getInstance();
+	log->debug("Relay::stopSpooling() start");
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_spoolEnabled = false;
+	pthread_mutex_unlock(&this->_mutex);
+
+	log->debug("Relay::stopSpooling() end");
+}
+
+/**
+ * \brief Waits until the stream has been forwarded and written locally
+ *
+ * If the local copy is a pipe, its reader must have finished, the rest of the
+ * stream isn't written to it. A failure of the next link is only reported.
+ */
+void Relay::finish() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Relay::finish() start");
+
+	if(this->_pipeRead >= 0) {
+		close(this->_pipeRead);
+		this->_pipeRead = -1;
+	}
+
+	if(this->_forwarderStarted) {
+		pthread_join(this->_forwarder, 0);
+		this->_forwarderStarted = false;
+	}
+
+	if(this->_writerStarted) {
+		pthread_join(this->_writer, 0);
+		this->_writerStarted = false;
+	}
+
+	if(this->_nextFailed) {
+		SendDataException ex(this->_host);
+		ex.logMsg();
+	}
+
+	if(this->_recvFailed) {
+		ReceiveDataException ex;
+		throw ex;
+	}
+
+	if(this->_localFailed) {
+		WriteDataException ex;
+		throw ex;
+	}
+
+	log->debug("Relay::finish() end");
+}
+
+/**
+ * \brief Main function of the forwarding thread
+ *
+ * \param data
+ * 		Pointer to the Relay object
+ */
+void *Relay::forwarderThread(void *data) {
+	Relay *relay = static_cast<Relay *>(data);
+
+	Util::blockSignals();
+
+	try {
+		relay->forward();
+	} catch(const Exception &ex) {
+		pthread_mutex_lock(&relay->_mutex);
+		relay->_recvFailed = true;
+		pthread_mutex_unlock(&relay->_mutex);
+	}
+
+	pthread_mutex_lock(&relay->_mutex);
+	relay->_finished = true;
+	pthread_cond_broadcast(&relay->_filled);
+	pthread_mutex_unlock(&relay->_mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Main function of the local writing thread
+ *
+ * \param data
+ * 		Pointer to the Relay object
+ */
+void *Relay::writerThread(void *data) {
+	Relay *relay = static_cast<Relay *>(data);
+
+	Util::blockSignals();
+
+	try {
+		relay->writeLocal();
+	} catch(const Exception &ex) {
+		pthread_mutex_lock(&relay->_mutex);
+		relay->_localFailed = true;
+		pthread_mutex_unlock(&relay->_mutex);
+	}
+
+	// The end of file for the reader of the pipe
+	if(relay->_ownsLocal) {
+		close(relay->_fdlocal);
+		relay->_fdlocal = -1;
+	}
+
+	// The forwarder may be waiting for room
+	pthread_mutex_lock(&relay->_mutex);
+	pthread_cond_broadcast(&relay->_drained);
+	pthread_mutex_unlock(&relay->_mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Receives the stream and sends each block to the next link at once
+ */
+void Relay::forward() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Relay::forward() start");
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	dcBuffSize size = trns->getBufferSize(this->_fdin);
+
+	for(;;) {
+		std::vector<char> *block = new std::vector<char>(size);
+
+		ssize_t nbytes = read(this->_fdin, &(*block)[0], size);
+		if(nbytes <= 0) {
+			delete block;
+
+			if(nbytes < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if(nbytes < 0) {
+				ReceiveDataException ex;
+				throw ex;
+			}
+
+			break;
+		}
+
+		block->resize(nbytes);
+
+		if(this->_fdnext >= 0 && !this->_nextFailed) {
+			const char *buf = &(*block)[0];
+			size_t left = nbytes;
+
+			while(left > 0) {
+				ssize_t sent = send(this->_fdnext, buf, left, MSG_NOSIGNAL);
+				if(sent < 0 && errno == EINTR) {
+					continue;
+				}
+
+				if(sent <= 0) {
+					// The rest of the chain is lost, the local copy goes on
+					this->_nextFailed = true;
+					break;
+				}
+
+				buf += sent;
+				left -= sent;
+			}
+		}
+
+		this->queue(block);
+	}
+
+	// The next link sees the end of the stream without waiting for this one
+	if(this->_fdnext >= 0 && !this->_nextFailed) {
+		shutdown(this->_fdnext, SHUT_WR);
+	}
+
+	log->debug("Relay::forward() end");
+}
+
+/**
+ * \brief Hands a block to the local writer
+ *
+ * The block is kept in memory while the writer is within the window, and
+ * appended to the spool otherwise. If the spool is full or disabled, it waits
+ * for the writer.
+ *
+ * \param block
+ * 		The block, owned by the relay from now on
+ */
+void Relay::queue(std::vector<char> *block) {
+	size_t len = block->size();
+
+	pthread_mutex_lock(&this->_mutex);
+
+	for(;;) {
+		// Nobody will read it
+		if(this->_localFailed || this->_localClosed || this->_stop) {
+			this->_head += len;
+			pthread_mutex_unlock(&this->_mutex);
+			delete block;
+			return;
+		}
+
+		if(this->_spooling) {
+			// The spool is emptied once the writer catches up
+			if(this->_head - this->_spoolStart + len <= this->_spoolSize) {
+				break;
+			}
+		} else if(this->_queued == 0
+				|| this->_queued + len <= this->_window) {
+			this->_blocks.push_back(block);
+			this->_queued += len;
+			this->_head += len;
+			pthread_cond_broadcast(&this->_filled);
+			pthread_mutex_unlock(&this->_mutex);
+			return;
+		} else if(this->_spoolFd >= 0 && this->_spoolEnabled
+				&& len <= this->_spoolSize) {
+			this->_spooling = true;
+			this->_spoolStart = this->_head;
+			this->_spoolEnd = this->_head;
+			break;
+		}
+
+		pthread_cond_wait(&this->_drained, &this->_mutex);
+	}
+
+	// Only this thread writes the spool, the writer waits for _spoolEnd
+	off_t offset = this->_head - this->_spoolStart;
+	this->_head += len;
+	this->_appending = true;
+	pthread_mutex_unlock(&this->_mutex);
+
+	bool written = true;
+	for(size_t done = 0; done < len;) {
+		ssize_t nbytes = pwrite(this->_spoolFd, &(*block)[done], len - done,
+				offset + done);
+		if(nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(nbytes <= 0) {
+			written = false;
+			break;
+		}
+
+		done += nbytes;
+	}
+
+	delete block;
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_appending = false;
+	if(written) {
+		this->_spoolEnd += len;
+	} else {
+		WriteDataException ex;
+		ex.logMsg();
+		this->_localFailed = true;
+	}
+	pthread_cond_broadcast(&this->_filled);
+	pthread_mutex_unlock(&this->_mutex);
+}
+
+/**
+ * \brief Writes the queued blocks, and then the spooled data, to the local
+ * descriptor
+ */
+void Relay::writeLocal() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Relay::writeLocal() start");
+
+	std::vector<char> buf;
+
+	pthread_mutex_lock(&this->_mutex);
+	while(!this->_stop && !this->_localFailed) {
+		if(!this->_blocks.empty()) {
+			std::vector<char> *block = this->_blocks.front();
+			this->_blocks.pop_front();
+			pthread_mutex_unlock(&this->_mutex);
+
+			bool open;
+			try {
+				open = this->writeAll(&(*block)[0], block->size());
+			} catch(...) {
+				delete block;
+				throw;
+			}
+
+			pthread_mutex_lock(&this->_mutex);
+			this->_queued -= block->size();
+			this->_written += block->size();
+			delete block;
+			pthread_cond_broadcast(&this->_drained);
+
+			if(!open) {
+				break;
+			}
+		} else if(this->_spooling && this->_written < this->_spoolEnd) {
+			uint64_t left = this->_spoolEnd - this->_written;
+			size_t len = left < Doclone::ZEROCOPY_CHUNK_SIZE ?
+					left : Doclone::ZEROCOPY_CHUNK_SIZE;
+			off_t offset = this->_written - this->_spoolStart;
+			pthread_mutex_unlock(&this->_mutex);
+
+			buf.resize(len);
+			ssize_t nbytes;
+			while((nbytes = pread(this->_spoolFd, &buf[0], len, offset)) < 0
+					&& errno == EINTR);
+
+			if(nbytes <= 0) {
+				ReadDataException ex;
+				throw ex;
+			}
+
+			bool open = this->writeAll(&buf[0], nbytes);
+
+			pthread_mutex_lock(&this->_mutex);
+			this->_written += nbytes;
+
+			if(!open) {
+				break;
+			}
+		} else if(this->_spooling && !this->_appending) {
+			// Caught up, back to memory. The spool space is freed
+			this->_spooling = false;
+			ftruncate(this->_spoolFd, 0);
+			pthread_cond_broadcast(&this->_drained);
+		} else if(this->_finished && !this->_spooling) {
+			break;
+		} else {
+			pthread_cond_wait(&this->_filled, &this->_mutex);
+		}
+	}
+	pthread_mutex_unlock(&this->_mutex);
+
+	log->debug("Relay::writeLocal() end");
+}
+
+/**
+ * \brief Writes a whole buffer to the local descriptor
+ *
+ * \param buf
+ * 		The data
+ * \param len
+ * 		Size of the data
+ *
+ * \return False if the reader of the local pipe has closed it, or the relay
+ * is being stopped
+ */
+bool Relay::writeAll(const char *buf, size_t len) throw(Exception) {
+	size_t left = len;
+
+	while(left > 0) {
+		ssize_t nbytes = write(this->_fdlocal, buf, left);
+
+		if(nbytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			if(errno == EAGAIN) {
+				pthread_mutex_lock(&this->_mutex);
+				bool stopped = this->_stop;
+				pthread_mutex_unlock(&this->_mutex);
+
+				if(stopped) {
+					return false;
+				}
+
+				pollfd pfd = { this->_fdlocal, POLLOUT, 0 };
+				poll(&pfd, 1, 100);
+				continue;
+			}
+
+			if(errno == EPIPE) {
+				pthread_mutex_lock(&this->_mutex);
+				this->_localClosed = true;
+				pthread_mutex_unlock(&this->_mutex);
+
+				return false;
+			}
+
+			WriteDataException ex;
+			throw ex;
+		}
+
+		buf += nbytes;
+		left -= nbytes;
+	}
+
+	if(this->_notify) {
+		DataTransfer *trns = DataTransfer::getInstance();
+		trns->addTransferredBytes(len);
+	}
+
+	return true;
+}
+
+/**
+ * \brief Stops and joins the threads that are still running, and frees the
+ * resources
+ *
+ * The sockets are shut down, so the forwarder doesn't stay blocked on them.
+ */
+void Relay::stop() {
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+	pthread_cond_broadcast(&this->_filled);
+	pthread_cond_broadcast(&this->_drained);
+	pthread_mutex_unlock(&this->_mutex);
+
+	// The writer gets EPIPE instead of waiting for a reader
+	if(this->_pipeRead >= 0) {
+		close(this->_pipeRead);
+		this->_pipeRead = -1;
+	}
+
+	if(this->_forwarderStarted) {
+		shutdown(this->_fdin, SHUT_RDWR);
+		if(this->_fdnext >= 0) {
+			shutdown(this->_fdnext, SHUT_RDWR);
+		}
+
+		pthread_join(this->_forwarder, 0);
+		this->_forwarderStarted = false;
+	}
+
+	if(this->_writerStarted) {
+		pthread_join(this->_writer, 0);
+		this->_writerStarted = false;
+	}
+
+	std::deque<std::vector<char> *>::iterator it;
+	for(it = this->_blocks.begin(); it != this->_blocks.end(); ++it) {
+		delete *it;
+	}
+	this->_blocks.clear();
+
+	// The writer never ran
+	if(this->_ownsLocal && this->_fdlocal >= 0) {
+		close(this->_fdlocal);
+		this->_fdlocal = -1;
+	}
+
+	if(this->_spoolFd >= 0) {
+		close(this->_spoolFd);
+		this->_spoolFd = -1;
+	}
+
+	pthread_cond_destroy(&this->_drained);
+	pthread_cond_destroy(&this->_filled);
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+}
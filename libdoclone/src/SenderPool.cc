@@ -0,0 +1,721 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/SenderPool.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <doclone/DataTransfer.h>
+#include <doclone/Logger.h>
+#include <doclone/Util.h>
+#include <doclone/exception/CreateFileException.h>
+#include <doclone/exception/DropReceiverException.h>
+#include <doclone/exception/InitializationException.h>
+#include <doclone/exception/ReadDataException.h>
+#include <doclone/exception/SendDataException.h>
+#include <doclone/exception/WriteDataException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Starts a sender thread for each receiver
+ *
+ * \param fds
+ * 		Sockets connected to the receivers
+ * \param window
+ * 		Lag window in bytes
+ * \param policy
+ * 		What to do with the receivers that fall out of the window
+ */
+SenderPool::SenderPool(const std::vector<int> &fds, uint64_t window,
+		Doclone::dcLagPolicy policy) throw(Exception)
+		: _window(window), _policy(policy), _senders(), _ring(), _head(0),
+		  _finished(false), _stop(false), _mutex(), _filled(), _drained() {
+	Logger *log = Logger::getInstance();
+	log->debug("SenderPool::SenderPool(window=>%d, policy=>%d) start", window, policy);
+
+	if(this->_window == 0) {
+		this->_window = Doclone::DEFAULT_LAG_WINDOW;
+	}
+
+	pthread_mutex_init(&this->_mutex, 0);
+	pthread_cond_init(&this->_filled, 0);
+	pthread_cond_init(&this->_drained, 0);
+
+	std::vector<int>::const_iterator it;
+	for(it = fds.begin(); it != fds.end(); ++it) {
+		sender *snd = new sender();
+		snd->fd = *it;
+		snd->state = SENDER_RING;
+		snd->reported = false;
+		snd->sent = 0;
+		snd->busy = 0;
+		snd->spoolFd = -1;
+		snd->ownSpool = false;
+		snd->spoolBase = 0;
+		snd->spoolStart = 0;
+		snd->spoolEnd = 0;
+		snd->started = false;
+		snd->pool = this;
+
+		struct sockaddr_in addr;
+		socklen_t addrSize = sizeof(addr);
+		if(getpeername(*it, reinterpret_cast<sockaddr *>(&addr),
+				&addrSize) == 0) {
+			snd->host = inet_ntoa(addr.sin_addr);
+		}
+
+		this->_senders.push_back(snd);
+	}
+
+	std::vector<sender *>::iterator st;
+	for(st = this->_senders.begin(); st != this->_senders.end(); ++st) {
+		if(pthread_create(&(*st)->thread, 0, SenderPool::senderThread,
+				*st) != 0) {
+			this->stop();
+
+			InitializationException ex;
+			throw ex;
+		}
+
+		(*st)->started = true;
+	}
+
+	log->debug("SenderPool::SenderPool() end");
+}
+
+/**
+ * \brief Stops the senders and frees the resources
+ *
+ * Receivers that have not got the whole stream are disconnected.
+ */
+SenderPool::~SenderPool() {
+	this->stop();
+}
+
+/**
+ * \brief Appends data to the stream
+ *
+ * Waits only while the fastest receiver is a whole window behind. The data is
+ * copied, so the buffer can be reused once this method returns.
+ *
+ * \param buf
+ * 		The data
+ * \param len
+ * 		Size of the data
+ */
+void SenderPool::write(const void *buf, size_t len) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("SenderPool::write(buf=>0x%x, len=>%d) start", buf, len);
+
+	if(len == 0) {
+		log->loopDebug("SenderPool::write() end");
+		return;
+	}
+
+	const char *data = static_cast<const char *>(buf);
+	std::vector<sender *> spooled;
+
+	pthread_mutex_lock(&this->_mutex);
+
+	try {
+		for(;;) {
+			uint64_t minLag = 0;
+			bool inRing = false;
+
+			std::vector<sender *>::iterator it;
+			for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+				if((*it)->state != SENDER_RING) {
+					continue;
+				}
+
+				uint64_t lag = this->_head - (*it)->sent;
+				if(!inRing || lag < minLag) {
+					minLag = lag;
+				}
+				inRing = true;
+			}
+
+			if(!inRing || minLag == 0 || minLag + len <= this->_window) {
+				break;
+			}
+
+			pthread_cond_wait(&this->_drained, &this->_mutex);
+		}
+
+		unsigned int refs = 0;
+
+		std::vector<sender *>::iterator it;
+		for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+			sender *snd = *it;
+
+			if(snd->state == SENDER_RING) {
+				uint64_t lag = this->_head - snd->sent;
+				if(lag > 0 && lag + len > this->_window) {
+					this->applyPolicy(snd);
+				}
+			}
+
+			if(snd->state == SENDER_RING) {
+				refs++;
+			} else if(snd->state == SENDER_SPOOL) {
+				spooled.push_back(snd);
+			}
+		}
+
+		if(refs > 0) {
+			chunk *chk = new chunk();
+			chk->data.assign(data, data + len);
+			chk->offset = this->_head;
+			chk->refs = refs;
+			this->_ring.push_back(chk);
+		}
+	} catch(...) {
+		pthread_mutex_unlock(&this->_mutex);
+		throw;
+	}
+
+	uint64_t offset = this->_head;
+	this->_head += len;
+	pthread_mutex_unlock(&this->_mutex);
+
+	// Only this thread writes the spools, the senders wait for spoolEnd
+	std::vector<bool> written;
+	std::vector<sender *>::iterator it;
+	for(it = spooled.begin(); it != spooled.end(); ++it) {
+		written.push_back(this->spool(*it, data, len, offset));
+	}
+
+	pthread_mutex_lock(&this->_mutex);
+	for(unsigned int i = 0; i < spooled.size(); i++) {
+		if(written[i]) {
+			spooled[i]->spoolEnd = this->_head;
+		} else if(spooled[i]->state == SENDER_SPOOL) {
+			this->drop(spooled[i]);
+		}
+	}
+	pthread_cond_broadcast(&this->_filled);
+	pthread_mutex_unlock(&this->_mutex);
+
+	this->reportFailures();
+
+	log->loopDebug("SenderPool::write() end");
+}
+
+/**
+ * \brief Marks the end of the stream and waits for all the receivers
+ */
+void SenderPool::finish() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("SenderPool::finish() start");
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_finished = true;
+	pthread_cond_broadcast(&this->_filled);
+
+	for(;;) {
+		bool running = false;
+
+		std::vector<sender *>::iterator it;
+		for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+			running = running || this->isActive(*it);
+		}
+
+		if(!running) {
+			break;
+		}
+
+		pthread_cond_wait(&this->_drained, &this->_mutex);
+	}
+	pthread_mutex_unlock(&this->_mutex);
+
+	this->reportFailures();
+
+	log->debug("SenderPool::finish() end");
+}
+
+/**
+ * \brief Sends the rest of the regular file [fdin] to all the receivers
+ *
+ * The file itself acts as the spool of every receiver, so each one is sent
+ * with sendfile() from its own offset and nobody waits for anybody. The
+ * progress reported is the one of the slowest receiver.
+ *
+ * \param fdin
+ * 		The file to be sent
+ */
+void SenderPool::sendFile(int fdin) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("SenderPool::sendFile(fdin=>%d) start", fdin);
+
+	DataTransfer *trns = DataTransfer::getInstance();
+	off_t start = lseek(fdin, 0, SEEK_CUR);
+	struct stat st;
+
+	if(start < 0 || fstat(fdin, &st) != 0) {
+		ReadDataException ex;
+		throw ex;
+	}
+
+	uint64_t size = st.st_size > start ? st.st_size - start : 0;
+
+	pthread_mutex_lock(&this->_mutex);
+
+	std::vector<sender *>::iterator it;
+	for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+		if((*it)->state == SENDER_RING) {
+			(*it)->spoolFd = fdin;
+			(*it)->ownSpool = false;
+			(*it)->spoolBase = start;
+			(*it)->spoolStart = 0;
+			(*it)->spoolEnd = size;
+			(*it)->state = SENDER_SPOOL;
+		}
+	}
+
+	this->_head = size;
+	this->_finished = true;
+	pthread_cond_broadcast(&this->_filled);
+
+	uint64_t reported = 0;
+	for(;;) {
+		bool running = false;
+		uint64_t slowest = size;
+
+		for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+			if(this->isActive(*it)) {
+				running = true;
+				if((*it)->sent < slowest) {
+					slowest = (*it)->sent;
+				}
+			}
+		}
+
+		if(slowest > reported) {
+			// Notifying the views may take a while, don't hold the senders
+			pthread_mutex_unlock(&this->_mutex);
+			trns->addTransferredBytes(slowest - reported);
+			pthread_mutex_lock(&this->_mutex);
+			reported = slowest;
+			continue;
+		}
+
+		if(!running) {
+			break;
+		}
+
+		pthread_cond_wait(&this->_drained, &this->_mutex);
+	}
+	pthread_mutex_unlock(&this->_mutex);
+
+	lseek(fdin, start + size, SEEK_SET);
+
+	this->reportFailures();
+
+	log->debug("SenderPool::sendFile() end");
+}
+
+/**
+ * \brief Main loop of the sender threads
+ *
+ * \param data
+ * 		Pointer to the sender
+ */
+void *SenderPool::senderThread(void *data) {
+	sender *snd = static_cast<sender *>(data);
+	SenderPool *pool = snd->pool;
+
+	Util::blockSignals();
+
+	pthread_mutex_lock(&pool->_mutex);
+	while(!pool->_stop) {
+		if(snd->state == SENDER_RING) {
+			chunk *chk = 0;
+
+			std::deque<chunk *>::iterator it;
+			for(it = pool->_ring.begin(); it != pool->_ring.end(); ++it) {
+				if((*it)->offset == snd->sent) {
+					chk = *it;
+					break;
+				}
+			}
+
+			if(chk == 0) {
+				if(pool->_finished && snd->sent == pool->_head) {
+					snd->state = SENDER_DONE;
+					break;
+				}
+
+				pthread_cond_wait(&pool->_filled, &pool->_mutex);
+				continue;
+			}
+
+			snd->busy = chk;
+			pthread_mutex_unlock(&pool->_mutex);
+
+			const char *buf = &chk->data[0];
+			size_t size = chk->data.size();
+			size_t left = size;
+			bool failed = false;
+
+			while(left > 0) {
+				ssize_t nbytes = send(snd->fd, buf, left, MSG_NOSIGNAL);
+				if(nbytes < 0 && errno == EINTR) {
+					continue;
+				}
+
+				if(nbytes <= 0) {
+					failed = true;
+					break;
+				}
+
+				buf += nbytes;
+				left -= nbytes;
+			}
+
+			pthread_mutex_lock(&pool->_mutex);
+
+			// While busy, the chunk being sent is left to the code below
+			if(failed && snd->state == SENDER_RING) {
+				pool->releaseChunks(snd);
+			}
+
+			// The chunk may be freed from now on
+			snd->busy = 0;
+			chk->refs--;
+			pool->freeChunks();
+
+			if(failed) {
+				if(snd->state != SENDER_DROPPED) {
+					snd->state = SENDER_FAILED;
+				}
+				break;
+			}
+
+			snd->sent += size;
+			pthread_cond_broadcast(&pool->_drained);
+		} else if(snd->state == SENDER_SPOOL) {
+			if(snd->sent == snd->spoolEnd) {
+				if(pool->_finished && snd->sent == pool->_head) {
+					snd->state = SENDER_DONE;
+					break;
+				}
+
+				pthread_cond_wait(&pool->_filled, &pool->_mutex);
+				continue;
+			}
+
+			off_t offset = snd->spoolBase + (snd->sent - snd->spoolStart);
+			uint64_t left = snd->spoolEnd - snd->sent;
+			size_t len = left < Doclone::ZEROCOPY_CHUNK_SIZE ?
+					left : Doclone::ZEROCOPY_CHUNK_SIZE;
+			int spoolFd = snd->spoolFd;
+			pthread_mutex_unlock(&pool->_mutex);
+
+			ssize_t nbytes;
+			do {
+				nbytes = sendfile(snd->fd, spoolFd, &offset, len);
+			} while(nbytes < 0 && errno == EINTR);
+
+			pthread_mutex_lock(&pool->_mutex);
+			if(nbytes <= 0) {
+				snd->state = SENDER_FAILED;
+				break;
+			}
+
+			snd->sent += nbytes;
+			pthread_cond_broadcast(&pool->_drained);
+		} else {
+			break;
+		}
+	}
+
+	pthread_cond_broadcast(&pool->_drained);
+	pthread_mutex_unlock(&pool->_mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Takes a receiver that fell out of the window off the ring
+ *
+ * Must be called with the mutex locked.
+ *
+ * \param snd
+ * 		The lagging sender
+ */
+void SenderPool::applyPolicy(sender *snd) {
+	Logger *log = Logger::getInstance();
+	log->debug("SenderPool::applyPolicy(host=>%s) start", snd->host.c_str());
+
+	if(this->_policy == Doclone::LAG_DROP) {
+		this->drop(snd);
+
+		log->debug("SenderPool::applyPolicy() end");
+		return;
+	}
+
+	char path[] = "/tmp/doclone-spool-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) {
+		CreateFileException ex(path);
+		ex.logMsg();
+
+		this->drop(snd);
+
+		log->debug("SenderPool::applyPolicy() end");
+		return;
+	}
+
+	// Nobody else needs the name
+	unlink(path);
+
+	// The chunk being sent is finished by the thread itself
+	uint64_t start = snd->sent;
+	if(snd->busy != 0) {
+		start += snd->busy->data.size();
+	}
+
+	snd->spoolFd = fd;
+	snd->ownSpool = true;
+	snd->spoolBase = 0;
+	snd->spoolStart = start;
+	snd->spoolEnd = start;
+
+	std::deque<chunk *>::iterator it;
+	for(it = this->_ring.begin(); it != this->_ring.end(); ++it) {
+		if((*it)->offset >= start) {
+			if(!this->spool(snd, &(*it)->data[0], (*it)->data.size(),
+					(*it)->offset)) {
+				this->drop(snd);
+
+				log->debug("SenderPool::applyPolicy() end");
+				return;
+			}
+
+			snd->spoolEnd = (*it)->offset + (*it)->data.size();
+		}
+	}
+
+	this->releaseChunks(snd);
+	snd->state = SENDER_SPOOL;
+
+	log->debug("SenderPool::applyPolicy() end");
+}
+
+/**
+ * \brief Appends a block of the stream to the spool of [snd]
+ *
+ * \param snd
+ * 		The spooled sender
+ * \param buf
+ * 		The data
+ * \param len
+ * 		Size of the data
+ * \param offset
+ * 		Position of the data in the stream
+ *
+ * \return false if the spool can't be written
+ */
+bool SenderPool::spool(sender *snd, const char *buf, size_t len,
+		uint64_t offset) {
+	off_t pos = snd->spoolBase + (offset - snd->spoolStart);
+
+	while(len > 0) {
+		ssize_t nbytes = pwrite(snd->spoolFd, buf, len, pos);
+		if(nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(nbytes <= 0) {
+			WriteDataException ex;
+			ex.logMsg();
+			return false;
+		}
+
+		buf += nbytes;
+		len -= nbytes;
+		pos += nbytes;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Disconnects the receiver of [snd] and stops sending it data
+ *
+ * Must be called with the mutex locked.
+ *
+ * \param snd
+ * 		The sender to be dropped
+ */
+void SenderPool::drop(sender *snd) {
+	if(snd->state == SENDER_RING) {
+		this->releaseChunks(snd);
+	}
+
+	snd->state = SENDER_DROPPED;
+
+	// Wakes up the thread if it is blocked in send()
+	shutdown(snd->fd, SHUT_RDWR);
+	pthread_cond_broadcast(&this->_filled);
+}
+
+/**
+ * \brief Releases the chunks of the ring that [snd] has not sent yet
+ *
+ * The chunk being sent, if any, is released by the thread when it finishes.
+ * Must be called with the mutex locked.
+ *
+ * \param snd
+ * 		The sender leaving the ring
+ */
+void SenderPool::releaseChunks(sender *snd) {
+	std::deque<chunk *>::iterator it;
+	for(it = this->_ring.begin(); it != this->_ring.end(); ++it) {
+		if((*it)->offset >= snd->sent && *it != snd->busy) {
+			(*it)->refs--;
+		}
+	}
+
+	this->freeChunks();
+}
+
+/**
+ * \brief Frees the oldest chunks once every sender has sent them
+ *
+ * Must be called with the mutex locked.
+ */
+void SenderPool::freeChunks() {
+	while(!this->_ring.empty() && this->_ring.front()->refs == 0) {
+		delete this->_ring.front();
+		this->_ring.pop_front();
+	}
+
+	pthread_cond_broadcast(&this->_drained);
+}
+
+/**
+ * \brief Whether the receiver of [snd] can still get data
+ *
+ * \param snd
+ * 		The sender
+ */
+bool SenderPool::isActive(const sender *snd) const {
+	return snd->state == SENDER_RING || snd->state == SENDER_SPOOL;
+}
+
+/**
+ * \brief Logs the receivers lost since the last call
+ *
+ * Throws an exception if none of them is left.
+ */
+void SenderPool::reportFailures() throw(Exception) {
+	std::vector<std::string> failed;
+	std::vector<std::string> dropped;
+	bool alive = false;
+
+	pthread_mutex_lock(&this->_mutex);
+	std::vector<sender *>::iterator it;
+	for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+		sender *snd = *it;
+
+		if(snd->state == SENDER_FAILED && !snd->reported) {
+			failed.push_back(snd->host);
+			snd->reported = true;
+		} else if(snd->state == SENDER_DROPPED && !snd->reported) {
+			dropped.push_back(snd->host);
+			snd->reported = true;
+		}
+
+		alive = alive || this->isActive(snd) || snd->state == SENDER_DONE;
+	}
+	pthread_mutex_unlock(&this->_mutex);
+
+	std::vector<std::string>::iterator st;
+	for(st = dropped.begin(); st != dropped.end(); ++st) {
+		DropReceiverException ex(*st);
+		ex.logMsg();
+	}
+
+	for(st = failed.begin(); st != failed.end(); ++st) {
+		SendDataException ex(*st);
+		ex.logMsg();
+	}
+
+	if(!alive) {
+		std::string host;
+		if(!this->_senders.empty()) {
+			host = this->_senders.back()->host;
+		}
+
+		SendDataException ex(host);
+		throw ex;
+	}
+}
+
+/**
+ * \brief Stops and joins all the threads and frees everything
+ */
+void SenderPool::stop() {
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+
+	std::vector<sender *>::iterator it;
+	for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+		if(this->isActive(*it)) {
+			shutdown((*it)->fd, SHUT_RDWR);
+		}
+	}
+
+	pthread_cond_broadcast(&this->_filled);
+	pthread_mutex_unlock(&this->_mutex);
+
+	for(it = this->_senders.begin(); it != this->_senders.end(); ++it) {
+		if((*it)->started) {
+			pthread_join((*it)->thread, 0);
+		}
+
+		if((*it)->ownSpool) {
+			close((*it)->spoolFd);
+		}
+
+		delete *it;
+	}
+	this->_senders.clear();
+
+	std::deque<chunk *>::iterator ct;
+	for(ct = this->_ring.begin(); ct != this->_ring.end(); ++ct) {
+		delete *ct;
+	}
+	this->_ring.clear();
+
+	pthread_cond_destroy(&this->_drained);
+	pthread_cond_destroy(&this->_filled);
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+}
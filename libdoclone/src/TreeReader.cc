@@ -0,0 +1,693 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/TreeReader.h>
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include <doclone/DataTransfer.h>
+#include <doclone/Logger.h>
+#include <doclone/Util.h>
+#include <doclone/exception/FileNotFoundException.h>
+#include <doclone/exception/InitializationException.h>
+#include <doclone/exception/ReadDataException.h>
+#include <doclone/exception/ReadErrorsInDirectoryException.h>
+#include <doclone/exception/WarningException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Starts the walkers on the root of the tree
+ *
+ * \param threads
+ * 		Number of walker threads
+ * \param path
+ * 		Path of the root of the tree, ended in '/'
+ * \param imgRootDir
+ * 		Path into the image file where the tree is written
+ */
+TreeReader::TreeReader(unsigned int threads, const std::string &path,
+		const std::string &imgRootDir) throw(Exception)
+		: _path(path), _imgRootDir(imgRootDir), _walkers(), _pendingDirs(0),
+		  _queue(), _queuedBytes(0), _queuedFds(0), _claimed(), _errorDirs(),
+		  _failed(false), _stop(false), _mutex(), _workReady(),
+		  _entryReady(), _spaceReady(), _linkTargets(), _pendingLinks() {
+	Logger *log = Logger::getInstance();
+	log->debug("TreeReader::TreeReader(threads=>%d, path=>%s, imgRootDir=>%s) start",
+			threads, path.c_str(), imgRootDir.c_str());
+
+	if(threads == 0) {
+		threads = 1;
+	}
+
+	pthread_mutex_init(&this->_mutex, 0);
+	pthread_cond_init(&this->_workReady, 0);
+	pthread_cond_init(&this->_entryReady, 0);
+	pthread_cond_init(&this->_spaceReady, 0);
+
+	// All the walkers must exist before any of them starts stealing
+	for(unsigned int i = 0; i < threads; i++) {
+		treeWalker *walker = new treeWalker();
+		walker->archiveIn = archive_read_disk_new();
+		archive_read_disk_set_symlink_physical(walker->archiveIn);
+		walker->started = false;
+		walker->reader = this;
+
+		this->_walkers.push_back(walker);
+	}
+
+	this->_walkers.front()->dirs.push_back(path);
+	this->_pendingDirs = 1;
+
+	bool started = false;
+	std::vector<treeWalker *>::iterator it;
+	for(it = this->_walkers.begin(); it != this->_walkers.end(); ++it) {
+		if(pthread_create(&(*it)->thread, 0, TreeReader::walkerThread,
+				*it) == 0) {
+			(*it)->started = true;
+			started = true;
+		}
+	}
+
+	if(!started) {
+		this->stop();
+
+		InitializationException ex;
+		throw ex;
+	}
+
+	log->debug("TreeReader::TreeReader() end");
+}
+
+/**
+ * \brief Stops the walkers and frees the entries not written
+ */
+TreeReader::~TreeReader() {
+	this->stop();
+}
+
+/**
+ * \brief Writes all the entries of the tree in the archives
+ *
+ * This method runs in the calling thread and returns when the whole tree has
+ * been written.
+ *
+ * \param outArchives
+ * 		Vector of archives to write in
+ */
+void TreeReader::readTree(std::vector<struct archive*> &outArchives)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("TreeReader::readTree(outArchives=>0x%x) start", &outArchives);
+
+	for(;;) {
+		pthread_mutex_lock(&this->_mutex);
+		while(this->_queue.empty() && this->_pendingDirs > 0
+				&& !this->_failed) {
+			pthread_cond_wait(&this->_entryReady, &this->_mutex);
+		}
+
+		std::vector<std::string> errorDirs;
+		errorDirs.swap(this->_errorDirs);
+
+		treeEntry *item = 0;
+		if(!this->_failed && !this->_queue.empty()) {
+			item = this->_queue.front();
+			this->_queue.pop_front();
+
+			this->_queuedBytes -= item->data.size();
+			if(item->fd >= 0) {
+				this->_queuedFds--;
+			}
+
+			pthread_cond_signal(&this->_spaceReady);
+		}
+
+		bool failed = this->_failed;
+		pthread_mutex_unlock(&this->_mutex);
+
+		std::vector<std::string>::iterator it;
+		for(it = errorDirs.begin(); it != errorDirs.end(); ++it) {
+			ReadErrorsInDirectoryException ex(*it);
+			ex.logMsg();
+		}
+
+		if(failed) {
+			ReadDataException ex;
+			throw ex;
+		}
+
+		if(item == 0) {
+			break;
+		}
+
+		this->writeEntry(item, outArchives);
+	}
+
+	log->debug("TreeReader::readTree() end");
+}
+
+/**
+ * \brief Main loop of the walker threads
+ *
+ * \param data
+ * 		Pointer to the treeWalker of the thread
+ */
+void *TreeReader::walkerThread(void *data) {
+	treeWalker *walker = static_cast<treeWalker *>(data);
+	TreeReader *reader = walker->reader;
+
+	Util::blockSignals();
+
+	std::string path;
+	while(reader->nextDirectory(walker, path)) {
+		reader->scanDirectory(walker, path);
+
+		pthread_mutex_lock(&reader->_mutex);
+		reader->_pendingDirs--;
+		if(reader->_pendingDirs == 0) {
+			pthread_cond_broadcast(&reader->_workReady);
+			pthread_cond_broadcast(&reader->_entryReady);
+		}
+		pthread_mutex_unlock(&reader->_mutex);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Takes the next directory to scan
+ *
+ * The newest directory of the walker is taken first, so each walker goes deep
+ * in its own branch. If it has none, the oldest one of another walker is
+ * stolen, which is usually the root of a big branch.
+ *
+ * \param walker
+ * 		The calling walker
+ * \param path
+ * 		Path of the directory
+ *
+ * \return False if the walk has ended
+ */
+bool TreeReader::nextDirectory(treeWalker *walker, std::string &path) {
+	pthread_mutex_lock(&this->_mutex);
+
+	for(;;) {
+		if(this->_stop) {
+			break;
+		}
+
+		if(!walker->dirs.empty()) {
+			path = walker->dirs.back();
+			walker->dirs.pop_back();
+
+			pthread_mutex_unlock(&this->_mutex);
+			return true;
+		}
+
+		std::vector<treeWalker *>::iterator it;
+		for(it = this->_walkers.begin(); it != this->_walkers.end(); ++it) {
+			if(!(*it)->dirs.empty()) {
+				path = (*it)->dirs.front();
+				(*it)->dirs.pop_front();
+
+				pthread_mutex_unlock(&this->_mutex);
+				return true;
+			}
+		}
+
+		if(this->_pendingDirs == 0) {
+			break;
+		}
+
+		pthread_cond_wait(&this->_workReady, &this->_mutex);
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+	return false;
+}
+
+/**
+ * \brief Queues all the entries of a directory
+ *
+ * The entries are visited in inode order. The subdirectories are left to be
+ * scanned later, by this or another walker.
+ *
+ * \param walker
+ * 		The calling walker
+ * \param path
+ * 		Path of the directory, ended in '/'
+ */
+void TreeReader::scanDirectory(treeWalker *walker, const std::string &path) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("TreeReader::scanDirectory(path=>%s) start", path.c_str());
+
+	int dirfd;
+	struct stat dirstat;
+	std::vector<dirEntry> names;
+	bool errors = false;
+
+	try {
+		if ((dirfd = open (path.c_str(), O_RDONLY | O_DIRECTORY)) < 0) {
+			FileNotFoundException ex(path);
+			throw ex;
+		}
+
+		if (fstat (dirfd, &dirstat) < 0) {
+			FileNotFoundException ex(path);
+			throw ex;
+		}
+
+		Util::readDirectory(dirfd, names);
+	} catch(const Exception &ex) {
+		if(dirfd >= 0) {
+			close(dirfd);
+		}
+
+		pthread_mutex_lock(&this->_mutex);
+		this->_errorDirs.push_back(path);
+		pthread_mutex_unlock(&this->_mutex);
+
+		log->loopDebug("TreeReader::scanDirectory() end");
+		return;
+	}
+
+	// The paths of the entries only differ in the name after these prefixes
+	std::string abPath = path;
+	std::string relPath = this->_imgRootDir + "/"
+			+ path.substr(this->_path.length());
+	size_t abLength = abPath.length();
+	size_t relLength = relPath.length();
+
+	std::vector<dirEntry>::iterator it;
+	for(it = names.begin(); it != names.end(); ++it) {
+		abPath.resize(abLength);
+		abPath.append(it->name);
+		relPath.resize(relLength);
+		relPath.append(it->name);
+
+		struct stat filestat;
+		treeEntry *item = 0;
+
+		int fdin = Util::openEntry(dirfd, *it, filestat);
+		if(fdin == -2) {
+			errors = true;
+			continue;
+		}
+
+		try {
+			item = this->readEntry(walker, dirfd, it->name, abPath, relPath,
+					filestat, fdin);
+		} catch(const WarningException &ex) {
+			errors = true;
+			continue;
+		} catch(const Exception &ex) {
+			pthread_mutex_lock(&this->_mutex);
+			this->_failed = true;
+			this->_stop = true;
+			pthread_cond_broadcast(&this->_workReady);
+			pthread_cond_broadcast(&this->_entryReady);
+			pthread_cond_broadcast(&this->_spaceReady);
+			pthread_mutex_unlock(&this->_mutex);
+			break;
+		}
+
+		/*
+		 * If the current folder is a virtual one or is the mount
+		 * point of another partition, bypass it.
+		 */
+		bool subdir = S_ISDIR(filestat.st_mode)
+				&& !Util::isVirtualDirectory(abPath.c_str())
+				&& filestat.st_dev == dirstat.st_dev;
+
+		// The directory entry is queued before its contents
+		if(!this->push(item)) {
+			break;
+		}
+
+		if(subdir) {
+			this->pushDirectory(walker, abPath + "/");
+		}
+	}
+
+	close(dirfd);
+
+	if(errors) {
+		pthread_mutex_lock(&this->_mutex);
+		this->_errorDirs.push_back(path);
+		pthread_mutex_unlock(&this->_mutex);
+	}
+
+	log->loopDebug("TreeReader::scanDirectory() end");
+}
+
+/**
+ * \brief Reads the metadata of a file and, if it is small, its data
+ *
+ * \param walker
+ * 		The calling walker
+ * \param dirfd
+ * 		Descriptor of the directory of the file
+ * \param name
+ * 		Name of the file in the directory
+ * \param path
+ * 		Path of the file
+ * \param relPath
+ * 		Path of the file in the image
+ * \param filestat
+ * 		Status of the file
+ * \param fdin
+ * 		Descriptor of the file if it is regular, closed by this method
+ *
+ * \return A new entry, to be freed by the caller
+ */
+TreeReader::treeEntry *TreeReader::readEntry(treeWalker *walker, int dirfd,
+		const std::string &name, const std::string &path,
+		const std::string &relPath, const struct stat &filestat, int fdin)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("TreeReader::readEntry(path=>%s) start", path.c_str());
+
+	if(S_ISREG(filestat.st_mode) && fdin < 0) {
+		FileNotFoundException ex(path);
+		throw ex;
+	}
+
+	treeEntry *item = new treeEntry();
+	item->entry = archive_entry_new();
+	item->fd = -1;
+	item->holes = false;
+	item->link = false;
+
+	archive_entry_update_pathname_utf8(item->entry, relPath.c_str());
+	archive_entry_copy_sourcepath(item->entry, path.c_str());
+	archive_read_disk_entry_from_file(walker->archiveIn, item->entry, fdin,
+			&filestat);
+
+	switch (archive_entry_filetype(item->entry)) {
+	case AE_IFDIR:
+	case AE_IFIFO:
+	case AE_IFSOCK:
+	case AE_IFCHR:
+	case AE_IFBLK:
+		break;
+	case AE_IFLNK: {
+		char linkPath[4096] = {};
+
+		// Read link
+		if (readlinkat (dirfd, name.c_str(), linkPath, sizeof(linkPath) - 1) < 0) {
+			TreeReader::freeEntry(item);
+
+			FileNotFoundException ex(path);
+			throw ex;
+		}
+
+		archive_entry_update_symlink_utf8(item->entry, linkPath);
+		break;
+	}
+	case AE_IFREG: {
+		// Only the first name found of a hard linked file keeps the data
+		if(archive_entry_nlink(item->entry) > 1) {
+			inodeKey key(filestat.st_dev, filestat.st_ino);
+
+			pthread_mutex_lock(&this->_mutex);
+			item->link = !this->_claimed.insert(key).second;
+			pthread_mutex_unlock(&this->_mutex);
+		}
+
+		/*
+		 * If the current file is a virtual one, bypass
+		 */
+		if(item->link || Util::isLiveFile(path.c_str())
+				|| archive_entry_size(item->entry) == 0) {
+			break;
+		}
+
+		// The holes must be known before the header is written
+		item->holes = DataTransfer::readSparseMap(fdin, filestat,
+				item->entry);
+
+		// The beginning is requested now, the writer will read it later
+		if(item->holes
+				|| static_cast<uint64_t>(filestat.st_size) > TREE_INLINE_SIZE) {
+			posix_fadvise(fdin, 0, TREE_INLINE_SIZE, POSIX_FADV_WILLNEED);
+
+			item->fd = fdin;
+			fdin = -1;
+			break;
+		}
+
+		// If the file shrinks, libarchive pads the entry with zeros
+		item->data.resize(filestat.st_size);
+
+		size_t done = 0;
+		ssize_t nbytes;
+		while(done < item->data.size() && (nbytes = read (fdin,
+				&item->data[done], item->data.size() - done)) > 0) {
+			done += nbytes;
+		}
+
+		item->data.resize(done);
+		break;
+	}
+	default:
+		if(fdin >= 0) {
+			close(fdin);
+		}
+		TreeReader::freeEntry(item);
+
+		ReadDataException ex;
+		throw ex;
+	}
+
+	if(fdin >= 0) {
+		close(fdin);
+	}
+
+	log->loopDebug("TreeReader::readEntry(item=>0x%x) end", item);
+	return item;
+}
+
+/**
+ * \brief Queues an entry for the writer
+ *
+ * Waits while the queue is full.
+ *
+ * \param item
+ * 		The entry, owned by the queue from now on
+ *
+ * \return False if the walkers must stop. The entry is freed.
+ */
+bool TreeReader::push(treeEntry *item) {
+	size_t bytes = item->data.size();
+	bool open = item->fd >= 0;
+
+	pthread_mutex_lock(&this->_mutex);
+
+	// An empty queue always takes the entry, whatever its size
+	while(!this->_stop && !this->_queue.empty()
+			&& (this->_queue.size() >= TREE_QUEUE_ENTRIES
+				|| this->_queuedBytes + bytes > TREE_QUEUE_SIZE
+				|| (open && this->_queuedFds >= TREE_QUEUE_FDS))) {
+		pthread_cond_wait(&this->_spaceReady, &this->_mutex);
+	}
+
+	if(this->_stop) {
+		pthread_mutex_unlock(&this->_mutex);
+		TreeReader::freeEntry(item);
+		return false;
+	}
+
+	this->_queue.push_back(item);
+	this->_queuedBytes += bytes;
+	if(open) {
+		this->_queuedFds++;
+	}
+
+	pthread_cond_signal(&this->_entryReady);
+	pthread_mutex_unlock(&this->_mutex);
+
+	return true;
+}
+
+/**
+ * \brief Adds a directory to the stack of a walker
+ *
+ * \param walker
+ * 		The calling walker
+ * \param path
+ * 		Path of the directory, ended in '/'
+ */
+void TreeReader::pushDirectory(treeWalker *walker, const std::string &path) {
+	pthread_mutex_lock(&this->_mutex);
+	walker->dirs.push_back(path);
+	this->_pendingDirs++;
+	pthread_cond_signal(&this->_workReady);
+	pthread_mutex_unlock(&this->_mutex);
+}
+
+/**
+ * \brief Writes an entry in the archives and frees it
+ *
+ * A link whose target is not in the archives yet is kept until it is.
+ *
+ * \param item
+ * 		The entry
+ * \param outArchives
+ * 		Vector of archives to write in
+ */
+void TreeReader::writeEntry(treeEntry *item,
+		std::vector<struct archive*> &outArchives) throw(Exception) {
+	DataTransfer *trns = DataTransfer::getInstance();
+	struct archive_entry *entry = item->entry;
+
+	inodeKey key(archive_entry_dev(entry), archive_entry_ino64(entry));
+
+	if(item->link) {
+		this->_pendingLinks.insert(std::make_pair(key, item));
+
+		std::map<inodeKey, std::string>::iterator it =
+				this->_linkTargets.find(key);
+		if(it != this->_linkTargets.end()) {
+			this->writeLinks(key, it->second, outArchives);
+		}
+
+		return;
+	}
+
+	try {
+		trns->copyHeader(entry, outArchives);
+
+		if(!item->data.empty()) {
+			trns->bufToArchive(item->data, outArchives);
+		} else if(item->fd >= 0 && item->holes) {
+			trns->sparseToArchive(item->fd, entry, outArchives);
+		} else if(item->fd >= 0) {
+			trns->fdToArchive(item->fd, outArchives);
+		}
+	} catch(...) {
+		TreeReader::freeEntry(item);
+		throw;
+	}
+
+	if(archive_entry_filetype(entry) == AE_IFREG
+			&& archive_entry_nlink(entry) > 1) {
+		std::string target = archive_entry_pathname(entry);
+		this->_linkTargets[key] = target;
+
+		this->writeLinks(key, target, outArchives);
+	}
+
+	TreeReader::freeEntry(item);
+}
+
+/**
+ * \brief Writes the links waiting for a target that is in the archives
+ *
+ * \param key
+ * 		Device and inode of the target
+ * \param target
+ * 		Path of the target in the image
+ * \param outArchives
+ * 		Vector of archives to write in
+ */
+void TreeReader::writeLinks(const inodeKey &key, const std::string &target,
+		std::vector<struct archive*> &outArchives) throw(Exception) {
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	std::multimap<inodeKey, treeEntry *>::iterator it;
+	while((it = this->_pendingLinks.find(key)) != this->_pendingLinks.end()) {
+		treeEntry *item = it->second;
+		this->_pendingLinks.erase(it);
+
+		archive_entry_sparse_clear(item->entry);
+		archive_entry_set_size(item->entry, 0);
+		archive_entry_copy_hardlink(item->entry, target.c_str());
+
+		try {
+			trns->copyHeader(item->entry, outArchives);
+		} catch(...) {
+			TreeReader::freeEntry(item);
+			throw;
+		}
+
+		TreeReader::freeEntry(item);
+	}
+}
+
+/**
+ * \brief Closes the file of an entry, if open, and frees it
+ */
+void TreeReader::freeEntry(treeEntry *item) {
+	if(item->fd >= 0) {
+		close(item->fd);
+	}
+
+	archive_entry_free(item->entry);
+	delete item;
+}
+
+/**
+ * \brief Stops and joins the walkers and frees all the resources
+ */
+void TreeReader::stop() {
+	if(this->_walkers.empty()) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+	pthread_cond_broadcast(&this->_workReady);
+	pthread_cond_broadcast(&this->_spaceReady);
+	pthread_mutex_unlock(&this->_mutex);
+
+	std::vector<treeWalker *>::iterator it;
+	for(it = this->_walkers.begin(); it != this->_walkers.end(); ++it) {
+		if((*it)->started) {
+			pthread_join((*it)->thread, 0);
+		}
+
+		archive_read_free((*it)->archiveIn);
+		delete *it;
+	}
+	this->_walkers.clear();
+
+	std::deque<treeEntry *>::iterator qt;
+	for(qt = this->_queue.begin(); qt != this->_queue.end(); ++qt) {
+		TreeReader::freeEntry(*qt);
+	}
+	this->_queue.clear();
+
+	std::multimap<inodeKey, treeEntry *>::iterator lt;
+	for(lt = this->_pendingLinks.begin(); lt != this->_pendingLinks.end(); ++lt) {
+		TreeReader::freeEntry(lt->second);
+	}
+	this->_pendingLinks.clear();
+
+	pthread_cond_destroy(&this->_spaceReady);
+	pthread_cond_destroy(&this->_entryReady);
+	pthread_cond_destroy(&this->_workReady);
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+}
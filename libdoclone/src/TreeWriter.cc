@@ -0,0 +1,438 @@
+/*
+ *  libdoclone - library for cloning GNU/Linux systems
+ *  Copyright (C) 2015 Joan Lledó <joanlluislledo@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <doclone/TreeWriter.h>
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <doclone/DataTransfer.h>
+#include <doclone/Logger.h>
+#include <doclone/Util.h>
+#include <doclone/exception/InitializationException.h>
+#include <doclone/exception/ReadDataException.h>
+
+namespace Doclone {
+
+/**
+ * \brief Starts the writer threads
+ *
+ * \param threads
+ * 		Number of writer threads
+ * \param flags
+ * 		Options of the disk archives, as in archive_write_disk_set_options()
+ */
+TreeWriter::TreeWriter(unsigned int threads, int flags) throw(Exception)
+		: _flags(flags), _archives(), _workers(), _queue(), _queuedBytes(0),
+		  _inFlight(), _errors(), _stop(false), _mutex(), _jobReady(),
+		  _spaceReady(), _jobDone() {
+	Logger *log = Logger::getInstance();
+	log->debug("TreeWriter::TreeWriter(threads=>%d, flags=>%d) start",
+			threads, flags);
+
+	if(threads == 0) {
+		threads = 1;
+	}
+
+	pthread_mutex_init(&this->_mutex, 0);
+	pthread_cond_init(&this->_jobReady, 0);
+	pthread_cond_init(&this->_spaceReady, 0);
+	pthread_cond_init(&this->_jobDone, 0);
+
+	this->_archives.push_back(this->newArchive());
+
+	bool started = false;
+	for(unsigned int i = 0; i < threads; i++) {
+		treeWorker *worker = new treeWorker();
+		worker->archiveOut = this->newArchive();
+		worker->started = false;
+		worker->writer = this;
+
+		this->_workers.push_back(worker);
+
+		if(pthread_create(&worker->thread, 0, TreeWriter::writerThread,
+				worker) == 0) {
+			worker->started = true;
+			started = true;
+		}
+	}
+
+	if(!started) {
+		this->stop();
+
+		pthread_cond_destroy(&this->_jobDone);
+		pthread_cond_destroy(&this->_spaceReady);
+		pthread_cond_destroy(&this->_jobReady);
+		pthread_mutex_destroy(&this->_mutex);
+
+		InitializationException ex;
+		throw ex;
+	}
+
+	log->debug("TreeWriter::TreeWriter() end");
+}
+
+/**
+ * \brief Stops the writers and frees the entries not written
+ */
+TreeWriter::~TreeWriter() {
+	this->stop();
+
+	pthread_cond_destroy(&this->_jobDone);
+	pthread_cond_destroy(&this->_spaceReady);
+	pthread_cond_destroy(&this->_jobReady);
+	pthread_mutex_destroy(&this->_mutex);
+}
+
+/**
+ * \brief Writes an entry of the archive in the disk
+ *
+ * Its data is read from archiveIn before returning, but a writer thread may
+ * create the file later.
+ *
+ * \param archiveIn
+ * 		Archive the entry has been read from
+ * \param entry
+ * 		The entry, with the path it must be written at
+ * \param part
+ * 		Index of the partition of the entry, returned by takeError()
+ * \param extractor
+ * 		Writes the entry instead of the disk archives, or 0
+ */
+void TreeWriter::writeEntry(struct archive *archiveIn,
+		struct archive_entry *entry, unsigned int part,
+		FreshExtractor *extractor) throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("TreeWriter::writeEntry(entry=>%s, part=>%d) start",
+			archive_entry_pathname(entry), part);
+
+	DataTransfer *trns = DataTransfer::getInstance();
+
+	this->waitFor(archive_entry_pathname(entry), archive_entry_hardlink(entry));
+
+	mode_t type = archive_entry_filetype(entry);
+	if(type == AE_IFDIR || (type == AE_IFREG
+			&& archive_entry_size(entry) > static_cast<int64_t>(TREE_JOB_SIZE))) {
+		if(extractor != 0) {
+			extractor->writeEntry(archiveIn, entry);
+		} else {
+			trns->copyHeader(entry, this->_archives);
+			trns->copyData(archiveIn, this->_archives);
+		}
+	} else {
+		treeJob *job = new treeJob();
+		job->entry = archive_entry_clone(entry);
+		job->part = part;
+		job->extractor = extractor;
+		job->data.reserve(archive_entry_size(entry));
+
+		int r;
+		const void *buff;
+		size_t size;
+		int64_t offset;
+		while((r = archive_read_data_block(archiveIn, &buff, &size, &offset))
+				!= ARCHIVE_EOF) {
+			if(r < ARCHIVE_OK) {
+				TreeWriter::freeJob(job);
+
+				ReadDataException ex;
+				throw ex;
+			}
+
+			job->blocks.push_back(std::make_pair(offset, size));
+			job->data.append(static_cast<const char *>(buff), size);
+		}
+
+		trns->addTransferredBytes(job->data.size());
+
+		this->push(job);
+	}
+
+	log->loopDebug("TreeWriter::writeEntry() end");
+}
+
+/**
+ * \brief Takes one of the files the writer threads couldn't write
+ *
+ * \param part
+ * 		Index of the partition of the file
+ * \param path
+ * 		Path of the file
+ *
+ * \return False if there are no more errors
+ */
+bool TreeWriter::takeError(unsigned int &part, std::string &path) {
+	pthread_mutex_lock(&this->_mutex);
+
+	bool found = !this->_errors.empty();
+	if(found) {
+		part = this->_errors.front().first;
+		path = this->_errors.front().second;
+		this->_errors.pop_front();
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	return found;
+}
+
+/**
+ * \brief Waits until all the entries are written and applies the metadata of
+ * the directories
+ *
+ * The errors are still available through takeError().
+ */
+void TreeWriter::finish() throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("TreeWriter::finish() start");
+
+	pthread_mutex_lock(&this->_mutex);
+	while(!this->_inFlight.empty()) {
+		pthread_cond_wait(&this->_jobDone, &this->_mutex);
+	}
+	pthread_mutex_unlock(&this->_mutex);
+
+	// Closing the archive of this thread fixes the directories up
+	this->stop();
+
+	log->debug("TreeWriter::finish() end");
+}
+
+/**
+ * \brief Main loop of the writer threads
+ *
+ * \param data
+ * 		Pointer to the treeWorker of the thread
+ */
+void *TreeWriter::writerThread(void *data) {
+	treeWorker *worker = static_cast<treeWorker *>(data);
+	TreeWriter *writer = worker->writer;
+
+	Util::blockSignals();
+
+	treeJob *job;
+	while((job = writer->pop()) != 0) {
+		writer->writeJob(worker, job);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Creates a disk archive with the options of this extractor
+ */
+struct archive *TreeWriter::newArchive() const {
+	struct archive *arch = archive_write_disk_new();
+	archive_write_disk_set_options(arch, this->_flags);
+
+	return arch;
+}
+
+/**
+ * \brief Writes an entry with its extractor or the disk archive of a worker
+ *
+ * \param worker
+ * 		The worker that writes the entry
+ * \param job
+ * 		The entry, freed when it is done
+ */
+void TreeWriter::writeJob(treeWorker *worker, treeJob *job) {
+	if(job->extractor != 0) {
+		bool error = false;
+		try {
+			job->extractor->writeEntry(job->entry, job->data, job->blocks);
+		} catch(const Exception &ex) {
+			error = true;
+		}
+
+		this->done(job, error);
+		return;
+	}
+
+	int r = archive_write_header(worker->archiveOut, job->entry);
+	bool error = r < ARCHIVE_OK;
+
+	// Like in DataTransfer::copyData(), the data isn't written after an error
+	std::vector<std::pair<int64_t, size_t> >::const_iterator it;
+	size_t pos = 0;
+	for(it = job->blocks.begin(); !error && it != job->blocks.end(); ++it) {
+		r = archive_write_data_block(worker->archiveOut,
+				job->data.data() + pos, it->second, it->first);
+		error = r < ARCHIVE_OK;
+		pos += it->second;
+	}
+
+	if(r != ARCHIVE_FATAL) {
+		r = archive_write_finish_entry(worker->archiveOut);
+		error = error || r < ARCHIVE_OK;
+	}
+
+	// A fatal error leaves the archive unusable for the next entries
+	if(r == ARCHIVE_FATAL) {
+		archive_write_free(worker->archiveOut);
+		worker->archiveOut = this->newArchive();
+	}
+
+	this->done(job, error);
+}
+
+/**
+ * \brief Queues an entry for the writer threads
+ *
+ * It blocks while the queue is full.
+ *
+ * \param job
+ * 		The entry to write
+ */
+void TreeWriter::push(treeJob *job) {
+	size_t bytes = job->data.size();
+
+	pthread_mutex_lock(&this->_mutex);
+
+	// An empty queue always takes the entry, whatever its size
+	while(!this->_queue.empty()
+			&& (this->_queue.size() >= TREE_JOBS_ENTRIES
+				|| this->_queuedBytes + bytes > TREE_JOBS_SIZE)) {
+		pthread_cond_wait(&this->_spaceReady, &this->_mutex);
+	}
+
+	this->_queue.push_back(job);
+	this->_queuedBytes += bytes;
+	this->_inFlight.insert(archive_entry_pathname(job->entry));
+
+	pthread_cond_signal(&this->_jobReady);
+	pthread_mutex_unlock(&this->_mutex);
+}
+
+/**
+ * \brief Takes the next entry to write
+ *
+ * \return The entry, or 0 if the writers must stop
+ */
+TreeWriter::treeJob *TreeWriter::pop() {
+	pthread_mutex_lock(&this->_mutex);
+
+	while(this->_queue.empty() && !this->_stop) {
+		pthread_cond_wait(&this->_jobReady, &this->_mutex);
+	}
+
+	treeJob *job = 0;
+	if(!this->_stop) {
+		job = this->_queue.front();
+		this->_queue.pop_front();
+		this->_queuedBytes -= job->data.size();
+
+		pthread_cond_signal(&this->_spaceReady);
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+
+	return job;
+}
+
+/**
+ * \brief Marks an entry as written and frees it
+ *
+ * \param job
+ * 		The written entry
+ * \param error
+ * 		Whether it couldn't be written
+ */
+void TreeWriter::done(treeJob *job, bool error) {
+	std::string path = archive_entry_pathname(job->entry);
+
+	pthread_mutex_lock(&this->_mutex);
+
+	this->_inFlight.erase(this->_inFlight.find(path));
+	if(error) {
+		this->_errors.push_back(treeError(job->part, path));
+	}
+
+	pthread_cond_broadcast(&this->_jobDone);
+	pthread_mutex_unlock(&this->_mutex);
+
+	TreeWriter::freeJob(job);
+}
+
+/**
+ * \brief Waits until no writer thread is working on a path
+ *
+ * \param path
+ * 		Path of the entry about to be written
+ * \param hardlink
+ * 		Target of the entry, if it is a hard link, or 0
+ */
+void TreeWriter::waitFor(const std::string &path, const char *hardlink) {
+	pthread_mutex_lock(&this->_mutex);
+
+	while(this->_inFlight.count(path) > 0
+			|| (hardlink != 0 && this->_inFlight.count(hardlink) > 0)) {
+		pthread_cond_wait(&this->_jobDone, &this->_mutex);
+	}
+
+	pthread_mutex_unlock(&this->_mutex);
+}
+
+/**
+ * \brief Frees an entry
+ */
+void TreeWriter::freeJob(treeJob *job) {
+	archive_entry_free(job->entry);
+	delete job;
+}
+
+/**
+ * \brief Stops the writers and closes all the archives
+ *
+ * The entries still queued are discarded.
+ */
+void TreeWriter::stop() {
+	pthread_mutex_lock(&this->_mutex);
+	this->_stop = true;
+	pthread_cond_broadcast(&this->_jobReady);
+	pthread_mutex_unlock(&this->_mutex);
+
+	std::vector<treeWorker *>::iterator it;
+	for(it = this->_workers.begin(); it != this->_workers.end(); ++it) {
+		if((*it)->started) {
+			pthread_join((*it)->thread, 0);
+		}
+
+		archive_write_close((*it)->archiveOut);
+		archive_write_free((*it)->archiveOut);
+		delete *it;
+	}
+	this->_workers.clear();
+
+	std::deque<treeJob *>::iterator qt;
+	for(qt = this->_queue.begin(); qt != this->_queue.end(); ++qt) {
+		TreeWriter::freeJob(*qt);
+	}
+	this->_queue.clear();
+	this->_queuedBytes = 0;
+	this->_inFlight.clear();
+
+	std::vector<struct archive *>::iterator at;
+	for(at = this->_archives.begin(); at != this->_archives.end(); ++at) {
+		archive_write_close(*at);
+		archive_write_free(*at);
+	}
+	this->_archives.clear();
+}
+
+}
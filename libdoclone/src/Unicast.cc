@@ -33,6 +33,8 @@
 #include <doclone/DiskLabel.h>
 #include <doclone/DlFactory.h>
 #include <doclone/Image.h>
+#include <doclone/Relay.h>
+#include <doclone/SenderPool.h>
 #include <doclone/exception/Exception.h>
 #include <doclone/exception/ConnectionException.h>
 #include <doclone/exception/ReadDataException.h>
@@ -231,7 +233,14 @@ void Unicast::sendFromImage() throw(Exception) {
 	DataTransfer::sendData(this->_fds, &tmpTotalSize,
 			static_cast<size_t>(sizeof(uint64_t)));
 
-	trns->copyData(fd, this->_fds);
+	if(this->_fds.size() > 1) {
+		// Every receiver is sent the file at its own pace
+		uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
+		SenderPool senders(this->_fds, window, dcl->getLagPolicy());
+		senders.sendFile(fd);
+	} else {
+		trns->zeroCopyData(fd, this->_fds);
+	}
 
 	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
 
@@ -298,7 +307,6 @@ void Unicast::sendFromDevice() throw(Exception) {
 
 	image.initCreateOperations();
 	image.initDiskReadArchive();
-	image.initFdWriteArchive(this->_fds);
 
 	/*
 	 * Before sending the data, it sends its size. So the client/s can
@@ -319,6 +327,9 @@ void Unicast::sendFromDevice() throw(Exception) {
 	DataTransfer::sendData(this->_fds, &tmpTotalSize,
 			static_cast<size_t>(sizeof(uint64_t)));
 
+	// From now on, the sockets are fed by the sender threads of the archive
+	image.initFdWriteArchive(this->_fds);
+
 	image.saveImageHeader();
 
 	image.readPartitionsData();
@@ -406,7 +417,7 @@ void Unicast::receiveToImage() throw(Exception) {
 	DataTransfer *trns = DataTransfer::getInstance();
 	trns->setTotalSize(tmpTotalSize);
 
-	trns->copyData(this->_fds[0], fd);
+	trns->zeroCopyData(this->_fds[0], fd);
 
 	dcl->markCompleted(Doclone::OP_TRANSFER_DATA, "");
 
@@ -460,22 +471,43 @@ void Unicast::receiveToDevice() throw(Exception) {
 	DataTransfer *trns = DataTransfer::getInstance();
 	trns->setTotalSize(tmpTotalSize);
 
+	/*
+	 * The stream keeps arriving while the disk is partitioned and formatted,
+	 * so the server isn't stalled meanwhile. The archive reads it from the
+	 * spool of a relay with no next link.
+	 */
+	uint64_t window = static_cast<uint64_t>(dcl->getLagWindow()) << 20;
+	Relay *spool = new Relay(this->_fds[0], -1, -1, window, false);
+
 	Image image;
-	image.initFdReadArchive(this->_fds[0]);
-	image.initDiskWriteArchive();
-	image.loadImageHeader();
+	try {
+		image.initFdReadArchive(spool->getLocalFd());
+		image.initDiskWriteArchive();
+		image.loadImageHeader();
 
-	if(image.canRestoreCheck(this->_device) == false) {
-		RestoreImageException ex;
-		throw ex;
-	}
+		if(image.canRestoreCheck(this->_device) == false) {
+			RestoreImageException ex;
+			throw ex;
+		}
 
-	image.initRestoreOperations(this->_device);
-	image.writePartitionTable(this->_device);
-	image.writePartitionsData(this->_device);
+		image.initRestoreOperations(this->_device);
+		image.writePartitionTable(this->_device);
 
-	image.freeWriteArchive();
-	image.freeReadArchive();
+		// The disk is ready, the server can wait for it from now on
+		spool->stopSpooling();
+
+		image.writePartitionsData(this->_device);
+
+		image.freeWriteArchive();
+		image.freeReadArchive();
+
+		spool->finish();
+	} catch(...) {
+		delete spool;
+		throw;
+	}
+
+	delete spool;
 
 	this->closeConnection();
 
@@ -18,23 +18,30 @@
 
 #include <doclone/Util.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <mntent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 #include <signal.h>
+#include <pthread.h>
 #include <string.h>
 #include <regex.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <fstream>
 
-#include <blkid/blkid.h>
-
 #include <doclone/Logger.h>
 #include <doclone/Clone.h>
 #include <doclone/exception/Exception.h>
@@ -299,6 +306,176 @@ void Util::writeBinData(const std::string &file, const void *data, unsigned int
 	log->debug("Util::writeBinData() end");
 }
 
+/**
+ * \brief Reads exactly size bytes of a file at the given offset
+ *
+ * \param fd The descriptor of the file
+ * \param data Buffer for the data
+ * \param offset The offset in the file
+ * \param size The number of bytes to read
+ *
+ * \return False if the data can't be read entirely
+ */
+bool Util::readBinData(int fd, void *data, uint64_t offset, size_t size) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Util::readBinData(fd=>%d, data=>0x%x, offset=>%d, size=>%d) start", fd, data, offset, size);
+
+	char *pos = static_cast<char *>(data);
+
+	while(size > 0) {
+		ssize_t nbytes = pread(fd, pos, size, offset);
+
+		if(nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if(nbytes <= 0) {
+			log->loopDebug("Util::readBinData(retVal=>%d) end", false);
+			return false;
+		}
+
+		pos += nbytes;
+		size -= nbytes;
+		offset += nbytes;
+	}
+
+	log->loopDebug("Util::readBinData(retVal=>%d) end", true);
+	return true;
+}
+
+/**
+ * \brief Returns where the data of a file starts in its device
+ *
+ * Only the first extent is asked to FIEMAP, it is enough to sort the files
+ * to be read in disk order.
+ *
+ * \param fd
+ * 		Descriptor of the file
+ *
+ * \return The physical offset in bytes, 0 if unknown
+ */
+uint64_t Util::getPhysicalOffset(int fd) {
+	uint64_t buf[(sizeof(struct fiemap) + sizeof(struct fiemap_extent))
+			/ sizeof(uint64_t) + 1] = {};
+	struct fiemap *map = reinterpret_cast<struct fiemap *>(buf);
+
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	if(ioctl(fd, FS_IOC_FIEMAP, map) < 0 || map->fm_mapped_extents == 0) {
+		return 0;
+	}
+
+	return map->fm_extents[0].fe_physical;
+}
+
+/**
+ * \brief Reads the names in a directory, sorted by inode number
+ *
+ * Visiting the files in inode order reads the inode tables sequentially, and
+ * on most filesystems the files created together have close inodes and data.
+ *
+ * \param fd
+ * 		Descriptor of the directory, it is left open
+ * \param entries
+ * 		Names of the files, but "." and ".."
+ */
+void Util::readDirectory(int fd, std::vector<dirEntry> &entries)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->loopDebug("Util::readDirectory(fd=>%d) start", fd);
+
+	DIR *directory;
+	struct dirent *d_file; // a file in *directory
+	int dupfd;
+
+	if ((dupfd = dup (fd)) < 0 || (directory = fdopendir (dupfd)) == 0) {
+		if(dupfd >= 0) {
+			close(dupfd);
+		}
+
+		FileNotFoundException ex(Util::intToString(fd));
+		throw ex;
+	}
+
+	// The descriptor may have been read before
+	rewinddir (directory);
+
+	entries.clear();
+	while ((d_file = readdir (directory)) != 0) {
+		if (strcmp (".", d_file->d_name) && strcmp ("..", d_file->d_name)) {
+			dirEntry entry;
+			entry.ino = d_file->d_ino;
+			entry.type = d_file->d_type;
+			entry.name = d_file->d_name;
+
+			entries.push_back(entry);
+		}
+	}
+
+	closedir (directory);
+
+	std::sort(entries.begin(), entries.end(), Util::inodeOrder);
+
+	log->loopDebug("Util::readDirectory(entries=>%d) end", entries.size());
+}
+
+/**
+ * \brief Sorts the directory entries by inode number
+ */
+bool Util::inodeOrder(const dirEntry &a, const dirEntry &b) {
+	return a.ino < b.ino;
+}
+
+/**
+ * \brief Gets the status of a directory entry and opens it if it is a regular
+ * file
+ *
+ * The path is only looked up once for the files the directory says to be
+ * regular: they are opened and their descriptor is stat'ed. Nothing else is
+ * opened, since opening a FIFO or a device can block or have side effects.
+ *
+ * \param dirfd
+ * 		Descriptor of the directory
+ * \param entry
+ * 		Name read from the directory
+ * \param filestat
+ * 		Status of the file, not following links
+ *
+ * \return Descriptor of the regular file, -1 if it is not one, or -2 if the
+ * file can't be stat'ed or it is a regular file that can't be opened
+ */
+int Util::openEntry(int dirfd, const dirEntry &entry, struct stat &filestat) {
+	const int flags = O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY;
+	int fd = -1;
+
+	if(entry.type == DT_REG) {
+		fd = openat(dirfd, entry.name.c_str(), flags);
+
+		// It may have been replaced since the directory was read
+		if(fd >= 0 && (fstat(fd, &filestat) < 0 || !S_ISREG(filestat.st_mode))) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	if(fd < 0) {
+		if(fstatat(dirfd, entry.name.c_str(), &filestat,
+				AT_SYMLINK_NOFOLLOW) < 0) {
+			return -2;
+		}
+
+		// Its data couldn't be read
+		if(S_ISREG(filestat.st_mode)
+				&& (fd = openat(dirfd, entry.name.c_str(), flags)) < 0) {
+			return -2;
+		}
+	}
+
+	return fd;
+}
+
 /**
  * \brief Adds a new line in /etc/mtab, called when the program mounts a
  * partition
@@ -514,6 +691,46 @@ bool Util::isDisk(const std::string &device) throw(Exception) {
 	return retValue;
 }
 
+/**
+ * \brief Checks whether a device is on a rotational disk
+ *
+ * \param device
+ * 		Path of the disk or partition
+ *
+ * \return True if the kernel says so, false if it doesn't or is unknown
+ */
+bool Util::isRotational(const std::string &device) {
+	Logger *log = Logger::getInstance();
+	log->debug("Util::isRotational(device=>%s) start", device.c_str());
+
+	bool retVal = false;
+	char realPath[PATH_MAX];
+
+	if(realpath(device.c_str(), realPath) != 0) {
+		std::string name = realPath;
+		name = name.substr(name.rfind('/') + 1);
+
+		// The queue of a partition is in the directory of its disk
+		std::string paths[] = {
+			"/sys/class/block/" + name + "/queue/rotational",
+			"/sys/class/block/" + name + "/../queue/rotational"
+		};
+
+		for(int i = 0; i < 2; i++) {
+			std::ifstream istr(paths[i].c_str(), std::ios::in);
+			int rotational;
+
+			if(istr >> rotational) {
+				retVal = rotational != 0;
+				break;
+			}
+		}
+	}
+
+	log->debug("Util::isRotational(retVal=>%d) end", retVal);
+	return retVal;
+}
+
 /**
  * Check if a string matches with the regular expression passed as parameter
  *
@@ -580,17 +797,22 @@ bool Util::isMountPoint(const std::string &path) throw(Exception) {
 	bool retVal = false;
 
 	FILE *fp;
+	struct mntent mnt;
 	struct mntent *tmp;
+	char buf[4096];
 
 	fp = setmntent("/etc/mtab","r");
 
 	if(fp == 0) {
 		FileNotFoundException ex("/etc/mtab");
 		ex.logMsg();
+
+		log->debug("Util::isMountPoint(retVal=>%d) end", retVal);
+		return retVal;
 	}
 
-	// Read all the mount points of the system
-	while( (tmp = getmntent(fp)) != 0) {
+	// Read all the mount points of the system, reentrant for the tree walkers
+	while( (tmp = getmntent_r(fp, &mnt, buf, sizeof(buf))) != 0) {
 		// if it matches, return true
 		if(path.compare(tmp->mnt_dir) == 0) {
 			retVal = true;
@@ -650,46 +872,18 @@ bool Util::isLiveFile(const char *path) {
 }
 
 /**
- * \brief Determines whether the given UUID is assigned to more than one device
- *
- * \param uuid
- * 		The UUID to check
+ * \brief Gets the number of processors currently online
  *
- * \return true if there are more than one device with the UUID, false otherwise
+ * \return Number of online processors, at least 1
  */
-bool Util::isUUIDRepeated(const char *uuid) throw(Exception) {
+unsigned int Util::getNumberOfCpus() {
 	Logger *log = Logger::getInstance();
-	log->debug("Util::isUUIDRepeated(uuid=>%s) start", uuid);
-	bool retVal = false;
+	log->debug("Util::getNumberOfCpus() start");
 
-	blkid_dev_iterate iter;
-	blkid_dev dev;
-	blkid_cache cache = 0;
-	int numDevRep = 0;
-
-	blkid_get_cache(&cache, "/dev/null"); //Do not use blkid cache
-	int blDev = blkid_probe_all(cache);
-	if(blDev != 0) {
-		blkid_put_cache(cache);
-		log->debug("Util::isUUIDRepeated(retVal=>%d) end", retVal);
-		// Returning true to enforce mounting/unmounting of the device, just in case.
-		return true;
-	}
-
-	iter = blkid_dev_iterate_begin(cache);
-	blkid_dev_set_search(iter, strdup("UUID"), strdup(uuid));
-	while (blkid_dev_next(iter, &dev) == 0) {
-		dev = blkid_verify(cache, dev);
-		if (!dev) {
-			continue;
-		}
-		numDevRep++;
-	}
-	blkid_dev_iterate_end(iter);
-	blkid_put_cache(cache);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int retVal = cpus > 0 ? cpus : 1;
 
-	retVal = numDevRep > 1;
-	log->debug("Util::isUUIDRepeated(retVal=>%d) end", retVal);
+	log->debug("Util::getNumberOfCpus(retVal=>%d) end", retVal);
 	return retVal;
 }
 
@@ -746,6 +940,25 @@ void Util::signalCapture() {
 	return;
 }
 
+/**
+ * \brief Blocks the signals captured by signalHandler() in the calling thread
+ *
+ * The handler throws exceptions, which can only be caught in the main thread,
+ * so the worker threads call this function before doing anything else.
+ */
+void Util::blockSignals() {
+	Logger *log = Logger::getInstance();
+	log->debug("Util::blockSignals() start");
+
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, 0);
+
+	log->debug("Util::blockSignals() end");
+}
+
 /**
  * \brief Captures the signals, preventing the interruption of the program.
  *
@@ -874,6 +1087,16 @@ void Util::spawn_command_line_sync(const std::string &command, int *exitValue, s
 			dup2(fds[1], STDOUT_FILENO);
 		}
 
+		/*
+		 * The worker threads block these signals, and the mask is kept
+		 * through exec, so Ctrl-C wouldn't stop the command.
+		 */
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGPIPE);
+		sigaddset(&set, SIGINT);
+		sigprocmask(SIG_UNBLOCK, &set, 0);
+
 		//Launch the new process
 		execlp("/bin/sh", "sh", "-c", command.c_str(), (void *)0);
 	} else if(waitpid(pid, &status, 0) != pid) {
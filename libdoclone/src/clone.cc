@@ -75,6 +75,12 @@ int doclone_create(const dc_doclone *dc_obj) {
 	try {
 		dcl->setImage(dc_obj->_image);
 		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
+		dcl->setCodec(static_cast<Doclone::dcCodec>(dc_obj->_codec));
+		dcl->setCompressionLevel(dc_obj->_compressionLevel);
+		dcl->setBlockImaging(dc_obj->_blockImaging);
 
 		dcl->create();
 	} catch(const Doclone::Exception &ex) {
@@ -101,6 +107,9 @@ int doclone_restore(const dc_doclone *dc_obj) {
 	try {
 		dcl->setImage(dc_obj->_image);
 		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
 
 		dcl->restore();
 	} catch(const Doclone::Exception &ex) {
@@ -128,8 +137,16 @@ int doclone_send(const dc_doclone *dc_obj) {
 	try {
 		dcl->setImage(dc_obj->_image);
 		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
+		dcl->setCodec(static_cast<Doclone::dcCodec>(dc_obj->_codec));
+		dcl->setCompressionLevel(dc_obj->_compressionLevel);
+		dcl->setBlockImaging(dc_obj->_blockImaging);
 
 		dcl->setNodesNumber(dc_obj->_nodesNumber);
+		dcl->setLagWindow(dc_obj->_lagWindow);
+		dcl->setLagPolicy(static_cast<Doclone::dcLagPolicy>(dc_obj->_lagPolicy));
 
 		dcl->send();
 	} catch(const Doclone::Exception &ex) {
@@ -157,6 +174,9 @@ int doclone_receive(const dc_doclone *dc_obj) {
 	try {
 		dcl->setImage(dc_obj->_image);
 		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
 		dcl->setAddress(dc_obj->_address);
 
 		dcl->receive();
@@ -184,6 +204,12 @@ int doclone_chain_origin(const dc_doclone *dc_obj) {
 	try {
 		dcl->setImage(dc_obj->_image);
 		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
+		dcl->setCodec(static_cast<Doclone::dcCodec>(dc_obj->_codec));
+		dcl->setCompressionLevel(dc_obj->_compressionLevel);
+		dcl->setBlockImaging(dc_obj->_blockImaging);
 
 		dcl->chainOrigin();
 	} catch(const Doclone::Exception &ex) {
@@ -210,6 +236,9 @@ int doclone_chain_link(const dc_doclone *dc_obj) {
 		try {
 			dcl->setImage(dc_obj->_image);
 			dcl->setDevice(dc_obj->_device);
+			dcl->setBufferSize(dc_obj->_bufferSize);
+			dcl->setBufferCount(dc_obj->_bufferCount);
+			dcl->setThreads(dc_obj->_threads);
 
 			dcl->chainLink();
 		} catch(const Doclone::Exception &ex) {
@@ -220,6 +249,74 @@ int doclone_chain_link(const dc_doclone *dc_obj) {
 		return retVal;
 }
 
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sends an image or a device to the network by IP multicast.
+ *
+ * The number of receivers and either image or device path must be set before
+ * calling this function.
+ *
+ * \return 0 if the process has success, -1 if any error happen
+ */
+int doclone_multicast_send(const dc_doclone *dc_obj) {
+	Doclone::Clone *dcl = Doclone::Clone::getInstance();
+
+	int retVal = 0;
+
+	try {
+		dcl->setImage(dc_obj->_image);
+		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
+		dcl->setCodec(static_cast<Doclone::dcCodec>(dc_obj->_codec));
+		dcl->setCompressionLevel(dc_obj->_compressionLevel);
+		dcl->setBlockImaging(dc_obj->_blockImaging);
+
+		dcl->setNodesNumber(dc_obj->_nodesNumber);
+		dcl->setInterface(dc_obj->_interface);
+		dcl->setMulticastRate(dc_obj->_multicastRate);
+
+		dcl->multicastSend();
+	} catch(const Doclone::Exception &ex) {
+		ex.logMsg();
+		retVal = -1;
+	}
+
+	return retVal;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Receives an image or a device from the network by IP multicast.
+ *
+ * Either image or device path must be set before calling this function.
+ *
+ * \return 0 if the process has success, -1 if any error happen
+ */
+int doclone_multicast_receive(const dc_doclone *dc_obj) {
+	Doclone::Clone *dcl = Doclone::Clone::getInstance();
+
+	int retVal = 0;
+
+	try {
+		dcl->setImage(dc_obj->_image);
+		dcl->setDevice(dc_obj->_device);
+		dcl->setBufferSize(dc_obj->_bufferSize);
+		dcl->setBufferCount(dc_obj->_bufferCount);
+		dcl->setThreads(dc_obj->_threads);
+		dcl->setAddress(dc_obj->_address);
+		dcl->setInterface(dc_obj->_interface);
+
+		dcl->multicastReceive();
+	} catch(const Doclone::Exception &ex) {
+		ex.logMsg();
+		retVal = -1;
+	}
+
+	return retVal;
+}
+
 /**
  * \ingroup CWrapperAPI
  * \brief Through this function the user can set its callback for the transfer
@@ -329,6 +426,98 @@ void doclone_set_force(dc_doclone *dc_obj, unsigned short force) {
 	dc_obj->_force = force;
 }
 
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the number of reading, compression and restoring threads of the given dc_doclone object
+ *
+ * 0 means one thread per online processor
+ */
+void doclone_set_threads(dc_doclone *dc_obj, unsigned int threads) {
+	dc_obj->_threads = threads;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the compression codec of the given dc_doclone object
+ *
+ * Only used when creating or sending an image, the codec of the images to be
+ * restored is detected automatically
+ */
+void doclone_set_codec(dc_doclone *dc_obj, dcCodec codec) {
+	dc_obj->_codec = codec;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the compression level of the given dc_doclone object
+ *
+ * 0 means the default level of the codec
+ */
+void doclone_set_compression_level(dc_doclone *dc_obj, int level) {
+	dc_obj->_compressionLevel = level;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the size of the data buffers of the given dc_doclone object
+ *
+ * 0 means a size chosen for each descriptor type
+ */
+void doclone_set_buffer_size(dc_doclone *dc_obj, unsigned int size) {
+	dc_obj->_bufferSize = size;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the number of data buffers of the given dc_doclone object
+ *
+ * 0 means the default number
+ */
+void doclone_set_buffer_count(dc_doclone *dc_obj, unsigned int count) {
+	dc_obj->_bufferCount = count;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the lag window, in MiB, of the given dc_doclone object
+ *
+ * 0 means the default window
+ */
+void doclone_set_lag_window(dc_doclone *dc_obj, unsigned int window) {
+	dc_obj->_lagWindow = window;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the lag policy of the given dc_doclone object
+ *
+ * Says what to do with the receivers that fall out of the lag window
+ */
+void doclone_set_lag_policy(dc_doclone *dc_obj, dcLagPolicy policy) {
+	dc_obj->_lagPolicy = policy;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the multicast rate, in Mbit/s, of the given dc_doclone object
+ *
+ * 0 means the default rate
+ */
+void doclone_set_multicast_rate(dc_doclone *dc_obj, unsigned int rate) {
+	dc_obj->_multicastRate = rate;
+}
+
+/**
+ * \ingroup CWrapperAPI
+ * \brief Sets the block imaging flag of the given dc_doclone object
+ *
+ * Only used when creating or sending an image, the images to be restored say
+ * how each partition was imaged
+ */
+void doclone_set_block_imaging(dc_doclone *dc_obj, unsigned short blocks) {
+	dc_obj->_blockImaging = blocks;
+}
+
 /*
  * C wrapper for callback functions
  */
@@ -19,7 +19,6 @@
 #include <doclone/dl/Dvh.h>
 
 #include <doclone/PartedDevice.h>
-#include <doclone/Util.h>
 #include <doclone/exception/WarningException.h>
 
 namespace Doclone {
@@ -52,6 +51,7 @@ void Dvh::readPartitions() throw(Exception) {
 	pedDev->open();
 	PedDisk *pDisk = pedDev->getDisk();
 
+	std::vector<PedPartition *> pedParts;
 	while ((pedPart = ped_disk_next_partition (pDisk, pedPart))) {
 		/*
 		 * The extended partition is created automatically by libparted when
@@ -59,19 +59,17 @@ void Dvh::readPartitions() throw(Exception) {
 		 */
 		if (ped_partition_is_active (pedPart)
 				&& pedPart->type != PED_PARTITION_EXTENDED) {
-			try {
-				std::string path=
-						Util::buildPartPath(pedPart->disk->dev->path, pedPart->num);
-				Partition *part = new Partition();
-				part->initFromPath(path);
-				this->_partitions.push_back(part);
-			}
-			catch(const WarningException &ex) {
-				continue;
-			}
+			pedParts.push_back(pedPart);
 		}
 	}
 
+	try {
+		this->initPartitions(pedParts);
+	} catch(...) {
+		pedDev->close();
+		throw;
+	}
+
 	pedDev->close();
 
 	log->debug("Dvh::readPartitions() end");
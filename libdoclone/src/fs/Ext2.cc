@@ -24,6 +24,7 @@
 #include <doclone/Logger.h>
 #include <doclone/Util.h>
 #include <doclone/exception/Exception.h>
+#include <doclone/exception/ReadBlockMapException.h>
 #include <doclone/exception/WriteLabelException.h>
 #include <doclone/exception/WriteUuidException.h>
 
@@ -78,6 +79,9 @@ void Ext2::checkSupport() {
 	this->_uuidSupport = true;
 	this->_labelSupport = true;
 
+	// The used blocks are read with e2fslibs
+	this->_blockSupport = true;
+
 	log->debug("Ext2::checkSupport() end");
 }
 
@@ -197,6 +201,77 @@ void Ext2::writeUUID(const std::string &dev) const throw(Exception) {
 
 	log->debug("Ext2::writeUUID() end");
 }
+
+/**
+ * \brief Reads the used blocks of a ext2/3/4 fs from its block bitmap
+ *
+ * The blocks in front of the first data block (the boot block, with 1 KiB
+ * blocks) are always taken.
+ *
+ * \param dev
+ * 		The path of the partition
+ * \param map
+ * 		Filled with the used blocks
+ */
+void Ext2::readBlockMap(const std::string &dev, BlockMap &map) const
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Ext2::readBlockMap(dev=>%s) start", dev.c_str());
+
+	ext2_filsys fs;
+
+	errcode_t retVal = ext2fs_open(dev.c_str(), EXT2_FLAG_64BITS, 0, 0,
+			unix_io_manager, &fs);
+
+	if (retVal) {
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	if (ext2fs_read_block_bitmap(fs)) {
+		ext2fs_close(fs);
+
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	try {
+		blk64_t blocks = ext2fs_blocks_count(fs->super);
+		blk64_t first = fs->super->s_first_data_block;
+
+		map = BlockMap(fs->blocksize, blocks);
+		map.addExtent(0, first);
+
+		// Runs of set bits, found a word at a time by e2fslibs
+		blk64_t start = first;
+		while (start < blocks) {
+			blk64_t used, unused;
+
+			if (ext2fs_find_first_set_block_bitmap2(fs->block_map, start,
+					blocks - 1, &used)) {
+				break;
+			}
+
+			if (ext2fs_find_first_zero_block_bitmap2(fs->block_map, used,
+					blocks - 1, &unused)) {
+				unused = blocks;
+			}
+
+			map.addExtent(used, unused - used);
+			start = unused;
+		}
+	}
+	catch(const Exception &e) {
+		ext2fs_close(fs);
+
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	ext2fs_close(fs);
+
+	log->debug("Ext2::readBlockMap(used=>%d) end", map.getUsedBlocks());
+}
 /**@}*/
 
 }
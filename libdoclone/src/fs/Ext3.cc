@@ -72,6 +72,9 @@ void Ext3::checkSupport() {
 	this->_uuidSupport = true;
 	this->_labelSupport = true;
 
+	// The used blocks are read with e2fslibs
+	this->_blockSupport = true;
+
 	log->debug("Ext3::checkSupport() end");
 }
 /**@}*/
@@ -19,12 +19,16 @@
 #include <doclone/fs/Fat16.h>
 
 #include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
 
 #include <doclone/Logger.h>
 #include <doclone/Util.h>
 #include <doclone/exception/Exception.h>
+#include <doclone/exception/ReadBlockMapException.h>
 #include <doclone/exception/WriteLabelException.h>
 #include <doclone/exception/WriteUuidException.h>
 
@@ -79,6 +83,9 @@ void Fat16::checkSupport() {
 	this->_uuidSupport = true;
 	this->_labelSupport = true;
 
+	// The used clusters are read from the FAT
+	this->_blockSupport = true;
+
 	log->debug("Fat16::checkSupport() end");
 }
 
@@ -150,6 +157,199 @@ void Fat16::writeUUID(const std::string &dev) const throw(Exception) {
 
 	log->debug("Fat16::writeUUID() end");
 }
+
+/**
+ * \brief Reads the used sectors of the fs from the FAT
+ *
+ * \param dev
+ * 		The path of the partition
+ * \param map
+ * 		Filled with the used sectors
+ */
+void Fat16::readBlockMap(const std::string &dev, BlockMap &map) const
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Fat16::readBlockMap(dev=>%s) start", dev.c_str());
+
+	Fat16::readFatMap(dev, map);
+
+	log->debug("Fat16::readBlockMap() end");
+}
+
+/**
+ * \brief Reads the used sectors of a fat12, fat16 or fat32 from the first FAT
+ *
+ * The reserved sectors, the FATs and the root directory of fat12/16 are
+ * always taken, followed by the clusters that are neither free nor bad. The
+ * variant is told apart by the number of clusters, not by the boot sector.
+ *
+ * \param dev
+ * 		The path of the partition
+ * \param map
+ * 		Filled with the used sectors
+ */
+void Fat16::readFatMap(const std::string &dev, BlockMap &map)
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Fat16::readFatMap(dev=>%s) start", dev.c_str());
+
+	int fd = open(dev.c_str(), O_RDONLY);
+
+	if(fd < 0) {
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	try {
+		uint8_t boot[512];
+
+		if(!Util::readBinData(fd, boot, 0, sizeof(boot))
+				|| boot[510] != 0x55 || boot[511] != 0xaa) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		uint16_t bytesPerSector, reservedSectors, rootEntries, sectors16,
+			fatSize16;
+		uint32_t sectors32, fatSize32;
+		memcpy(&bytesPerSector, boot + 0x0b, sizeof(bytesPerSector));
+		memcpy(&reservedSectors, boot + 0x0e, sizeof(reservedSectors));
+		memcpy(&rootEntries, boot + 0x11, sizeof(rootEntries));
+		memcpy(&sectors16, boot + 0x13, sizeof(sectors16));
+		memcpy(&fatSize16, boot + 0x16, sizeof(fatSize16));
+		memcpy(&sectors32, boot + 0x20, sizeof(sectors32));
+		memcpy(&fatSize32, boot + 0x24, sizeof(fatSize32));
+		bytesPerSector = le16toh(bytesPerSector);
+		reservedSectors = le16toh(reservedSectors);
+		rootEntries = le16toh(rootEntries);
+		sectors16 = le16toh(sectors16);
+		fatSize16 = le16toh(fatSize16);
+		sectors32 = le32toh(sectors32);
+		fatSize32 = le32toh(fatSize32);
+
+		uint32_t sectorsPerCluster = boot[0x0d];
+		uint32_t numFats = boot[0x10];
+		uint32_t totalSectors = sectors16 ? sectors16 : sectors32;
+		uint32_t fatSize = fatSize16 ? fatSize16 : fatSize32;
+
+		if(bytesPerSector < 512 || bytesPerSector > 4096
+				|| (bytesPerSector & (bytesPerSector - 1))
+				|| sectorsPerCluster == 0
+				|| (sectorsPerCluster & (sectorsPerCluster - 1))
+				|| reservedSectors == 0 || numFats == 0 || fatSize == 0) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		uint32_t rootSectors = (rootEntries * 32 + bytesPerSector - 1)
+				/ bytesPerSector;
+		uint64_t dataStart = reservedSectors
+				+ static_cast<uint64_t>(numFats) * fatSize + rootSectors;
+
+		if(totalSectors <= dataStart) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		uint32_t clusters = (totalSectors - dataStart) / sectorsPerCluster;
+
+		unsigned int entryBits;
+		uint32_t badCluster;
+		if(clusters < 4085) {
+			entryBits = 12;
+			badCluster = 0xff7;
+		}
+		else if(clusters < 65525) {
+			entryBits = 16;
+			badCluster = 0xfff7;
+		}
+		else {
+			entryBits = 32;
+			badCluster = 0x0ffffff7;
+		}
+
+		// The clusters are numbered from 2, the first two entries are reserved
+		uint64_t fatBytes = ((clusters + 2ULL) * entryBits + 7) / 8;
+		if(fatBytes > static_cast<uint64_t>(fatSize) * bytesPerSector) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		map = BlockMap(bytesPerSector, totalSectors);
+		map.addExtent(0, dataStart);
+
+		// Holds whole pairs of fat12 entries and whole fat32 entries
+		std::vector<uint8_t> buf(3 << 18);
+		uint64_t fatOffset = static_cast<uint64_t>(reservedSectors)
+				* bytesPerSector;
+		uint32_t entry = 0;
+		uint32_t runStart = 0;
+		bool inRun = false;
+
+		for(uint64_t pos = 0; pos < fatBytes; pos += buf.size()) {
+			size_t len = std::min(static_cast<uint64_t>(buf.size()),
+					fatBytes - pos);
+
+			if(!Util::readBinData(fd, &buf[0], fatOffset + pos, len)) {
+				ReadBlockMapException ex(dev);
+				throw ex;
+			}
+
+			uint32_t count = len * 8 / entryBits;
+			for(uint32_t i = 0; i < count && entry < clusters + 2;
+					i++, entry++) {
+				uint32_t value;
+
+				if(entryBits == 12) {
+					const uint8_t *p = &buf[i * 3 / 2];
+					value = p[0] | (p[1] << 8);
+					value = (i & 1) ? value >> 4 : value & 0xfff;
+				}
+				else if(entryBits == 16) {
+					uint16_t value16;
+					memcpy(&value16, &buf[i * 2], sizeof(value16));
+					value = le16toh(value16);
+				}
+				else {
+					memcpy(&value, &buf[i * 4], sizeof(value));
+					value = le32toh(value) & 0x0fffffff;
+				}
+
+				bool used = entry >= 2 && value != 0 && value != badCluster;
+
+				if(used && !inRun) {
+					runStart = entry;
+					inRun = true;
+				}
+				else if(!used && inRun) {
+					map.addExtent(dataStart
+							+ static_cast<uint64_t>(runStart - 2)
+							* sectorsPerCluster,
+							static_cast<uint64_t>(entry - runStart)
+							* sectorsPerCluster);
+					inRun = false;
+				}
+			}
+		}
+
+		if(inRun) {
+			map.addExtent(dataStart
+					+ static_cast<uint64_t>(runStart - 2) * sectorsPerCluster,
+					static_cast<uint64_t>(entry - runStart)
+					* sectorsPerCluster);
+		}
+	}
+	catch(const Exception &e) {
+		close(fd);
+
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	close(fd);
+
+	log->debug("Fat16::readFatMap(used=>%d) end", map.getUsedBlocks());
+}
 /**@}*/
 
 }
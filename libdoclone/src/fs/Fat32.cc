@@ -24,6 +24,7 @@
 
 #include <doclone/Logger.h>
 #include <doclone/Util.h>
+#include <doclone/fs/Fat16.h>
 #include <doclone/exception/Exception.h>
 #include <doclone/exception/WriteLabelException.h>
 #include <doclone/exception/WriteUuidException.h>
@@ -79,6 +80,9 @@ void Fat32::checkSupport() {
 	this->_uuidSupport = true;
 	this->_labelSupport = true;
 
+	// The used clusters are read from the FAT
+	this->_blockSupport = true;
+
 	log->debug("Fat32::checkSupport() end");
 }
 
@@ -150,6 +154,24 @@ void Fat32::writeUUID(const std::string &dev) const throw(Exception) {
 
 	log->debug("Fat32::writeUUID() end");
 }
+
+/**
+ * \brief Reads the used sectors of the fs from the FAT
+ *
+ * \param dev
+ * 		The path of the partition
+ * \param map
+ * 		Filled with the used sectors
+ */
+void Fat32::readBlockMap(const std::string &dev, BlockMap &map) const
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Fat32::readBlockMap(dev=>%s) start", dev.c_str());
+
+	Fat16::readFatMap(dev, map);
+
+	log->debug("Fat32::readBlockMap() end");
+}
 /**@}*/
 
 }
@@ -19,12 +19,16 @@
 #include <doclone/fs/Ntfs.h>
 
 #include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
 
 #include <doclone/Logger.h>
 #include <doclone/Util.h>
 #include <doclone/exception/Exception.h>
+#include <doclone/exception/ReadBlockMapException.h>
 #include <doclone/exception/WriteLabelException.h>
 #include <doclone/exception/WriteUuidException.h>
 
@@ -91,6 +95,9 @@ void Ntfs::checkSupport() {
 		this->_labelSupport = true;
 	}
 
+	// The used clusters are read from $Bitmap
+	this->_blockSupport = true;
+
 	log->debug("Ntfs::checkSupport() end");
 }
 
@@ -170,6 +177,376 @@ void Ntfs::writeUUID(const std::string &dev) const throw(Exception) {
 
 	log->debug("Ntfs::writeUUID() end");
 }
+
+/**
+ * \brief Reads the used clusters of a ntfs from $Bitmap
+ *
+ * The boot sector and the $Bitmap record are parsed straight from the device,
+ * as ntfsclone does. $Bitmap is looked for in the first extent of the MFT,
+ * because the first records of the MFT are always kept contiguous.
+ *
+ * The map is made of sectors rather than clusters, to take the backup of the
+ * boot sector too, that is in the last sector of the partition.
+ *
+ * \param dev
+ * 		The path of the partition
+ * \param map
+ * 		Filled with the used sectors
+ */
+void Ntfs::readBlockMap(const std::string &dev, BlockMap &map) const
+		throw(Exception) {
+	Logger *log = Logger::getInstance();
+	log->debug("Ntfs::readBlockMap(dev=>%s) start", dev.c_str());
+
+	int fd = open(dev.c_str(), O_RDONLY);
+
+	if(fd < 0) {
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	try {
+		uint8_t boot[512];
+
+		if(!Util::readBinData(fd, boot, 0, sizeof(boot))
+				|| memcmp(boot + 0x03, "NTFS    ", 8)) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		uint16_t bytesPerSector;
+		uint64_t totalSectors, mftLcn;
+		memcpy(&bytesPerSector, boot + 0x0b, sizeof(bytesPerSector));
+		memcpy(&totalSectors, boot + 0x28, sizeof(totalSectors));
+		memcpy(&mftLcn, boot + 0x30, sizeof(mftLcn));
+		bytesPerSector = le16toh(bytesPerSector);
+		totalSectors = le64toh(totalSectors);
+		mftLcn = le64toh(mftLcn);
+
+		// Big clusters are given as a negative power of two
+		uint32_t sectorsPerCluster = boot[0x0d];
+		if(sectorsPerCluster > 0x80) {
+			uint32_t shift = 256 - sectorsPerCluster;
+			sectorsPerCluster = shift <= 16 ? 1U << shift : 0;
+		}
+
+		if(bytesPerSector < 256 || bytesPerSector > 4096
+				|| (bytesPerSector & (bytesPerSector - 1))
+				|| sectorsPerCluster == 0
+				|| totalSectors < sectorsPerCluster) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		uint64_t clusterSize = bytesPerSector * sectorsPerCluster;
+
+		// The same for the size of a MFT record
+		int8_t clustersPerRecord = static_cast<int8_t>(boot[0x40]);
+		uint64_t recordSize;
+		if(clustersPerRecord > 0) {
+			recordSize = clustersPerRecord * clusterSize;
+		}
+		else if(clustersPerRecord > -31) {
+			recordSize = 1U << -clustersPerRecord;
+		}
+		else {
+			recordSize = 0;
+		}
+
+		if(recordSize < 512 || recordSize > 0x10000 || recordSize % 512) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		std::vector<uint8_t> record(recordSize);
+		uint64_t recordOffset = mftLcn * clusterSize
+				+ NTFS_BITMAP_RECORD * recordSize;
+
+		if(!Util::readBinData(fd, &record[0], recordOffset, recordSize)
+				|| memcmp(&record[0], "FILE", 4)
+				|| !Ntfs::applyFixups(&record[0], recordSize)) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		// Looks for the unnamed $DATA attribute
+		uint16_t attrOffset;
+		memcpy(&attrOffset, &record[0x14], sizeof(attrOffset));
+		uint32_t pos = le16toh(attrOffset);
+		const uint8_t *data = 0;
+		uint32_t dataLength = 0;
+
+		while(pos + 16 <= recordSize) {
+			uint32_t type, length;
+			memcpy(&type, &record[pos], sizeof(type));
+			memcpy(&length, &record[pos + 4], sizeof(length));
+			type = le32toh(type);
+			length = le32toh(length);
+
+			if(type == 0xffffffff || length < 16 || length > recordSize - pos) {
+				break;
+			}
+
+			if(type == 0x80 && record[pos + 9] == 0) {
+				data = &record[pos];
+				dataLength = length;
+				break;
+			}
+
+			pos += length;
+		}
+
+		if(data == 0) {
+			ReadBlockMapException ex(dev);
+			throw ex;
+		}
+
+		// Takes the backup boot sector if the partition has room for it
+		off_t devSize = lseek(fd, 0, SEEK_END);
+		uint64_t sectors = totalSectors;
+		if(devSize > 0 && static_cast<uint64_t>(devSize) / bytesPerSector
+				> totalSectors) {
+			sectors++;
+		}
+
+		map = BlockMap(bytesPerSector, sectors);
+		bitmapScan scan = {totalSectors / sectorsPerCluster, sectorsPerCluster,
+				0, 0, false};
+
+		if(data[0x08] == 0) {
+			// Resident, only on tiny volumes
+			uint32_t valueLength;
+			uint16_t valueOffset;
+			memcpy(&valueLength, data + 0x10, sizeof(valueLength));
+			memcpy(&valueOffset, data + 0x14, sizeof(valueOffset));
+			valueLength = le32toh(valueLength);
+			valueOffset = le16toh(valueOffset);
+
+			if(valueOffset > dataLength
+					|| valueLength > dataLength - valueOffset) {
+				ReadBlockMapException ex(dev);
+				throw ex;
+			}
+
+			Ntfs::scanBitmap(scan, data + valueOffset, valueLength, map);
+		}
+		else {
+			uint16_t runOffset;
+			uint64_t dataSize;
+			memcpy(&runOffset, data + 0x20, sizeof(runOffset));
+			memcpy(&dataSize, data + 0x30, sizeof(dataSize));
+			runOffset = le16toh(runOffset);
+			dataSize = le64toh(dataSize);
+
+			std::vector<std::pair<int64_t, uint64_t> > runs;
+			if(dataLength < 0x40 || runOffset >= dataLength
+					|| !Ntfs::decodeRunlist(data + runOffset, data + dataLength,
+							runs)) {
+				ReadBlockMapException ex(dev);
+				throw ex;
+			}
+
+			std::vector<uint8_t> buf(1 << 20);
+			uint64_t left = dataSize;
+
+			std::vector<std::pair<int64_t, uint64_t> >::const_iterator it;
+			for(it = runs.begin(); it != runs.end() && left > 0; ++it) {
+				uint64_t len = std::min(it->second * clusterSize, left);
+				left -= len;
+
+				// Sparse run, read as zeros
+				if(it->first < 0) {
+					Ntfs::skipBitmap(scan, len, map);
+					continue;
+				}
+
+				uint64_t offset = it->first * clusterSize;
+				while(len > 0) {
+					size_t chunk = std::min(static_cast<uint64_t>(buf.size()),
+							len);
+
+					if(!Util::readBinData(fd, &buf[0], offset, chunk)) {
+						ReadBlockMapException ex(dev);
+						throw ex;
+					}
+
+					Ntfs::scanBitmap(scan, &buf[0], chunk, map);
+					offset += chunk;
+					len -= chunk;
+				}
+			}
+		}
+
+		// Closes the last run
+		Ntfs::skipBitmap(scan, 0, map);
+
+		if(sectors > totalSectors) {
+			map.addExtent(totalSectors, 1);
+		}
+	}
+	catch(const Exception &e) {
+		close(fd);
+
+		ReadBlockMapException ex(dev);
+		throw ex;
+	}
+
+	close(fd);
+
+	log->debug("Ntfs::readBlockMap(used=>%d) end", map.getUsedBlocks());
+}
+
+/**
+ * \brief Restores the last two bytes of every 512 bytes of a MFT record
+ *
+ * They were replaced with the update sequence number when the record was
+ * written, to detect torn writes.
+ *
+ * \return False if the record is damaged
+ */
+bool Ntfs::applyFixups(uint8_t *record, uint32_t size) {
+	uint16_t usaOffset, usaCount;
+	memcpy(&usaOffset, record + 0x04, sizeof(usaOffset));
+	memcpy(&usaCount, record + 0x06, sizeof(usaCount));
+	usaOffset = le16toh(usaOffset);
+	usaCount = le16toh(usaCount);
+
+	if(usaCount == 0 || (usaCount - 1) * 512U != size
+			|| usaOffset + usaCount * 2U > 512) {
+		return false;
+	}
+
+	const uint8_t *usa = record + usaOffset;
+	for(uint16_t i = 1; i < usaCount; i++) {
+		uint8_t *end = record + i * 512 - 2;
+
+		if(memcmp(end, usa, 2)) {
+			return false;
+		}
+
+		memcpy(end, usa + i * 2, 2);
+	}
+
+	return true;
+}
+
+/**
+ * \brief Decodes the runlist of a non-resident attribute
+ *
+ * \param run
+ * 		First byte of the runlist
+ * \param end
+ * 		End of the attribute
+ * \param runs
+ * 		Filled with the first cluster and the length of each run. The first
+ * 		cluster of the sparse runs is -1.
+ *
+ * \return False if the runlist is damaged
+ */
+bool Ntfs::decodeRunlist(const uint8_t *run, const uint8_t *end,
+		std::vector<std::pair<int64_t, uint64_t> > &runs) {
+	int64_t lcn = 0;
+
+	while(run < end && *run != 0) {
+		unsigned int lengthBytes = *run & 0x0f;
+		unsigned int offsetBytes = *run >> 4;
+		run++;
+
+		if(lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8
+				|| end - run < static_cast<int>(lengthBytes + offsetBytes)) {
+			return false;
+		}
+
+		uint64_t length = 0;
+		for(unsigned int i = 0; i < lengthBytes; i++) {
+			length |= static_cast<uint64_t>(run[i]) << (8 * i);
+		}
+		run += lengthBytes;
+
+		if(offsetBytes == 0) {
+			runs.push_back(std::make_pair(static_cast<int64_t>(-1), length));
+			continue;
+		}
+
+		// The offset is signed and relative to the previous run
+		uint64_t delta = 0;
+		for(unsigned int i = 0; i < offsetBytes; i++) {
+			delta |= static_cast<uint64_t>(run[i]) << (8 * i);
+		}
+		if(offsetBytes < 8 && (run[offsetBytes - 1] & 0x80)) {
+			delta |= ~0ULL << (8 * offsetBytes);
+		}
+		run += offsetBytes;
+
+		lcn += static_cast<int64_t>(delta);
+		if(lcn < 0) {
+			return false;
+		}
+
+		runs.push_back(std::make_pair(lcn, length));
+	}
+
+	return run < end;
+}
+
+/**
+ * \brief Adds the runs of used clusters in a piece of $Bitmap to the map
+ *
+ * Words with all the clusters free, or all used inside a run, are skipped at
+ * once.
+ */
+void Ntfs::scanBitmap(bitmapScan &scan, const uint8_t *buf, size_t len,
+		BlockMap &map) throw(Exception) {
+	size_t i = 0;
+
+	while(i < len && scan.cluster < scan.clusters) {
+		uint64_t word;
+		if(len - i >= sizeof(word) && scan.clusters - scan.cluster >= 64) {
+			memcpy(&word, buf + i, sizeof(word));
+
+			if(word == (scan.inRun ? ~0ULL : 0)) {
+				scan.cluster += 64;
+				i += sizeof(word);
+				continue;
+			}
+		}
+
+		uint8_t byte = buf[i++];
+		for(int bit = 0; bit < 8 && scan.cluster < scan.clusters; bit++) {
+			bool used = byte & (1 << bit);
+
+			if(used && !scan.inRun) {
+				scan.runStart = scan.cluster;
+				scan.inRun = true;
+			}
+			else if(!used && scan.inRun) {
+				map.addExtent(scan.runStart * scan.sectorsPerCluster,
+						(scan.cluster - scan.runStart) * scan.sectorsPerCluster);
+				scan.inRun = false;
+			}
+
+			scan.cluster++;
+		}
+	}
+}
+
+/**
+ * \brief Goes past a piece of $Bitmap with all the clusters free
+ *
+ * \param len
+ * 		Length of the piece, in bytes. With 0, only closes the current run.
+ */
+void Ntfs::skipBitmap(bitmapScan &scan, uint64_t len, BlockMap &map)
+		throw(Exception) {
+	if(scan.inRun) {
+		map.addExtent(scan.runStart * scan.sectorsPerCluster,
+				(scan.cluster - scan.runStart) * scan.sectorsPerCluster);
+		scan.inRun = false;
+	}
+
+	uint64_t left = scan.clusters - scan.cluster;
+	scan.cluster += len < left / 8 ? len * 8 : left;
+}
 /**@}*/
 
 }
@@ -573,15 +573,17 @@ const uint64_t XMLDocument::getElementValueU64(const DOMElement *parent,
  *
  * \param parent The parent of the element
  * \param name The name of the element
+ * \param size The size of the returned array, 0 if there is none
  *
  * \return A byte array with the content of the element
  */
 const uint8_t *XMLDocument::getElementValueBinary(const DOMElement *parent,
-		const char *name) {
+		const char *name, size_t &size) {
 	Logger *log = Logger::getInstance();
 	log->debug("XMLDocument::getElementValueBinary(parent=>0x%x, name=>%s) start", parent, name);
 
 	const uint8_t *retVal = 0;
+	size = 0;
 	XMLStringHandler *xmlStr = XMLStringHandler::getInstance();
 
 	DOMNodeList *nodeList = parent->getElementsByTagName(xmlStr->toXMLText(name));
@@ -592,6 +594,7 @@ const uint8_t *XMLDocument::getElementValueBinary(const DOMElement *parent,
 		XMLByte *binaryContent = Base64::decodeToXMLByte(content, &outputSize);
 		if(outputSize > 0) {
 			retVal = xmlStr->toBinaryArray(binaryContent, true);
+			size = outputSize;
 		}
 	}
 
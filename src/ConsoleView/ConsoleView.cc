@@ -205,7 +205,7 @@ void ConsoleView::initView(int argc, char **argv) const {
 	std::string interface="";
 	int nodesNumber = 0;
 
-	const char options_c[] = "hvcrSRsld:f:a:i:n:eF";
+	const char options_c[] = "hvcrSRslMmd:f:a:i:n:eFt:z:b:B";
 	const struct option options_l[] = {
 		{"help", 0, 0, 'h'},
 		{"version", 0, 0, 'v'},
@@ -215,6 +215,8 @@ void ConsoleView::initView(int argc, char **argv) const {
 		{"receive", 0, 0, 'R'},
 		{"link-send", 0, 0, 's'},
 		{"link-receive", 0, 0, 'l'},
+		{"mcast-send", 0, 0, 'M'},
+		{"mcast-receive", 0, 0, 'm'},
 		{"device", 1, 0, 'd'},
 		{"file", 1, 0, 'f'},
 		{"address", 1, 0, 'a'},
@@ -222,6 +224,10 @@ void ConsoleView::initView(int argc, char **argv) const {
 		{"nodes", 1, 0, 'n'},
 		{"empty", 0, 0, 'e'},
 		{"force", 0, 0, 'F'},
+		{"threads", 1, 0, 't'},
+		{"compression", 1, 0, 'z'},
+		{"bandwidth", 1, 0, 'b'},
+		{"blocks", 0, 0, 'B'},
 		{0, 0, 0, 0}
 	};
 
@@ -274,6 +280,18 @@ void ConsoleView::initView(int argc, char **argv) const {
 			function = CONSOLE_LINK_RECEIVE;
 			break;
 		}
+		case 'M': {
+			if (function != CONSOLE_NONE)
+				usage (stderr, 1, cmd);
+			function = CONSOLE_MCAST_SEND;
+			break;
+		}
+		case 'm': {
+			if (function != CONSOLE_NONE)
+				usage (stderr, 1, cmd);
+			function = CONSOLE_MCAST_RECEIVE;
+			break;
+		}
 		case 'f': {
 			if (!strrchr (optarg, '/'))	{ // If it is a relative path
 				char tmp[256];
@@ -316,6 +334,39 @@ void ConsoleView::initView(int argc, char **argv) const {
 			dcl->setForce(true);
 			break;
 		}
+		case 'B': {
+			dcl->setBlockImaging(true);
+			break;
+		}
+		case 't': {
+			dcl->setThreads(atoi (optarg));
+			break;
+		}
+		case 'z': {
+			std::string codec = optarg;
+			std::string::size_type colon = codec.find(':');
+			if(colon != std::string::npos) {
+				dcl->setCompressionLevel(atoi (codec.substr(colon + 1).c_str()));
+				codec.erase(colon);
+			}
+
+			if(codec == "gzip") {
+				dcl->setCodec(Doclone::CODEC_GZIP);
+			} else if(codec == "zstd") {
+				dcl->setCodec(Doclone::CODEC_ZSTD);
+			} else if(codec == "lz4") {
+				dcl->setCodec(Doclone::CODEC_LZ4);
+			} else if(codec == "none") {
+				dcl->setCodec(Doclone::CODEC_NONE);
+			} else {
+				usage (stderr, 1, cmd);
+			}
+			break;
+		}
+		case 'b': {
+			dcl->setMulticastRate(atoi (optarg));
+			break;
+		}
 		case -1:
 			break;
 		case '?':
@@ -392,6 +443,27 @@ void ConsoleView::initView(int argc, char **argv) const {
 
 			break;
 		}
+		/* network functions - IP multicast */
+		case CONSOLE_MCAST_SEND: {
+			if(image.empty() && device.empty()) {
+				usage(stderr, 1, cmd);
+				break;
+			}
+
+			dcl->multicastSend();
+
+			break;
+		}
+		case CONSOLE_MCAST_RECEIVE: {
+			if(image.empty() && device.empty()) {
+				usage(stderr, 1, cmd);
+				break;
+			}
+
+			dcl->multicastReceive();
+
+			break;
+		}
 		default: {
 			usage (stderr, 1, cmd);
 			break;
@@ -420,7 +492,9 @@ void ConsoleView::usage (FILE * stream, int code, const char * cmd) const {
 			"\t[ -a, --address SERVER-IP-ADDRESS ]"
 			" [ -n, --nodes NUMBER ]\n"
 			"\t[ -i, --interface IP-OF-WORKING-INTERFACE]\n"
-			"\t[ -e, --empty ] [ -F, --force]\n "), cmd);
+			"\t[ -e, --empty ] [ -F, --force] [ -t, --threads NUMBER ]\n"
+			"\t[ -z, --compression gzip|zstd|lz4|none[:LEVEL] ]\n"
+			"\t[ -b, --bandwidth MBIT/S ] [ -B, --blocks ]\n "), cmd);
 
 	fprintf (stream,
 			_("\nFUNCTION is made up of one of these specifications:\n"
@@ -437,7 +511,13 @@ void ConsoleView::usage (FILE * stream, int code, const char * cmd) const {
 					"\n"
 					"\tLink mode:\n"
 					"\t-s, --link-send\t\tSends data to the network.\n"
-					"\t-l, --link-receive\tReceives data from the network.\n"));
+					"\t-l, --link-receive\tReceives data from the network.\n"
+					"\n"
+					"\tIP multicast mode:\n"
+					"\t-M, --mcast-send\tMulticasts data to receivers.\n"
+					"\t\t\t\t(This function implies -n, -b is optional).\n"
+					"\t-m, --mcast-receive\tReceives multicast data.\n"
+					"\t\t\t\t(-a selects the server, optional).\n"));
 	fprintf (stream,
 			_("\n\tOthers:\n" "\t-h, --help\t\tShow this help.\n"
 					"\t-v, --version\t\tShow doclone version.\n"));